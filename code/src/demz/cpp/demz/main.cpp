@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "hillshader/dem_codec.hpp"
+#include "hillshader/mapped_file.hpp"
+#include "hillshader/parallel.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace
+{
+
+    using bench_clock = std::chrono::steady_clock;
+
+    inline double seconds_since(bench_clock::time_point start)
+    {
+        return std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    inline double megabytes(double bytes) { return bytes / (1024.0 * 1024.0); }
+
+    struct dem
+    {
+        size_t width = 0;
+        size_t height = 0;
+        std::vector<float> values;
+        hillshader::dem_codec::header hdr = {};
+    };
+
+    // decodes a terrarium png and its sidecar json on the calling thread (the same work terrain does per core)
+    bool load_png(std::filesystem::path const& path, dem& out)
+    {
+        int width = 0, height = 0, channels = 0;
+        unsigned char* img = stbi_load(path.string().c_str(), &width, &height, &channels, 0);
+        if (!img) { return false; }
+        if (channels < 3)
+        {
+            stbi_image_free(img);
+            return false;
+        }
+
+        out.width = static_cast<size_t>(width);
+        out.height = static_cast<size_t>(height);
+        out.values.resize(out.width * out.height);
+        hillshader::terrarium::decode(img, static_cast<size_t>(channels), out.width, 0, out.height, out.values.data());
+        stbi_image_free(img);
+
+        out.hdr = {};
+        out.hdr.width = out.width;
+        out.hdr.height = out.height;
+        out.hdr.step = hillshader::dem_codec::c_terrarium_step;
+
+        stfd::vec2 min, max;
+        if (hillshader::terrarium::read_sidecar(path, min, max))
+        {
+            out.hdr.min[0] = min.x; out.hdr.min[1] = min.y;
+            out.hdr.max[0] = max.x; out.hdr.max[1] = max.y;
+        }
+        return true;
+    }
+
+    // decodes tiles [begin, end) of a compressed DEM into a row-major buffer
+    bool decode_tiles(hillshader::mapped_file const& file, hillshader::dem_codec::header const& hdr, size_t begin, size_t end, float* out)
+    {
+        bool ok = true;
+        for (size_t t = begin; t < end; ++t)
+        {
+            hillshader::dem_codec::tile_rect const rect = hillshader::dem_codec::tile_extent(hdr, t);
+            ok &= hillshader::dem_codec::decode_tile(file, hdr, t, out + rect.x + hdr.width * rect.y, static_cast<size_t>(hdr.width));
+        }
+        return ok;
+    }
+
+    int encode(std::filesystem::path const& input, std::filesystem::path const& output, float step)
+    {
+        dem src;
+        if (!load_png(input, src))
+        {
+            std::fprintf(stderr, "error: failed to decode %s\n", input.string().c_str());
+            return 1;
+        }
+
+        src.hdr.step = step;
+        if (!hillshader::dem_codec::write(output, src.hdr, src.values.data()))
+        {
+            std::fprintf(stderr, "error: failed to write %s\n", output.string().c_str());
+            return 1;
+        }
+
+        std::error_code ec;
+        std::printf("%s -> %s (%.2f MB -> %.2f MB)\n", input.string().c_str(), output.string().c_str(),
+            megabytes(static_cast<double>(std::filesystem::file_size(input, ec))), megabytes(static_cast<double>(std::filesystem::file_size(output, ec))));
+        return 0;
+    }
+
+    // compares the png path (stbi_load + terrarium decode) with the compressed format for each DEM. throughput is
+    // measured in MB of decoded floats per second
+    int bench(std::vector<std::filesystem::path> const& inputs)
+    {
+        size_t const threads = hillshader::parallel::concurrency();
+        std::printf("%-24s %12s %10s %10s %8s %14s %14s %14s %10s\n", "dem", "posts", "png MB", "hsz MB", "ratio", "png MB/s/core", "hsz MB/s/core", "hsz MB/s (all)", "max err");
+
+        int status = 0;
+        for (std::filesystem::path const& input : inputs)
+        {
+            dem src;
+            bench_clock::time_point start = bench_clock::now();
+            if (!load_png(input, src))
+            {
+                std::fprintf(stderr, "error: failed to decode %s\n", input.string().c_str());
+                status = 1;
+                continue;
+            }
+            double const png_seconds = seconds_since(start);
+            double const payload = static_cast<double>(sizeof(float) * src.values.size());
+
+            std::filesystem::path const output = std::filesystem::temp_directory_path() / (input.stem().string() + hillshader::dem_codec::c_extension);
+            if (!hillshader::dem_codec::write(output, src.hdr, src.values.data()))
+            {
+                std::fprintf(stderr, "error: failed to write %s\n", output.string().c_str());
+                status = 1;
+                continue;
+            }
+
+            hillshader::mapped_file file(output);
+            hillshader::dem_codec::header const* hdr = hillshader::dem_codec::validate(file);
+            size_t const tiles = (hdr) ? static_cast<size_t>(hillshader::dem_codec::tile_count(*hdr)) : 0;
+            std::vector<float> decoded(src.values.size());
+
+            // one core
+            start = bench_clock::now();
+            bool ok = hdr && decode_tiles(file, *hdr, 0, tiles, decoded.data());
+            double const single_seconds = seconds_since(start);
+
+            // every core
+            start = bench_clock::now();
+            if (hdr)
+            {
+                hillshader::parallel::for_each_chunk(0, tiles, [&](size_t begin, size_t end, size_t) { decode_tiles(file, *hdr, begin, end, decoded.data()); });
+            }
+            double const parallel_seconds = seconds_since(start);
+
+            float max_error = 0.f;
+            for (size_t i = 0; i < decoded.size(); ++i)
+            {
+                max_error = std::max(max_error, std::abs(decoded[i] - src.values[i]));
+            }
+
+            std::error_code ec;
+            double const png_bytes = static_cast<double>(std::filesystem::file_size(input, ec));
+            double const hsz_bytes = static_cast<double>(file.size());
+            std::printf("%-24s %12zu %10.2f %10.2f %8.2f %14.1f %14.1f %14.1f %10.4f%s\n", input.stem().string().c_str(), src.values.size(),
+                megabytes(png_bytes), megabytes(hsz_bytes), png_bytes / hsz_bytes, megabytes(payload) / png_seconds,
+                megabytes(payload) / single_seconds, megabytes(payload) / parallel_seconds, max_error, (ok) ? "" : " (corrupt)");
+
+            file.close();
+            std::filesystem::remove(output, ec);
+        }
+
+        std::printf("(%zu threads)\n", threads);
+        return status;
+    }
+
+    void usage()
+    {
+        std::printf("Usage: demz encode INPUT.png [OUTPUT.hsz] [--step METERS]\n");
+        std::printf("       demz bench INPUT.png...\n");
+        std::printf("\n");
+        std::printf("  encode   converts a terrarium png (with its sidecar json) to the compressed DEM format. the default step\n");
+        std::printf("           (1/256 m) is the terrarium resolution, which makes the conversion lossless\n");
+        std::printf("  bench    compares file size and decode throughput of the png and compressed formats\n");
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    if (!hillshader::simd::supported())
+    {
+        std::fprintf(stderr, "error: this build requires a cpu with AVX2 and FMA (configure with -DHILLSHADER_ENABLE_AVX2=OFF for older cpus)\n");
+        return 1;
+    }
+
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    if (std::strcmp(argv[1], "encode") == 0)
+    {
+        std::filesystem::path const input = argv[2];
+        std::filesystem::path output = input;
+        output.replace_extension(hillshader::dem_codec::c_extension);
+        float step = hillshader::dem_codec::c_terrarium_step;
+        for (int i = 3; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--step") == 0 && i + 1 < argc) { step = static_cast<float>(std::atof(argv[++i])); }
+            else { output = argv[i]; }
+        }
+        return encode(input, output, step);
+    }
+
+    if (std::strcmp(argv[1], "bench") == 0)
+    {
+        return bench(std::vector<std::filesystem::path>(argv + 2, argv + argc));
+    }
+
+    usage();
+    return 1;
+}
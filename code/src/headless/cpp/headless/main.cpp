@@ -0,0 +1,1024 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// terrain.cpp provides the stb_image implementation
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "hillshader/contours.hpp"
+#include "hillshader/dem_file.hpp"
+#include "hillshader/hillshade_renderer.hpp"
+#include "hillshader/horizon_field.hpp"
+#include "hillshader/memory.hpp"
+#include "hillshader/mip_chain.hpp"
+#include "hillshader/mosaic.hpp"
+#include "hillshader/normal_buffer.hpp"
+#include "hillshader/normal_field.hpp"
+#include "hillshader/paged_terrain.hpp"
+#include "hillshader/parallel.hpp"
+#include "hillshader/perspective_renderer.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/terrain.hpp"
+#include "hillshader/terrain_derivatives.hpp"
+#include "hillshader/texture_rows.hpp"
+#include "hillshader/timer.hpp"
+#include "hillshader/viewshed.hpp"
+
+static void usage()
+{
+    std::printf("Usage: headless DEM OUTPUT.png [--size WxH] [--bounds MINX,MINY,MAXX,MAXY] [--tap METERS] [--azimuth DEGREES]\n");
+    std::printf("                [--altitude DEGREES] [--ambient INTENSITY] [--exaggeration SCALE] [--albedo R,G,B] [--repeat N]\n");
+    std::printf("                [--camera X,Y,Z,THETA,PHI] [--fov DEGREES] [--step-scalar SCALAR] [--background R,G,B] [--normals]\n");
+    std::printf("                [--relight N] [--horizons N] [--shadows STRENGTH] [--sky-view STRENGTH] [--shadow-mask MASK.png]\n");
+    std::printf("                [--lights AZIMUTH:ALTITUDE:WEIGHT,...] [--multidirectional] [--derivatives PREFIX]\n");
+    std::printf("                [--relief PREFIX] [--radii R,...] [--statistics MINX,MINY,MAXX,MAXY]\n");
+    std::printf("                [--viewshed MASK.png] [--observer X,Y,HEIGHT,RADIUS]\n");
+    std::printf("                [--contours FILE.geojson] [--interval METERS] [--draw-contours] [--bench-sample N]\n");
+    std::printf("                [--bench-upload MB]\n");
+    std::printf("                [--mosaic] [--pyramid] [--tile-cache N]\n");
+    std::printf("\n");
+    std::printf("  DEM       a terrarium .png (with its sidecar .json) or a .hsz file (a directory of terrarium tiles with --mosaic\n");
+    std::printf("            and the root of a z/x/y tile pyramid with --pyramid)\n");
+    std::printf("  --size    image size in pixels. defaults to one pixel per post of the area being rendered\n");
+    std::printf("  --bounds  area to render in the DEM's coordinate system. defaults to the whole DEM\n");
+    std::printf("  --tap     distance in meters between a pixel and the taps that estimate its normal. defaults to one pixel\n");
+    std::printf("  --repeat  render N times and report the average (for benchmarking)\n");
+    std::printf("  --camera  renders the 3d view from an eye at (X, Y, Z) in the DEM's coordinate system, looking along the spherical\n");
+    std::printf("            angles THETA and PHI (in degrees, as the application displays them) instead of a north-up hillshade.\n");
+    std::printf("            the image defaults to 1280x720 and --step-scalar replaces --tap\n");
+    std::printf("  --normals shade with a precomputed normal field (one fetch per pixel instead of four elevation taps)\n");
+    std::printf("  --relight re-light the rendered frame N times (sweeping the sun once around the horizon) from its cached normals\n");
+    std::printf("            and report the cost of a lighting-only frame\n");
+    std::printf("  --horizons      sweep horizon angles toward N azimuths and shade with cast shadows and the sky-view factor\n");
+    std::printf("  --shadows       how strongly cast shadows darken the direct light (0 to 1, default 1)\n");
+    std::printf("  --sky-view      how strongly the sky-view factor darkens the ambient light (0 to 1, default 1)\n");
+    std::printf("  --shadow-mask   also write the cast shadow mask of the posts for the first light (requires --horizons)\n");
+    std::printf("  --lights        shade with up to %zu weighted lights instead of one. --azimuth and --altitude set the first\n", hillshader::shading::c_max_lights);
+    std::printf("  --multidirectional  replace the light with the four azimuths of the USGS MDOW hillshade around it\n");
+    std::printf("  --derivatives   also write the slope, aspect, curvature and hillshade of the posts to PREFIX.<raster>.hsdem\n");
+    std::printf("  --relief        also write the multi-scale elevation deviation of the posts to PREFIX.relief.hsdem\n");
+    std::printf("  --radii         window radii in posts of --relief (default 4,16,64)\n");
+    std::printf("  --statistics    print the elevation statistics of an area in the DEM's coordinate system\n");
+    std::printf("  --viewshed      also write the posts visible from the observer (the window of posts the radius reaches)\n");
+    std::printf("  --observer      the observer of --viewshed: a position in the DEM's coordinate system, the height of the eye\n");
+    std::printf("                  above the terrain and the radius in meters to consider (0 for the whole DEM). defaults to a\n");
+    std::printf("                  2 m eye at the center of the DEM\n");
+    std::printf("  --contours      also write the contour lines of the DEM as GeoJSON (reprojected from web mercator meters to WGS84\n");
+    std::printf("                  longitude and latitude)\n");
+    std::printf("  --interval      elevation between contour lines in meters (default 10)\n");
+    std::printf("  --draw-contours draw the line list of the contour lines over the hillshade (not the 3d view)\n");
+    std::printf("  --bench-sample  time N random and N ray coherent elevation queries through the scalar and the batched sampler\n");
+    std::printf("                  with the DEM stored row-major and tiled, and exit\n");
+    std::printf("  --bench-upload  measure the memory the viewer stages to upload the terrain texture (whole, as it used to, and in\n");
+    std::printf("                  strips of MB megabytes) for each storage of the DEM, and exit\n");
+    std::printf("  --mosaic        hillshade a directory of adjacent terrarium tiles as one surface (through mosaic sampling) and trace\n");
+    std::printf("                  rays along the first light onto it. --size, --bounds and the lighting options apply\n");
+    std::printf("  --pyramid       render the 3d view of a web mercator tile pyramid (such as the tiler writes) as the viewer would page\n");
+    std::printf("                  it: the tiles under the camera's footprint are requested, a frame is traced with whatever is\n");
+    std::printf("                  resident, and a second frame once they are decoded. --camera (in web mercator meters), --fov,\n");
+    std::printf("                  --size, --background and the lighting options apply\n");
+    std::printf("  --tile-cache    tiles of --mosaic that stay decoded at once (default %zu, 0 keeps every tile) or tiles of\n", hillshader::mosaic::c_default_capacity);
+    std::printf("                  --pyramid (default %zu)\n", hillshader::paged_terrain::c_default_capacity);
+}
+
+static bool write(char const* path, size_t width, size_t height, std::vector<uint8_t> const& rgba)
+{
+    int const stride = static_cast<int>(4 * width);
+    if (stbi_write_png(path, static_cast<int>(width), static_cast<int>(height), 4, rgba.data(), stride) == 0)
+    {
+        std::fprintf(stderr, "error: failed to write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// parses a comma separated list of AZIMUTH:ALTITUDE:WEIGHT lights
+static bool parse_lights(char const* arg, std::vector<hillshader::shading::light>& lights)
+{
+    lights.clear();
+    while (*arg != '\0' && lights.size() < hillshader::shading::c_max_lights)
+    {
+        hillshader::shading::light light;
+        int consumed = 0;
+        if (std::sscanf(arg, "%f:%f:%f%n", &light.azimuth, &light.altitude, &light.weight, &consumed) != 3) { return false; }
+        lights.push_back(light);
+        arg += consumed;
+        if (*arg == ',') { ++arg; }
+    }
+    return *arg == '\0' && !lights.empty();
+}
+
+// parses a comma separated list of radii
+static bool parse_radii(char const* arg, std::vector<size_t>& radii)
+{
+    radii.clear();
+    while (*arg != '\0')
+    {
+        size_t radius = 0;
+        int consumed = 0;
+        if (std::sscanf(arg, "%zu%n", &radius, &consumed) != 1) { return false; }
+        radii.push_back(radius);
+        arg += consumed;
+        if (*arg == ',') { ++arg; }
+    }
+    return !radii.empty();
+}
+
+// writes the multi-scale relief of the terrain a strip of rows at a time
+static bool write_relief(hillshader::terrain const& terrain, std::vector<size_t> const& radii, char const* prefix)
+{
+    hillshader::dem_file::header hdr = {};
+    hdr.width = static_cast<uint64_t>(terrain.width());
+    hdr.height = static_cast<uint64_t>(terrain.height());
+    stfd::vec2 const& center = terrain.center();
+    hdr.min[0] = center.x + terrain.bounds().min.x; hdr.min[1] = center.y + terrain.bounds().min.y;
+    hdr.max[0] = center.x + terrain.bounds().max.x; hdr.max[1] = center.y + terrain.bounds().max.y;
+
+    std::string const path = std::string(prefix) + ".relief" + hillshader::dem_file::c_extension;
+    hillshader::dem_file::row_writer writer(path, hdr);
+    size_t const strip = 256;
+    std::vector<float> rows(strip * terrain.width());
+    for (size_t begin = 0; begin < terrain.height() && writer.is_open(); begin += strip)
+    {
+        size_t const end = std::min(terrain.height(), begin + strip);
+        terrain.summed_area().relief(terrain, radii, begin, end, rows.data());
+        writer.write_rows(rows.data(), end - begin);
+    }
+    return writer.finish();
+}
+
+// queries inside the DEM for the sampling benchmark. random queries are spread uniformly. coherent queries follow rays
+// of c_ray_steps half-post steps in random directions (the access pattern of ray marching and shading neighborhoods)
+static std::vector<stff::vec2> bench_queries(hillshader::terrain const& terrain, size_t count, bool coherent)
+{
+    constexpr size_t c_ray_steps = 1024;
+
+    std::mt19937 rng(1);
+    stff::aabb2 const& bounds = terrain.bounds();
+    std::uniform_real_distribution<float> xs(bounds.min.x, bounds.max.x);
+    std::uniform_real_distribution<float> ys(bounds.min.y, bounds.max.y);
+    std::uniform_real_distribution<float> angles(0.f, stff::constants::two_pi);
+    float const step = 0.5f * bounds.diagonal().x / static_cast<float>(terrain.width());
+
+    std::vector<stff::vec2> queries(count);
+    stff::vec2 position, direction;
+    for (size_t q = 0; q < count; ++q)
+    {
+        if (!coherent || q % c_ray_steps == 0)
+        {
+            float const angle = angles(rng);
+            position = stff::vec2(xs(rng), ys(rng));
+            direction = stff::vec2(step * std::cos(angle), step * std::sin(angle));
+        }
+        else
+        {
+            position = position + direction;
+            position.x = std::clamp(position.x, bounds.min.x, bounds.max.x);
+            position.y = std::clamp(position.y, bounds.min.y, bounds.max.y);
+        }
+        queries[q] = position;
+    }
+    return queries;
+}
+
+// the memory a pattern of queries touches: 64-byte cache lines per query (over the four posts of each bilinear quad)
+// and distinct 4 KB pages per thousand consecutive queries. these depend only on the storage order, so they explain
+// the timings without hardware counters (run under e.g. perf stat -e cache-misses,dTLB-load-misses for those)
+static std::pair<double, double> bench_locality(hillshader::terrain const& terrain, std::vector<stff::vec2> const& queries)
+{
+    constexpr size_t c_window = 1000;
+
+    hillshader::layout const& layout = terrain.storage();
+    size_t const element = (terrain.is_quantized()) ? sizeof(uint16_t) : sizeof(float);
+    size_t lines = 0;
+    size_t pages = 0;
+    std::vector<size_t> window;
+    window.reserve(4 * c_window);
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        stff::vec2 const texel = terrain.to_texel(queries[q]);
+        size_t const i = std::min(static_cast<size_t>(std::max(0.f, texel.x)), terrain.width() - 2);
+        size_t const j = std::min(static_cast<size_t>(std::max(0.f, texel.y)), terrain.height() - 2);
+        std::array<size_t, 4> bytes = { layout.index(i, j), layout.index(i + 1, j), layout.index(i, j + 1), layout.index(i + 1, j + 1) };
+        for (size_t& b : bytes) { b *= element; }
+
+        std::array<size_t, 4> quad_lines = { bytes[0] >> 6, bytes[1] >> 6, bytes[2] >> 6, bytes[3] >> 6 };
+        std::sort(quad_lines.begin(), quad_lines.end());
+        lines += static_cast<size_t>(std::unique(quad_lines.begin(), quad_lines.end()) - quad_lines.begin());
+
+        for (size_t const b : bytes) { window.push_back(b >> 12); }
+        if (window.size() == 4 * c_window || q + 1 == queries.size())
+        {
+            std::sort(window.begin(), window.end());
+            pages += static_cast<size_t>(std::unique(window.begin(), window.end()) - window.begin());
+            window.clear();
+        }
+    }
+    double const count = static_cast<double>(queries.size());
+    return { static_cast<double>(lines) / count, static_cast<double>(pages) * static_cast<double>(c_window) / count };
+}
+
+// times count queries through the one-at-a-time sampler and the batched sampler for random and ray coherent access,
+// with the terrain stored in each ordering
+static bool bench_sample(char const* path, hillshader::terrain::options options, size_t count)
+{
+    using clock = std::chrono::steady_clock;
+    auto nanoseconds = [count](clock::time_point start) { return std::chrono::duration<double, std::nano>(clock::now() - start).count() / static_cast<double>(count); };
+
+#if defined(HILLSHADER_AVX2)
+    char const* batch_path = "avx2 gathers";
+#else
+    char const* batch_path = "scalar fallback";
+#endif
+    std::printf("sampling %zu queries per pattern on one thread (batch path: %s)\n", count, batch_path);
+    std::printf("%-10s %-9s %12s %12s %8s %12s %14s\n", "ordering", "access", "scalar ns/q", "batch ns/q", "speedup", "lines/query", "pages/1k query");
+
+    bool agree = true;
+    for (hillshader::ordering const order : { hillshader::ordering::row_major, hillshader::ordering::tiled })
+    {
+        options.order = order;
+        hillshader::terrain const terrain(path, options);
+        if (terrain.empty())
+        {
+            std::fprintf(stderr, "error: failed to load %s\n", path);
+            return false;
+        }
+
+        for (bool const coherent : { false, true })
+        {
+            std::vector<stff::vec2> const queries = bench_queries(terrain, count, coherent);
+
+            std::vector<float> scalar(count);
+            clock::time_point start = clock::now();
+            for (size_t q = 0; q < count; ++q) { scalar[q] = terrain.sample(queries[q]); }
+            double const scalar_ns = nanoseconds(start);
+
+            std::vector<float> batch(count);
+            start = clock::now();
+            terrain.sample(queries.data(), batch.data(), count);
+            double const batch_ns = nanoseconds(start);
+
+            float max_difference = 0.f;
+            for (size_t q = 0; q < count; ++q) { max_difference = std::max(max_difference, std::abs(scalar[q] - batch[q])); }
+            agree = agree && max_difference <= 1e-3f * std::max(1.f, std::abs(terrain.range().b));
+
+            std::pair<double, double> const locality = bench_locality(terrain, queries);
+            std::printf("%-10s %-9s %12.1f %12.1f %7.2fx %12.2f %14.1f\n", (order == hillshader::ordering::tiled) ? "tiled" : "row-major",
+                (coherent) ? "coherent" : "random", scalar_ns, batch_ns, scalar_ns / batch_ns, locality.first, locality.second);
+        }
+    }
+
+    if (!agree) { std::fprintf(stderr, "error: the scalar and batched samplers disagree\n"); }
+    return agree;
+}
+
+// stages level 0 of the terrain texture the way the viewer's upload does, reporting how far the resident size rises
+// above what it was before the upload (the driver's own staging comes on top of this and is not measured here)
+static bool bench_upload(char const* path, hillshader::terrain::options options, size_t strip_bytes)
+{
+    constexpr double c_mb = 1.0 / (1024.0 * 1024.0);
+
+    std::printf("staging level 0 of the terrain texture whole and in strips of %.0f MB\n", c_mb * static_cast<double>(strip_bytes));
+    std::printf("%-20s %12s %12s %14s %12s %8s\n", "storage", "resident MB", "whole MB", "whole peak MB", "strips MB", "strips");
+
+    struct storage { char const* name; hillshader::ordering order; bool quantize; };
+    storage const storages[] =
+    {
+        { "row-major", hillshader::ordering::row_major, false },
+        { "tiled", hillshader::ordering::tiled, false },
+        { "row-major quantized", hillshader::ordering::row_major, true },
+        { "tiled quantized", hillshader::ordering::tiled, true },
+    };
+    for (storage const& s : storages)
+    {
+        options.order = s.order;
+        options.quantize = s.quantize;
+        hillshader::terrain const terrain(path, options);
+        if (terrain.empty())
+        {
+            std::fprintf(stderr, "error: failed to load %s\n", path);
+            return false;
+        }
+        hillshader::mip_chain const mips(terrain);
+
+        // returns the peak resident bytes above the baseline while staging every strip
+        size_t const baseline = hillshader::memory::resident_bytes();
+        size_t strips = 0;
+        auto stage = [&](size_t bytes)
+        {
+            hillshader::texture_rows staging(terrain, bytes);
+            size_t peak = baseline;
+            strips = 0;
+            for (size_t begin = 0; begin < terrain.height(); begin += staging.strip_rows(), ++strips)
+            {
+                staging.rows(begin, std::min(terrain.height(), begin + staging.strip_rows()));
+                peak = std::max(peak, hillshader::memory::resident_bytes());
+            }
+            return peak - baseline;
+        };
+
+        size_t const whole = stage(0);
+        size_t const striped = stage(strip_bytes);
+        std::printf("%-20s %12.1f %12.1f %14.1f %12.1f %8zu\n", s.name, c_mb * static_cast<double>(baseline), c_mb * static_cast<double>(whole),
+            c_mb * static_cast<double>(baseline + whole), c_mb * static_cast<double>(striped), strips);
+    }
+    std::printf("peak resident size of the process: %.1f MB\n", c_mb * static_cast<double>(hillshader::memory::peak_resident_bytes()));
+    return true;
+}
+
+// draws a line list (two vertices per segment) over a hillshade of the terrain, darkening the pixels the segments cross
+static void draw_contours(std::vector<hillshader::contours::line_vertex> const& vertices, hillshader::hillshade_renderer::view const& view, std::vector<uint8_t>& rgba)
+{
+    static constexpr float c_opacity = 0.6f;
+    static constexpr float c_color[3] = { 48.f, 32.f, 16.f };
+
+    stff::vec2 const diagonal = view.bounds.diagonal();
+    float const scale_x = static_cast<float>(view.width) / diagonal.x;
+    float const scale_y = static_cast<float>(view.height) / diagonal.y;
+    auto plot = [&](float x, float y)
+    {
+        if (x < 0.f || y < 0.f || x >= static_cast<float>(view.width) || y >= static_cast<float>(view.height)) { return; }
+        uint8_t* pixel = rgba.data() + 4 * (static_cast<size_t>(y) * view.width + static_cast<size_t>(x));
+        for (size_t c = 0; c < 3; ++c)
+        {
+            pixel[c] = static_cast<uint8_t>(static_cast<float>(pixel[c]) + c_opacity * (c_color[c] - static_cast<float>(pixel[c])) + 0.5f);
+        }
+    };
+
+    for (size_t v = 0; v + 1 < vertices.size(); v += 2)
+    {
+        // pixel coordinates, top row first
+        float const x0 = (vertices[v].pos.x - view.bounds.min.x) * scale_x;
+        float const y0 = (view.bounds.max.y - vertices[v].pos.y) * scale_y;
+        float const x1 = (vertices[v + 1].pos.x - view.bounds.min.x) * scale_x;
+        float const y1 = (view.bounds.max.y - vertices[v + 1].pos.y) * scale_y;
+
+        // one step per pixel along the major axis, without plotting the end point that the next segment starts on
+        size_t const steps = static_cast<size_t>(std::ceil(std::max(std::abs(x1 - x0), std::abs(y1 - y0))));
+        for (size_t s = 0; s < std::max<size_t>(1, steps); ++s)
+        {
+            float const t = (steps > 0) ? static_cast<float>(s) / static_cast<float>(steps) : 0.f;
+            plot(x0 + t * (x1 - x0), y0 + t * (y1 - y0));
+        }
+    }
+}
+
+// re-shades a frame count times while the sun makes one full turn, ending at the requested azimuth
+static void relight(hillshader::normal_buffer const& normals, hillshader::shading::lighting const& lighting, int count, std::vector<uint8_t>& rgba)
+{
+    if (count <= 0) { return; }
+
+    hillshader::timer::time_t const start = hillshader::timer::now_ms();
+    for (int i = 1; i <= count; ++i)
+    {
+        hillshader::shading::lighting sweep = lighting;
+        for (hillshader::shading::light& light : sweep.lights) { light.azimuth += 360.f * static_cast<float>(i) / static_cast<float>(count); }
+        normals.shade(sweep, rgba.data());
+    }
+    double const seconds = std::max(1e-3, static_cast<double>(hillshader::timer::now_ms() - start) / 1000.0) / static_cast<double>(count);
+    std::printf("re-lit %d frames at %.2f ms per frame\n", count, 1000.0 * seconds);
+}
+
+static bool render_perspective(hillshader::terrain const& terrain, hillshader::mip_chain const& mips, hillshader::normal_field const& normals,
+    hillshader::horizon_field const& horizons, hillshader::perspective_renderer::view const& view, hillshader::perspective_renderer::lighting const& lighting,
+    int repeat, int relights, char const* path)
+{
+    hillshader::perspective_renderer const renderer(terrain, mips, &normals, &horizons);
+    std::vector<uint8_t> rgba(4 * view.width * view.height);
+    hillshader::perspective_renderer::stats stats;
+    hillshader::timer::time_t const start = hillshader::timer::now_ms();
+    for (int i = 0; i < repeat; ++i)
+    {
+        stats = renderer.render(view, lighting, rgba.data());
+    }
+    hillshader::timer::time_t const end = hillshader::timer::now_ms();
+    double const seconds = std::max(1e-3, static_cast<double>(end - start) / 1000.0) / static_cast<double>(repeat);
+    std::printf("traced %zu x %zu in %.1f ms on %zu threads (%.2f Mrays/s, %.1f%% hit the terrain)\n", view.width, view.height, 1000.0 * seconds,
+        hillshader::parallel::concurrency(), static_cast<double>(stats.rays) / seconds / 1e6, 100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.rays));
+
+    if (relights > 0)
+    {
+        hillshader::normal_buffer normals_buffer;
+        renderer.render(view, lighting, rgba.data(), &normals_buffer);
+        relight(normals_buffer, lighting, relights, rgba);
+    }
+    return write(path, view.width, view.height, rgba);
+}
+
+// hillshades a mosaic with four taps per pixel through the batched sampler, then traces a grid of rays along the first
+// light onto it and checks that each hit lies on the sampled surface
+static bool render_mosaic(char const* directory, hillshader::terrain::options const& options, size_t capacity, size_t width, size_t height,
+    double const* bounds, hillshader::shading::lighting const& lighting, float tap, char const* path)
+{
+    constexpr size_t c_ray_grid = 128;
+
+    hillshader::timer::time_t const open_start = hillshader::timer::now_ms();
+    hillshader::mosaic const tiles(directory, options, capacity);
+    if (tiles.empty())
+    {
+        std::fprintf(stderr, "error: found no terrarium tiles with sidecars in %s\n", directory);
+        return false;
+    }
+    std::printf("%s: %zu tiles indexed in %lld ms\n", directory, tiles.tile_count(), hillshader::timer::now_ms() - open_start);
+
+    // the mosaic works relative to its center
+    stff::aabb2 area = tiles.bounds();
+    if (bounds)
+    {
+        stfd::vec2 const center = tiles.center();
+        area = stff::aabb2(
+            stff::vec2(static_cast<float>(bounds[0] - center.x), static_cast<float>(bounds[1] - center.y)),
+            stff::vec2(static_cast<float>(bounds[2] - center.x), static_cast<float>(bounds[3] - center.y))
+        );
+    }
+    stff::vec2 const diagonal = area.diagonal();
+    if (width == 0 || height == 0)
+    {
+        width = (diagonal.x >= diagonal.y) ? 1024 : std::max<size_t>(1, static_cast<size_t>(1024.f * diagonal.x / diagonal.y));
+        height = (diagonal.y >= diagonal.x) ? 1024 : std::max<size_t>(1, static_cast<size_t>(1024.f * diagonal.y / diagonal.x));
+    }
+    stff::vec2 const pixel(diagonal.x / static_cast<float>(width), diagonal.y / static_cast<float>(height));
+    float const delta = (tap > 0.f) ? tap : std::max(pixel.x, pixel.y);
+
+    // east, west, north, and south taps of every pixel
+    std::vector<stff::vec2> queries(4 * width * height);
+    for (size_t j = 0; j < height; ++j)
+    {
+        for (size_t i = 0; i < width; ++i)
+        {
+            stff::vec2 const center(area.min.x + (static_cast<float>(i) + 0.5f) * pixel.x, area.max.y - (static_cast<float>(j) + 0.5f) * pixel.y);
+            stff::vec2* taps = queries.data() + 4 * (i + width * j);
+            taps[0] = center + stff::vec2(delta, 0.f);
+            taps[1] = center - stff::vec2(delta, 0.f);
+            taps[2] = center + stff::vec2(0.f, delta);
+            taps[3] = center - stff::vec2(0.f, delta);
+        }
+    }
+
+    std::vector<float> elevations(queries.size());
+    hillshader::timer::time_t const sample_start = hillshader::timer::now_ms();
+    tiles.sample(queries.data(), elevations.data(), queries.size());
+    std::printf("sampled %zu taps in %lld ms (%zu tiles decoded, %zu resident)\n", queries.size(), hillshader::timer::now_ms() - sample_start,
+        tiles.loads(), tiles.loaded());
+
+    // pixels with a tap in a gap of the coverage are left transparent
+    hillshader::shading::light_set const lights = hillshader::shading::resolve(lighting);
+    std::vector<uint8_t> rgba(4 * width * height);
+    std::vector<float> intensities(width);
+    for (size_t j = 0; j < height; ++j)
+    {
+        for (size_t i = 0; i < width; ++i)
+        {
+            float const* taps = elevations.data() + 4 * (i + width * j);
+            stff::vec3 const normal = hillshader::shading::normal(taps[0], taps[1], taps[2], taps[3], delta);
+            intensities[i] = hillshader::shading::intensity(lights, lighting.ambient_intensity, normal, lighting.exaggeration);
+        }
+        uint8_t* row = rgba.data() + 4 * width * j;
+        hillshader::shading::encode_row(intensities.data(), width, lighting.albedo, row);
+        for (size_t i = 0; i < width; ++i)
+        {
+            float const* taps = elevations.data() + 4 * (i + width * j);
+            if (std::any_of(taps, taps + 4, [](float tap) { return std::isnan(tap); })) { std::fill(row + 4 * i, row + 4 * i + 4, uint8_t(0)); }
+        }
+    }
+
+    // rays start above the highest tap and travel along the first light
+    float top = std::numeric_limits<float>::lowest();
+    for (float elevation : elevations)
+    {
+        if (!std::isnan(elevation)) { top = std::max(top, elevation); }
+    }
+    top += 100.f;
+    hillshader::shading::light const& sun = lighting.lights.front();
+    stff::vec3 const direction = hillshader::shading::light_direction(sun.azimuth, sun.altitude);
+    std::vector<stff::ray3> rays;
+    rays.reserve(c_ray_grid * c_ray_grid);
+    for (size_t j = 0; j < c_ray_grid; ++j)
+    {
+        for (size_t i = 0; i < c_ray_grid; ++i)
+        {
+            float const x = area.min.x + (static_cast<float>(i) + 0.5f) * diagonal.x / static_cast<float>(c_ray_grid);
+            float const y = area.min.y + (static_cast<float>(j) + 0.5f) * diagonal.y / static_cast<float>(c_ray_grid);
+            rays.emplace_back(stff::vec3(x, y, top), direction);
+        }
+    }
+
+    std::vector<std::optional<stff::vec3>> hits(rays.size());
+    hillshader::timer::time_t const trace_start = hillshader::timer::now_ms();
+    hillshader::parallel::for_each_dynamic(0, rays.size(), [&](size_t r, size_t) { hits[r] = tiles.intersect(rays[r]); });
+    hillshader::timer::time_t const trace_ms = hillshader::timer::now_ms() - trace_start;
+
+    // rays that drop into a gap in the coverage hit the side of the next tile well below its surface, so those are
+    // counted apart from the error of the hits on the surface
+    constexpr float c_side_depth = 1.f;
+    size_t hit_count = 0;
+    size_t side_count = 0;
+    float max_error = 0.f;
+    for (std::optional<stff::vec3> const& hit : hits)
+    {
+        if (!hit) { continue; }
+        ++hit_count;
+        std::optional<float> const ground = tiles.sample(stff::vec2(hit->x, hit->y));
+        if (!ground) { continue; }
+        if (hit->z < *ground - c_side_depth) { ++side_count; continue; }
+        max_error = std::max(max_error, std::abs(hit->z - *ground));
+    }
+    std::printf("traced %zu rays in %lld ms (%zu hit, %zu on the side of a gap, at most %.3f m off the sampled surface; %zu tiles decoded, %zu resident)\n",
+        rays.size(), trace_ms, hit_count, side_count, max_error, tiles.loads(), tiles.loaded());
+
+    return write(path, width, height, rgba);
+}
+
+// pages a tile pyramid the way a moving camera would: the footprint of the view is requested, one frame is traced with
+// the tiles that happen to be resident (the coarsest level stands in for the rest) and another once the requested
+// tiles have been decoded
+static bool render_pyramid(char const* root, size_t capacity, double const* eye, float theta, float phi, float fov, size_t width, size_t height,
+    stff::vec3 const& background, hillshader::shading::lighting const& lighting, char const* path)
+{
+    constexpr float c_max_distance = 100000.f;
+
+    auto drain = [](hillshader::paged_terrain const& pages)
+    {
+        hillshader::timer::time_t const start = hillshader::timer::now_ms();
+        while (pages.pending() > 0) { std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+        return hillshader::timer::now_ms() - start;
+    };
+
+    hillshader::paged_terrain pages(root, capacity);
+    if (pages.empty())
+    {
+        std::fprintf(stderr, "error: found no z/x/y tiles in %s\n", root);
+        return false;
+    }
+    hillshader::timer::time_t const pinned_ms = drain(pages);
+    std::printf("%s: zoom %u to %u, %zu tiles of the coarsest level decoded in %lld ms\n", root, pages.min_zoom(), pages.max_zoom(), pages.resident(), pinned_ms);
+
+    // the pyramid works relative to its center. without a camera, look north at 45 degrees from south of the middle
+    stff::vec2 const diagonal = pages.bounds().diagonal();
+    stff::vec3 position(0.f, -0.25f * diagonal.y, 0.f);
+    if (eye)
+    {
+        stfd::vec2 const center = pages.center();
+        position = stff::vec3(static_cast<float>(eye[0] - center.x), static_cast<float>(eye[1] - center.y), static_cast<float>(eye[2]));
+    }
+    else
+    {
+        theta = 90.f;
+        phi = 135.f;
+        position.z = pages.sample(stff::vec2(position.x, position.y)).value_or(0.f) + 0.1f * std::min(diagonal.x, diagonal.y);
+    }
+    if (width == 0 || height == 0)
+    {
+        width = 320;
+        height = 180;
+    }
+    float const aspect = static_cast<float>(width) / static_cast<float>(height);
+    stff::scamera const camera(position, stf::math::to_radians(theta), stf::math::to_radians(phi), 0.01f, c_max_distance, aspect, stf::math::to_radians(fov));
+
+    // ask for the level whose texels match the pixels in the middle of the view, where the ground meets the center ray
+    float const ground = pages.sample(stff::vec2(position.x, position.y)).value_or(0.f);
+    float const pixel_angle = 2.f * std::tan(0.5f * stf::math::to_radians(fov)) / static_cast<float>(height);
+    stff::ray3 const center_ray = camera.ray(stff::vec2(0.5f, 0.5f));
+    float const center_length = std::sqrt(center_ray.direction.x * center_ray.direction.x + center_ray.direction.y * center_ray.direction.y + center_ray.direction.z * center_ray.direction.z);
+    float center_distance = c_max_distance;
+    if (center_ray.direction.z < 0.f)
+    {
+        center_distance = std::min(center_distance, center_length * (ground - position.z) / center_ray.direction.z);
+    }
+    float const meters_per_texel = std::max(1.f, center_distance * pixel_angle);
+    pages.request(hillshader::paged_terrain::footprint(camera, ground, c_max_distance), meters_per_texel);
+    std::printf("requested the footprint at %.1f m per texel (%zu tiles pending)\n", meters_per_texel, pages.pending());
+
+    hillshader::shading::light_set const lights = hillshader::shading::resolve(lighting, stf::math::to_radians(theta));
+    std::vector<uint8_t> rgba(4 * width * height);
+    auto trace = [&](char const* label)
+    {
+        std::atomic<size_t> hits{ 0 };
+        size_t const resident = pages.resident();
+        size_t const pending = pages.pending();
+        hillshader::timer::time_t const start = hillshader::timer::now_ms();
+        hillshader::parallel::for_each_dynamic(0, height, [&](size_t j, size_t)
+        {
+            std::vector<float> intensities(width, 0.f);
+            std::vector<bool> hit(width, false);
+            for (size_t i = 0; i < width; ++i)
+            {
+                stff::vec2 const uv((static_cast<float>(i) + 0.5f) / static_cast<float>(width), (static_cast<float>(j) + 0.5f) / static_cast<float>(height));
+                std::optional<stff::vec3> const p = pages.intersect(camera.ray(uv), c_max_distance);
+                if (!p) { continue; }
+
+                // taps a pixel's footprint apart, falling back to the hit where no tile answers
+                stff::vec3 const d = *p - position;
+                float const delta = std::max(1.f, std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z) * pixel_angle);
+                auto tap = [&](float x, float y) { return pages.sample(stff::vec2(x, y)).value_or(p->z); };
+                stff::vec3 const normal = hillshader::shading::normal(tap(p->x + delta, p->y), tap(p->x - delta, p->y), tap(p->x, p->y + delta), tap(p->x, p->y - delta), delta);
+                intensities[i] = hillshader::shading::intensity(lights, lighting.ambient_intensity, normal, lighting.exaggeration);
+                hit[i] = true;
+                hits.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            uint8_t* row = rgba.data() + 4 * width * j;
+            hillshader::shading::encode_row(intensities.data(), width, lighting.albedo, row);
+            for (size_t i = 0; i < width; ++i)
+            {
+                if (hit[i]) { continue; }
+                row[4 * i + 0] = hillshader::shading::encode_srgb(background.x);
+                row[4 * i + 1] = hillshader::shading::encode_srgb(background.y);
+                row[4 * i + 2] = hillshader::shading::encode_srgb(background.z);
+            }
+        });
+        std::printf("%s: traced %zu x %zu in %lld ms (%.1f%% hit the terrain) starting with %zu tiles resident and %zu pending\n", label,
+            width, height, hillshader::timer::now_ms() - start, 100.0 * static_cast<double>(hits.load()) / static_cast<double>(width * height), resident, pending);
+    };
+
+    trace("while paging");
+    hillshader::timer::time_t const paged_ms = drain(pages);
+    std::printf("the requested tiles were resident after another %lld ms\n", paged_ms);
+    trace("paged in");
+
+    // the viewer draws the pyramid through a terrain snapshot of the resident tiles, so build one over the footprint
+    // the way it does and compare it with the pages
+    stff::aabb2 const view = hillshader::paged_terrain::footprint(camera, ground, c_max_distance);
+    stff::aabb2 const& coverage = pages.bounds();
+    stff::aabb2 const area(stff::vec2(std::max(view.min.x, coverage.min.x), std::max(view.min.y, coverage.min.y)),
+        stff::vec2(std::min(view.max.x, coverage.max.x), std::min(view.max.y, coverage.max.y)));
+    if (area.min.x < area.max.x && area.min.y < area.max.y)
+    {
+        constexpr size_t c_snapshot_posts = 2048;
+        stff::vec2 const extent = area.diagonal();
+        float const spacing = std::max(extent.x, extent.y) / static_cast<float>(c_snapshot_posts);
+        size_t const posts_x = std::max<size_t>(2, static_cast<size_t>(std::ceil(extent.x / spacing)));
+        size_t const posts_y = std::max<size_t>(2, static_cast<size_t>(std::ceil(extent.y / spacing)));
+
+        hillshader::timer::time_t const start = hillshader::timer::now_ms();
+        hillshader::terrain const snapshot(pages, area, posts_x, posts_y, hillshader::terrain::options());
+        hillshader::timer::time_t const snapshot_ms = hillshader::timer::now_ms() - start;
+
+        // post centers match exactly, so compare halfway between posts where both sides interpolate
+        double total = 0.0;
+        size_t count = 0;
+        for (size_t j = 0; j + 1 < posts_y; j += 7)
+        {
+            for (size_t i = 0; i + 1 < posts_x; i += 7)
+            {
+                stff::vec2 const p(area.min.x + (static_cast<float>(i) + 1.f) * extent.x / static_cast<float>(posts_x),
+                    area.max.y - (static_cast<float>(j) + 1.f) * extent.y / static_cast<float>(posts_y));
+                std::optional<float> const expected = pages.sample(p);
+                if (!expected) { continue; }
+                total += std::abs(static_cast<double>(snapshot.sample(p) - *expected));
+                ++count;
+            }
+        }
+        std::printf("snapshot: %zu x %zu posts over the footprint built in %lld ms, mean difference from the pages %.3f m at %zu points\n",
+            snapshot.width(), snapshot.height(), snapshot_ms, (count > 0) ? total / static_cast<double>(count) : 0.0, count);
+    }
+
+    return write(path, width, height, rgba);
+}
+
+int main(int argc, char** argv)
+{
+    if (!hillshader::simd::supported())
+    {
+        std::fprintf(stderr, "error: this build requires a cpu with AVX2 and FMA (configure with -DHILLSHADER_ENABLE_AVX2=OFF for older cpus)\n");
+        return 1;
+    }
+
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    hillshader::hillshade_renderer::lighting lighting;
+    size_t width = 0, height = 0;
+    double bounds[4] = { 0.0, 0.0, 0.0, 0.0 };
+    bool has_bounds = false;
+    float tap = 0.f;
+    int repeat = 1;
+    int relights = 0;
+    char const* mask_path = nullptr;
+    char const* derivatives_prefix = nullptr;
+    char const* relief_prefix = nullptr;
+    std::vector<size_t> radii = { 4, 16, 64 };
+    double area[4] = { 0.0, 0.0, 0.0, 0.0 };
+    bool has_area = false;
+    bool multidirectional = false;
+    char const* viewshed_path = nullptr;
+    double observer[4] = { 0.0, 0.0, 2.0, 0.0 };
+    bool has_observer = false;
+    char const* contours_path = nullptr;
+    hillshader::contours::options contour_options;
+    bool contour_overlay = false;
+    size_t bench_queries = 0;
+    size_t bench_upload_mb = 0;
+    bool mosaic = false;
+    bool pyramid = false;
+    size_t tile_cache = 0;
+    bool has_tile_cache = false;
+    hillshader::terrain::options options;
+    double eye[3] = { 0.0, 0.0, 0.0 };
+    float theta = 0.f, phi = 0.f;
+    bool perspective = false;
+    float fov = stf::math::to_degrees(stff::scamera::c_default_fov);
+    hillshader::perspective_renderer::view perspective_view;
+    for (int i = 3; i < argc; ++i)
+    {
+        bool const has_value = i + 1 < argc;
+        bool valid = has_value;
+        if (std::strcmp(argv[i], "--size") == 0 && has_value) { valid = std::sscanf(argv[++i], "%zux%zu", &width, &height) == 2; }
+        else if (std::strcmp(argv[i], "--bounds") == 0 && has_value)
+        {
+            has_bounds = true;
+            valid = std::sscanf(argv[++i], "%lf,%lf,%lf,%lf", &bounds[0], &bounds[1], &bounds[2], &bounds[3]) == 4 && bounds[0] < bounds[2] && bounds[1] < bounds[3];
+        }
+        else if (std::strcmp(argv[i], "--tap") == 0 && has_value) { tap = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--azimuth") == 0 && has_value) { lighting.lights.front().azimuth = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--altitude") == 0 && has_value) { lighting.lights.front().altitude = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--ambient") == 0 && has_value) { lighting.ambient_intensity = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--exaggeration") == 0 && has_value) { lighting.exaggeration = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--albedo") == 0 && has_value)
+        {
+            valid = std::sscanf(argv[++i], "%f,%f,%f", &lighting.albedo.x, &lighting.albedo.y, &lighting.albedo.z) == 3;
+        }
+        else if (std::strcmp(argv[i], "--camera") == 0 && has_value)
+        {
+            perspective = true;
+            valid = std::sscanf(argv[++i], "%lf,%lf,%lf,%f,%f", &eye[0], &eye[1], &eye[2], &theta, &phi) == 5;
+        }
+        else if (std::strcmp(argv[i], "--fov") == 0 && has_value) { fov = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--step-scalar") == 0 && has_value) { perspective_view.step_scalar = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--background") == 0 && has_value)
+        {
+            stff::vec3& color = perspective_view.background;
+            valid = std::sscanf(argv[++i], "%f,%f,%f", &color.x, &color.y, &color.z) == 3;
+        }
+        else if (std::strcmp(argv[i], "--normals") == 0) { options.normals = true; valid = true; }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && has_value) { repeat = std::max(1, std::atoi(argv[++i])); }
+        else if (std::strcmp(argv[i], "--relight") == 0 && has_value) { relights = std::max(0, std::atoi(argv[++i])); }
+        else if (std::strcmp(argv[i], "--horizons") == 0 && has_value) { options.horizons = static_cast<size_t>(std::max(0, std::atoi(argv[++i]))); }
+        else if (std::strcmp(argv[i], "--shadows") == 0 && has_value) { lighting.shadows = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--sky-view") == 0 && has_value) { lighting.sky_view = static_cast<float>(std::atof(argv[++i])); }
+        else if (std::strcmp(argv[i], "--shadow-mask") == 0 && has_value) { mask_path = argv[++i]; }
+        else if (std::strcmp(argv[i], "--lights") == 0 && has_value) { valid = parse_lights(argv[++i], lighting.lights); }
+        else if (std::strcmp(argv[i], "--multidirectional") == 0) { multidirectional = true; valid = true; }
+        else if (std::strcmp(argv[i], "--derivatives") == 0 && has_value) { derivatives_prefix = argv[++i]; }
+        else if (std::strcmp(argv[i], "--relief") == 0 && has_value) { relief_prefix = argv[++i]; }
+        else if (std::strcmp(argv[i], "--radii") == 0 && has_value) { valid = parse_radii(argv[++i], radii); }
+        else if (std::strcmp(argv[i], "--statistics") == 0 && has_value)
+        {
+            has_area = true;
+            valid = std::sscanf(argv[++i], "%lf,%lf,%lf,%lf", &area[0], &area[1], &area[2], &area[3]) == 4 && area[0] <= area[2] && area[1] <= area[3];
+        }
+        else if (std::strcmp(argv[i], "--viewshed") == 0 && has_value) { viewshed_path = argv[++i]; }
+        else if (std::strcmp(argv[i], "--observer") == 0 && has_value)
+        {
+            has_observer = true;
+            valid = std::sscanf(argv[++i], "%lf,%lf,%lf,%lf", &observer[0], &observer[1], &observer[2], &observer[3]) == 4 && observer[3] >= 0.0;
+        }
+        else if (std::strcmp(argv[i], "--contours") == 0 && has_value) { contours_path = argv[++i]; }
+        else if (std::strcmp(argv[i], "--interval") == 0 && has_value)
+        {
+            contour_options.interval = static_cast<float>(std::atof(argv[++i]));
+            valid = contour_options.interval > 0.f;
+        }
+        else if (std::strcmp(argv[i], "--draw-contours") == 0) { contour_overlay = true; valid = true; }
+        else if (std::strcmp(argv[i], "--bench-sample") == 0 && has_value) { valid = std::sscanf(argv[++i], "%zu", &bench_queries) == 1 && bench_queries > 0; }
+        else if (std::strcmp(argv[i], "--mosaic") == 0) { mosaic = true; valid = true; }
+        else if (std::strcmp(argv[i], "--pyramid") == 0) { pyramid = true; valid = true; }
+        else if (std::strcmp(argv[i], "--tile-cache") == 0 && has_value) { has_tile_cache = valid = std::sscanf(argv[++i], "%zu", &tile_cache) == 1; }
+        else if (std::strcmp(argv[i], "--bench-upload") == 0 && has_value) { valid = std::sscanf(argv[++i], "%zu", &bench_upload_mb) == 1 && bench_upload_mb > 0; }
+        else { valid = false; }
+
+        if (!valid)
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    if (contour_overlay && (perspective || mosaic || pyramid))
+    {
+        std::fprintf(stderr, "error: --draw-contours only draws over the north-up hillshade of a DEM\n");
+        return 1;
+    }
+    if (multidirectional) { lighting.lights = hillshader::shading::multidirectional(lighting.lights.front()); }
+    options.summed_area = relief_prefix != nullptr || has_area;
+
+    if (bench_queries > 0)
+    {
+        return bench_sample(argv[1], options, bench_queries) ? 0 : 1;
+    }
+    if (bench_upload_mb > 0)
+    {
+        return bench_upload(argv[1], options, bench_upload_mb << 20) ? 0 : 1;
+    }
+    if (mosaic)
+    {
+        size_t const capacity = (has_tile_cache) ? tile_cache : hillshader::mosaic::c_default_capacity;
+        return render_mosaic(argv[1], options, capacity, width, height, (has_bounds) ? bounds : nullptr, lighting, tap, argv[2]) ? 0 : 1;
+    }
+    if (pyramid)
+    {
+        size_t const capacity = (has_tile_cache) ? tile_cache : hillshader::paged_terrain::c_default_capacity;
+        return render_pyramid(argv[1], capacity, (perspective) ? eye : nullptr, theta, phi, fov, width, height, perspective_view.background, lighting, argv[2]) ? 0 : 1;
+    }
+
+    hillshader::timer::time_t const load_start = hillshader::timer::now_ms();
+    hillshader::terrain terrain(argv[1], options);
+    if (terrain.empty())
+    {
+        std::fprintf(stderr, "error: failed to load %s\n", argv[1]);
+        return 1;
+    }
+    hillshader::mip_chain const mips(terrain);
+    std::printf("%s: %zu x %zu loaded in %lld ms\n", argv[1], terrain.width(), terrain.height(), hillshader::timer::now_ms() - load_start);
+    if (!terrain.summed_area().empty())
+    {
+        std::printf("with summed-area tables (%.1f MB)\n", static_cast<double>(terrain.summed_area().bytes()) / (1024.0 * 1024.0));
+    }
+
+    hillshader::normal_field normals;
+    if (options.normals)
+    {
+        hillshader::timer::time_t const normals_start = hillshader::timer::now_ms();
+        normals = hillshader::normal_field(terrain, mips);
+        std::printf("built %zu normal levels (%.1f MB) in %lld ms\n", normals.levels(), static_cast<double>(normals.bytes()) / (1024.0 * 1024.0),
+            hillshader::timer::now_ms() - normals_start);
+    }
+
+    hillshader::horizon_field horizons;
+    if (options.horizons > 0)
+    {
+        hillshader::timer::time_t const horizons_start = hillshader::timer::now_ms();
+        horizons = hillshader::horizon_field(terrain, options.horizons);
+        std::printf("swept %zu horizon directions (%.1f MB) in %lld ms\n", horizons.directions(), static_cast<double>(horizons.bytes()) / (1024.0 * 1024.0),
+            hillshader::timer::now_ms() - horizons_start);
+    }
+
+    if (mask_path)
+    {
+        if (horizons.empty())
+        {
+            std::fprintf(stderr, "error: --shadow-mask requires --horizons\n");
+            return 1;
+        }
+        std::vector<uint8_t> mask(terrain.width() * terrain.height());
+        hillshader::shading::light const& sun = lighting.lights.front();
+        horizons.shadow_mask(sun.azimuth, sun.altitude, lighting.exaggeration, mask.data());
+        int const stride = static_cast<int>(terrain.width());
+        if (stbi_write_png(mask_path, static_cast<int>(terrain.width()), static_cast<int>(terrain.height()), 1, mask.data(), stride) == 0)
+        {
+            std::fprintf(stderr, "error: failed to write %s\n", mask_path);
+            return 1;
+        }
+    }
+
+    if (derivatives_prefix)
+    {
+        hillshader::terrain_derivatives::options derivatives;
+        derivatives.lighting = lighting;
+        hillshader::timer::time_t const derivatives_start = hillshader::timer::now_ms();
+        if (!hillshader::terrain_derivatives::write(terrain, derivatives, derivatives_prefix))
+        {
+            std::fprintf(stderr, "error: failed to write the derivatives of %s\n", argv[1]);
+            return 1;
+        }
+        std::printf("wrote slope, aspect, curvature and hillshade in %lld ms\n", hillshader::timer::now_ms() - derivatives_start);
+    }
+
+    if (has_area)
+    {
+        // the tables work relative to the terrain's center
+        stfd::vec2 const center = terrain.center();
+        stff::aabb2 const query(
+            stff::vec2(static_cast<float>(area[0] - center.x), static_cast<float>(area[1] - center.y)),
+            stff::vec2(static_cast<float>(area[2] - center.x), static_cast<float>(area[3] - center.y))
+        );
+        hillshader::summed_area_table::statistics const stats = terrain.summed_area().query(terrain, query);
+        std::printf("area statistics: %zu posts, mean %.3f m, standard deviation %.3f m\n", stats.count, stats.mean, stats.stddev());
+    }
+
+    if (relief_prefix)
+    {
+        hillshader::timer::time_t const relief_start = hillshader::timer::now_ms();
+        if (!write_relief(terrain, radii, relief_prefix))
+        {
+            std::fprintf(stderr, "error: failed to write the relief of %s\n", argv[1]);
+            return 1;
+        }
+        std::printf("wrote the relief over %zu radii in %lld ms\n", radii.size(), hillshader::timer::now_ms() - relief_start);
+    }
+
+    if (viewshed_path)
+    {
+        // the viewshed works relative to the terrain's center
+        stfd::vec2 const center = terrain.center();
+        hillshader::viewshed::observer obs;
+        if (has_observer) { obs.position = stff::vec2(static_cast<float>(observer[0] - center.x), static_cast<float>(observer[1] - center.y)); }
+        obs.height = static_cast<float>(observer[2]);
+        obs.radius = static_cast<float>(observer[3]);
+
+        hillshader::timer::time_t const viewshed_start = hillshader::timer::now_ms();
+        hillshader::viewshed const visible(terrain, obs);
+        std::printf("%zu of %zu posts visible in %lld ms\n", visible.visible_count(), visible.width() * visible.height(), hillshader::timer::now_ms() - viewshed_start);
+
+        int const stride = static_cast<int>(visible.width());
+        if (stbi_write_png(viewshed_path, static_cast<int>(visible.width()), static_cast<int>(visible.height()), 1, visible.values(), stride) == 0)
+        {
+            std::fprintf(stderr, "error: failed to write %s\n", viewshed_path);
+            return 1;
+        }
+    }
+
+    hillshader::contours::collection contour_lines;
+    if (contours_path || contour_overlay)
+    {
+        hillshader::timer::time_t const contours_start = hillshader::timer::now_ms();
+        contour_lines = hillshader::contours::extract(terrain, contour_options);
+        std::printf("extracted %zu contour lines (%zu points) in %lld ms\n", contour_lines.polylines.size(), contour_lines.points.size(),
+            hillshader::timer::now_ms() - contours_start);
+    }
+    if (contours_path)
+    {
+        if (!hillshader::contours::write_geojson(terrain, contour_lines, contours_path))
+        {
+            std::fprintf(stderr, "error: failed to write %s\n", contours_path);
+            return 1;
+        }
+    }
+
+    if (perspective)
+    {
+        // the camera works relative to the terrain's center
+        stfd::vec2 const center = terrain.center();
+        stff::vec3 const position(static_cast<float>(eye[0] - center.x), static_cast<float>(eye[1] - center.y), static_cast<float>(eye[2]));
+        perspective_view.width = (width > 0 && height > 0) ? width : 1280;
+        perspective_view.height = (width > 0 && height > 0) ? height : 720;
+        float const aspect = static_cast<float>(perspective_view.width) / static_cast<float>(perspective_view.height);
+        perspective_view.camera = stff::scamera(position, stf::math::to_radians(theta), stf::math::to_radians(phi), 0.01f, 100000.f, aspect, stf::math::to_radians(fov));
+        return render_perspective(terrain, mips, normals, horizons, perspective_view, lighting, repeat, relights, argv[2]) ? 0 : 1;
+    }
+
+    hillshader::hillshade_renderer const renderer(terrain, mips, &normals, &horizons);
+
+    hillshader::hillshade_renderer::view view = renderer.full_view();
+    if (has_bounds)
+    {
+        // the renderer works relative to the terrain's center
+        stfd::vec2 const center = terrain.center();
+        view.bounds = stff::aabb2(
+            stff::vec2(static_cast<float>(bounds[0] - center.x), static_cast<float>(bounds[1] - center.y)),
+            stff::vec2(static_cast<float>(bounds[2] - center.x), static_cast<float>(bounds[3] - center.y))
+        );
+
+        // keep one pixel per post unless a size was given
+        stff::vec2 const post = terrain.bounds().diagonal() / stff::vec2(static_cast<float>(terrain.width()), static_cast<float>(terrain.height()));
+        view.width = std::max<size_t>(1, static_cast<size_t>(view.bounds.diagonal().x / post.x));
+        view.height = std::max<size_t>(1, static_cast<size_t>(view.bounds.diagonal().y / post.y));
+    }
+    if (width > 0 && height > 0)
+    {
+        view.width = width;
+        view.height = height;
+    }
+    view.tap_spacing = tap;
+
+    std::vector<uint8_t> rgba(4 * view.width * view.height);
+    hillshader::timer::time_t const render_start = hillshader::timer::now_ms();
+    for (int i = 0; i < repeat; ++i)
+    {
+        renderer.render(view, lighting, rgba.data());
+    }
+    double const seconds = std::max(1e-3, static_cast<double>(hillshader::timer::now_ms() - render_start) / 1000.0) / static_cast<double>(repeat);
+    std::printf("rendered %zu x %zu in %.1f ms on %zu threads with %s (%.1f Mpix/s)\n", view.width, view.height, 1000.0 * seconds,
+        hillshader::parallel::concurrency(), hillshader::simd::name(), static_cast<double>(view.width * view.height) / seconds / 1e6);
+
+
+    if (relights > 0)
+    {
+        hillshader::normal_buffer normals_buffer;
+        renderer.render(view, lighting, rgba.data(), &normals_buffer);
+        relight(normals_buffer, lighting, relights, rgba);
+    }
+    if (contour_overlay)
+    {
+        std::vector<hillshader::contours::line_vertex> const vertices = hillshader::contours::line_list(contour_lines);
+        draw_contours(vertices, view, rgba);
+        std::printf("drew %zu contour segments\n", vertices.size() / 2);
+    }
+    return write(argv[2], view.width, view.height, rgba) ? 0 : 1;
+}
@@ -1,7 +1,11 @@
 #include "hillshader/application.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <filesystem>
+#include <limits>
 #include <set>
 
 #include <nlohmann/json.hpp>
@@ -11,12 +15,9 @@
 
 #include <stf/alg/intersect.hpp>
 
-#include <Common/interface/DataBlobImpl.hpp>
 #include <Graphics/GraphicsEngineOpenGL/interface/EngineFactoryOpenGL.h>
 #include <Graphics/GraphicsTools/interface/GraphicsUtilities.h>
 #include <Graphics/GraphicsTools/interface/MapHelper.hpp>
-#include <TextureLoader/interface/TextureLoader.h>
-#include <TextureLoader/interface/TextureUtilities.h>
 #include <imgui.h>
 
 #include "hillshader/camera/config.hpp"
@@ -26,21 +27,11 @@
 #include "hillshader/camera/controllers/animators/zoom.hpp"
 #include "hillshader/camera/controllers/identity.hpp"
 #include "hillshader/camera/controllers/input.hpp"
+#include "hillshader/memory.hpp"
+#include "hillshader/shading.hpp"
+#include "hillshader/texture_rows.hpp"
 #include "hillshader/timer.hpp"
 
-namespace
-{
-
-    stff::vec3 light_direction(float const azimuth, float const altitude)
-    {
-        // transform azimuth and altitude into spherical coordinates
-        float const theta = stff::constants::half_pi - stf::math::to_radians(azimuth);
-        float const phi = stff::constants::half_pi - stf::math::to_radians(altitude);
-        return -stf::math::unit_vector(theta, phi);
-    }
-
-}
-
 namespace hillshader
 {
 
@@ -49,10 +40,20 @@ namespace hillshader
     static constexpr char const* c_terrarium_dir = "terrarium";
     static constexpr char const* c_frames_dir = "frames";
 
-    static constexpr float c_min_meters_per_quad = 5.0;
-
     static constexpr float c_min_terrain_offset = 0.5;
 
+    // terrain rows are uploaded in strips of at most this many bytes
+    static constexpr size_t c_upload_strip_bytes = size_t(64) << 20;
+
+    // posts along the longer side of a pyramid snapshot and the distance past which the view requests no tiles
+    static constexpr size_t c_snapshot_posts = 2048;
+    static constexpr float c_max_page_distance = 100000.f;
+
+    // a snapshot covers the view's footprint grown by this fraction on each side, and is rebuilt once the footprint
+    // leaves it or shrinks below c_snapshot_shrink of it (so zooming in sharpens the snapshot)
+    static constexpr float c_snapshot_margin = 0.25f;
+    static constexpr float c_snapshot_shrink = 0.25f;
+
     struct constants
     {
         stff::mtx4 view_proj;
@@ -61,14 +62,26 @@ namespace hillshader
         stff::vec4 resolution;
         stff::vec4 albedo;
 
-        stff::vec3 light_dir;
+        // direction of travel and weight of each light, then the weighted sum of the directions (see shading::light_set)
+        stff::vec4 lights[shading::c_max_lights];
+        stff::vec3 combined_light;
         float ambient_intensity;
 
         stff::vec3 eye;
         float exaggeration;
 
+        // hlsl bools are 4 bytes, so flags are written as full words (a c++ bool leaves the rest of the word undefined
+        // in a buffer mapped with MAP_FLAG_DISCARD)
         float step_scalar;
-        bool flag_3d;
+        uint32_t flag_3d;
+
+        float elevation_scale;
+        float elevation_offset;
+
+        uint32_t flag_normals;
+        float horizon_directions;
+        float shadow_strength;
+        float sky_view_strength;
     };
 
     application::application() : m_controller(std::make_unique<camera::controllers::identity>()) {}
@@ -101,6 +114,8 @@ namespace hillshader
 
         create_resources();
 
+        m_catalog = std::make_unique<dem_catalog>(c_terrarium_dir);
+
         std::ifstream start_up_stream(c_start_up_file);
         if (start_up_stream)
         {
@@ -172,16 +187,27 @@ namespace hillshader
 
             if (ImGui::BeginMenu("DEMs"))
             {
-                for (std::filesystem::directory_entry const& file : std::filesystem::directory_iterator(c_terrarium_dir))
+                dem_catalog::snapshot dems = m_catalog->entries();
+                for (dem_catalog::entry const& dem : *dems)
                 {
-                    if (file.path().extension() != ".json")
+                    std::string const& current = (m_loader) ? m_loader->path() : (m_pages) ? m_pages->root().string() : m_dem_path;
+                    bool selected = current == dem.path;
+                    char details[64];
+                    if (dem.pyramid)
+                    {
+                        std::snprintf(details, sizeof(details), "pyramid");
+                    }
+                    else
+                    {
+                        std::snprintf(details, sizeof(details), "%zux%zu  %.1f MB", dem.width, dem.height, static_cast<double>(dem.file_size) / (1024.0 * 1024.0));
+                    }
+                    if (ImGui::MenuItem(dem.name.c_str(), details, selected, !selected))
+                    {
+                        load_dem(dem.path);
+                    }
+                    if (dem.has_bounds && ImGui::IsItemHovered())
                     {
-                        std::string path = file.path().string();
-                        bool selected = m_dem_path == path;
-                        if (ImGui::MenuItem(file.path().stem().generic_string().c_str(), nullptr, selected, !selected))
-                        {
-                            load_dem(path);
-                        }
+                        ImGui::SetTooltip("(%.1f, %.1f) - (%.1f, %.1f)", dem.min.x, dem.min.y, dem.max.x, dem.max.y);
                     }
                 }
                 ImGui::EndMenu();
@@ -238,12 +264,56 @@ namespace hillshader
                 ImGui::Text("Configuration");
                 ImGui::ColorEdit3("background", reinterpret_cast<float*>(&m_clear_color));
                 ImGui::ColorEdit3("albedo", reinterpret_cast<float*>(&m_albedo));
-                ImGui::DragFloat("azimuth", &m_azimuth, 0.5f, 0.f, 360.f, "%.1f");
-                ImGui::DragFloat("altitude", &m_altitude, 0.5f, 0.f, 90.f, "%.1f");
+                for (size_t i = 0; i < m_lights.size(); ++i)
+                {
+                    ImGui::PushID(static_cast<int>(i));
+                    shading::light& light = m_lights[i];
+                    ImGui::DragFloat("azimuth", &light.azimuth, 0.5f, 0.f, 360.f, "%.1f");
+                    ImGui::DragFloat("altitude", &light.altitude, 0.5f, 0.f, 90.f, "%.1f");
+                    if (m_lights.size() > 1)
+                    {
+                        ImGui::DragFloat("weight", &light.weight, 0.01f, 0.f, 1.f, "%.2f");
+                        if (ImGui::Button("remove light")) { m_lights.erase(m_lights.begin() + i--); }
+                    }
+                    ImGui::PopID();
+                }
+                if (m_lights.size() < shading::c_max_lights && ImGui::Button("add light"))
+                {
+                    m_lights.push_back(m_lights.back());
+                }
+                if (m_lights.size() == 1)
+                {
+                    // the four azimuths of the USGS MDOW hillshade around the light
+                    ImGui::SameLine();
+                    if (ImGui::Button("multidirectional")) { m_lights = shading::multidirectional(m_lights.front()); }
+                }
                 ImGui::DragFloat("ambient", &m_ambient_intensity, 0.01f, 0.f, 1.f, "%.2f");
                 ImGui::DragFloat("exaggeration", &m_exaggeration, 0.01f, 0.f, 10.f, "%.2f");
+                ImGui::DragFloat("shadows", &m_shadows, 0.01f, 0.f, 1.f, "%.2f");
+                ImGui::DragFloat("sky view", &m_sky_view, 0.01f, 0.f, 1.f, "%.2f");
                 ImGui::DragFloat("step scalar", &m_step_scalar, 0.0001f, 0.f, 0.01f, "%.4f");
                 ImGui::Checkbox("render in 3d", &m_flag_3d);
+
+                bool tiled = m_terrain_options.order == ordering::tiled;
+                if (ImGui::Checkbox("tiled storage (next load)", &tiled))
+                {
+                    m_terrain_options.order = (tiled) ? ordering::tiled : ordering::row_major;
+                }
+                ImGui::Checkbox("quantized storage (next load)", &m_terrain_options.quantize);
+                ImGui::Checkbox("precomputed normals (next load)", &m_terrain_options.normals);
+                ImGui::Checkbox("summed-area tables (next load)", &m_terrain_options.summed_area);
+
+                int directions = static_cast<int>(m_terrain_options.horizons);
+                if (ImGui::DragInt("horizon directions (next load)", &directions, 0.25f, 0, 64))
+                {
+                    m_terrain_options.horizons = static_cast<size_t>(directions);
+                }
+
+                int budget_mb = static_cast<int>(m_dem_cache.budget() >> 20);
+                if (ImGui::DragInt("DEM cache budget (MB)", &budget_mb, 16.f, 0, 65536))
+                {
+                    m_dem_cache.set_budget(static_cast<size_t>(budget_mb) << 20);
+                }
             }
             ImGui::Separator();
             // info block
@@ -251,6 +321,10 @@ namespace hillshader
                 ImGui::Text("Info");
                 stff::aabb2 const bounds = (m_terrain) ? m_terrain->bounds() : stff::aabb2(stff::vec2(), stff::vec2());
                 ImGui::Text("DEM Bounds: (%.1f, %.1f) - (%.1f, %.1f)", bounds.min.x, bounds.min.y, bounds.max.x, bounds.max.y);
+                if (m_terrain && m_terrain->is_quantized())
+                {
+                    ImGui::Text("Quantization error: %.4f m", m_terrain->quantization_params().max_error);
+                }
                 ImGui::Text("Eye: (%.1f, %.1f, %.1f)", m_camera.eye.x, m_camera.eye.y, m_camera.eye.z);
                 ImGui::Text("Theta: %.1f  Phi: %.1f", stf::math::to_degrees(m_camera.theta), stf::math::to_degrees(m_camera.phi));
 
@@ -261,12 +335,54 @@ namespace hillshader
                 {
                     stff::vec3 const& world_pos = *opt;
                     ImGui::Text("Mouse Pos (world): (%.3f, %.3f, %.3f)", world_pos.x, world_pos.y, world_pos.z);
+
+                    // four lookups per frame, however large the area
+                    if (m_terrain && !m_terrain->summed_area().empty())
+                    {
+                        ImGui::DragFloat("statistics radius (m)", &m_statistics_radius, 10.f, 0.f, 100000.f, "%.0f");
+                        stff::vec2 const extent(m_statistics_radius, m_statistics_radius);
+                        stff::aabb2 const area(world_pos.xy - extent, world_pos.xy + extent);
+                        summed_area_table::statistics const stats = m_terrain->summed_area().query(*m_terrain, area);
+                        ImGui::Text("Area: %zu posts, mean %.1f m, std dev %.1f m", stats.count, stats.mean, stats.stddev());
+                    }
                 }
 
-                stff::vec3 light_dir = light_direction(m_azimuth, m_altitude);
+                stff::vec3 light_dir = shading::light_direction(m_lights.front().azimuth, m_lights.front().altitude);
                 ImGui::Text("Light Direction: (%.3f, %.3f, %.3f)", light_dir.x, light_dir.y, light_dir.z);
 
                 ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+                float const mb = 1.f / (1024.f * 1024.f);
+                ImGui::Text("Memory: %.1f MB resident, %.1f MB peak", mb * memory::resident_bytes(), mb * memory::peak_resident_bytes());
+                if (m_load_memory.baseline > 0)
+                {
+                    ImGui::Text("Last load: %.1f MB peak (%.1f MB before)", mb * m_load_memory.peak, mb * m_load_memory.baseline);
+                }
+                ImGui::Text("DEM cache: %zu entries, %.1f MB, %zu hits, %zu misses", m_dem_cache.count(), mb * m_dem_cache.bytes(), m_dem_cache.hits(), m_dem_cache.misses());
+                if (m_pages)
+                {
+                    ImGui::Text("Pyramid: z%u-%u, %zu tiles resident, %zu pending%s", m_pages->min_zoom(), m_pages->max_zoom(), m_pages->resident(), m_pages->pending(), (m_page_loader) ? ", refreshing" : "");
+                }
+            }
+            // loading block
+            if (m_loader)
+            {
+                ImGui::Separator();
+                ImGui::Text("Loading %s", std::filesystem::path(m_loader->path()).stem().string().c_str());
+                char const* label = "building mesh";
+                switch (m_loader->current_stage())
+                {
+                    case dem_loader::stage::decoding: label = "decoding"; break;
+                    case dem_loader::stage::mipmapping: label = "building mips"; break;
+                    case dem_loader::stage::normals: label = "building normals"; break;
+                    case dem_loader::stage::horizons: label = "sweeping horizons"; break;
+                    default: break;
+                }
+                ImGui::ProgressBar(m_loader->fraction(), ImVec2(-1.f, 0.f), label);
+                if (ImGui::Button("Cancel"))
+                {
+                    cancel_dem_load();
+                }
             }
 
             ImGui::End();
@@ -278,8 +394,12 @@ namespace hillshader
         // start the ImGui frame (even if we're not going to render it) so that input is refreshed
         m_imgui_impl->NewFrame(m_width, m_height, Diligent::SURFACE_TRANSFORM_IDENTITY);
 
+        poll_dem_load();
+
         update();
 
+        update_pages();
+
         // set render targets before issuing any draw command.
         // note that present() unbinds the back buffer if it is set as render target.
         m_immediate_context->SetRenderTargets(1, &m_msaa_color_rtv, m_msaa_depth_dsv, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
@@ -300,15 +420,39 @@ namespace hillshader
 
             consts->albedo = m_albedo.as_vec();
 
-            float azimuth = m_azimuth - stf::math::to_degrees(m_camera.theta - stff::constants::half_pi);
-            consts->light_dir = light_direction(azimuth, m_altitude);
+            shading::lighting lighting;
+            lighting.lights = m_lights;
+            shading::light_set const lights = shading::resolve(lighting, m_camera.theta);
+            for (size_t i = 0; i < shading::c_max_lights; ++i)
+            {
+                stff::vec3 const& dir = lights.directions[i];
+                consts->lights[i] = (i < lights.count) ? stff::vec4(dir.x, dir.y, dir.z, lights.lights[i].weight) : stff::vec4(0.f, 0.f, 0.f, 0.f);
+            }
+            consts->combined_light = lights.combined;
             consts->ambient_intensity = m_ambient_intensity;
 
             consts->eye = m_camera.eye;
             consts->exaggeration = m_exaggeration;
 
             consts->step_scalar = m_step_scalar;
-            consts->flag_3d = m_flag_3d;
+            consts->flag_3d = (m_flag_3d) ? 1u : 0u;
+            consts->flag_normals = (m_normal_texture_srv != nullptr) ? 1u : 0u;
+            consts->horizon_directions = (m_horizon_texture_srv) ? static_cast<float>(m_dem_options.horizons) : 0.f;
+            consts->shadow_strength = m_shadows;
+            consts->sky_view_strength = m_sky_view;
+
+            // unorm textures sample in [0, 1], so the quantization step is scaled up by the code range
+            if (m_terrain->is_quantized())
+            {
+                terrain::quantization const& q = m_terrain->quantization_params();
+                consts->elevation_scale = q.scale * 65535.f;
+                consts->elevation_offset = q.offset;
+            }
+            else
+            {
+                consts->elevation_scale = 1.f;
+                consts->elevation_offset = 0.f;
+            }
 
             uint64_t const offset = 0;
             Diligent::IBuffer* buffers[] = { m_vertex_buffer };
@@ -530,11 +674,13 @@ namespace hillshader
         Diligent::ShaderResourceVariableDesc vars[] =
         {
             { Diligent::SHADER_TYPE_VERTEX | Diligent::SHADER_TYPE_PIXEL, "g_terrain", Diligent::SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+            { Diligent::SHADER_TYPE_PIXEL, "g_normals", Diligent::SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
+            { Diligent::SHADER_TYPE_PIXEL, "g_horizons", Diligent::SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE },
         };
         pso_info.PSODesc.ResourceLayout.Variables = vars;
         pso_info.PSODesc.ResourceLayout.NumVariables = _countof(vars);
 
-        // define immutable sampler for g_terrain. Immutable samplers should be used whenever possible
+        // define immutable samplers for g_terrain, g_normals, and g_horizons. Immutable samplers should be used whenever possible
         Diligent::SamplerDesc desc
         {
             Diligent::FILTER_TYPE_LINEAR, Diligent::FILTER_TYPE_LINEAR, Diligent::FILTER_TYPE_LINEAR,
@@ -543,6 +689,8 @@ namespace hillshader
         Diligent::ImmutableSamplerDesc immutable_samplers[] =
         {
             { Diligent::SHADER_TYPE_VERTEX | Diligent::SHADER_TYPE_PIXEL, "g_terrain", desc },
+            { Diligent::SHADER_TYPE_PIXEL, "g_normals", desc },
+            { Diligent::SHADER_TYPE_PIXEL, "g_horizons", desc },
         };
         pso_info.PSODesc.ResourceLayout.ImmutableSamplers = immutable_samplers;
         pso_info.PSODesc.ResourceLayout.NumImmutableSamplers = _countof(immutable_samplers);
@@ -553,6 +701,30 @@ namespace hillshader
         m_pso->GetStaticVariableByName(Diligent::SHADER_TYPE_PIXEL , "PSConstants")->Set(m_shader_constants);
 
         m_pso->CreateShaderResourceBinding(&m_srb, true);
+
+        // a single layer stands in for the horizon field of DEMs without one (horizon_directions is 0)
+        {
+            uint16_t const zero = 0;
+            Diligent::TextureSubResData subresource;
+            subresource.pData = &zero;
+            subresource.Stride = sizeof(uint16_t);
+
+            Diligent::TextureDesc desc;
+            desc.Name = "Empty horizon texture";
+            desc.Type = Diligent::RESOURCE_DIM_TEX_2D_ARRAY;
+            desc.Width = 1;
+            desc.Height = 1;
+            desc.ArraySize = 1;
+            desc.MipLevels = 1;
+            desc.Format = Diligent::TEXTURE_FORMAT::TEX_FORMAT_R16_UNORM;
+            desc.BindFlags = Diligent::BIND_SHADER_RESOURCE;
+            desc.Usage = Diligent::USAGE_IMMUTABLE;
+
+            Diligent::TextureData data;
+            data.pSubResources = &subresource;
+            data.NumSubresources = 1;
+            m_device->CreateTexture(desc, &data, &m_empty_horizons);
+        }
     }
 
     void application::create_msaa_resources()
@@ -655,6 +827,15 @@ namespace hillshader
             {
                 return focus;
             }
+
+            // terrain::intersect misses rays that leave the DEM. past the edge the terrain continues as a floor at its
+            // lowest elevation (which is what sample returns there), so looking past the edge still finds a focus
+            stff::plane floor = stff::plane(stff::vec3(0, 0, m_terrain->range().a), stff::vec3(0, 0, 1));
+            std::optional<stff::vec3> beyond = stf::alg::intersect(ray, floor);
+            if (beyond.has_value())
+            {
+                return beyond;
+            }
         }
         // fall-through case
         stff::plane plane = stff::plane(stff::vec3(), stff::vec3(0, 0, 1));
@@ -727,90 +908,409 @@ namespace hillshader
 
     void application::load_dem(std::string const& path)
     {
-        release_dem_resources();
+        cancel_dem_load();
+        m_pages.reset();
 
-        m_dem_path = path;
-        m_terrain = std::make_unique<terrain>(m_dem_path);
+        // a pyramid pins its coarsest level straight away and the first snapshot follows from update_pages
+        if (std::filesystem::is_directory(path))
+        {
+            auto pages = std::make_shared<paged_terrain>(path);
+            if (!pages->empty())
+            {
+                // no revision matches, so the first snapshot starts on the next frame
+                m_pages = std::move(pages);
+                m_page_revision = std::numeric_limits<size_t>::max();
+            }
+            return;
+        }
 
-        reset_camera();
+        // recently used DEMs are swapped back in without touching the disk
+        if (std::optional<dem_cache::entry> cached = m_dem_cache.take(path, m_terrain_options))
+        {
+            activate_dem(std::move(*cached));
+            return;
+        }
+
+        m_loader = std::make_unique<dem_loader>(path, m_terrain_options);
+        m_load_memory.baseline = memory::resident_bytes();
+        m_load_memory.peak = m_load_memory.baseline;
+    }
+
+    void application::cancel_dem_load()
+    {
+        if (m_loader)
+        {
+            // joining a cancelled loader can still wait on an image decode, so park it until its thread finishes
+            m_loader->cancel();
+            m_cancelled_loaders.push_back(std::move(m_loader));
+        }
+        if (m_page_loader)
+        {
+            m_page_loader->cancel();
+            m_cancelled_loaders.push_back(std::move(m_page_loader));
+        }
+    }
 
-        // compute and load vertex/index buffer
+    void application::poll_dem_load()
+    {
+        auto finished = [](std::unique_ptr<dem_loader> const& loader) { return loader->is_ready(); };
+        m_cancelled_loaders.erase(std::remove_if(m_cancelled_loaders.begin(), m_cancelled_loaders.end(), finished), m_cancelled_loaders.end());
+
+        if (m_loader)
         {
-            // compute resolution
-            stff::vec2 const& diagonal = m_terrain->bounds().diagonal();
-            float meters_per_pixel = std::max(diagonal.x / m_terrain->width(), diagonal.y / m_terrain->height());
-            float meters_per_quad = std::max(meters_per_pixel, c_min_meters_per_quad);
-            size_t threshold = static_cast<size_t>(std::min(diagonal.x / meters_per_quad, diagonal.y / meters_per_quad));
-            size_t resolution = std::min(threshold, std::max(m_terrain->width(), m_terrain->height()));
+            m_load_memory.peak = std::max(m_load_memory.peak, memory::resident_bytes());
+        }
 
-            // compute and load vertex buffer
+        if (m_loader && m_loader->is_ready())
+        {
+            dem_loader::result result = m_loader->take();
+            m_loader.reset();
+            if (result.dem)     // keep the current DEM if the load failed
             {
-                m_vertices = mesh::vertices(resolution);
-
-                Diligent::BufferDesc desc;
-                desc.Name = "Terrain vertex buffer";
-                desc.Usage = Diligent::USAGE_IMMUTABLE;
-                desc.BindFlags = Diligent::BIND_VERTEX_BUFFER;
-                desc.Size = sizeof(mesh::vertex_t) * m_vertices.size();
-
-                Diligent::BufferData data;
-                data.pData = m_vertices.data();
-                data.DataSize = sizeof(mesh::vertex_t) * m_vertices.size();
-                m_device->CreateBuffer(desc, &data, &m_vertex_buffer);
+                upload_dem(std::move(result));
             }
+        }
+    }
 
-            // compute and load index buffer
-            {
-                m_indices = mesh::index_strip(resolution);
-
-                Diligent::BufferDesc desc;
-                desc.Name = "Terrain index buffer";
-                desc.Usage = Diligent::USAGE_IMMUTABLE;
-                desc.BindFlags = Diligent::BIND_INDEX_BUFFER;
-                desc.Size = sizeof(uint32_t) * m_indices.size();
-
-                Diligent::BufferData data;
-                data.pData = m_indices.data();
-                data.DataSize = sizeof(uint32_t) * m_indices.size();
-                m_device->CreateBuffer(desc, &data, &m_index_buffer);
-            }
+    void application::upload_dem(dem_loader::result&& result)
+    {
+        dem_cache::entry dem;
+        dem.path = result.path;
+        dem.options = result.options;
+        dem.stamp = result.stamp;
+        dem.dem = std::move(result.dem);
+        dem.vertices = std::move(result.vertices);
+        dem.indices = std::move(result.indices);
+
+        // load vertex buffer
+        {
+            Diligent::BufferDesc desc;
+            desc.Name = "Terrain vertex buffer";
+            desc.Usage = Diligent::USAGE_IMMUTABLE;
+            desc.BindFlags = Diligent::BIND_VERTEX_BUFFER;
+            desc.Size = sizeof(mesh::vertex_t) * dem.vertices.size();
+
+            Diligent::BufferData data;
+            data.pData = dem.vertices.data();
+            data.DataSize = sizeof(mesh::vertex_t) * dem.vertices.size();
+            m_device->CreateBuffer(desc, &data, &dem.vertex_buffer);
+        }
+
+        // load index buffer
+        {
+            Diligent::BufferDesc desc;
+            desc.Name = "Terrain index buffer";
+            desc.Usage = Diligent::USAGE_IMMUTABLE;
+            desc.BindFlags = Diligent::BIND_INDEX_BUFFER;
+            desc.Size = sizeof(uint32_t) * dem.indices.size();
+
+            Diligent::BufferData data;
+            data.pData = dem.indices.data();
+            data.DataSize = sizeof(uint32_t) * dem.indices.size();
+            m_device->CreateBuffer(desc, &data, &dem.index_buffer);
         }
 
         // load terrain texture
         {
-            Diligent::RefCntAutoPtr<Diligent::IDataBlob> blob = Diligent::DataBlobImpl::Create(sizeof(float) * m_terrain->width() * m_terrain->height(), m_terrain->values().data());
+            dem.texture = upload_terrain_texture(*dem.dem, result.mips);
+            dem.texture_srv = dem.texture->GetDefaultView(Diligent::TEXTURE_VIEW_SHADER_RESOURCE);
+        }
+
+        // load normal texture (the CPU copy is released with the result)
+        if (!result.normals.empty())
+        {
+            dem.normal_texture = upload_normal_texture(result.normals);
+            dem.normal_texture_srv = dem.normal_texture->GetDefaultView(Diligent::TEXTURE_VIEW_SHADER_RESOURCE);
+        }
+
+        // load horizon texture
+        if (!result.horizons.empty())
+        {
+            dem.horizon_texture = upload_horizon_texture(result.horizons);
+            dem.horizon_texture_srv = dem.horizon_texture->GetDefaultView(Diligent::TEXTURE_VIEW_SHADER_RESOURCE);
+        }
 
-            Diligent::RefCntAutoPtr<Diligent::Image> img;
-            Diligent::ImageDesc desc;
-            desc.Width = static_cast<Diligent::Uint32>(m_terrain->width());
-            desc.Height = static_cast<Diligent::Uint32>(m_terrain->height());
-            desc.NumComponents = 1;
-            desc.ComponentType = Diligent::VALUE_TYPE::VT_FLOAT32;
-            desc.RowStride = sizeof(float) * desc.Width;
-            Diligent::Image::CreateFromMemory(desc, blob, &img);
+        activate_dem(std::move(dem), result.snapshot);
+    }
 
-            Diligent::RefCntAutoPtr<Diligent::ITextureLoader> loader;
-            Diligent::TextureLoadInfo info;
-            info.Format = Diligent::TEXTURE_FORMAT::TEX_FORMAT_R32_FLOAT;
-            info.MipLevels = 1;
-            info.GenerateMips = false;
-            Diligent::CreateTextureLoaderFromImage(img, info, &loader);
+    void application::update_pages()
+    {
+        if (!m_pages) { return; }
 
-            loader->CreateTexture(m_device, &m_texture);
+        if (m_page_loader && m_page_loader->is_ready())
+        {
+            dem_loader::result result = m_page_loader->take();
+            m_page_loader.reset();
+            if (result.dem)     // nothing was resident yet, so the next revision tries again
+            {
+                upload_dem(std::move(result));
+            }
+        }
 
-            m_texture_srv = m_texture->GetDefaultView(Diligent::TEXTURE_VIEW_SHADER_RESOURCE);
-            m_srb->GetVariableByName(Diligent::SHADER_TYPE_VERTEX, "g_terrain")->Set(m_texture_srv, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
-            m_srb->GetVariableByName(Diligent::SHADER_TYPE_PIXEL , "g_terrain")->Set(m_texture_srv, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
+        // until the pyramid has a snapshot on screen the camera is in another DEM's frame, so the whole coverage is
+        // requested (which the pinned level already answers)
+        stff::aabb2 const& coverage = m_pages->bounds();
+        stff::aabb2 footprint = coverage;
+        bool const on_screen = m_dem_snapshot && m_dem_path == m_pages->root().string();
+        if (on_screen)
+        {
+            stff::aabb2 const view = paged_terrain::footprint(m_camera, m_terrain->range().a, c_max_page_distance);
+            stff::vec2 const min(std::max(view.min.x, coverage.min.x), std::max(view.min.y, coverage.min.y));
+            stff::vec2 const max(std::min(view.max.x, coverage.max.x), std::min(view.max.y, coverage.max.y));
+            if (min.x < max.x && min.y < max.y) { footprint = stff::aabb2(min, max); }
         }
 
-        m_start_up_state["dem_path"] = path;
+        stff::vec2 const diagonal = footprint.diagonal();
+        float const extent = std::max(diagonal.x, diagonal.y);
+        m_pages->request(footprint, extent / static_cast<float>(c_snapshot_posts));
+
+        if (m_page_loader) { return; }
+
+        bool const inside = m_page_area.min.x <= footprint.min.x && m_page_area.min.y <= footprint.min.y
+            && footprint.max.x <= m_page_area.max.x && footprint.max.y <= m_page_area.max.y;
+        stff::vec2 const area = m_page_area.diagonal();
+        bool const sharp = extent >= c_snapshot_shrink * std::max(area.x, area.y);
+        bool const current = inside && sharp && m_pages->revision() == m_page_revision;
+        if (current) { return; }
+
+        // the snapshot reads whatever is resident, falling back to coarser levels where finer tiles are in flight
+        stff::vec2 const margin = c_snapshot_margin * diagonal;
+        stff::vec2 const min(std::max(footprint.min.x - margin.x, coverage.min.x), std::max(footprint.min.y - margin.y, coverage.min.y));
+        stff::vec2 const max(std::min(footprint.max.x + margin.x, coverage.max.x), std::min(footprint.max.y + margin.y, coverage.max.y));
+        m_page_area = stff::aabb2(min, max);
+        m_page_revision = m_pages->revision();
+        m_page_loader = std::make_unique<dem_loader>(m_pages, m_page_area, c_snapshot_posts, m_terrain_options);
+    }
+
+    void application::activate_dem(dem_cache::entry&& dem, bool snapshot)
+    {
+        // snapshots are rebuilt from the pyramid rather than cached
+        bool const refresh = snapshot && m_dem_snapshot && m_dem_path == dem.path;
+        if (m_dem_snapshot)
+        {
+            m_terrain.reset();
+            release_dem_resources();
+        }
+        else
+        {
+            stash_dem();
+        }
+        m_dem_snapshot = snapshot;
+
+        m_dem_path = std::move(dem.path);
+        m_dem_options = dem.options;
+        m_dem_stamp = dem.stamp;
+        m_terrain = std::move(dem.dem);
+        m_vertices = std::move(dem.vertices);
+        m_indices = std::move(dem.indices);
+        m_texture = std::move(dem.texture);
+        m_texture_srv = std::move(dem.texture_srv);
+        m_normal_texture = std::move(dem.normal_texture);
+        m_normal_texture_srv = std::move(dem.normal_texture_srv);
+        m_horizon_texture = std::move(dem.horizon_texture);
+        m_horizon_texture_srv = std::move(dem.horizon_texture_srv);
+        m_vertex_buffer = std::move(dem.vertex_buffer);
+        m_index_buffer = std::move(dem.index_buffer);
+
+        m_srb->GetVariableByName(Diligent::SHADER_TYPE_VERTEX, "g_terrain")->Set(m_texture_srv, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
+        m_srb->GetVariableByName(Diligent::SHADER_TYPE_PIXEL , "g_terrain")->Set(m_texture_srv, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
+
+        // every variable must be bound, so DEMs without normals bind the terrain in their place (flag_normals is off)
+        Diligent::ITextureView* normals = (m_normal_texture_srv) ? m_normal_texture_srv.RawPtr() : m_texture_srv.RawPtr();
+        m_srb->GetVariableByName(Diligent::SHADER_TYPE_PIXEL , "g_normals")->Set(normals, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
+
+        Diligent::ITextureView* horizons = (m_horizon_texture_srv) ? m_horizon_texture_srv.RawPtr() : m_empty_horizons->GetDefaultView(Diligent::TEXTURE_VIEW_SHADER_RESOURCE);
+        m_srb->GetVariableByName(Diligent::SHADER_TYPE_PIXEL , "g_horizons")->Set(horizons, Diligent::SET_SHADER_RESOURCE_FLAG_ALLOW_OVERWRITE);
+
+        if (refresh) { return; }
+
+        reset_camera();
+
+        m_start_up_state["dem_path"] = m_dem_path;
         store_start_up_state();
     }
 
+    void application::stash_dem()
+    {
+        if (!m_terrain) { return; }
+
+        dem_cache::entry dem;
+        dem.path = m_dem_path;
+        dem.options = m_dem_options;
+        dem.stamp = m_dem_stamp;
+        dem.dem = std::move(m_terrain);
+        dem.vertices = std::move(m_vertices);
+        dem.indices = std::move(m_indices);
+        dem.texture = std::move(m_texture);
+        dem.texture_srv = std::move(m_texture_srv);
+        dem.normal_texture = std::move(m_normal_texture);
+        dem.normal_texture_srv = std::move(m_normal_texture_srv);
+        dem.horizon_texture = std::move(m_horizon_texture);
+        dem.horizon_texture_srv = std::move(m_horizon_texture_srv);
+        dem.vertex_buffer = std::move(m_vertex_buffer);
+        dem.index_buffer = std::move(m_index_buffer);
+        m_dem_cache.insert(std::move(dem));
+
+        release_dem_resources();
+    }
+
+    Diligent::RefCntAutoPtr<Diligent::ITexture> application::upload_terrain_texture(terrain const& dem, mip_chain const& mips)
+    {
+        // quantized terrains upload their 16-bit values as-is and the shaders rescale them
+        bool const quantized = dem.is_quantized();
+        size_t const width = dem.width();
+        size_t const height = dem.height();
+
+        // row-major float terrains are uploaded straight from their (possibly memory mapped) buffer. every other
+        // storage is flattened one strip of rows at a time
+        texture_rows staging(dem, c_upload_strip_bytes);
+        size_t const element_size = staging.element_size();
+        size_t const row_bytes = staging.row_bytes();
+        size_t const strip_rows = staging.strip_rows();
+
+        auto mip_data = [&](size_t level) -> Diligent::TextureSubResData
+        {
+            mip_chain::level const& mip = mips.at(level);
+            Diligent::TextureSubResData data;
+            data.pData = (quantized) ? static_cast<void const*>(mip.quantized_values.data() + 1) : static_cast<void const*>(mip.values.data());
+            data.Stride = element_size * mip.width;
+            return data;
+        };
+
+        Diligent::TextureDesc desc;
+        desc.Name = "Terrain texture";
+        desc.Type = Diligent::RESOURCE_DIM_TEX_2D;
+        desc.Width = static_cast<Diligent::Uint32>(width);
+        desc.Height = static_cast<Diligent::Uint32>(height);
+        desc.MipLevels = static_cast<Diligent::Uint32>(mips.levels());
+        desc.Format = (quantized) ? Diligent::TEXTURE_FORMAT::TEX_FORMAT_R16_UNORM : Diligent::TEXTURE_FORMAT::TEX_FORMAT_R32_FLOAT;
+        desc.BindFlags = Diligent::BIND_SHADER_RESOURCE;
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> texture;
+        if (strip_rows == height)
+        {
+            // level 0 fits in a single strip, so every level is passed as initial data
+            std::vector<Diligent::TextureSubResData> subresources(mips.levels());
+            subresources[0].pData = staging.rows(0, height);
+            subresources[0].Stride = row_bytes;
+            for (size_t level = 1; level < mips.levels(); ++level)
+            {
+                subresources[level] = mip_data(level);
+            }
+
+            desc.Usage = Diligent::USAGE_IMMUTABLE;
+            Diligent::TextureData data;
+            data.pSubResources = subresources.data();
+            data.NumSubresources = static_cast<Diligent::Uint32>(subresources.size());
+            m_device->CreateTexture(desc, &data, &texture);
+        }
+        else
+        {
+            // larger DEMs are written strip by strip so that neither we nor the driver stage the whole level at once
+            desc.Usage = Diligent::USAGE_DEFAULT;
+            m_device->CreateTexture(desc, nullptr, &texture);
+
+            auto update = [&](size_t level, Diligent::Box const& box, Diligent::TextureSubResData const& data)
+            {
+                m_immediate_context->UpdateTexture(texture, static_cast<Diligent::Uint32>(level), 0, box, data, Diligent::RESOURCE_STATE_TRANSITION_MODE_NONE, Diligent::RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+            };
+
+            for (size_t begin = 0; begin < height; begin += strip_rows)
+            {
+                size_t const end = std::min(height, begin + strip_rows);
+                Diligent::TextureSubResData data;
+                data.pData = staging.rows(begin, end);
+                data.Stride = row_bytes;
+                update(0, Diligent::Box(0, desc.Width, static_cast<Diligent::Uint32>(begin), static_cast<Diligent::Uint32>(end)), data);
+            }
+
+            for (size_t level = 1; level < mips.levels(); ++level)
+            {
+                mip_chain::level const& mip = mips.at(level);
+                update(level, Diligent::Box(0, static_cast<Diligent::Uint32>(mip.width), 0, static_cast<Diligent::Uint32>(mip.height)), mip_data(level));
+            }
+        }
+
+        // sample while the staging strips are still alive
+        m_load_memory.peak = std::max(m_load_memory.peak, memory::resident_bytes());
+
+        return texture;
+    }
+
+    Diligent::RefCntAutoPtr<Diligent::ITexture> application::upload_normal_texture(normal_field const& normals)
+    {
+        std::vector<Diligent::TextureSubResData> subresources(normals.levels());
+        for (size_t level = 0; level < normals.levels(); ++level)
+        {
+            normal_field::level const& lvl = normals.at(level);
+            subresources[level].pData = lvl.values.data();
+            subresources[level].Stride = sizeof(uint32_t) * lvl.width;
+        }
+
+        Diligent::TextureDesc desc;
+        desc.Name = "Normal texture";
+        desc.Type = Diligent::RESOURCE_DIM_TEX_2D;
+        desc.Width = static_cast<Diligent::Uint32>(normals.at(0).width);
+        desc.Height = static_cast<Diligent::Uint32>(normals.at(0).height);
+        desc.MipLevels = static_cast<Diligent::Uint32>(normals.levels());
+        desc.Format = Diligent::TEXTURE_FORMAT::TEX_FORMAT_RG16_UNORM;
+        desc.BindFlags = Diligent::BIND_SHADER_RESOURCE;
+        desc.Usage = Diligent::USAGE_IMMUTABLE;
+
+        // the field is already in memory at its final layout, so every level is passed as initial data
+        Diligent::TextureData data;
+        data.pSubResources = subresources.data();
+        data.NumSubresources = static_cast<Diligent::Uint32>(subresources.size());
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> texture;
+        m_device->CreateTexture(desc, &data, &texture);
+        return texture;
+    }
+
+    Diligent::RefCntAutoPtr<Diligent::ITexture> application::upload_horizon_texture(horizon_field const& horizons)
+    {
+        // subresources are ordered by layer and then by level
+        std::vector<Diligent::TextureSubResData> subresources;
+        subresources.reserve(horizons.layers() * horizons.levels());
+        for (size_t layer = 0; layer < horizons.layers(); ++layer)
+        {
+            for (size_t level = 0; level < horizons.levels(); ++level)
+            {
+                horizon_field::level const& lvl = horizons.at(level);
+                Diligent::TextureSubResData& subresource = subresources.emplace_back();
+                subresource.pData = lvl.values.data() + layer * lvl.width * lvl.height;
+                subresource.Stride = sizeof(uint16_t) * lvl.width;
+            }
+        }
+
+        Diligent::TextureDesc desc;
+        desc.Name = "Horizon texture";
+        desc.Type = Diligent::RESOURCE_DIM_TEX_2D_ARRAY;
+        desc.Width = static_cast<Diligent::Uint32>(horizons.at(0).width);
+        desc.Height = static_cast<Diligent::Uint32>(horizons.at(0).height);
+        desc.ArraySize = static_cast<Diligent::Uint32>(horizons.layers());
+        desc.MipLevels = static_cast<Diligent::Uint32>(horizons.levels());
+        desc.Format = Diligent::TEXTURE_FORMAT::TEX_FORMAT_R16_UNORM;
+        desc.BindFlags = Diligent::BIND_SHADER_RESOURCE;
+        desc.Usage = Diligent::USAGE_IMMUTABLE;
+
+        Diligent::TextureData data;
+        data.pSubResources = subresources.data();
+        data.NumSubresources = static_cast<Diligent::Uint32>(subresources.size());
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> texture;
+        m_device->CreateTexture(desc, &data, &texture);
+        return texture;
+    }
+
     void application::release_dem_resources()
     {
         if (m_texture) { m_texture = nullptr; }
         if (m_texture_srv) { m_texture_srv = nullptr; }
+        if (m_normal_texture) { m_normal_texture = nullptr; }
+        if (m_normal_texture_srv) { m_normal_texture_srv = nullptr; }
+        if (m_horizon_texture) { m_horizon_texture = nullptr; }
+        if (m_horizon_texture_srv) { m_horizon_texture_srv = nullptr; }
         if (m_vertex_buffer) { m_vertex_buffer = nullptr; }
         if (m_index_buffer) { m_index_buffer = nullptr; }
     }
@@ -0,0 +1,417 @@
+#include "hillshader/contours.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+#include "hillshader/parallel.hpp"
+
+namespace hillshader::contours
+{
+
+    namespace
+    {
+
+        constexpr size_t c_none = std::numeric_limits<size_t>::max();
+
+        // radius of the sphere that web mercator projects (the WGS84 semi-major axis)
+        constexpr double c_earth_radius = 6378137.0;
+        constexpr double c_pi = 3.14159265358979323846;
+
+        // inverse spherical web mercator (EPSG:3857) from meters to WGS84 longitude and latitude in degrees
+        stfd::vec2 to_lon_lat(double x, double y)
+        {
+            double const lon = x / c_earth_radius;
+            double const lat = 2.0 * std::atan(std::exp(y / c_earth_radius)) - 0.5 * c_pi;
+            return stfd::vec2(lon * 180.0 / c_pi, lat * 180.0 / c_pi);
+        }
+
+        // the edges of a cell: 0 is the top (row j), 1 the right, 2 the bottom (row j + 1) and 3 the left. a case is
+        // indexed by which corners are at or above the contour elevation: bit 0 is post (i, j), bit 1 is (i + 1, j),
+        // bit 2 is (i + 1, j + 1) and bit 3 is (i, j + 1). the saddles (5 and 10) list the pairs for a center below the
+        // contour. a center at or above it uses the pairs of the opposite saddle
+        constexpr int8_t c_cases[16][4] =
+        {
+            { -1, -1, -1, -1 }, { 3, 0, -1, -1 }, { 0, 1, -1, -1 }, { 3, 1, -1, -1 },
+            { 1, 2, -1, -1 },   { 3, 0, 1, 2 },   { 0, 2, -1, -1 }, { 2, 3, -1, -1 },
+            { 2, 3, -1, -1 },   { 0, 2, -1, -1 }, { 0, 1, 2, 3 },   { 1, 2, -1, -1 },
+            { 3, 1, -1, -1 },   { 0, 1, -1, -1 }, { 3, 0, -1, -1 }, { -1, -1, -1, -1 },
+        };
+
+        // a run of points at one elevation. the ends of an open piece are identified by the post edge they cross
+        // (combined with the elevation), so two pieces that meet share a key. the points at a shared edge are
+        // computed the same way by both cells, so they are identical
+        struct piece
+        {
+            uint64_t keys[2];
+            size_t first;
+            size_t count;
+            int64_t level;
+            bool closed;
+        };
+
+        struct pieces
+        {
+            std::vector<piece> runs;
+            std::vector<stff::vec2> points;
+
+            inline void clear() { runs.clear(); points.clear(); }
+        };
+
+        // joins the pieces that share an end key into as few pieces as possible. pieces that come back to where they
+        // started are closed
+        void stitch(pieces const& in, pieces& out)
+        {
+            size_t const n = in.runs.size();
+            out.runs.reserve(out.runs.size() + n);
+            out.points.reserve(out.points.size() + in.points.size());
+
+            // pairs the ends through an open addressing table of the ends seen so far. an edge is crossed by at most
+            // two pieces at an elevation, so a key is matched at most once
+            size_t capacity = 16;
+            while (capacity < 4 * n) { capacity *= 2; }
+            size_t const mask = capacity - 1;
+            std::vector<std::pair<uint64_t, size_t>> table(capacity, { 0, c_none });
+            std::vector<size_t> partner(2 * n, c_none);
+            for (size_t p = 0; p < n; ++p)
+            {
+                if (in.runs[p].closed) { continue; }
+                for (size_t e = 0; e < 2; ++e)
+                {
+                    uint64_t const key = in.runs[p].keys[e];
+                    size_t slot = static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+                    while (table[slot].second != c_none && table[slot].first != key) { slot = (slot + 1) & mask; }
+                    if (table[slot].second == c_none)
+                    {
+                        table[slot] = { key, 2 * p + e };
+                    }
+                    else
+                    {
+                        partner[table[slot].second] = 2 * p + e;
+                        partner[2 * p + e] = table[slot].second;
+                    }
+                }
+            }
+
+            std::vector<bool> visited(n, false);
+            auto walk = [&](size_t p, size_t entry)
+            {
+                size_t const start = p;
+                piece joined = { { in.runs[p].keys[entry], 0 }, out.points.size(), 0, in.runs[p].level, false };
+                while (true)
+                {
+                    visited[p] = true;
+                    piece const& run = in.runs[p];
+
+                    // the first point of every piece after the first repeats the last point added
+                    stff::vec2 const* pts = in.points.data() + run.first;
+                    size_t const skip = (out.points.size() > joined.first) ? 1 : 0;
+                    for (size_t s = skip; s < run.count; ++s)
+                    {
+                        out.points.push_back((entry == 0) ? pts[s] : pts[run.count - 1 - s]);
+                    }
+
+                    size_t const exit = 1 - entry;
+                    joined.keys[1] = run.keys[exit];
+                    size_t const next = partner[2 * p + exit];
+                    if (next == c_none) { break; }
+
+                    p = next / 2;
+                    entry = next % 2;
+                    if (p == start)
+                    {
+                        joined.closed = true;
+                        break;
+                    }
+                }
+                joined.count = out.points.size() - joined.first;
+                out.runs.push_back(joined);
+            };
+
+            for (size_t p = 0; p < n; ++p)
+            {
+                piece const& run = in.runs[p];
+                if (run.closed)
+                {
+                    piece copy = run;
+                    copy.first = out.points.size();
+                    out.points.insert(out.points.end(), in.points.begin() + run.first, in.points.begin() + run.first + run.count);
+                    out.runs.push_back(copy);
+                    visited[p] = true;
+                }
+            }
+
+            // chains start at an end that has no partner
+            for (size_t p = 0; p < n; ++p)
+            {
+                if (visited[p]) { continue; }
+                if (partner[2 * p] == c_none) { walk(p, 0); }
+                else if (partner[2 * p + 1] == c_none) { walk(p, 1); }
+            }
+
+            // and what is left are loops
+            for (size_t p = 0; p < n; ++p)
+            {
+                if (!visited[p]) { walk(p, 0); }
+            }
+        }
+
+    }
+
+    collection extract(terrain const& terrain, options const& opts, progress* progress)
+    {
+        collection lines;
+        pyramid const& min_max = terrain.min_max();
+        if (terrain.empty() || min_max.empty() || !(opts.interval > 0.f)) { return lines; }
+
+        auto elevation = [&](int64_t level) { return opts.base + static_cast<float>(level) * opts.interval; };
+
+        // a contour crosses a cell if the lowest post is below its elevation and the highest is at or above it. the
+        // estimates from the division are nudged until they agree with the elevations the cells are tested against
+        auto nearest_level = [&](float z) { return static_cast<int64_t>(std::floor((static_cast<double>(z) - opts.base) / opts.interval)); };
+        auto first_above = [&](float z)
+        {
+            int64_t level = nearest_level(z);
+            while (elevation(level) <= z) { ++level; }
+            while (elevation(level - 1) > z) { --level; }
+            return level;
+        };
+        auto last_at_or_below = [&](float z)
+        {
+            int64_t level = nearest_level(z);
+            while (elevation(level) > z) { --level; }
+            while (elevation(level + 1) <= z) { ++level; }
+            return level;
+        };
+
+        int64_t const first_level = first_above(terrain.range().a);
+        int64_t const last_level = last_at_or_below(terrain.range().b);
+        if (first_level > last_level) { return lines; }
+        uint64_t const levels = static_cast<uint64_t>(last_level - first_level + 1);
+
+        size_t const width = terrain.width();
+        size_t const cells_x = min_max.cells_x();
+        size_t const cells_y = min_max.cells_y();
+
+        // texel space to world space
+        stff::vec2 const origin = terrain.to_texel(stff::vec2(0.f, 0.f));
+        stff::vec2 const unit = terrain.to_texel(stff::vec2(1.f, 1.f)) - origin;
+        stff::vec2 const inv_scale(1.f / unit.x, 1.f / unit.y);
+
+        // the edge from post (i, j) to (i + 1, j) is 2 * (i + width * j) and the edge to (i, j + 1) is one more
+        auto key = [&](size_t i, size_t j, size_t edge, int64_t level)
+        {
+            uint64_t id = 0;
+            switch (edge)
+            {
+                case 0: id = 2 * (i + width * j); break;
+                case 1: id = 2 * ((i + 1) + width * j) + 1; break;
+                case 2: id = 2 * (i + width * (j + 1)); break;
+                default: id = 2 * (i + width * j) + 1; break;
+            }
+            return id * levels + static_cast<uint64_t>(level - first_level);
+        };
+
+        // a tile is a node of the pyramid
+        size_t tile_level = 0;
+        while ((size_t(1) << tile_level) < opts.tile_cells && tile_level < min_max.top()) { ++tile_level; }
+        size_t const tiles_x = min_max.width(tile_level);
+        size_t const tiles_y = min_max.height(tile_level);
+        size_t const tiles = tiles_x * tiles_y;
+
+        std::vector<pieces> stitched(tiles);
+        std::vector<pieces> scratch(parallel::concurrency());
+        std::atomic<size_t> done(0);
+        parallel::for_each_dynamic(0, tiles, [&](size_t tile, size_t worker)
+        {
+            if (progress && progress->cancelled()) { return; }
+
+            pieces& segments = scratch[worker];
+            segments.clear();
+
+            auto march = [&](size_t i, size_t j, int64_t lo, int64_t hi)
+            {
+                std::array<float, 4> const z = terrain.read_quad(i, j);
+                float const z00 = z[0], z10 = z[1], z01 = z[2], z11 = z[3];
+                lo = std::max(lo, first_above(std::min(std::min(z00, z10), std::min(z01, z11))));
+                hi = std::min(hi, last_at_or_below(std::max(std::max(z00, z10), std::max(z01, z11))));
+
+                stff::vec2 const corner(static_cast<float>(i), static_cast<float>(j));
+                for (int64_t level = lo; level <= hi; ++level)
+                {
+                    float const v = elevation(level);
+                    size_t c = ((z00 >= v) ? 1 : 0) | ((z10 >= v) ? 2 : 0) | ((z11 >= v) ? 4 : 0) | ((z01 >= v) ? 8 : 0);
+                    if (c == 0 || c == 15) { continue; }
+                    if ((c == 5 || c == 10) && 0.25f * (z00 + z10 + z01 + z11) >= v) { c = 15 - c; }
+
+                    // where the contour crosses an edge, interpolated from the edge's first post
+                    auto cross = [&](int8_t edge)
+                    {
+                        stff::vec2 texel = corner;
+                        switch (edge)
+                        {
+                            case 0: texel.x += (v - z00) / (z10 - z00); break;
+                            case 1: texel.x += 1.f; texel.y += (v - z10) / (z11 - z10); break;
+                            case 2: texel.x += (v - z01) / (z11 - z01); texel.y += 1.f; break;
+                            default: texel.y += (v - z00) / (z01 - z00); break;
+                        }
+                        return stff::vec2((texel.x - origin.x) * inv_scale.x, (texel.y - origin.y) * inv_scale.y);
+                    };
+
+                    for (size_t s = 0; s < 4 && c_cases[c][s] >= 0; s += 2)
+                    {
+                        int8_t const a = c_cases[c][s];
+                        int8_t const b = c_cases[c][s + 1];
+                        segments.runs.push_back({ { key(i, j, a, level), key(i, j, b, level) }, segments.points.size(), 2, level, false });
+                        segments.points.push_back(cross(a));
+                        segments.points.push_back(cross(b));
+                    }
+                }
+            };
+
+            // skips every node whose range holds no contour elevation
+            auto descend = [&](auto&& self, size_t level, size_t i, size_t j, int64_t lo, int64_t hi) -> void
+            {
+                stff::interval const range = min_max.range(level, i, j);
+                lo = std::max(lo, first_above(range.a));
+                hi = std::min(hi, last_at_or_below(range.b));
+                if (lo > hi) { return; }
+
+                if (level <= pyramid::c_base_level)
+                {
+                    size_t const i1 = std::min((i + 1) << level, cells_x);
+                    size_t const j1 = std::min((j + 1) << level, cells_y);
+                    for (size_t cj = j << level; cj < j1; ++cj)
+                    {
+                        for (size_t ci = i << level; ci < i1; ++ci) { march(ci, cj, lo, hi); }
+                    }
+                    return;
+                }
+
+                size_t const below_w = min_max.width(level - 1);
+                size_t const below_h = min_max.height(level - 1);
+                for (size_t cj = 2 * j; cj < std::min(2 * j + 2, below_h); ++cj)
+                {
+                    for (size_t ci = 2 * i; ci < std::min(2 * i + 2, below_w); ++ci) { self(self, level - 1, ci, cj, lo, hi); }
+                }
+            };
+
+            descend(descend, tile_level, tile % tiles_x, tile / tiles_x, first_level, last_level);
+            stitch(segments, stitched[tile]);
+
+            if (progress) { progress->set(static_cast<float>(++done) / static_cast<float>(tiles)); }
+        });
+        if (progress && progress->cancelled()) { return lines; }
+
+        // join the pieces that leave their tile
+        pieces open;
+        for (pieces const& tile : stitched)
+        {
+            for (piece const& run : tile.runs)
+            {
+                if (run.closed) { continue; }
+                piece copy = run;
+                copy.first = open.points.size();
+                open.points.insert(open.points.end(), tile.points.begin() + run.first, tile.points.begin() + run.first + run.count);
+                open.runs.push_back(copy);
+            }
+        }
+        pieces joined;
+        stitch(open, joined);
+
+        // gather everything in order of elevation
+        struct source
+        {
+            piece const* run;
+            stff::vec2 const* points;
+        };
+        std::vector<source> sources;
+        sources.reserve(joined.runs.size() + std::accumulate(stitched.begin(), stitched.end(), size_t(0), [](size_t sum, pieces const& tile) { return sum + tile.runs.size(); }));
+        size_t total = joined.points.size();
+        for (pieces const& tile : stitched)
+        {
+            for (piece const& run : tile.runs)
+            {
+                if (!run.closed) { continue; }
+                sources.push_back({ &run, tile.points.data() });
+                total += run.count;
+            }
+        }
+        for (piece const& run : joined.runs) { sources.push_back({ &run, joined.points.data() }); }
+        std::stable_sort(sources.begin(), sources.end(), [](source const& lhs, source const& rhs) { return lhs.run->level < rhs.run->level; });
+
+        lines.polylines.reserve(sources.size());
+        lines.points.reserve(total);
+        for (source const& src : sources)
+        {
+            piece const& run = *src.run;
+            lines.polylines.push_back({ elevation(run.level), lines.points.size(), run.count, run.closed });
+            lines.points.insert(lines.points.end(), src.points + run.first, src.points + run.first + run.count);
+        }
+        return lines;
+    }
+
+    std::vector<line_vertex> line_list(collection const& lines)
+    {
+        size_t segments = 0;
+        for (polyline const& line : lines.polylines) { segments += (line.count > 1) ? line.count - 1 : 0; }
+
+        std::vector<line_vertex> vertices;
+        vertices.reserve(2 * segments);
+        for (polyline const& line : lines.polylines)
+        {
+            for (size_t p = line.first + 1; p < line.first + line.count; ++p)
+            {
+                vertices.push_back({ lines.points[p - 1], line.elevation });
+                vertices.push_back({ lines.points[p], line.elevation });
+            }
+        }
+        return vertices;
+    }
+
+    bool write_geojson(terrain const& terrain, collection const& lines, std::filesystem::path const& path)
+    {
+        std::filesystem::path tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::trunc);
+            if (!ofs) { return false; }
+
+            stfd::vec2 const& center = terrain.center();
+            char buffer[96];
+            ofs << "{\"type\":\"FeatureCollection\",\"features\":[";
+            for (size_t l = 0; l < lines.polylines.size(); ++l)
+            {
+                polyline const& line = lines.polylines[l];
+                std::snprintf(buffer, sizeof(buffer), "%s\n{\"type\":\"Feature\",\"properties\":{\"elevation\":%g},", (l > 0) ? "," : "", line.elevation);
+                ofs << buffer << "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[";
+                for (size_t p = 0; p < line.count; ++p)
+                {
+                    stff::vec2 const& point = lines.points[line.first + p];
+                    stfd::vec2 const lon_lat = to_lon_lat(center.x + point.x, center.y + point.y);
+                    std::snprintf(buffer, sizeof(buffer), "%s[%.7f,%.7f]", (p > 0) ? "," : "", lon_lat.x, lon_lat.y);
+                    ofs << buffer;
+                }
+                ofs << "]}}";
+            }
+            ofs << "\n]}\n";
+            if (!ofs) { return false; }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+}
@@ -0,0 +1,112 @@
+#include "hillshader/dem_cache.hpp"
+
+#include <algorithm>
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        bool same_options(terrain::options const& lhs, terrain::options const& rhs)
+        {
+            return lhs.order == rhs.order && lhs.quantize == rhs.quantize && lhs.normals == rhs.normals && lhs.horizons == rhs.horizons
+                && lhs.summed_area == rhs.summed_area;
+        }
+
+        size_t texture_bytes(Diligent::ITexture* texture)
+        {
+            if (!texture) { return 0; }
+
+            Diligent::TextureDesc const& desc = texture->GetDesc();
+            // R32_FLOAT terrains and RG16_UNORM normal fields both take four bytes per texel. horizon fields are
+            // R16_UNORM arrays
+            size_t const element_size = (desc.Format == Diligent::TEX_FORMAT_R16_UNORM) ? sizeof(uint16_t) : sizeof(uint32_t);
+            size_t bytes = 0;
+            for (Diligent::Uint32 level = 0; level < desc.MipLevels; ++level)
+            {
+                size_t const w = std::max<size_t>(1, desc.Width >> level);
+                size_t const h = std::max<size_t>(1, desc.Height >> level);
+                bytes += element_size * w * h * std::max<size_t>(1, desc.ArraySize);
+            }
+            return bytes;
+        }
+
+        size_t buffer_bytes(Diligent::IBuffer* buffer)
+        {
+            return (buffer) ? static_cast<size_t>(buffer->GetDesc().Size) : 0;
+        }
+
+    }
+
+    std::optional<dem_cache::entry> dem_cache::take(std::string const& path, terrain::options const& options)
+    {
+        auto found = std::find_if(m_entries.begin(), m_entries.end(), [&](std::pair<size_t, entry> const& cached)
+        {
+            return cached.second.path == path && same_options(cached.second.options, options);
+        });
+
+        if (found == m_entries.end())
+        {
+            ++m_misses;
+            return std::nullopt;
+        }
+
+        if (found->second.stamp != dem_file::stamp(path))
+        {
+            ++m_misses;
+            m_bytes -= found->first;
+            m_entries.erase(found);
+            return std::nullopt;
+        }
+
+        ++m_hits;
+        m_bytes -= found->first;
+        entry e = std::move(found->second);
+        m_entries.erase(found);
+        return e;
+    }
+
+    void dem_cache::insert(entry&& e)
+    {
+        size_t const bytes = footprint(e);
+        m_entries.emplace_front(bytes, std::move(e));
+        m_bytes += bytes;
+        evict();
+    }
+
+    void dem_cache::clear()
+    {
+        m_entries.clear();
+        m_bytes = 0;
+    }
+
+    void dem_cache::set_budget(size_t budget)
+    {
+        m_budget = budget;
+        evict();
+    }
+
+    size_t dem_cache::footprint(entry const& e)
+    {
+        size_t bytes = sizeof(mesh::vertex_t) * e.vertices.size() + sizeof(uint32_t) * e.indices.size();
+        if (e.dem)
+        {
+            size_t const element_size = (e.dem->is_quantized()) ? sizeof(uint16_t) : sizeof(float);
+            bytes += element_size * e.dem->storage().size() + e.dem->min_max().bytes() + e.dem->summed_area().bytes();
+        }
+        bytes += texture_bytes(e.texture) + texture_bytes(e.normal_texture) + texture_bytes(e.horizon_texture);
+        bytes += buffer_bytes(e.vertex_buffer) + buffer_bytes(e.index_buffer);
+        return bytes;
+    }
+
+    void dem_cache::evict()
+    {
+        while (m_bytes > m_budget && !m_entries.empty())
+        {
+            m_bytes -= m_entries.back().first;
+            m_entries.pop_back();
+        }
+    }
+
+}
@@ -0,0 +1,257 @@
+#include "hillshader/dem_catalog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include <stb_image.h>
+
+#include "hillshader/dem_codec.hpp"
+#include "hillshader/terrarium.hpp"
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+namespace hillshader
+{
+
+    // how often the stop flag is checked while waiting on a change notification
+    static constexpr std::chrono::milliseconds c_wake_interval(250);
+
+    // how often the directory is rescanned when change notifications are unavailable
+    static constexpr std::chrono::milliseconds c_poll_interval(2000);
+
+    namespace
+    {
+
+        // size and modification time of the sidecar of a DEM (zero and the epoch if there is none)
+        void sidecar_state(std::filesystem::path const& path, uintmax_t& size, std::filesystem::file_time_type& modified)
+        {
+            std::filesystem::path sidecar = path;
+            sidecar.replace_extension(".json");
+            std::error_code ec;
+            size = std::filesystem::file_size(sidecar, ec);
+            if (ec) { size = 0; }
+            modified = std::filesystem::last_write_time(sidecar, ec);
+            if (ec) { modified = std::filesystem::file_time_type(); }
+        }
+
+        // whether a directory holds a tile pyramid (a numeric zoom level subdirectory)
+        bool is_pyramid(std::filesystem::path const& path)
+        {
+            std::error_code ec;
+            for (std::filesystem::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+            {
+                std::string const name = it->path().filename().string();
+                bool const numeric = !name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return '0' <= c && c <= '9'; });
+                if (numeric && it->is_directory(ec)) { return true; }
+            }
+            return false;
+        }
+
+        dem_catalog::entry describe(std::filesystem::path const& path, uintmax_t file_size, std::filesystem::file_time_type modified,
+            uintmax_t sidecar_size, std::filesystem::file_time_type sidecar_modified)
+        {
+            dem_catalog::entry e;
+            e.path = path.string();
+            e.name = path.stem().generic_string();
+            e.file_size = file_size;
+            e.modified = modified;
+            e.sidecar_size = sidecar_size;
+            e.sidecar_modified = sidecar_modified;
+
+            // compressed DEMs carry their dimensions and bounds in the header
+            if (path.extension() == dem_codec::c_extension)
+            {
+                dem_codec::header hdr;
+                if (dem_codec::read_header(path, hdr))
+                {
+                    e.width = static_cast<size_t>(hdr.width);
+                    e.height = static_cast<size_t>(hdr.height);
+                    e.min = stfd::vec2(hdr.min[0], hdr.min[1]);
+                    e.max = stfd::vec2(hdr.max[0], hdr.max[1]);
+                    e.has_bounds = true;
+                }
+                return e;
+            }
+
+            // only the image header is read
+            int width = 0, height = 0, channels = 0;
+            if (stbi_info(e.path.c_str(), &width, &height, &channels))
+            {
+                e.width = static_cast<size_t>(width);
+                e.height = static_cast<size_t>(height);
+            }
+
+            e.has_bounds = terrarium::read_sidecar(path, e.min, e.max);
+
+            return e;
+        }
+
+    }
+
+    dem_catalog::dem_catalog(std::filesystem::path const& directory) :
+        m_directory(directory),
+        m_entries(std::make_shared<std::vector<entry> const>()),
+        m_thread(&dem_catalog::watch, this)
+    {}
+
+    dem_catalog::~dem_catalog()
+    {
+        m_stopping.store(true, std::memory_order_release);
+        m_thread.join();
+    }
+
+    dem_catalog::snapshot dem_catalog::entries() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries;
+    }
+
+    void dem_catalog::watch()
+    {
+        refresh();
+        if (!watch_native())
+        {
+            poll();
+        }
+    }
+
+    void dem_catalog::refresh()
+    {
+        snapshot previous = entries();
+        std::unordered_map<std::string, entry const*> known;
+        for (entry const& e : *previous)
+        {
+            known.emplace(e.path, &e);
+        }
+
+        auto current = std::make_shared<std::vector<entry>>();
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(m_directory, ec), end; !ec && it != end; it.increment(ec))
+        {
+            std::filesystem::path const& path = it->path();
+            if (it->is_directory(ec))
+            {
+                // a pyramid's tiles are read as they are requested, so only its name is cataloged
+                if (!ec && is_pyramid(path))
+                {
+                    entry e;
+                    e.path = path.string();
+                    e.name = path.filename().generic_string();
+                    e.pyramid = true;
+                    current->push_back(e);
+                }
+                ec.clear();
+                continue;
+            }
+
+            // skip sidecar metadata and native DEM caches
+            if (path.extension() != ".png" && path.extension() != dem_codec::c_extension) { continue; }
+
+            uintmax_t const size = it->file_size(ec);
+            std::filesystem::file_time_type const modified = it->last_write_time(ec);
+            if (ec) { ec.clear(); continue; }
+
+            uintmax_t sidecar_size = 0;
+            std::filesystem::file_time_type sidecar_modified;
+            sidecar_state(path, sidecar_size, sidecar_modified);
+
+            // files whose image and sidecar are both unchanged keep their metadata
+            auto found = known.find(path.string());
+            bool const unchanged = found != known.end() && found->second->file_size == size && found->second->modified == modified
+                && found->second->sidecar_size == sidecar_size && found->second->sidecar_modified == sidecar_modified;
+            if (unchanged)
+            {
+                current->push_back(*found->second);
+            }
+            else
+            {
+                current->push_back(describe(path, size, modified, sidecar_size, sidecar_modified));
+            }
+        }
+
+        std::sort(current->begin(), current->end(), [](entry const& lhs, entry const& rhs) { return lhs.name < rhs.name; });
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries = std::move(current);
+        }
+        m_revision.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    bool dem_catalog::watch_native()
+    {
+#if defined(_WIN32)
+        HANDLE change = FindFirstChangeNotificationW(m_directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+        if (change == INVALID_HANDLE_VALUE) { return false; }
+
+        DWORD const timeout = static_cast<DWORD>(c_wake_interval.count());
+        while (!m_stopping.load(std::memory_order_acquire))
+        {
+            DWORD const status = WaitForSingleObject(change, timeout);
+            if (status == WAIT_OBJECT_0)
+            {
+                refresh();
+                if (!FindNextChangeNotification(change)) { break; }
+            }
+            else if (status != WAIT_TIMEOUT)
+            {
+                break;
+            }
+        }
+
+        FindCloseChangeNotification(change);
+        return m_stopping.load(std::memory_order_acquire);
+#elif defined(__linux__)
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0) { return false; }
+
+        uint32_t const mask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB;
+        if (inotify_add_watch(fd, m_directory.c_str(), mask) < 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        while (!m_stopping.load(std::memory_order_acquire))
+        {
+            pollfd pfd = { fd, POLLIN, 0 };
+            int const ready = ::poll(&pfd, 1, static_cast<int>(c_wake_interval.count()));
+            if (ready < 0) { break; }
+            if (ready == 0) { continue; }
+
+            // drain every pending event and rescan once
+            while (read(fd, buffer, sizeof(buffer)) > 0) {}
+            refresh();
+        }
+
+        close(fd);
+        return m_stopping.load(std::memory_order_acquire);
+#else
+        return false;
+#endif
+    }
+
+    void dem_catalog::poll()
+    {
+        auto next = std::chrono::steady_clock::now() + c_poll_interval;
+        while (!m_stopping.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(c_wake_interval);
+            if (std::chrono::steady_clock::now() >= next)
+            {
+                refresh();
+                next = std::chrono::steady_clock::now() + c_poll_interval;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,397 @@
+#include "hillshader/dem_codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <system_error>
+#include <vector>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+#include "hillshader/parallel.hpp"
+
+namespace
+{
+
+    // residuals share a Rice parameter per block
+    constexpr size_t c_block_size = 32;
+    constexpr unsigned c_k_bits = 5;
+    constexpr unsigned c_max_k = 24;
+
+    // a unary run this long marks a residual stored verbatim in 32 bits
+    constexpr unsigned c_escape = 24;
+
+    // largest grid index we store, which keeps every residual within 32 bits after zigzag mapping
+    constexpr double c_max_level = static_cast<double>(1 << 29);
+
+    inline unsigned count_trailing_zeros(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index = 0;
+        _BitScanForward64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+    }
+
+    inline uint32_t zigzag(int64_t value) { return static_cast<uint32_t>((value < 0) ? (-2 * value - 1) : (2 * value)); }
+    inline int64_t unzigzag(uint32_t value) { return (value & 1) ? -static_cast<int64_t>(value >> 1) - 1 : static_cast<int64_t>(value >> 1); }
+
+    // the LOCO-I median edge detector. a is the left neighbor, b is the neighbor above and c is the one above-left
+    inline int64_t predict(int64_t a, int64_t b, int64_t c)
+    {
+        if (c >= std::max(a, b)) { return std::min(a, b); }
+        if (c <= std::min(a, b)) { return std::max(a, b); }
+        return a + b - c;
+    }
+
+    // prediction for post (i, j) of a tile given the current and previous rows of decoded values
+    inline int64_t predict_at(size_t i, size_t j, int64_t const* current, int64_t const* previous)
+    {
+        if (j == 0) { return (i == 0) ? 0 : current[i - 1]; }
+        if (i == 0) { return previous[0]; }
+        return predict(current[i - 1], previous[i], previous[i - 1]);
+    }
+
+    // little-endian bit stream, least significant bit first
+    class bit_writer
+    {
+    public:
+
+        bit_writer(std::vector<uint8_t>& out) : m_out(out) {}
+
+        // n must be at most 32
+        inline void put(uint64_t value, unsigned n)
+        {
+            m_bits |= value << m_count;
+            m_count += n;
+            while (m_count >= 8)
+            {
+                m_out.push_back(static_cast<uint8_t>(m_bits));
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        inline void put_rice(uint32_t value, unsigned k)
+        {
+            uint32_t const quotient = value >> k;
+            if (quotient < c_escape)
+            {
+                put((uint64_t(1) << quotient) - 1, quotient + 1);
+                put(value & ((uint64_t(1) << k) - 1), k);
+            }
+            else
+            {
+                put((uint64_t(1) << c_escape) - 1, c_escape);
+                put(value, 32);
+            }
+        }
+
+        void flush()
+        {
+            if (m_count > 0) { m_out.push_back(static_cast<uint8_t>(m_bits)); }
+            m_bits = 0;
+            m_count = 0;
+        }
+
+    private:
+
+        std::vector<uint8_t>& m_out;
+        uint64_t m_bits = 0;
+        unsigned m_count = 0;
+    };
+
+    class bit_reader
+    {
+    public:
+
+        bit_reader(uint8_t const* begin, uint8_t const* end) : m_begin(begin), m_pos(begin), m_end(end) {}
+
+        // tops the buffer up to at least 56 bits. reading past the end supplies zeros (see overrun)
+        inline void refill()
+        {
+            if (m_end - m_pos >= 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, m_pos, sizeof(word));
+                m_bits |= word << m_count;
+                m_pos += (63 - m_count) >> 3;
+                m_count |= 56;
+            }
+            else
+            {
+                while (m_count <= 56)
+                {
+                    if (m_pos < m_end) { m_bits |= static_cast<uint64_t>(*m_pos++) << m_count; }
+                    else { ++m_padding; }
+                    m_count += 8;
+                }
+            }
+        }
+
+        inline uint32_t get(unsigned n)
+        {
+            refill();
+            uint32_t const value = static_cast<uint32_t>(m_bits & ((uint64_t(1) << n) - 1));
+            consume(n);
+            return value;
+        }
+
+        inline uint32_t get_rice(unsigned k)
+        {
+            refill();
+            uint64_t const inverted = ~m_bits;
+            unsigned const run = (inverted != 0) ? count_trailing_zeros(inverted) : 64;
+            if (run < c_escape)
+            {
+                consume(run + 1);
+                uint32_t const value = (static_cast<uint32_t>(run) << k) | static_cast<uint32_t>(m_bits & ((uint64_t(1) << k) - 1));
+                consume(k);
+                return value;
+            }
+
+            consume(c_escape);
+            return get(32);
+        }
+
+        // whether more bits were consumed than the stream holds
+        inline bool overrun() const
+        {
+            size_t const consumed = 8 * (static_cast<size_t>(m_pos - m_begin) + m_padding) - m_count;
+            return consumed > 8 * static_cast<size_t>(m_end - m_begin);
+        }
+
+    private:
+
+        inline void consume(unsigned n)
+        {
+            m_bits >>= n;
+            m_count -= n;
+        }
+
+        uint8_t const* m_begin;
+        uint8_t const* m_pos;
+        uint8_t const* m_end;
+        uint64_t m_bits = 0;
+        unsigned m_count = 0;
+        size_t m_padding = 0;
+    };
+
+    // Rice parameter that minimizes the coded size of a block
+    unsigned best_k(uint32_t const* values, size_t count)
+    {
+        unsigned best = 0;
+        uint64_t best_cost = std::numeric_limits<uint64_t>::max();
+        for (unsigned k = 0; k <= c_max_k; ++k)
+        {
+            uint64_t cost = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t const quotient = values[i] >> k;
+                cost += (quotient < c_escape) ? quotient + 1 + k : c_escape + 32;
+            }
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best = k;
+            }
+        }
+        return best;
+    }
+
+    void encode_tile(hillshader::dem_codec::header const& hdr, hillshader::dem_codec::tile_rect const& rect, float const* values, std::vector<uint8_t>& out)
+    {
+        // residuals of the whole tile in raster order
+        std::vector<uint32_t> residuals(rect.width * rect.height);
+        std::vector<int64_t> rows(2 * rect.width);
+        int64_t* previous = rows.data();
+        int64_t* current = rows.data() + rect.width;
+        for (size_t j = 0; j < rect.height; ++j)
+        {
+            float const* src = values + rect.x + hdr.width * (rect.y + j);
+            for (size_t i = 0; i < rect.width; ++i)
+            {
+                double const level = std::round((static_cast<double>(src[i]) - hdr.offset) / hdr.step);
+                current[i] = static_cast<int64_t>(std::clamp(level, 0.0, c_max_level));
+                residuals[i + rect.width * j] = zigzag(current[i] - predict_at(i, j, current, previous));
+            }
+            std::swap(previous, current);
+        }
+
+        bit_writer writer(out);
+        for (size_t b = 0; b < residuals.size(); b += c_block_size)
+        {
+            size_t const count = std::min(c_block_size, residuals.size() - b);
+            unsigned const k = best_k(residuals.data() + b, count);
+            writer.put(k, c_k_bits);
+            for (size_t i = 0; i < count; ++i)
+            {
+                writer.put_rice(residuals[b + i], k);
+            }
+        }
+        writer.flush();
+    }
+
+}
+
+namespace hillshader::dem_codec
+{
+
+    static constexpr char c_magic[8] = { 'H', 'S', 'D', 'E', 'M', 'Z', '\0', '\0' };
+
+    uint64_t tile_count(header const& hdr)
+    {
+        uint64_t const tiles_x = (hdr.width + hdr.tile_size - 1) / hdr.tile_size;
+        uint64_t const tiles_y = (hdr.height + hdr.tile_size - 1) / hdr.tile_size;
+        return tiles_x * tiles_y;
+    }
+
+    tile_rect tile_extent(header const& hdr, size_t tile)
+    {
+        size_t const tiles_x = static_cast<size_t>((hdr.width + hdr.tile_size - 1) / hdr.tile_size);
+        tile_rect rect;
+        rect.x = (tile % tiles_x) * hdr.tile_size;
+        rect.y = (tile / tiles_x) * hdr.tile_size;
+        rect.width = std::min<size_t>(hdr.tile_size, static_cast<size_t>(hdr.width) - rect.x);
+        rect.height = std::min<size_t>(hdr.tile_size, static_cast<size_t>(hdr.height) - rect.y);
+        return rect;
+    }
+
+    bool write(std::filesystem::path const& path, header const& hdr, float const* values)
+    {
+        header out = hdr;
+        std::memcpy(out.magic, c_magic, sizeof(c_magic));
+        out.version = c_version;
+        out.tile_size = c_tile_size;
+        if (out.width == 0 || out.height == 0 || !(out.step > 0.f)) { return false; }
+
+        // the grid starts at the lowest elevation so that every index is non-negative. there is no code for missing
+        // data, so a nan (or infinite) elevation is rejected rather than being written as the lowest elevation
+        size_t const count = static_cast<size_t>(out.width * out.height);
+        float lo = std::numeric_limits<float>::max();
+        float hi = std::numeric_limits<float>::lowest();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!std::isfinite(values[i])) { return false; }
+            lo = std::min(lo, values[i]);
+            hi = std::max(hi, values[i]);
+        }
+        if ((static_cast<double>(hi) - lo) / out.step >= c_max_level) { return false; }
+
+        out.range[0] = lo;
+        out.range[1] = hi;
+        out.offset = lo;
+        out.tile_count = tile_count(out);
+
+        // encode the tiles in parallel
+        std::vector<std::vector<uint8_t>> tiles(static_cast<size_t>(out.tile_count));
+        parallel::for_each_chunk(0, tiles.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t t = begin; t < end; ++t)
+            {
+                encode_tile(out, tile_extent(out, t), values, tiles[t]);
+            }
+        });
+
+        std::vector<uint64_t> offsets(tiles.size() + 1);
+        offsets[0] = sizeof(header) + sizeof(uint64_t) * offsets.size();
+        for (size_t t = 0; t < tiles.size(); ++t)
+        {
+            offsets[t + 1] = offsets[t] + tiles[t].size();
+        }
+
+        std::filesystem::path tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            if (!ofs) { return false; }
+
+            ofs.write(reinterpret_cast<char const*>(&out), sizeof(header));
+            ofs.write(reinterpret_cast<char const*>(offsets.data()), static_cast<std::streamsize>(sizeof(uint64_t) * offsets.size()));
+            for (std::vector<uint8_t> const& tile : tiles)
+            {
+                ofs.write(reinterpret_cast<char const*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+            if (!ofs) { return false; }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    bool read_header(std::filesystem::path const& path, header& hdr)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs.read(reinterpret_cast<char*>(&hdr), sizeof(header))) { return false; }
+        return std::memcmp(hdr.magic, c_magic, sizeof(c_magic)) == 0 && hdr.version == c_version;
+    }
+
+    header const* validate(mapped_file const& file)
+    {
+        if (!file.is_open() || file.size() < sizeof(header)) { return nullptr; }
+
+        header const* hdr = reinterpret_cast<header const*>(file.data());
+        if (std::memcmp(hdr->magic, c_magic, sizeof(c_magic)) != 0 || hdr->version != c_version) { return nullptr; }
+        if (hdr->tile_size == 0 || hdr->width == 0 || hdr->height == 0 || !(hdr->step > 0.f)) { return nullptr; }
+        if (hdr->tile_count != tile_count(*hdr)) { return nullptr; }
+
+        uint64_t const table_end = sizeof(header) + sizeof(uint64_t) * (hdr->tile_count + 1);
+        if (table_end > file.size()) { return nullptr; }
+
+        // the tiles must be in order and inside the file
+        uint64_t const* offsets = reinterpret_cast<uint64_t const*>(file.data() + sizeof(header));
+        if (offsets[0] < table_end || offsets[hdr->tile_count] > file.size()) { return nullptr; }
+        for (uint64_t t = 0; t < hdr->tile_count; ++t)
+        {
+            if (offsets[t] > offsets[t + 1]) { return nullptr; }
+        }
+
+        return hdr;
+    }
+
+    bool decode_tile(mapped_file const& file, header const& hdr, size_t tile, float* out, size_t stride)
+    {
+        uint64_t const* offsets = reinterpret_cast<uint64_t const*>(file.data() + sizeof(header));
+        uint8_t const* base = reinterpret_cast<uint8_t const*>(file.data());
+        bit_reader reader(base + offsets[tile], base + offsets[tile + 1]);
+
+        tile_rect const rect = tile_extent(hdr, tile);
+        std::vector<int64_t> rows(2 * rect.width);
+        int64_t* previous = rows.data();
+        int64_t* current = rows.data() + rect.width;
+
+        unsigned k = 0;
+        size_t n = 0;
+        for (size_t j = 0; j < rect.height; ++j)
+        {
+            float* dst = out + j * stride;
+            for (size_t i = 0; i < rect.width; ++i, ++n)
+            {
+                if (n % c_block_size == 0)
+                {
+                    k = reader.get(c_k_bits);
+                    if (k > c_max_k) { return false; }
+                }
+
+                current[i] = predict_at(i, j, current, previous) + unzigzag(reader.get_rice(k));
+                dst[i] = hdr.offset + static_cast<float>(current[i]) * hdr.step;
+            }
+            std::swap(previous, current);
+        }
+
+        return !reader.overrun();
+    }
+
+}
@@ -0,0 +1,222 @@
+#include "hillshader/dem_file.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <system_error>
+#include <vector>
+
+namespace hillshader::dem_file
+{
+
+    static constexpr char c_magic[8] = { 'H', 'S', 'D', 'E', 'M', '\0', '\0', '\0' };
+
+    std::filesystem::path cache_path(std::filesystem::path const& source)
+    {
+        std::filesystem::path path = source;
+        return path.replace_extension(c_extension);
+    }
+
+    // size and modification time of a file (zeros if it does not exist)
+    static void file_stamp(std::filesystem::path const& path, uint64_t& size, int64_t& time)
+    {
+        std::error_code ec;
+        uintmax_t bytes = std::filesystem::file_size(path, ec);
+        size = (ec) ? 0 : static_cast<uint64_t>(bytes);
+        std::filesystem::file_time_type written = std::filesystem::last_write_time(path, ec);
+        time = (ec) ? 0 : static_cast<int64_t>(written.time_since_epoch().count());
+    }
+
+    // out = a * b, returning false on overflow
+    static bool multiply(uint64_t a, uint64_t b, uint64_t& out)
+    {
+        if (a != 0 && b > std::numeric_limits<uint64_t>::max() / a) { return false; }
+        out = a * b;
+        return true;
+    }
+
+    // a temporary path next to path that no other process picks, so concurrent writers of the same cache never share
+    // (and truncate) a temporary file
+    static std::filesystem::path temp_path(std::filesystem::path const& path)
+    {
+        static std::atomic<uint64_t> counter(0);
+        std::random_device device;
+        uint64_t const salt = (static_cast<uint64_t>(device()) << 32) ^ device() ^ counter.fetch_add(1);
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), ".%016llx.tmp", static_cast<unsigned long long>(salt));
+        std::filesystem::path tmp = path;
+        tmp += suffix;
+        return tmp;
+    }
+
+    source_stamp stamp(std::filesystem::path const& source)
+    {
+        source_stamp current;
+        file_stamp(source, current.size, current.time);
+
+        // the bounds come from the sidecar, so it is part of the stamp as well
+        std::filesystem::path sidecar = source;
+        file_stamp(sidecar.replace_extension(".json"), current.sidecar_size, current.sidecar_time);
+        return current;
+    }
+
+    void stamp(header& hdr, std::filesystem::path const& source)
+    {
+        source_stamp const current = stamp(source);
+        hdr.source_size = current.size;
+        hdr.source_time = current.time;
+        hdr.sidecar_size = current.sidecar_size;
+        hdr.sidecar_time = current.sidecar_time;
+    }
+
+    bool is_current(header const& hdr, std::filesystem::path const& source)
+    {
+        source_stamp const current = stamp(source);
+        return hdr.source_size == current.size && hdr.source_time == current.time
+            && hdr.sidecar_size == current.sidecar_size && hdr.sidecar_time == current.sidecar_time;
+    }
+
+    header const* validate(mapped_file const& file)
+    {
+        if (!file.is_open() || file.size() < sizeof(header)) { return nullptr; }
+
+        header const* hdr = reinterpret_cast<header const*>(file.data());
+        if (std::memcmp(hdr->magic, c_magic, sizeof(c_magic)) != 0 || hdr->version != c_version) { return nullptr; }
+
+        if (hdr->payload_offset % c_payload_alignment != 0 || hdr->payload_offset > file.size()) { return nullptr; }
+
+        // a corrupt header can hold dimensions whose payload size wraps around, so every step is checked
+        uint64_t cols = hdr->width;
+        uint64_t rows = hdr->height;
+        if (hdr->tile_size != 0)
+        {
+            uint64_t const tile = hdr->tile_size;
+            if (!multiply(cols / tile + ((cols % tile != 0) ? 1 : 0), tile, cols)) { return nullptr; }
+            if (!multiply(rows / tile + ((rows % tile != 0) ? 1 : 0), tile, rows)) { return nullptr; }
+        }
+        uint64_t count = 0;
+        uint64_t payload_size = 0;
+        if (!multiply(cols, rows, count) || !multiply(count, sizeof(float), payload_size)) { return nullptr; }
+        if (payload_size > file.size() - hdr->payload_offset) { return nullptr; }
+
+        return hdr;
+    }
+
+    bool write(std::filesystem::path const& path, header const& hdr, float const* values)
+    {
+        header out = hdr;
+        std::memcpy(out.magic, c_magic, sizeof(c_magic));
+        out.version = c_version;
+        out.payload_offset = c_payload_alignment;
+
+        std::filesystem::path const tmp = temp_path(path);
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            if (!ofs) { return false; }
+
+            std::vector<char> padding(out.payload_offset, 0);
+            std::memcpy(padding.data(), &out, sizeof(header));
+            ofs.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+            ofs.write(reinterpret_cast<char const*>(values), static_cast<std::streamsize>(sizeof(float) * payload_count(out)));
+            if (!ofs) { return false; }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    row_writer::row_writer(std::filesystem::path const& path, header const& hdr) :
+        m_path(path),
+        m_tmp(temp_path(path)),
+        m_header(hdr),
+        m_min(std::numeric_limits<float>::infinity()),
+        m_max(-std::numeric_limits<float>::infinity())
+    {
+        std::memcpy(m_header.magic, c_magic, sizeof(c_magic));
+        m_header.version = c_version;
+        m_header.tile_size = 0;
+        m_header.payload_offset = c_payload_alignment;
+
+        // the header is rewritten by finish once the range is known
+        m_stream.open(m_tmp, std::ios::binary | std::ios::trunc);
+        std::vector<char> padding(m_header.payload_offset, 0);
+        m_stream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    }
+
+    row_writer::~row_writer()
+    {
+        // an unfinished file never replaces the destination
+        if (m_stream.is_open())
+        {
+            m_stream.close();
+            std::error_code ec;
+            std::filesystem::remove(m_tmp, ec);
+        }
+    }
+
+    bool row_writer::write_rows(float const* values, size_t count)
+    {
+        if (!is_open() || m_rows + count > m_header.height) { return false; }
+
+        size_t const n = count * static_cast<size_t>(m_header.width);
+        for (size_t k = 0; k < n; ++k)
+        {
+            // NaN (no data) is left out of the range
+            if (values[k] < m_min) { m_min = values[k]; }
+            if (values[k] > m_max) { m_max = values[k]; }
+        }
+        m_stream.write(reinterpret_cast<char const*>(values), static_cast<std::streamsize>(sizeof(float) * n));
+        m_rows += count;
+        return is_open();
+    }
+
+    bool row_writer::finish()
+    {
+        if (!is_open() || m_rows != m_header.height) { return false; }
+
+        m_header.range[0] = (m_min <= m_max) ? m_min : 0.f;
+        m_header.range[1] = (m_min <= m_max) ? m_max : 0.f;
+        m_stream.seekp(0);
+        m_stream.write(reinterpret_cast<char const*>(&m_header), sizeof(header));
+        m_stream.close();
+        if (m_stream.fail())
+        {
+            std::error_code ec;
+            std::filesystem::remove(m_tmp, ec);
+            return false;
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(m_tmp, m_path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(m_tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t payload_count(header const& hdr)
+    {
+        if (hdr.tile_size == 0)
+        {
+            return hdr.width * hdr.height;
+        }
+        else
+        {
+            uint64_t tiles_x = (hdr.width + hdr.tile_size - 1) / hdr.tile_size;
+            uint64_t tiles_y = (hdr.height + hdr.tile_size - 1) / hdr.tile_size;
+            return tiles_x * tiles_y * hdr.tile_size * hdr.tile_size;
+        }
+    }
+
+}
@@ -0,0 +1,118 @@
+#include "hillshader/dem_loader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+
+namespace hillshader
+{
+
+    static constexpr float c_min_meters_per_quad = 5.0;
+
+    static size_t mesh_resolution(terrain const& terrain)
+    {
+        stff::vec2 const& diagonal = terrain.bounds().diagonal();
+        float meters_per_pixel = std::max(diagonal.x / terrain.width(), diagonal.y / terrain.height());
+        float meters_per_quad = std::max(meters_per_pixel, c_min_meters_per_quad);
+        size_t threshold = static_cast<size_t>(std::min(diagonal.x / meters_per_quad, diagonal.y / meters_per_quad));
+        return std::min(threshold, std::max(terrain.width(), terrain.height()));
+    }
+
+    dem_loader::dem_loader(std::string const& path, terrain::options const& opts) :
+        m_path(path),
+        m_options(opts),
+        m_stage(stage::decoding),
+        m_thread(&dem_loader::run, this)
+    {}
+
+    dem_loader::dem_loader(std::shared_ptr<paged_terrain const> pages, stff::aabb2 const& area, size_t posts, terrain::options const& opts) :
+        m_path(pages->root().string()),
+        m_options(opts),
+        m_pages(std::move(pages)),
+        m_area(area),
+        m_posts(posts),
+        m_stage(stage::decoding),
+        m_thread(&dem_loader::run, this)
+    {}
+
+    dem_loader::~dem_loader()
+    {
+        cancel();
+        m_thread.join();
+    }
+
+    dem_loader::result dem_loader::take()
+    {
+        return std::move(m_result);
+    }
+
+    void dem_loader::run()
+    {
+        // an exception escaping the loader's thread would terminate the application, so a throwing load is treated
+        // like any other failed load: the result has no dem and the application keeps the current one
+        try
+        {
+            load();
+        }
+        catch (std::exception const&)
+        {
+            m_result = result();
+        }
+
+        m_stage.store(stage::ready, std::memory_order_release);
+    }
+
+    void dem_loader::load()
+    {
+        m_result.path = m_path;
+        m_result.options = m_options;
+        m_result.snapshot = m_pages != nullptr;
+
+        std::unique_ptr<terrain> loaded;
+        if (m_pages)
+        {
+            // posts along the longer side of the area, keeping them square
+            stff::vec2 const diagonal = m_area.diagonal();
+            float const spacing = std::max(diagonal.x, diagonal.y) / static_cast<float>(std::max<size_t>(m_posts, 2));
+            size_t const width = std::max<size_t>(2, static_cast<size_t>(std::ceil(diagonal.x / spacing)));
+            size_t const height = std::max<size_t>(2, static_cast<size_t>(std::ceil(diagonal.y / spacing)));
+            loaded = std::make_unique<terrain>(*m_pages, m_area, width, height, m_options, &m_progress);
+        }
+        else
+        {
+            m_result.stamp = dem_file::stamp(m_path);
+            loaded = std::make_unique<terrain>(m_path, m_options, &m_progress);
+        }
+
+        if (!loaded->empty() && !cancelled())
+        {
+            m_stage.store(stage::meshing, std::memory_order_release);
+
+            size_t resolution = mesh_resolution(*loaded);
+            m_result.vertices = mesh::vertices(resolution);
+            m_result.indices = mesh::index_strip(resolution);
+
+            m_stage.store(stage::mipmapping, std::memory_order_release);
+            m_result.mips = mip_chain(*loaded);
+
+            if (m_options.normals && !cancelled())
+            {
+                m_stage.store(stage::normals, std::memory_order_release);
+                m_result.normals = normal_field(*loaded, m_result.mips);
+            }
+
+            if (m_options.horizons > 0 && !cancelled())
+            {
+                m_stage.store(stage::horizons, std::memory_order_release);
+                m_result.horizons = horizon_field(*loaded, m_options.horizons);
+            }
+            m_result.dem = std::move(loaded);
+        }
+
+        if (cancelled())
+        {
+            m_result = result();
+        }
+    }
+
+}
@@ -0,0 +1,174 @@
+#include "hillshader/hillshade_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/shading.hpp"
+
+namespace hillshader
+{
+
+    hillshade_renderer::hillshade_renderer(terrain const& terrain, mip_chain const& mips, normal_field const* normals, horizon_field const* horizons) :
+        m_terrain(terrain),
+        m_sampler(terrain, mips),
+        m_normals((normals && !normals->empty()) ? normals : nullptr),
+        m_horizons((horizons && !horizons->empty()) ? horizons : nullptr)
+    {}
+
+    hillshade_renderer::view hillshade_renderer::full_view() const
+    {
+        view v;
+        v.bounds = m_terrain.bounds();
+        v.width = m_terrain.width();
+        v.height = m_terrain.height();
+        return v;
+    }
+
+    void hillshade_renderer::render(view const& v, lighting const& l, uint8_t* rgba, normal_buffer* normals) const
+    {
+        if (v.width == 0 || v.height == 0 || m_terrain.empty()) { return; }
+
+        if (normals)
+        {
+            normals->resize(v.width, v.height);
+            normals->theta = stff::constants::half_pi;
+            normals->horizons = m_horizons;
+        }
+
+        stff::vec2 const terrain_size = m_terrain.bounds().diagonal();
+        stff::vec2 const view_size = v.bounds.diagonal();
+
+        // uv of the first pixel center and the uv step between pixels
+        float const du = view_size.x / static_cast<float>(v.width) / terrain_size.x;
+        float const dv = view_size.y / static_cast<float>(v.height) / terrain_size.y;
+        float const u0 = (v.bounds.min.x - m_terrain.bounds().min.x) / terrain_size.x + 0.5f * du;
+        float const v0 = (m_terrain.bounds().max.y - v.bounds.max.y) / terrain_size.y + 0.5f * dv;
+
+        // tap spacing and level of detail (compute_delta_uv and normal_at in the shader). an orthographic view has
+        // the same spacing at every pixel
+        float const spacing = (v.tap_spacing > 0.f) ? v.tap_spacing : view_size.x / static_cast<float>(v.width);
+        float const delta_uv = std::max(0.5f / static_cast<float>(m_terrain.width()), spacing / terrain_size.x);
+        float const lod = std::max(0.f, std::log2(delta_uv * static_cast<float>(m_terrain.width())));
+        float const delta_world = delta_uv * terrain_size.x;
+
+        shading::light_set const lights = shading::resolve(l);
+        horizon_field::suns const suns = (m_horizons) ? m_horizons->positions(lights) : horizon_field::suns();
+
+        parallel::for_each_chunk(0, v.height, [&](size_t begin, size_t end, size_t)
+        {
+            std::vector<float> intensities(v.width);
+            for (size_t row = begin; row < end; ++row)
+            {
+                float const pv = v0 + static_cast<float>(row) * dv;
+
+                size_t i = 0;
+#if defined(HILLSHADER_AVX2)
+                __m256 const lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+                __m256 const step = _mm256_set1_ps(du);
+                __m256 const start = _mm256_set1_ps(u0);
+                __m256 const center_v = _mm256_set1_ps(pv);
+                __m256 const delta = _mm256_set1_ps(delta_uv);
+                __m256 const exaggeration = _mm256_set1_ps(l.exaggeration);
+                __m256 const tap_z = _mm256_set1_ps(2.f * delta_world);
+                __m256 const light_x = _mm256_set1_ps(lights.combined.x);
+                __m256 const light_y = _mm256_set1_ps(lights.combined.y);
+                __m256 const light_z = _mm256_set1_ps(lights.combined.z);
+                __m256 const weight = _mm256_set1_ps(lights.weight);
+                __m256 const half = _mm256_set1_ps(0.5f);
+                __m256 const ambient = _mm256_set1_ps(l.ambient_intensity);
+                __m256 const diffuse = _mm256_set1_ps(1.f - l.ambient_intensity);
+                __m256 const lod_lanes = _mm256_set1_ps(lod);
+                for (; i + 8 <= v.width; i += 8)
+                {
+                    __m256 const pu = _mm256_fmadd_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes), step, start);
+                    __m256 nx, ny, nz;
+                    if (m_normals)
+                    {
+                        m_normals->sample(pu, center_v, lod, nx, ny, nz);
+                    }
+                    else
+                    {
+                        __m256 const east = m_sampler.sample(_mm256_add_ps(pu, delta), center_v, lod);
+                        __m256 const west = m_sampler.sample(_mm256_sub_ps(pu, delta), center_v, lod);
+                        __m256 const north = m_sampler.sample(pu, _mm256_sub_ps(center_v, delta), lod);
+                        __m256 const south = m_sampler.sample(pu, _mm256_add_ps(center_v, delta), lod);
+                        nx = _mm256_sub_ps(west, east);
+                        ny = _mm256_sub_ps(south, north);
+                        nz = tap_z;
+                    }
+
+                    if (m_horizons)
+                    {
+                        // shadows and sky view are sampled one pixel at a time
+                        alignas(32) float lane_u[8], lane_x[8], lane_y[8], lane_z[8];
+                        _mm256_store_ps(lane_u, pu);
+                        _mm256_store_ps(lane_x, nx);
+                        _mm256_store_ps(lane_y, ny);
+                        _mm256_store_ps(lane_z, nz);
+                        for (size_t k = 0; k < 8; ++k)
+                        {
+                            float lit[shading::c_max_lights];
+                            float const sky = m_horizons->occlusion(suns, lights.count, lane_u[k], pv, lod, l, lit);
+                            stff::vec3 const normal(lane_x[k], lane_y[k], lane_z[k]);
+                            intensities[i + k] = shading::intensity(lights, l.ambient_intensity, normal, l.exaggeration, lit, sky);
+                        }
+                    }
+                    else
+                    {
+                        __m256 const x = _mm256_mul_ps(exaggeration, nx);
+                        __m256 const y = _mm256_mul_ps(exaggeration, ny);
+                        __m256 const length = _mm256_sqrt_ps(_mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(nz, nz))));
+                        __m256 const dot = _mm256_fmadd_ps(x, light_x, _mm256_fmadd_ps(y, light_y, _mm256_mul_ps(nz, light_z)));
+                        __m256 const strength = _mm256_mul_ps(half, _mm256_sub_ps(weight, _mm256_div_ps(dot, length)));
+                        _mm256_storeu_ps(intensities.data() + i, _mm256_fmadd_ps(diffuse, strength, ambient));
+                    }
+
+                    if (normals)
+                    {
+                        size_t const index = row * v.width + i;
+                        _mm256_storeu_ps(normals->x() + index, nx);
+                        _mm256_storeu_ps(normals->y() + index, ny);
+                        _mm256_storeu_ps(normals->z() + index, nz);
+                        _mm256_storeu_ps(normals->u() + index, pu);
+                        _mm256_storeu_ps(normals->v() + index, center_v);
+                        _mm256_storeu_ps(normals->lod() + index, lod_lanes);
+                    }
+                }
+#endif
+                for (; i < v.width; ++i)
+                {
+                    float const pu = u0 + static_cast<float>(i) * du;
+                    stff::vec3 normal;
+                    if (m_normals)
+                    {
+                        normal = m_normals->sample(pu, pv, lod);
+                    }
+                    else
+                    {
+                        float const east = m_sampler.sample(pu + delta_uv, pv, lod);
+                        float const west = m_sampler.sample(pu - delta_uv, pv, lod);
+                        float const north = m_sampler.sample(pu, pv - delta_uv, lod);
+                        float const south = m_sampler.sample(pu, pv + delta_uv, lod);
+                        normal = shading::normal(east, west, north, south, delta_world);
+                    }
+                    if (m_horizons)
+                    {
+                        float lit[shading::c_max_lights];
+                        float const sky = m_horizons->occlusion(suns, lights.count, pu, pv, lod, l, lit);
+                        intensities[i] = shading::intensity(lights, l.ambient_intensity, normal, l.exaggeration, lit, sky);
+                    }
+                    else
+                    {
+                        intensities[i] = shading::intensity(lights, l.ambient_intensity, normal, l.exaggeration);
+                    }
+                    if (normals) { normals->store(row * v.width + i, normal, pu, pv, lod); }
+                }
+
+                shading::encode_row(intensities.data(), v.width, l.albedo, rgba + 4 * v.width * row);
+            }
+        });
+    }
+
+}
@@ -0,0 +1,360 @@
+#include "hillshader/horizon_field.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "hillshader/parallel.hpp"
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        constexpr float c_unorm_max = 65535.f;
+
+        // distance along the sweep direction (meters) and elevation of a post on the hull
+        struct hull_point
+        {
+            double s;
+            double z;
+        };
+
+        // horizon tangents (rise over run, clamped at 0) of every post toward an azimuth. the grid is tiled by digital
+        // lines with one post per step along the major axis of the direction, and each line is walked from the end the
+        // direction points to. the upper convex hull of the posts already walked holds every candidate horizon: the
+        // tangent from a new post touches the hull at its top once the hull points below the line to their
+        // predecessor are popped, and those points can never be the horizon of a later post either
+        void sweep(terrain const& terrain, std::vector<float> const& elevations, float azimuth, std::vector<float>& tangents)
+        {
+            size_t const width = terrain.width();
+            size_t const height = terrain.height();
+            stff::vec2 const size = terrain.bounds().diagonal();
+            double const sx = static_cast<double>(size.x) / static_cast<double>(width);
+            double const sy = static_cast<double>(size.y) / static_cast<double>(height);
+
+            // direction in texel space (columns increase to the east and rows to the south)
+            double const radians = stf::math::to_radians(static_cast<double>(azimuth));
+            double const di = std::sin(radians) / sx;
+            double const dj = -std::cos(radians) / sy;
+
+            bool const x_major = std::abs(di) >= std::abs(dj);
+            size_t const major_count = (x_major) ? width : height;
+            long const minor_count = static_cast<long>((x_major) ? height : width);
+            double const d_major = (x_major) ? di : dj;
+            double const d_minor = (x_major) ? dj : di;
+
+            // walking against the direction, each step moves one post along the major axis and slope posts along the
+            // minor axis, which covers step meters of the direction
+            double const slope = -d_minor / std::abs(d_major);
+            double const step = (x_major) ? std::hypot(sx, slope * sy) : std::hypot(sy, slope * sx);
+
+            // line k visits minor index k + offsets[m] at step m, so these lines cover every post exactly once
+            std::vector<long> offsets(major_count);
+            for (size_t m = 0; m < major_count; ++m) { offsets[m] = std::lround(slope * static_cast<double>(m)); }
+            long const last = offsets.back();
+            long const k_min = -std::max(0L, last);
+            long const k_max = minor_count - 1 - std::min(0L, last);
+
+            parallel::for_each_chunk(0, static_cast<size_t>(k_max - k_min + 1), [&](size_t begin, size_t end, size_t)
+            {
+                std::vector<hull_point> hull;
+                hull.reserve(major_count);
+                for (size_t line = begin; line < end; ++line)
+                {
+                    long const k = k_min + static_cast<long>(line);
+                    hull.clear();
+                    for (size_t m = 0; m < major_count; ++m)
+                    {
+                        long const minor = k + offsets[m];
+                        if (minor < 0 || minor >= minor_count)
+                        {
+                            // the minor index is monotonic, so a line that has left the grid does not come back
+                            if (hull.empty()) { continue; } else { break; }
+                        }
+
+                        size_t const major = (d_major > 0.0) ? major_count - 1 - m : m;
+                        size_t const i = (x_major) ? major : static_cast<size_t>(minor);
+                        size_t const j = (x_major) ? static_cast<size_t>(minor) : major;
+                        hull_point const q = { -static_cast<double>(m) * step, static_cast<double>(elevations[j * width + i]) };
+
+                        // pop the top while it sits on or below the line from q to the point before it
+                        while (hull.size() >= 2)
+                        {
+                            hull_point const& a = hull[hull.size() - 2];
+                            hull_point const& b = hull.back();
+                            if ((b.z - q.z) * (a.s - q.s) > (a.z - q.z) * (b.s - q.s)) { break; }
+                            hull.pop_back();
+                        }
+
+                        double const tangent = (hull.empty()) ? 0.0 : (hull.back().z - q.z) / (hull.back().s - q.s);
+                        tangents[j * width + i] = static_cast<float>(std::max(0.0, tangent));
+                        hull.push_back(q);
+                    }
+                }
+            });
+        }
+
+        inline uint16_t to_unorm(float value)
+        {
+            return static_cast<uint16_t>(std::clamp(value, 0.f, 1.f) * c_unorm_max + 0.5f);
+        }
+
+        inline float from_unorm(uint16_t value)
+        {
+            return static_cast<float>(value) * (1.f / c_unorm_max);
+        }
+
+        // destination texel k covers the source interval [k * n / m, (k + 1) * n / m) (the filter of mip_chain)
+        std::vector<std::vector<std::pair<size_t, float>>> taps(size_t n, size_t m)
+        {
+            double const ratio = static_cast<double>(n) / static_cast<double>(m);
+            std::vector<std::vector<std::pair<size_t, float>>> result(m);
+            for (size_t k = 0; k < m; ++k)
+            {
+                double const lo = k * ratio;
+                double const hi = (k + 1) * ratio;
+                for (size_t s = static_cast<size_t>(lo); s < std::min(n, static_cast<size_t>(std::ceil(hi))); ++s)
+                {
+                    double const overlap = std::min(hi, s + 1.0) - std::max(lo, static_cast<double>(s));
+                    if (overlap > 0.0) { result[k].emplace_back(s, static_cast<float>(overlap / ratio)); }
+                }
+            }
+            return result;
+        }
+
+        horizon_field::level downsample(horizon_field::level const& above, size_t layers)
+        {
+            horizon_field::level next;
+            next.width = std::max<size_t>(1, above.width >> 1);
+            next.height = std::max<size_t>(1, above.height >> 1);
+            next.values.resize(layers * next.width * next.height);
+
+            auto const x_taps = taps(above.width, next.width);
+            auto const y_taps = taps(above.height, next.height);
+            parallel::for_each_chunk(0, layers * next.height, [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t row = begin; row < end; ++row)
+                {
+                    size_t const layer = row / next.height;
+                    size_t const j = row % next.height;
+                    uint16_t const* src = above.values.data() + layer * above.width * above.height;
+                    uint16_t* dst = next.values.data() + row * next.width;
+                    for (size_t i = 0; i < next.width; ++i)
+                    {
+                        float sum = 0.f;
+                        for (auto const& [y, wy] : y_taps[j])
+                        {
+                            for (auto const& [x, wx] : x_taps[i]) { sum += wx * wy * from_unorm(src[y * above.width + x]); }
+                        }
+                        dst[i] = to_unorm(sum);
+                    }
+                }
+            });
+            return next;
+        }
+
+    }
+
+    horizon_field::horizon_field(terrain const& terrain, size_t directions) : m_directions(directions)
+    {
+        if (terrain.empty() || directions == 0) { m_directions = 0; return; }
+
+        size_t const posts = terrain.width() * terrain.height();
+        level base;
+        base.width = terrain.width();
+        base.height = terrain.height();
+        base.values.resize(layers() * posts);
+
+        // the sweeps read the posts along arbitrary lines, so they read a row-major copy of the terrain
+        std::vector<float> elevations(posts);
+        parallel::for_each_chunk(0, terrain.height(), [&](size_t begin, size_t end, size_t)
+        {
+            terrain.copy_rows(begin, end, elevations.data() + begin * terrain.width());
+        });
+
+        // layers store the sine of the horizon angle, so the sky-view factor is one minus the mean of the layers
+        std::vector<float> tangents(posts);
+        std::vector<float> occluded(posts, 0.f);
+        for (size_t d = 0; d < directions; ++d)
+        {
+            sweep(terrain, elevations, 360.f * static_cast<float>(d) / static_cast<float>(directions), tangents);
+            uint16_t* layer = base.values.data() + d * posts;
+            parallel::for_each_chunk(0, posts, [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t k = begin; k < end; ++k)
+                {
+                    float const t = tangents[k];
+                    float const sine = t / std::sqrt(1.f + t * t);
+                    layer[k] = to_unorm(sine);
+                    occluded[k] += sine;
+                }
+            });
+        }
+
+        uint16_t* sky = base.values.data() + directions * posts;
+        float const inv_directions = 1.f / static_cast<float>(directions);
+        parallel::for_each_chunk(0, posts, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t k = begin; k < end; ++k) { sky[k] = to_unorm(1.f - occluded[k] * inv_directions); }
+        });
+
+        m_levels.push_back(std::move(base));
+        while (m_levels.back().width > 1 || m_levels.back().height > 1)
+        {
+            m_levels.push_back(downsample(m_levels.back(), layers()));
+        }
+    }
+
+    size_t horizon_field::bytes() const
+    {
+        size_t total = 0;
+        for (level const& lvl : m_levels) { total += sizeof(uint16_t) * lvl.values.size(); }
+        return total;
+    }
+
+    horizon_field::sun horizon_field::position(float azimuth, float altitude) const
+    {
+        sun s;
+        if (empty()) { return s; }
+
+        float const turns = azimuth / 360.f;
+        float const layer = (turns - std::floor(turns)) * static_cast<float>(m_directions);
+        s.layer0 = std::min(static_cast<size_t>(layer), m_directions - 1);
+        s.layer1 = (s.layer0 + 1) % m_directions;
+        s.blend = layer - static_cast<float>(s.layer0);
+        float const radians = stf::math::to_radians(altitude);
+        s.sine = std::sin(radians);
+        s.inv_penumbra = 1.f / (c_penumbra * std::max(std::cos(radians), c_penumbra));
+        return s;
+    }
+
+    horizon_field::suns horizon_field::positions(shading::light_set const& lights) const
+    {
+        suns positioned;
+        for (size_t i = 0; i < lights.count; ++i)
+        {
+            positioned[i] = position(lights.lights[i].azimuth, lights.lights[i].altitude);
+        }
+        return positioned;
+    }
+
+    float horizon_field::visibility(sun const& s, float sine, float exaggeration)
+    {
+        // scaling elevations scales the tangent of the horizon angle. the sun's altitude is compared in sine space,
+        // where the penumbra is c_penumbra times the cosine of the altitude wide
+        float const scaled = exaggeration * sine;
+        float const exaggerated = scaled / std::sqrt(std::max(1e-12f, 1.f - sine * sine + scaled * scaled));
+        return std::clamp((s.sine - exaggerated) * s.inv_penumbra + 0.5f, 0.f, 1.f);
+    }
+
+    float horizon_field::lit(sun const& s, float u, float v, float lod, float exaggeration) const
+    {
+        lookup const l = locate(u, v, lod);
+        return visibility(s, stf::math::lerp(sample(l, s.layer0), sample(l, s.layer1), s.blend), exaggeration);
+    }
+
+    float horizon_field::sky_view(float u, float v, float lod) const
+    {
+        return sample(locate(u, v, lod), m_directions);
+    }
+
+    float horizon_field::occlusion(suns const& positioned, size_t count, float u, float v, float lod, shading::lighting const& l, float* lit) const
+    {
+        // one lookup serves the horizon layers of every sun and the sky view layer
+        lookup const found = locate(u, v, lod);
+        for (size_t i = 0; i < count; ++i)
+        {
+            float visible = 1.f;
+            if (l.shadows > 0.f)
+            {
+                sun const& s = positioned[i];
+                float const horizon = stf::math::lerp(sample(found, s.layer0), sample(found, s.layer1), s.blend);
+                visible = visibility(s, horizon, l.exaggeration);
+            }
+            lit[i] = stf::math::lerp(1.f, visible, l.shadows);
+        }
+        float const sky = (l.sky_view > 0.f) ? sample(found, m_directions) : 1.f;
+        return stf::math::lerp(1.f, sky, l.sky_view);
+    }
+
+    void horizon_field::shadow_mask(float azimuth, float altitude, float exaggeration, uint8_t* mask) const
+    {
+        if (empty()) { return; }
+
+        level const& base = m_levels.front();
+        size_t const posts = base.width * base.height;
+        sun const s = position(azimuth, altitude);
+        uint16_t const* layer0 = base.values.data() + s.layer0 * posts;
+        uint16_t const* layer1 = base.values.data() + s.layer1 * posts;
+        parallel::for_each_chunk(0, posts, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t k = begin; k < end; ++k)
+            {
+                float const h = stf::math::lerp(from_unorm(layer0[k]), from_unorm(layer1[k]), s.blend);
+                float const visible = visibility(s, h, exaggeration);
+                mask[k] = static_cast<uint8_t>(255.f * visible + 0.5f);
+            }
+        });
+    }
+
+    horizon_field::footprint horizon_field::locate(size_t index, float u, float v) const
+    {
+        level const& lvl = m_levels[index];
+        float const w = static_cast<float>(lvl.width);
+        float const h = static_cast<float>(lvl.height);
+
+        // same addressing as terrain_sampler
+        float const x = std::clamp(u * w - 0.5f, -1.f, w);
+        float const y = std::clamp(v * h - 0.5f, -1.f, h);
+        float const fx = std::floor(x);
+        float const fy = std::floor(y);
+
+        int const last_i = static_cast<int>(lvl.width) - 1;
+        int const last_j = static_cast<int>(lvl.height) - 1;
+        int const i = static_cast<int>(fx);
+        int const j = static_cast<int>(fy);
+        size_t const i0 = static_cast<size_t>(std::clamp(i, 0, last_i));
+        size_t const i1 = static_cast<size_t>(std::clamp(i + 1, 0, last_i));
+        size_t const j0 = static_cast<size_t>(std::clamp(j, 0, last_j));
+        size_t const j1 = static_cast<size_t>(std::clamp(j + 1, 0, last_j));
+
+        footprint f;
+        f.values = lvl.values.data();
+        f.layer_size = lvl.width * lvl.height;
+        f.offsets[0] = j0 * lvl.width + i0;
+        f.offsets[1] = j0 * lvl.width + i1;
+        f.offsets[2] = j1 * lvl.width + i0;
+        f.offsets[3] = j1 * lvl.width + i1;
+        f.s = x - fx;
+        f.t = y - fy;
+        return f;
+    }
+
+    horizon_field::lookup horizon_field::locate(float u, float v, float lod) const
+    {
+        float const clamped = std::clamp(lod, 0.f, static_cast<float>(m_levels.size() - 1));
+        size_t const index = static_cast<size_t>(clamped);
+
+        lookup l;
+        l.blend = clamped - static_cast<float>(index);
+        l.fine = locate(index, u, v);
+        if (l.blend > 0.f) { l.coarse = locate(index + 1, u, v); }
+        return l;
+    }
+
+    float horizon_field::sample(lookup const& l, size_t layer) const
+    {
+        auto filter = [layer](footprint const& f)
+        {
+            uint16_t const* values = f.values + layer * f.layer_size;
+            float const top = stf::math::lerp(from_unorm(values[f.offsets[0]]), from_unorm(values[f.offsets[1]]), f.s);
+            float const bottom = stf::math::lerp(from_unorm(values[f.offsets[2]]), from_unorm(values[f.offsets[3]]), f.s);
+            return stf::math::lerp(top, bottom, f.t);
+        };
+        float const fine = filter(l.fine);
+        return (l.blend > 0.f) ? stf::math::lerp(fine, filter(l.coarse), l.blend) : fine;
+    }
+
+}
@@ -9,6 +9,7 @@
 #include "hillshader/camera/controllers/animators/animator.hpp"
 #include "hillshader/camera/controllers/animators/orbit.hpp"
 #include "hillshader/camera/controllers/animators/zoom.hpp"
+#include "hillshader/simd.hpp"
 
 static std::unique_ptr<hillshader::application> s_app = nullptr;
 
@@ -148,6 +149,12 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+    if (!hillshader::simd::supported())
+    {
+        MessageBox(NULL, "This build requires a CPU with AVX2 and FMA", "Error", MB_OK | MB_ICONERROR);
+        return 0;
+    }
+
     // register window
     WNDCLASSEX wcex = { sizeof(WNDCLASSEX), CS_HREDRAW | CS_VREDRAW, MessageProc, 0L, 0L, hInstance, NULL, NULL, NULL, NULL, "Hillshade", NULL };
     RegisterClassEx(&wcex);
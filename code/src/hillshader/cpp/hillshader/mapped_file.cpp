@@ -0,0 +1,110 @@
+#include "hillshader/mapped_file.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace hillshader
+{
+
+    mapped_file::mapped_file(std::filesystem::path const& path)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) { return; }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return;
+        }
+
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+        {
+            CloseHandle(file);
+            return;
+        }
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view)
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return;
+        }
+
+        m_file = file;
+        m_mapping = mapping;
+        m_data = static_cast<std::byte const*>(view);
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { return; }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return;
+        }
+
+        void* view = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);    // the mapping keeps its own reference to the file
+        if (view == MAP_FAILED) { return; }
+
+        m_data = static_cast<std::byte const*>(view);
+        m_size = static_cast<size_t>(info.st_size);
+#endif
+    }
+
+    mapped_file::~mapped_file()
+    {
+        close();
+    }
+
+    mapped_file::mapped_file(mapped_file&& rhs) noexcept
+    {
+        *this = std::move(rhs);
+    }
+
+    mapped_file& mapped_file::operator=(mapped_file&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            close();
+            std::swap(m_data, rhs.m_data);
+            std::swap(m_size, rhs.m_size);
+#if defined(_WIN32)
+            std::swap(m_file, rhs.m_file);
+            std::swap(m_mapping, rhs.m_mapping);
+#endif
+        }
+        return *this;
+    }
+
+    void mapped_file::close()
+    {
+#if defined(_WIN32)
+        if (m_data) { UnmapViewOfFile(m_data); }
+        if (m_mapping) { CloseHandle(m_mapping); }
+        if (m_file) { CloseHandle(m_file); }
+        m_mapping = nullptr;
+        m_file = nullptr;
+#else
+        if (m_data) { ::munmap(const_cast<std::byte*>(m_data), m_size); }
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+}
@@ -0,0 +1,50 @@
+#include "hillshader/memory.hpp"
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <Windows.h>
+    #include <Psapi.h>
+#else
+    #include <cstdio>
+    #include <sys/resource.h>
+    #include <unistd.h>
+#endif
+
+namespace hillshader::memory
+{
+
+    size_t resident_bytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+        return counters.WorkingSetSize;
+#else
+        // the second field of statm is the resident set in pages
+        FILE* file = std::fopen("/proc/self/statm", "r");
+        if (!file) { return 0; }
+        unsigned long long size = 0, resident = 0;
+        int const read = std::fscanf(file, "%llu %llu", &size, &resident);
+        std::fclose(file);
+        return (read == 2) ? static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+    }
+
+    size_t peak_resident_bytes()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+    #if defined(__APPLE__)
+        return static_cast<size_t>(usage.ru_maxrss);            // bytes on macOS
+    #else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;     // kilobytes elsewhere
+    #endif
+#endif
+    }
+
+}
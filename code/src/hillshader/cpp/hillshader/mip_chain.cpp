@@ -0,0 +1,142 @@
+#include "hillshader/mip_chain.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        // contribution of a source texel to a destination texel along one axis
+        struct tap
+        {
+            size_t index;
+            float weight;
+        };
+
+        // destination texel k covers the source interval [k * n / m, (k + 1) * n / m). with m = max(1, n / 2) each
+        // destination texel covers at most three source texels
+        std::vector<std::vector<tap>> taps(size_t n, size_t m)
+        {
+            double const ratio = static_cast<double>(n) / static_cast<double>(m);
+            std::vector<std::vector<tap>> result(m);
+            for (size_t k = 0; k < m; ++k)
+            {
+                double const lo = k * ratio;
+                double const hi = (k + 1) * ratio;
+                for (size_t s = static_cast<size_t>(lo); s < std::min(n, static_cast<size_t>(std::ceil(hi))); ++s)
+                {
+                    double const overlap = std::min(hi, s + 1.0) - std::max(lo, static_cast<double>(s));
+                    if (overlap > 0.0)
+                    {
+                        result[k].push_back({ s, static_cast<float>(overlap / ratio) });
+                    }
+                }
+            }
+            return result;
+        }
+
+        // filters a level of size (w, h) down to the next level. row(j, buffer) returns a pointer to source row j,
+        // either by copying it into buffer or by pointing at stored data
+        template<typename RowFn>
+        mip_chain::level downsample(size_t w, size_t h, RowFn const& row)
+        {
+            mip_chain::level next;
+            next.width = std::max<size_t>(1, w >> 1);
+            next.height = std::max<size_t>(1, h >> 1);
+            next.values.resize(next.width * next.height);
+
+            std::vector<std::vector<tap>> const x_taps = taps(w, next.width);
+            std::vector<std::vector<tap>> const y_taps = taps(h, next.height);
+
+            parallel::for_each_chunk(0, next.height, [&](size_t begin, size_t end, size_t)
+            {
+                std::vector<float> buffer(w);
+                std::vector<float> combined(w);
+                for (size_t j = begin; j < end; ++j)
+                {
+                    // filter vertically into a full-width row and then horizontally into the destination row
+                    std::fill(combined.begin(), combined.end(), 0.f);
+                    for (tap const& y : y_taps[j])
+                    {
+                        float const* src = row(y.index, buffer.data());
+                        for (size_t i = 0; i < w; ++i)
+                        {
+                            combined[i] += y.weight * src[i];
+                        }
+                    }
+
+                    float* dst = next.values.data() + j * next.width;
+                    for (size_t i = 0; i < next.width; ++i)
+                    {
+                        float value = 0.f;
+                        for (tap const& x : x_taps[i])
+                        {
+                            value += x.weight * combined[x.index];
+                        }
+                        dst[i] = value;
+                    }
+                }
+            });
+
+            return next;
+        }
+
+    }
+
+    mip_chain::mip_chain(terrain const& terrain)
+    {
+        if (terrain.empty()) { return; }
+
+        size_t w = terrain.width();
+        size_t h = terrain.height();
+        bool const direct = terrain.values() && terrain.storage().order == ordering::row_major;
+        while (w > 1 || h > 1)
+        {
+            if (m_levels.empty())
+            {
+                // the first level reads the terrain (copying rows that are not stored contiguously)
+                m_levels.push_back(downsample(w, h, [&](size_t j, float* buffer) -> float const*
+                {
+                    if (direct) { return terrain.values() + j * w; }
+                    terrain.copy_rows(j, j + 1, buffer);
+                    return buffer;
+                }));
+            }
+            else
+            {
+                std::vector<float> const& above = m_levels.back().values;
+                m_levels.push_back(downsample(w, h, [&above, w](size_t j, float*) { return above.data() + j * w; }));
+            }
+
+            w = m_levels.back().width;
+            h = m_levels.back().height;
+        }
+
+        // quantized terrains requantize each level once every level has been filtered at full precision
+        if (terrain.is_quantized())
+        {
+            terrain::quantization const& q = terrain.quantization_params();
+            for (level& l : m_levels)
+            {
+                l.quantized_values.resize(l.values.size() + 1, 0);
+                uint16_t* dst = l.quantized_values.data() + 1;
+                parallel::for_each_chunk(0, l.values.size(), [&](size_t begin, size_t end, size_t)
+                {
+                    for (size_t k = begin; k < end; ++k)
+                    {
+                        float const scaled = std::round((l.values[k] - q.offset) / q.scale);
+                        dst[k] = static_cast<uint16_t>(std::clamp(scaled, 0.f, 65535.f));
+                    }
+                });
+                l.values = std::vector<float>();
+            }
+        }
+    }
+
+}
@@ -0,0 +1,423 @@
+#include "hillshader/mosaic.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace
+{
+
+    // clips [t0, t1] to the parameters where origin + t * direction is in [lo, hi]
+    bool clip(float origin, float direction, float lo, float hi, float& t0, float& t1)
+    {
+        if (direction == 0.f)
+        {
+            return lo <= origin && origin <= hi;
+        }
+
+        float a = (lo - origin) / direction;
+        float b = (hi - origin) / direction;
+        t0 = std::max(t0, std::min(a, b));
+        t1 = std::min(t1, std::max(a, b));
+        return t0 <= t1;
+    }
+
+    bool clip(stff::ray3 const& ray, stff::aabb2 const& box, float& t0, float& t1)
+    {
+        return clip(ray.origin.x, ray.direction.x, box.min.x, box.max.x, t0, t1) && clip(ray.origin.y, ray.direction.y, box.min.y, box.max.y, t0, t1);
+    }
+
+}
+
+namespace hillshader
+{
+
+    // number of bisection steps used to refine a crossing found by marching
+    static constexpr size_t c_bisection_steps = 16;
+
+    mosaic::mosaic(std::filesystem::path const& directory) : mosaic(directory, terrain::options()) {}
+
+    mosaic::mosaic(std::filesystem::path const& directory, terrain::options const& opts, size_t capacity) :
+        m_options(opts),
+        m_capacity(capacity)
+    {
+        // read the bounds of every tile that has a sidecar
+        std::vector<std::filesystem::path> paths;
+        std::vector<stfd::aabb2> extents;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+        {
+            std::filesystem::path const& path = it->path();
+            if (path.extension() != ".png") { continue; }
+
+            stfd::vec2 min, max;
+            if (!terrarium::read_sidecar(path, min, max)) { continue; }
+
+            paths.push_back(path);
+            extents.emplace_back(min, max);
+        }
+
+        if (paths.empty()) { return; }
+
+        stfd::vec2 min = extents.front().min;
+        stfd::vec2 max = extents.front().max;
+        for (stfd::aabb2 const& extent : extents)
+        {
+            min = stfd::vec2(std::min(min.x, extent.min.x), std::min(min.y, extent.min.y));
+            max = stfd::vec2(std::max(max.x, extent.max.x), std::max(max.y, extent.max.y));
+        }
+        m_center = 0.5 * (min + max);
+        m_bounds = stff::aabb2((min - m_center).as<float>(), (max - m_center).as<float>());
+
+        // terrain centers each tile on its own bounds, which gives the offset between the frames
+        stfd::vec2 mean_size(0, 0);
+        for (size_t t = 0; t < paths.size(); ++t)
+        {
+            stfd::aabb2 const& extent = extents[t];
+            stfd::vec2 const tile_center = 0.5 * (extent.min + extent.max);
+            m_tiles.push_back({ paths[t], stff::aabb2((extent.min - m_center).as<float>(), (extent.max - m_center).as<float>()), (m_center - tile_center).as<float>() });
+            m_slots.push_back(std::make_unique<slot>());
+            mean_size = mean_size + (extent.max - extent.min);
+        }
+        mean_size = (1.0 / static_cast<double>(paths.size())) * mean_size;
+
+        // size the grid so that a cell is about as large as an average tile
+        stff::vec2 const diagonal = m_bounds.diagonal();
+        m_cells_x = std::max<size_t>(1, static_cast<size_t>(std::ceil(diagonal.x / mean_size.x)));
+        m_cells_y = std::max<size_t>(1, static_cast<size_t>(std::ceil(diagonal.y / mean_size.y)));
+        m_cell_size = stff::vec2(diagonal.x / static_cast<float>(m_cells_x), diagonal.y / static_cast<float>(m_cells_y));
+        m_cells.resize(m_cells_x * m_cells_y);
+        for (size_t t = 0; t < m_tiles.size(); ++t)
+        {
+            stff::aabb2 const& bounds = m_tiles[t].bounds;
+            for (size_t j = cell_y(bounds.min.y); j <= cell_y(bounds.max.y); ++j)
+            {
+                for (size_t i = cell_x(bounds.min.x); i <= cell_x(bounds.max.x); ++i)
+                {
+                    m_cells[i + m_cells_x * j].push_back(static_cast<uint32_t>(t));
+                }
+            }
+        }
+    }
+
+    size_t mosaic::loaded() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_recent.size();
+    }
+
+    size_t mosaic::loads() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_loads;
+    }
+
+    void mosaic::touch(size_t index) const
+    {
+        m_recent.splice(m_recent.begin(), m_recent, m_slots[index]->recent);
+    }
+
+    std::shared_ptr<terrain const> mosaic::load(size_t index) const
+    {
+        slot& s = *m_slots[index];
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (s.dem) { touch(index); return s.dem; }
+        }
+
+        // another query may have decoded the tile while we waited
+        std::lock_guard<std::mutex> loading(s.loading);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (s.dem) { touch(index); return s.dem; }
+        }
+
+        // decode without holding the cache lock so that queries on other tiles carry on
+        std::shared_ptr<terrain const> dem = std::make_shared<terrain const>(m_tiles[index].path, m_options);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s.dem = dem;
+        s.recent = m_recent.insert(m_recent.begin(), index);
+        ++m_loads;
+        while (m_capacity > 0 && m_recent.size() > m_capacity)
+        {
+            // queries still holding the released tile keep it alive until they finish
+            m_slots[m_recent.back()]->dem.reset();
+            m_recent.pop_back();
+        }
+        return dem;
+    }
+
+    terrain const& mosaic::load(size_t index, pin& pinned) const
+    {
+        if (pinned.index != index)
+        {
+            pinned.dem = load(index);
+            pinned.index = index;
+        }
+        return *pinned.dem;
+    }
+
+    std::optional<size_t> mosaic::find(stff::vec2 const& pos) const
+    {
+        if (empty() || !m_bounds.contains(pos)) { return std::nullopt; }
+
+        for (uint32_t index : m_cells[cell_x(pos.x) + m_cells_x * cell_y(pos.y)])
+        {
+            if (m_tiles[index].bounds.contains(pos))
+            {
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<float> mosaic::nearest_post(stff::vec2 const& pos) const
+    {
+        std::optional<size_t> index = find(pos);
+        if (!index) { return std::nullopt; }
+
+        std::shared_ptr<terrain const> const dem = load(*index);
+        if (dem->empty()) { return std::nullopt; }
+
+        stff::vec2 const texel = dem->to_texel(pos + m_tiles[*index].offset);
+        long const i = std::clamp(std::lround(texel.x), 0l, static_cast<long>(dem->width()) - 1);
+        long const j = std::clamp(std::lround(texel.y), 0l, static_cast<long>(dem->height()) - 1);
+        return dem->read(static_cast<size_t>(i), static_cast<size_t>(j));
+    }
+
+    float mosaic::sample_seam(size_t index, stff::vec2 const& texel, pin& pinned) const
+    {
+        terrain const& dem = load(index, pinned);
+        tile const& t = m_tiles[index];
+
+        long const i0 = static_cast<long>(std::floor(texel.x));
+        long const j0 = static_cast<long>(std::floor(texel.y));
+        float const s = texel.x - static_cast<float>(i0);
+        float const u = texel.y - static_cast<float>(j0);
+
+        // posts that fall outside this tile are read from the neighbor that contains them (or clamped to this tile
+        // along the outer edge of the mosaic)
+        stff::vec2 const texel_size(dem.bounds().diagonal().x / static_cast<float>(dem.width()), dem.bounds().diagonal().y / static_cast<float>(dem.height()));
+        auto post = [&](long i, long j)
+        {
+            long const ci = std::clamp(i, 0l, static_cast<long>(dem.width()) - 1);
+            long const cj = std::clamp(j, 0l, static_cast<long>(dem.height()) - 1);
+            if (ci == i && cj == j)
+            {
+                return dem.read(static_cast<size_t>(i), static_cast<size_t>(j));
+            }
+
+            stff::vec2 const local(dem.bounds().min.x + (static_cast<float>(i) + 0.5f) * texel_size.x, dem.bounds().max.y - (static_cast<float>(j) + 0.5f) * texel_size.y);
+            std::optional<float> neighbor = nearest_post(local - t.offset);
+            return (neighbor) ? *neighbor : dem.read(static_cast<size_t>(ci), static_cast<size_t>(cj));
+        };
+
+        float const top = stf::math::lerp(post(i0, j0), post(i0 + 1, j0), s);
+        float const bottom = stf::math::lerp(post(i0, j0 + 1), post(i0 + 1, j0 + 1), s);
+        return stf::math::lerp(top, bottom, u);
+    }
+
+    std::optional<float> mosaic::sample(stff::vec2 const& query) const
+    {
+        pin pinned;
+        return sample(query, pinned);
+    }
+
+    std::optional<float> mosaic::sample(stff::vec2 const& query, pin& pinned) const
+    {
+        std::optional<size_t> index = find(query);
+        if (!index) { return std::nullopt; }
+
+        terrain const& dem = load(*index, pinned);
+        if (dem.empty()) { return std::nullopt; }
+
+        // queries between the outermost posts are interpolated by the tile itself (terrain falls back to the nearest
+        // post on its last row and column, so those are left to the seam interpolation)
+        stff::vec2 const local = query + m_tiles[*index].offset;
+        stff::vec2 const texel = dem.to_texel(local);
+        float const max_x = static_cast<float>(dem.width() - 1);
+        float const max_y = static_cast<float>(dem.height() - 1);
+        if (0.f <= texel.x && texel.x < max_x && 0.f <= texel.y && texel.y < max_y)
+        {
+            return dem.sample(local);
+        }
+        return sample_seam(*index, texel, pinned);
+    }
+
+    void mosaic::sample(stff::vec2 const* queries, float* elevations, size_t count) const
+    {
+        parallel::for_each_chunk(0, count, [&](size_t begin, size_t end, size_t)
+        {
+            pin pinned;
+            for (size_t q = begin; q < end; ++q)
+            {
+                elevations[q] = sample(queries[q], pinned).value_or(std::numeric_limits<float>::quiet_NaN());
+            }
+        });
+    }
+
+    std::optional<float> mosaic::march(stff::ray3 const& ray, float t0, float t1, float step) const
+    {
+        // a gap in the coverage has no surface for the ray to hit
+        pin pinned;
+        auto above = [&](float t)
+        {
+            stff::vec3 const p = ray.origin + t * ray.direction;
+            std::optional<float> const ground = sample(stff::vec2(p.x, p.y), pinned);
+            return (ground) ? p.z - *ground : std::numeric_limits<float>::max();
+        };
+
+        float prev_t = t0;
+        float prev = above(t0);
+        if (prev <= 0.f) { return t0; }
+
+        while (prev_t < t1)
+        {
+            float const t = std::min(t1, prev_t + step);
+            float const current = above(t);
+            if (current <= 0.f)
+            {
+                // refine the crossing between the last two samples
+                float lo = prev_t, hi = t;
+                for (size_t k = 0; k < c_bisection_steps; ++k)
+                {
+                    float const mid = 0.5f * (lo + hi);
+                    if (above(mid) <= 0.f) { hi = mid; } else { lo = mid; }
+                }
+                return hi;
+            }
+            prev_t = t;
+            prev = current;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<stff::vec3> mosaic::intersect(stff::ray3 const& ray) const
+    {
+        float ta = 0.f, tb = std::numeric_limits<float>::max();
+        if (empty() || !clip(ray, m_bounds, ta, tb)) { return std::nullopt; }
+
+        // walk the grid cells under the ray, collecting the tiles they list
+        std::vector<char> seen(m_tiles.size(), 0);
+        std::vector<size_t> touched;
+        {
+            stff::vec3 const entry = ray.origin + ta * ray.direction;
+            long i = static_cast<long>(cell_x(entry.x));
+            long j = static_cast<long>(cell_y(entry.y));
+            long const step_i = (ray.direction.x > 0.f) ? 1 : -1;
+            long const step_j = (ray.direction.y > 0.f) ? 1 : -1;
+
+            auto boundary = [&](float origin, float direction, float min, float size, long cell, long step)
+            {
+                if (direction == 0.f) { return std::numeric_limits<float>::max(); }
+                float const edge = min + size * static_cast<float>(cell + ((step > 0) ? 1 : 0));
+                return (edge - origin) / direction;
+            };
+            float next_x = boundary(ray.origin.x, ray.direction.x, m_bounds.min.x, m_cell_size.x, i, step_i);
+            float next_y = boundary(ray.origin.y, ray.direction.y, m_bounds.min.y, m_cell_size.y, j, step_j);
+            float const delta_x = (ray.direction.x == 0.f) ? std::numeric_limits<float>::max() : m_cell_size.x / std::abs(ray.direction.x);
+            float const delta_y = (ray.direction.y == 0.f) ? std::numeric_limits<float>::max() : m_cell_size.y / std::abs(ray.direction.y);
+
+            while (0 <= i && i < static_cast<long>(m_cells_x) && 0 <= j && j < static_cast<long>(m_cells_y))
+            {
+                for (uint32_t index : m_cells[static_cast<size_t>(i) + m_cells_x * static_cast<size_t>(j)])
+                {
+                    if (!seen[index])
+                    {
+                        seen[index] = 1;
+                        touched.push_back(index);
+                    }
+                }
+
+                if (std::min(next_x, next_y) > tb) { break; }
+                if (next_x < next_y) { next_x += delta_x; i += step_i; }
+                else                 { next_y += delta_y; j += step_j; }
+            }
+        }
+
+        // order the tiles by where the ray enters them
+        struct candidate { float t0; float t1; size_t index; };
+        std::vector<candidate> candidates;
+        for (size_t index : touched)
+        {
+            float t0 = ta, t1 = tb;
+            if (clip(ray, m_tiles[index].bounds, t0, t1))
+            {
+                candidates.push_back({ t0, t1, index });
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](candidate const& lhs, candidate const& rhs) { return lhs.t0 < rhs.t0; });
+
+        float const speed = std::sqrt(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y);
+        std::optional<float> best;
+        for (candidate const& c : candidates)
+        {
+            if (best && *best < c.t0) { break; }
+
+            std::shared_ptr<terrain const> const tile_dem = load(c.index);
+            terrain const& dem = *tile_dem;
+            if (dem.empty()) { continue; }
+
+            tile const& t = m_tiles[c.index];
+            stff::vec3 const offset(t.offset.x, t.offset.y, 0.f);
+            stff::ray3 const local(ray.origin + offset, ray.direction);
+
+            // the interior of the tile is handled by the tile's own intersection
+            std::optional<float> hit;
+            if (std::optional<stff::vec3> point = dem.intersect(local))
+            {
+                stff::vec3 const delta = *point - local.origin;
+                float const dd = ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z;
+                hit = (delta.x * ray.direction.x + delta.y * ray.direction.y + delta.z * ray.direction.z) / dd;
+            }
+
+            // the band between the tile's edge and its outermost posts is marched through sample
+            stff::vec2 const texel_size(dem.bounds().diagonal().x / static_cast<float>(dem.width()), dem.bounds().diagonal().y / static_cast<float>(dem.height()));
+            stff::aabb2 const posts(t.bounds.min + 0.5f * texel_size, t.bounds.max - 0.5f * texel_size);
+            float p0 = c.t0, p1 = c.t1;
+            bool const crosses_posts = clip(ray, posts, p0, p1);
+
+            auto band = [&](float b0, float b1)
+            {
+                if (b1 <= b0) { return; }
+                if (speed <= std::numeric_limits<float>::epsilon())
+                {
+                    // a vertical ray stays within the band for its whole length
+                    std::optional<float> const ground = sample(stff::vec2(ray.origin.x, ray.origin.y));
+                    if (ground && ray.direction.z < 0.f && ray.origin.z >= *ground)
+                    {
+                        float const t_ground = (ray.origin.z - *ground) / -ray.direction.z;
+                        if (b0 <= t_ground && t_ground <= b1 && (!hit || t_ground < *hit)) { hit = t_ground; }
+                    }
+                    return;
+                }
+                float const step = 0.5f * std::min(texel_size.x, texel_size.y) / speed;
+                std::optional<float> crossing = march(ray, b0, (hit) ? std::min(b1, *hit) : b1, step);
+                if (crossing && (!hit || *crossing < *hit)) { hit = crossing; }
+            };
+
+            if (crosses_posts)
+            {
+                band(c.t0, p0);
+                band(p1, c.t1);
+            }
+            else
+            {
+                band(c.t0, c.t1);
+            }
+
+            if (hit && (!best || *hit < *best)) { best = hit; }
+        }
+
+        if (best)
+        {
+            return ray.origin + *best * ray.direction;
+        }
+        return std::nullopt;
+    }
+
+}
@@ -0,0 +1,94 @@
+#include "hillshader/normal_buffer.hpp"
+
+#include <algorithm>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/simd.hpp"
+
+namespace hillshader
+{
+
+    void normal_buffer::resize(size_t width, size_t height)
+    {
+        m_width = width;
+        m_height = height;
+        m_x.resize(width * height);
+        m_y.resize(width * height);
+        m_z.resize(width * height);
+        m_u.resize(width * height);
+        m_v.resize(width * height);
+        m_lod.resize(width * height);
+    }
+
+    void normal_buffer::shade(shading::lighting const& l, uint8_t* rgba) const
+    {
+        if (empty()) { return; }
+
+        shading::light_set const lights = shading::resolve(l, theta);
+        horizon_field::suns const suns = (horizons) ? horizons->positions(lights) : horizon_field::suns();
+        uint8_t const miss[4] =
+        {
+            shading::encode_srgb(background.x), shading::encode_srgb(background.y), shading::encode_srgb(background.z), 255
+        };
+
+        parallel::for_each_chunk(0, m_height, [&](size_t begin, size_t end, size_t)
+        {
+            std::vector<float> intensities(m_width);
+            for (size_t row = begin; row < end; ++row)
+            {
+                float const* xs = m_x.data() + row * m_width;
+                float const* ys = m_y.data() + row * m_width;
+                float const* zs = m_z.data() + row * m_width;
+
+                size_t i = 0;
+                if (horizons)
+                {
+                    // occlusion is sampled per pixel, exactly as the renderers do
+                    float const* us = m_u.data() + row * m_width;
+                    float const* vs = m_v.data() + row * m_width;
+                    float const* lods = m_lod.data() + row * m_width;
+                    for (; i < m_width; ++i)
+                    {
+                        if (zs[i] < 0.f) { continue; }
+                        float lit[shading::c_max_lights];
+                        float const sky = horizons->occlusion(suns, lights.count, us[i], vs[i], lods[i], l, lit);
+                        intensities[i] = shading::intensity(lights, l.ambient_intensity, stff::vec3(xs[i], ys[i], zs[i]), l.exaggeration, lit, sky);
+                    }
+                }
+#if defined(HILLSHADER_AVX2)
+                __m256 const exaggeration = _mm256_set1_ps(l.exaggeration);
+                __m256 const light_x = _mm256_set1_ps(lights.combined.x);
+                __m256 const light_y = _mm256_set1_ps(lights.combined.y);
+                __m256 const light_z = _mm256_set1_ps(lights.combined.z);
+                __m256 const weight = _mm256_set1_ps(lights.weight);
+                __m256 const half = _mm256_set1_ps(0.5f);
+                __m256 const ambient = _mm256_set1_ps(l.ambient_intensity);
+                __m256 const diffuse = _mm256_set1_ps(1.f - l.ambient_intensity);
+                for (; i + 8 <= m_width; i += 8)
+                {
+                    // misses shade to garbage here and are overwritten below
+                    __m256 const x = _mm256_mul_ps(exaggeration, _mm256_loadu_ps(xs + i));
+                    __m256 const y = _mm256_mul_ps(exaggeration, _mm256_loadu_ps(ys + i));
+                    __m256 const z = _mm256_loadu_ps(zs + i);
+                    __m256 const length = _mm256_sqrt_ps(_mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z))));
+                    __m256 const dot = _mm256_fmadd_ps(x, light_x, _mm256_fmadd_ps(y, light_y, _mm256_mul_ps(z, light_z)));
+                    __m256 const strength = _mm256_mul_ps(half, _mm256_sub_ps(weight, _mm256_div_ps(dot, length)));
+                    _mm256_storeu_ps(intensities.data() + i, _mm256_fmadd_ps(diffuse, strength, ambient));
+                }
+#endif
+                for (; i < m_width; ++i)
+                {
+                    intensities[i] = shading::intensity(lights, l.ambient_intensity, stff::vec3(xs[i], ys[i], zs[i]), l.exaggeration);
+                }
+
+                uint8_t* dst = rgba + 4 * m_width * row;
+                shading::encode_row(intensities.data(), m_width, l.albedo, dst);
+                for (size_t p = 0; p < m_width; ++p)
+                {
+                    if (zs[p] < 0.f) { std::copy(miss, miss + 4, dst + 4 * p); }
+                }
+            }
+        });
+    }
+
+}
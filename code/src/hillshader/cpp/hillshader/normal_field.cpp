@@ -0,0 +1,258 @@
+#include "hillshader/normal_field.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/shading.hpp"
+#include "hillshader/terrain_sampler.hpp"
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        constexpr float c_unorm_max = 65535.f;
+
+        inline uint32_t to_unorm(float value)
+        {
+            float const scaled = std::clamp(0.5f * value + 0.5f, 0.f, 1.f) * c_unorm_max;
+            return static_cast<uint32_t>(scaled + 0.5f);
+        }
+
+        inline float from_unorm(uint32_t value)
+        {
+            return static_cast<float>(value) * (2.f / c_unorm_max) - 1.f;
+        }
+
+        // folds the lower hemisphere of the octahedron over the upper one (the fold is its own inverse)
+        inline stff::vec2 fold(float x, float y)
+        {
+            return stff::vec2(std::copysign(1.f - std::abs(y), x), std::copysign(1.f - std::abs(x), y));
+        }
+
+    }
+
+    normal_field::normal_field(terrain const& terrain, mip_chain const& mips)
+    {
+        if (terrain.empty()) { return; }
+
+        terrain_sampler const sampler(terrain, mips);
+        float const size_x = terrain.bounds().diagonal().x;
+        float const width = static_cast<float>(terrain.width());
+
+        m_levels.resize(sampler.levels());
+        for (size_t index = 0; index < sampler.levels(); ++index)
+        {
+            level& lvl = m_levels[index];
+            lvl.width = sampler.at(index).width;
+            lvl.height = sampler.at(index).height;
+            lvl.values.resize(lvl.width * lvl.height);
+
+            // normal_at samples lod L with taps 2^L / width apart in uv
+            float const delta_uv = std::ldexp(1.f, static_cast<int>(index)) / width;
+            float const delta_world = delta_uv * size_x;
+            float const du = 1.f / static_cast<float>(lvl.width);
+            float const dv = 1.f / static_cast<float>(lvl.height);
+            parallel::for_each_chunk(0, lvl.height, [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t j = begin; j < end; ++j)
+                {
+                    float const v = (static_cast<float>(j) + 0.5f) * dv;
+                    uint32_t* row = lvl.values.data() + j * lvl.width;
+                    for (size_t i = 0; i < lvl.width; ++i)
+                    {
+                        float const u = (static_cast<float>(i) + 0.5f) * du;
+                        float const east = sampler.sample(index, u + delta_uv, v);
+                        float const west = sampler.sample(index, u - delta_uv, v);
+                        float const north = sampler.sample(index, u, v - delta_uv);
+                        float const south = sampler.sample(index, u, v + delta_uv);
+                        row[i] = encode(shading::normal(east, west, north, south, delta_world));
+                    }
+                }
+            });
+        }
+    }
+
+    size_t normal_field::bytes() const
+    {
+        size_t total = 0;
+        for (level const& lvl : m_levels) { total += sizeof(uint32_t) * lvl.values.size(); }
+        return total;
+    }
+
+    uint32_t normal_field::encode(stff::vec3 const& normal)
+    {
+        float const l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+        stff::vec2 octahedral(normal.x / l1, normal.y / l1);
+        if (normal.z < 0.f)
+        {
+            octahedral = fold(octahedral.x, octahedral.y);
+        }
+        return to_unorm(octahedral.x) | (to_unorm(octahedral.y) << 16);
+    }
+
+    stff::vec3 normal_field::decode(uint32_t encoded)
+    {
+        stff::vec2 octahedral(from_unorm(encoded & 0xffff), from_unorm(encoded >> 16));
+        float const z = 1.f - std::abs(octahedral.x) - std::abs(octahedral.y);
+        if (z < 0.f)
+        {
+            octahedral = fold(octahedral.x, octahedral.y);
+        }
+        return stff::vec3(octahedral.x, octahedral.y, z).normalized();
+    }
+
+    stff::vec2 normal_field::sample_encoded(size_t index, float u, float v) const
+    {
+        level const& lvl = m_levels[index];
+        float const w = static_cast<float>(lvl.width);
+        float const h = static_cast<float>(lvl.height);
+
+        // same addressing as terrain_sampler
+        float const x = std::clamp(u * w - 0.5f, -1.f, w);
+        float const y = std::clamp(v * h - 0.5f, -1.f, h);
+        float const fx = std::floor(x);
+        float const fy = std::floor(y);
+        float const s = x - fx;
+        float const t = y - fy;
+
+        int const last_i = static_cast<int>(lvl.width) - 1;
+        int const last_j = static_cast<int>(lvl.height) - 1;
+        int const i = static_cast<int>(fx);
+        int const j = static_cast<int>(fy);
+        size_t const i0 = static_cast<size_t>(std::clamp(i, 0, last_i));
+        size_t const i1 = static_cast<size_t>(std::clamp(i + 1, 0, last_i));
+        size_t const j0 = static_cast<size_t>(std::clamp(j, 0, last_j));
+        size_t const j1 = static_cast<size_t>(std::clamp(j + 1, 0, last_j));
+
+        uint32_t const* row0 = lvl.values.data() + j0 * lvl.width;
+        uint32_t const* row1 = lvl.values.data() + j1 * lvl.width;
+        auto channel = [&](uint32_t shift)
+        {
+            float const top = stf::math::lerp(from_unorm((row0[i0] >> shift) & 0xffff), from_unorm((row0[i1] >> shift) & 0xffff), s);
+            float const bottom = stf::math::lerp(from_unorm((row1[i0] >> shift) & 0xffff), from_unorm((row1[i1] >> shift) & 0xffff), s);
+            return stf::math::lerp(top, bottom, t);
+        };
+        return stff::vec2(channel(0), channel(16));
+    }
+
+    stff::vec3 normal_field::sample(float u, float v, float lod) const
+    {
+        float const clamped = std::clamp(lod, 0.f, static_cast<float>(m_levels.size() - 1));
+        size_t const index = static_cast<size_t>(clamped);
+        float const frac = clamped - static_cast<float>(index);
+        stff::vec2 octahedral = sample_encoded(index, u, v);
+        if (frac > 0.f)
+        {
+            stff::vec2 const coarse = sample_encoded(index + 1, u, v);
+            octahedral = stff::vec2(stf::math::lerp(octahedral.x, coarse.x, frac), stf::math::lerp(octahedral.y, coarse.y, frac));
+        }
+
+        // terrain normals point up, and their encodings fill the convex diamond |x| + |y| <= 1, so filtered values stay
+        // in it and never need the fold
+        float const z = std::max(0.f, 1.f - std::abs(octahedral.x) - std::abs(octahedral.y));
+        return stff::vec3(octahedral.x, octahedral.y, z);
+    }
+
+#if defined(HILLSHADER_AVX2)
+    void normal_field::sample_encoded(size_t index, __m256 u, __m256 v, __m256& x, __m256& y) const
+    {
+        level const& lvl = m_levels[index];
+
+        // the gathers use 32-bit indices, so larger levels are sampled a lane at a time
+        if (lvl.values.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+        {
+            alignas(32) float us[8], vs[8], xs[8], ys[8];
+            _mm256_store_ps(us, u);
+            _mm256_store_ps(vs, v);
+            for (size_t lane = 0; lane < 8; ++lane)
+            {
+                stff::vec2 const encoded = sample_encoded(index, us[lane], vs[lane]);
+                xs[lane] = encoded.x;
+                ys[lane] = encoded.y;
+            }
+            x = _mm256_load_ps(xs);
+            y = _mm256_load_ps(ys);
+            return;
+        }
+
+        __m256 const w = _mm256_set1_ps(static_cast<float>(lvl.width));
+        __m256 const h = _mm256_set1_ps(static_cast<float>(lvl.height));
+        __m256 const half = _mm256_set1_ps(0.5f);
+        __m256 const minus_one = _mm256_set1_ps(-1.f);
+
+        __m256 const px = _mm256_min_ps(_mm256_max_ps(_mm256_fmsub_ps(u, w, half), minus_one), w);
+        __m256 const py = _mm256_min_ps(_mm256_max_ps(_mm256_fmsub_ps(v, h, half), minus_one), h);
+        __m256 const fx = _mm256_floor_ps(px);
+        __m256 const fy = _mm256_floor_ps(py);
+        __m256 const s = _mm256_sub_ps(px, fx);
+        __m256 const t = _mm256_sub_ps(py, fy);
+
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i const one = _mm256_set1_epi32(1);
+        __m256i const last_i = _mm256_set1_epi32(static_cast<int>(lvl.width) - 1);
+        __m256i const last_j = _mm256_set1_epi32(static_cast<int>(lvl.height) - 1);
+        __m256i const i = _mm256_cvttps_epi32(fx);
+        __m256i const j = _mm256_cvttps_epi32(fy);
+        __m256i const i0 = _mm256_min_epi32(_mm256_max_epi32(i, zero), last_i);
+        __m256i const i1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(i, one), zero), last_i);
+        __m256i const j0 = _mm256_min_epi32(_mm256_max_epi32(j, zero), last_j);
+        __m256i const j1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(j, one), zero), last_j);
+
+        __m256i const stride = _mm256_set1_epi32(static_cast<int>(lvl.width));
+        __m256i const row0 = _mm256_mullo_epi32(j0, stride);
+        __m256i const row1 = _mm256_mullo_epi32(j1, stride);
+        int const* base = reinterpret_cast<int const*>(lvl.values.data());
+        __m256i const v00 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, i0), 4);
+        __m256i const v10 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, i1), 4);
+        __m256i const v01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, i0), 4);
+        __m256i const v11 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, i1), 4);
+
+        // unpack a channel of the four texels to [-1, 1] and filter it
+        __m256 const scale = _mm256_set1_ps(2.f / c_unorm_max);
+        __m256i const low = _mm256_set1_epi32(0xffff);
+        auto channel = [&](int shift)
+        {
+            auto unpack = [&](__m256i texel)
+            {
+                __m256i const bits = (shift == 0) ? _mm256_and_si256(texel, low) : _mm256_srli_epi32(texel, 16);
+                return _mm256_fmadd_ps(_mm256_cvtepi32_ps(bits), scale, minus_one);
+            };
+            __m256 const a = unpack(v00);
+            __m256 const b = unpack(v10);
+            __m256 const c = unpack(v01);
+            __m256 const d = unpack(v11);
+            __m256 const top = _mm256_fmadd_ps(s, _mm256_sub_ps(b, a), a);
+            __m256 const bottom = _mm256_fmadd_ps(s, _mm256_sub_ps(d, c), c);
+            return _mm256_fmadd_ps(t, _mm256_sub_ps(bottom, top), top);
+        };
+        x = channel(0);
+        y = channel(16);
+    }
+
+    void normal_field::sample(__m256 u, __m256 v, float lod, __m256& x, __m256& y, __m256& z) const
+    {
+        float const clamped = std::clamp(lod, 0.f, static_cast<float>(m_levels.size() - 1));
+        size_t const index = static_cast<size_t>(clamped);
+        float const frac = clamped - static_cast<float>(index);
+        sample_encoded(index, u, v, x, y);
+        if (frac > 0.f)
+        {
+            __m256 cx, cy;
+            sample_encoded(index + 1, u, v, cx, cy);
+            __m256 const f = _mm256_set1_ps(frac);
+            x = _mm256_fmadd_ps(f, _mm256_sub_ps(cx, x), x);
+            y = _mm256_fmadd_ps(f, _mm256_sub_ps(cy, y), y);
+        }
+
+        __m256 const abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 const l1 = _mm256_add_ps(_mm256_and_ps(x, abs_mask), _mm256_and_ps(y, abs_mask));
+        z = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_set1_ps(1.f), l1));
+    }
+#endif
+
+}
@@ -0,0 +1,428 @@
+#include "hillshader/paged_terrain.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include <stb_image.h>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace hillshader
+{
+
+    // half the width of the web mercator plane in meters
+    static constexpr double c_half_world = 20037508.342789244;
+
+    // march step as a fraction of a texel and the number of bisection steps that refine a crossing
+    static constexpr float c_march_texels = 0.5f;
+    static constexpr size_t c_bisection_steps = 16;
+
+    // parses a non-negative integer directory or file stem
+    static std::optional<uint32_t> parse_index(std::string const& str)
+    {
+        if (str.empty() || str.size() > 9 || !std::all_of(str.begin(), str.end(), [](char c) { return '0' <= c && c <= '9'; }))
+        {
+            return std::nullopt;
+        }
+        return static_cast<uint32_t>(std::stoul(str));
+    }
+
+    paged_terrain::paged_terrain(std::filesystem::path const& root, size_t capacity) :
+        m_root(root),
+        m_capacity(capacity)
+    {
+        // find the zoom levels
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(m_root, ec), end; !ec && it != end; it.increment(ec))
+        {
+            std::optional<uint32_t> z = parse_index(it->path().filename().string());
+            if (!it->is_directory(ec) || !z || *z > 28) { continue; }
+
+            m_min_zoom = (m_empty) ? *z : std::min(m_min_zoom, *z);
+            m_max_zoom = (m_empty) ? *z : std::max(m_max_zoom, *z);
+            m_empty = false;
+        }
+
+        if (m_empty) { return; }
+
+        // the coarsest level defines the coverage and is pinned
+        std::vector<key> pinned;
+        for (std::filesystem::directory_iterator xs(m_root / std::to_string(m_min_zoom), ec), end; !ec && xs != end; xs.increment(ec))
+        {
+            std::optional<uint32_t> x = parse_index(xs->path().filename().string());
+            if (!x) { continue; }
+
+            std::error_code inner;
+            for (std::filesystem::directory_iterator ys(xs->path(), inner); !inner && ys != end; ys.increment(inner))
+            {
+                std::optional<uint32_t> y = parse_index(ys->path().stem().string());
+                if (y && ys->path().extension() == ".png")
+                {
+                    pinned.push_back({ m_min_zoom, *x, *y });
+                }
+            }
+        }
+
+        if (pinned.empty())
+        {
+            m_empty = true;
+            return;
+        }
+
+        double const size = tile_meters(m_min_zoom);
+        stfd::vec2 min(std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+        stfd::vec2 max(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest());
+        for (key const& k : pinned)
+        {
+            min = stfd::vec2(std::min(min.x, -c_half_world + k.x * size), std::min(min.y, c_half_world - (k.y + 1) * size));
+            max = stfd::vec2(std::max(max.x, -c_half_world + (k.x + 1) * size), std::max(max.y, c_half_world - k.y * size));
+        }
+        m_center = 0.5 * (min + max);
+        m_bounds = stff::aabb2((min - m_center).as<float>(), (max - m_center).as<float>());
+
+        m_pinned = pinned.size();
+        m_pinned_queue.assign(pinned.begin(), pinned.end());
+
+        // pinned tiles are never evicted, so a smaller capacity would leave no room for anything else
+        m_capacity = std::max(m_capacity, m_pinned + 1);
+
+        size_t const workers = std::max<size_t>(1, parallel::concurrency() / 2);
+        for (size_t w = 0; w < workers; ++w)
+        {
+            m_workers.emplace_back(&paged_terrain::work, this);
+        }
+    }
+
+    paged_terrain::~paged_terrain()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& worker : m_workers) { worker.join(); }
+    }
+
+    double paged_terrain::tile_meters(uint32_t z)
+    {
+        return 2.0 * c_half_world / static_cast<double>(uint64_t(1) << z);
+    }
+
+    stff::aabb2 paged_terrain::tile_bounds(key const& k) const
+    {
+        double const size = tile_meters(k.z);
+        stfd::vec2 const min(-c_half_world + k.x * size, c_half_world - (k.y + 1) * size);
+        stfd::vec2 const max(-c_half_world + (k.x + 1) * size, c_half_world - k.y * size);
+        return stff::aabb2((min - m_center).as<float>(), (max - m_center).as<float>());
+    }
+
+    std::optional<paged_terrain::key> paged_terrain::tile_at(uint32_t z, stff::vec2 const& pos) const
+    {
+        double const size = tile_meters(z);
+        double const x = (m_center.x + pos.x + c_half_world) / size;
+        double const y = (c_half_world - m_center.y - pos.y) / size;
+        double const count = static_cast<double>(uint64_t(1) << z);
+        if (x < 0.0 || y < 0.0 || x >= count || y >= count) { return std::nullopt; }
+        return key{ z, static_cast<uint32_t>(x), static_cast<uint32_t>(y) };
+    }
+
+    void paged_terrain::request(stff::aabb2 const& footprint, float meters_per_texel)
+    {
+        if (m_empty) { return; }
+
+        // the coarsest level that resolves the requested texel size
+        uint32_t z = m_min_zoom;
+        while (z < m_max_zoom && tile_meters(z) / static_cast<double>(c_tile_pixels) > meters_per_texel) { ++z; }
+
+        std::optional<key> lo = tile_at(z, stff::vec2(footprint.min.x, footprint.max.y));
+        std::optional<key> hi = tile_at(z, stff::vec2(footprint.max.x, footprint.min.y));
+        uint32_t const last = static_cast<uint32_t>((uint64_t(1) << z) - 1);
+        uint32_t const x0 = (lo) ? lo->x : 0, y0 = (lo) ? lo->y : 0;
+        uint32_t const x1 = (hi) ? hi->x : last, y1 = (hi) ? hi->y : last;
+
+        // wanted tiles (with the prefetch ring) ordered from the middle of the footprint outwards
+        std::vector<key> wanted;
+        for (uint32_t y = (y0 > c_prefetch_ring) ? y0 - c_prefetch_ring : 0; y <= std::min(last, y1 + c_prefetch_ring); ++y)
+        {
+            for (uint32_t x = (x0 > c_prefetch_ring) ? x0 - c_prefetch_ring : 0; x <= std::min(last, x1 + c_prefetch_ring); ++x)
+            {
+                wanted.push_back({ z, x, y });
+            }
+        }
+        double const mid_x = 0.5 * (x0 + x1);
+        double const mid_y = 0.5 * (y0 + y1);
+        std::sort(wanted.begin(), wanted.end(), [&](key const& lhs, key const& rhs)
+        {
+            double const dl = std::abs(lhs.x - mid_x) + std::abs(lhs.y - mid_y);
+            double const dr = std::abs(rhs.x - mid_x) + std::abs(rhs.y - mid_y);
+            return dl < dr;
+        });
+
+        // never ask for more than fits beside the pinned level, otherwise the outer tiles evict the middle ones
+        size_t const room = (m_capacity > m_pinned) ? m_capacity - m_pinned : 0;
+        if (wanted.size() > room) { wanted.resize(room); }
+
+        // wanted tiles that are already resident become the most recently used
+        std::vector<key> missing;
+        {
+            std::unique_lock<std::shared_mutex> lock(m_resident_mutex);
+            for (auto k = wanted.rbegin(); k != wanted.rend(); ++k)
+            {
+                auto found = m_resident.find(pack(*k));
+                if (found != m_resident.end())
+                {
+                    m_lru.splice(m_lru.begin(), m_lru, found->second.lru);
+                }
+            }
+            for (key const& k : wanted)
+            {
+                if (m_resident.find(pack(k)) == m_resident.end()) { missing.push_back(k); }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_queue.clear();
+            for (key const& k : missing)
+            {
+                if (m_in_flight.find(pack(k)) == m_in_flight.end()) { m_queue.push_back(k); }
+            }
+        }
+        m_wake.notify_all();
+    }
+
+    void paged_terrain::work()
+    {
+        while (true)
+        {
+            key k;
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_wake.wait(lock, [this]() { return m_stopping || !m_pinned_queue.empty() || !m_queue.empty(); });
+                if (m_stopping) { return; }
+
+                std::deque<key>& queue = (m_pinned_queue.empty()) ? m_queue : m_pinned_queue;
+                k = queue.front();
+                queue.pop_front();
+                m_in_flight.insert(pack(k));
+            }
+
+            insert(k, decode(k));
+
+            {
+                std::lock_guard<std::mutex> lock(m_queue_mutex);
+                m_in_flight.erase(pack(k));
+            }
+        }
+    }
+
+    std::shared_ptr<paged_terrain::tile const> paged_terrain::decode(key const& k) const
+    {
+        auto decoded = std::make_shared<tile>();
+
+        std::filesystem::path const path = m_root / std::to_string(k.z) / std::to_string(k.x) / (std::to_string(k.y) + ".png");
+        int width = 0, height = 0, channels = 0;
+        unsigned char* img = stbi_load(path.string().c_str(), &width, &height, &channels, 0);
+        if (img)
+        {
+            if (channels >= 3 && width > 0 && height > 0)
+            {
+                decoded->width = static_cast<size_t>(width);
+                decoded->height = static_cast<size_t>(height);
+                decoded->values.resize(decoded->width * decoded->height);
+                terrarium::decode(img, static_cast<size_t>(channels), decoded->width, 0, decoded->height, decoded->values.data());
+            }
+            stbi_image_free(img);
+        }
+
+        return decoded;
+    }
+
+    void paged_terrain::insert(key const& k, std::shared_ptr<tile const> data)
+    {
+        std::unique_lock<std::shared_mutex> lock(m_resident_mutex);
+
+        uint64_t const packed = pack(k);
+        if (m_resident.find(packed) != m_resident.end()) { return; }
+
+        m_lru.push_front(packed);
+        m_resident.emplace(packed, entry{ std::move(data), m_lru.begin() });
+
+        // evict the least recently used tiles, skipping the pinned level and the tile that was just inserted
+        auto it = m_lru.end();
+        while (m_resident.size() > m_capacity && it != m_lru.begin())
+        {
+            --it;
+            if ((*it >> 58) == m_min_zoom || *it == packed) { continue; }
+            m_resident.erase(*it);
+            it = m_lru.erase(it);
+        }
+        m_revision.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    std::optional<float> paged_terrain::sample(stff::vec2 const& pos) const
+    {
+        if (m_empty) { return std::nullopt; }
+
+        std::shared_lock<std::shared_mutex> lock(m_resident_mutex);
+        return sample_locked(pos, nullptr);
+    }
+
+    void paged_terrain::sample(stff::vec2 const* positions, float* elevations, size_t count) const
+    {
+        float const missing = std::numeric_limits<float>::quiet_NaN();
+        if (m_empty)
+        {
+            std::fill(elevations, elevations + count, missing);
+            return;
+        }
+
+        std::shared_lock<std::shared_mutex> lock(m_resident_mutex);
+        for (size_t q = 0; q < count; ++q)
+        {
+            elevations[q] = sample_locked(positions[q], nullptr).value_or(missing);
+        }
+    }
+
+    float paged_terrain::post(key const& k, tile const& t, long i, long j) const
+    {
+        long const width = static_cast<long>(t.width);
+        long const height = static_cast<long>(t.height);
+        if (0 <= i && i < width && 0 <= j && j < height)
+        {
+            return t.values[static_cast<size_t>(i) + t.width * static_cast<size_t>(j)];
+        }
+
+        // the neighbor across the edge (or corner) that holds the post
+        long const dx = (i < 0) ? -1 : (i >= width) ? 1 : 0;
+        long const dy = (j < 0) ? -1 : (j >= height) ? 1 : 0;
+        long const count = static_cast<long>(uint64_t(1) << k.z);
+        long const nx = static_cast<long>(k.x) + dx;
+        long const ny = static_cast<long>(k.y) + dy;
+        if (0 <= nx && nx < count && 0 <= ny && ny < count)
+        {
+            auto found = m_resident.find(pack({ k.z, static_cast<uint32_t>(nx), static_cast<uint32_t>(ny) }));
+            if (found != m_resident.end() && !found->second.data->values.empty())
+            {
+                tile const& n = *found->second.data;
+                long const ni = std::clamp((dx < 0) ? static_cast<long>(n.width) - 1 : (dx > 0) ? 0l : i, 0l, static_cast<long>(n.width) - 1);
+                long const nj = std::clamp((dy < 0) ? static_cast<long>(n.height) - 1 : (dy > 0) ? 0l : j, 0l, static_cast<long>(n.height) - 1);
+                return n.values[static_cast<size_t>(ni) + n.width * static_cast<size_t>(nj)];
+            }
+        }
+
+        long const ci = std::clamp(i, 0l, width - 1);
+        long const cj = std::clamp(j, 0l, height - 1);
+        return t.values[static_cast<size_t>(ci) + t.width * static_cast<size_t>(cj)];
+    }
+
+    std::optional<float> paged_terrain::sample_locked(stff::vec2 const& pos, float* texel) const
+    {
+        for (uint32_t z = m_max_zoom + 1; z-- > m_min_zoom;)
+        {
+            std::optional<key> k = tile_at(z, pos);
+            if (!k) { return std::nullopt; }
+
+            auto found = m_resident.find(pack(*k));
+            if (found == m_resident.end() || found->second.data->values.empty()) { continue; }
+
+            // bilinear interpolation between pixel centers. within half a texel of the tile's edge the posts on the
+            // far side come from the neighboring tile
+            tile const& t = *found->second.data;
+            stff::aabb2 const bounds = tile_bounds(*k);
+            stff::vec2 const diagonal = bounds.diagonal();
+            float const tx = (pos.x - bounds.min.x) / diagonal.x * static_cast<float>(t.width) - 0.5f;
+            float const ty = (bounds.max.y - pos.y) / diagonal.y * static_cast<float>(t.height) - 0.5f;
+            long const i = static_cast<long>(std::floor(tx));
+            long const j = static_cast<long>(std::floor(ty));
+            float const s = tx - static_cast<float>(i);
+            float const u = ty - static_cast<float>(j);
+            if (texel) { *texel = diagonal.x / static_cast<float>(t.width); }
+
+            float const top = stf::math::lerp(post(*k, t, i, j), post(*k, t, i + 1, j), s);
+            float const bottom = stf::math::lerp(post(*k, t, i, j + 1), post(*k, t, i + 1, j + 1), s);
+            return stf::math::lerp(top, bottom, u);
+        }
+        return std::nullopt;
+    }
+
+    std::optional<stff::vec3> paged_terrain::intersect(stff::ray3 const& ray, float max_distance) const
+    {
+        if (m_empty) { return std::nullopt; }
+
+        float const length = std::sqrt(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);
+        if (length == 0.f) { return std::nullopt; }
+
+        // steps are sized by the texels of the level that answered the previous sample
+        float const coarse_texel = static_cast<float>(tile_meters(m_min_zoom) / static_cast<double>(c_tile_pixels));
+        float const t_max = max_distance / length;
+
+        std::shared_lock<std::shared_mutex> lock(m_resident_mutex);
+        auto above = [&](float t, float* texel) -> std::optional<float>
+        {
+            stff::vec3 const p = ray.origin + t * ray.direction;
+            std::optional<float> ground = sample_locked(stff::vec2(p.x, p.y), texel);
+            return (ground) ? std::optional<float>(p.z - *ground) : std::nullopt;
+        };
+
+        float prev_t = 0.f;
+        float t = 0.f;
+        while (t <= t_max)
+        {
+            float texel = coarse_texel;
+            std::optional<float> current = above(t, &texel);
+            if (current && *current <= 0.f)
+            {
+                if (t == 0.f) { return ray.origin; }
+
+                float lo = prev_t, hi = t;
+                for (size_t k = 0; k < c_bisection_steps; ++k)
+                {
+                    float const mid = 0.5f * (lo + hi);
+                    std::optional<float> value = above(mid, nullptr);
+                    if (value && *value <= 0.f) { hi = mid; } else { lo = mid; }
+                }
+                return ray.origin + hi * ray.direction;
+            }
+            prev_t = t;
+            t += c_march_texels * texel / length;
+        }
+        return std::nullopt;
+    }
+
+    size_t paged_terrain::resident() const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_resident_mutex);
+        return m_resident.size();
+    }
+
+    size_t paged_terrain::pending() const
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        return m_pinned_queue.size() + m_queue.size() + m_in_flight.size();
+    }
+
+    stff::aabb2 paged_terrain::footprint(stff::scamera const& camera, float ground, float max_distance)
+    {
+        stff::vec2 min(camera.eye.x, camera.eye.y);
+        stff::vec2 max = min;
+        for (stff::vec2 const& uv : { stff::vec2(0, 0), stff::vec2(1, 0), stff::vec2(0, 1), stff::vec2(1, 1), stff::vec2(0.5f, 0.5f) })
+        {
+            stff::ray3 const ray = camera.ray(uv);
+            float const length = std::sqrt(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);
+            float t = max_distance / length;
+            if (ray.direction.z < 0.f)
+            {
+                t = std::min(t, (ground - ray.origin.z) / ray.direction.z);
+            }
+            stff::vec3 const p = ray.origin + std::max(0.f, t) * ray.direction;
+            min = stff::vec2(std::min(min.x, p.x), std::min(min.y, p.y));
+            max = stff::vec2(std::max(max.x, p.x), std::max(max.y, p.y));
+        }
+        return stff::aabb2(min, max);
+    }
+
+}
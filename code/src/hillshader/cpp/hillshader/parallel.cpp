@@ -0,0 +1,12 @@
+#include "hillshader/parallel.hpp"
+
+namespace hillshader::parallel
+{
+
+    size_t concurrency()
+    {
+        size_t threads = static_cast<size_t>(std::thread::hardware_concurrency());
+        return std::max<size_t>(1, threads);
+    }
+
+}
@@ -0,0 +1,147 @@
+#include "hillshader/perspective_renderer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "hillshader/parallel.hpp"
+
+namespace hillshader
+{
+
+    static constexpr size_t c_packet_width = 4;
+    static constexpr size_t c_packet_height = terrain::c_packet_size / c_packet_width;
+
+    perspective_renderer::perspective_renderer(terrain const& terrain, mip_chain const& mips, normal_field const* normals, horizon_field const* horizons) :
+        m_terrain(terrain),
+        m_sampler(terrain, mips),
+        m_normals((normals && !normals->empty()) ? normals : nullptr),
+        m_horizons((horizons && !horizons->empty()) ? horizons : nullptr)
+    {}
+
+    perspective_renderer::stats perspective_renderer::render(view const& v, lighting const& l, uint8_t* rgba, normal_buffer* normals) const
+    {
+        stats result;
+        if (v.width == 0 || v.height == 0 || m_terrain.empty()) { return result; }
+
+        stff::scamera camera = v.camera;
+        camera.aspect = static_cast<float>(v.width) / static_cast<float>(v.height);
+
+        // a pinhole camera's ray directions are an affine function of the screen position once they are scaled to unit
+        // length along the view direction. that lets each pixel's ray come from three vectors instead of a call to
+        // camera.ray (uv (0, 0) is the top left corner of the screen, as in the application)
+        stff::vec3 const forward = camera.ray(stff::vec2(0.5f, 0.5f)).direction;
+        auto scaled = [&camera, &forward](float u, float v)
+        {
+            stff::vec3 const direction = camera.ray(stff::vec2(u, v)).direction;
+            return direction / stf::math::dot(direction, forward);
+        };
+        stff::vec3 const corner = scaled(0.f, 0.f);
+        stff::vec3 const across = (scaled(1.f, 0.f) - corner) / static_cast<float>(v.width);
+        stff::vec3 const down = (scaled(0.f, 1.f) - corner) / static_cast<float>(v.height);
+
+        if (normals)
+        {
+            normals->resize(v.width, v.height);
+            normals->theta = camera.theta;
+            normals->background = v.background;
+            normals->horizons = m_horizons;
+        }
+
+        stff::vec2 const terrain_size = m_terrain.bounds().diagonal();
+        shading::light_set const lights = shading::resolve(l, camera.theta);
+        horizon_field::suns const suns = (m_horizons) ? m_horizons->positions(lights) : horizon_field::suns();
+        uint8_t const background[4] =
+        {
+            shading::encode_srgb(v.background.x), shading::encode_srgb(v.background.y), shading::encode_srgb(v.background.z), 255
+        };
+
+        size_t const tiles_x = (v.width + c_tile_size - 1) / c_tile_size;
+        size_t const tiles_y = (v.height + c_tile_size - 1) / c_tile_size;
+        std::vector<size_t> hits(parallel::concurrency(), 0);
+        parallel::for_each_dynamic(0, tiles_x * tiles_y, [&](size_t tile, size_t worker)
+        {
+            size_t const tile_x0 = (tile % tiles_x) * c_tile_size;
+            size_t const tile_y0 = (tile / tiles_x) * c_tile_size;
+            size_t const tile_x1 = std::min(v.width, tile_x0 + c_tile_size);
+            size_t const tile_y1 = std::min(v.height, tile_y0 + c_tile_size);
+
+            std::array<stff::ray3, terrain::c_packet_size> rays;
+            std::array<float, terrain::c_packet_size> ts;
+            for (size_t y0 = tile_y0; y0 < tile_y1; y0 += c_packet_height)
+            {
+                for (size_t x0 = tile_x0; x0 < tile_x1; x0 += c_packet_width)
+                {
+                    // pixels past the edge of the image repeat the last row or column so the packet stays full
+                    for (size_t k = 0; k < terrain::c_packet_size; ++k)
+                    {
+                        size_t const x = std::min(x0 + k % c_packet_width, tile_x1 - 1);
+                        size_t const y = std::min(y0 + k / c_packet_width, tile_y1 - 1);
+                        stff::vec3 const direction = corner + (static_cast<float>(x) + 0.5f) * across + (static_cast<float>(y) + 0.5f) * down;
+                        rays[k] = stff::ray3(camera.eye, direction.normalized());
+                    }
+                    m_terrain.intersect(rays, ts);
+
+                    for (size_t k = 0; k < terrain::c_packet_size; ++k)
+                    {
+                        size_t const x = x0 + k % c_packet_width;
+                        size_t const y = y0 + k / c_packet_width;
+                        if (x >= tile_x1 || y >= tile_y1) { continue; }
+
+                        uint8_t* dst = rgba + 4 * (x + v.width * y);
+                        if (!std::isfinite(ts[k]))
+                        {
+                            std::copy(background, background + 4, dst);
+                            if (normals) { normals->store_miss(x + v.width * y); }
+                            continue;
+                        }
+                        ++hits[worker];
+
+                        // shade the hit as the pixel shader does (compute_delta_uv and normal_at). the ray direction
+                        // has unit length, so the ray parameter is the distance to the eye
+                        stff::vec3 const pos = rays[k].origin + ts[k] * rays[k].direction;
+                        float const u = (pos.x - m_terrain.bounds().min.x) / terrain_size.x;
+                        float const w = (m_terrain.bounds().max.y - pos.y) / terrain_size.y;
+                        float const delta_uv = std::max(0.5f / static_cast<float>(m_terrain.width()), v.step_scalar * ts[k] / terrain_size.x);
+                        float const lod = std::max(0.f, std::log2(delta_uv * static_cast<float>(m_terrain.width())));
+                        stff::vec3 normal;
+                        if (m_normals)
+                        {
+                            normal = m_normals->sample(u, w, lod);
+                        }
+                        else
+                        {
+                            float const east = m_sampler.sample(u + delta_uv, w, lod);
+                            float const west = m_sampler.sample(u - delta_uv, w, lod);
+                            float const north = m_sampler.sample(u, w - delta_uv, lod);
+                            float const south = m_sampler.sample(u, w + delta_uv, lod);
+                            normal = shading::normal(east, west, north, south, delta_uv * terrain_size.x);
+                        }
+                        float intensity = 0.f;
+                        if (m_horizons)
+                        {
+                            float lit[shading::c_max_lights];
+                            float const sky = m_horizons->occlusion(suns, lights.count, u, w, lod, l, lit);
+                            intensity = shading::intensity(lights, l.ambient_intensity, normal, l.exaggeration, lit, sky);
+                        }
+                        else
+                        {
+                            intensity = shading::intensity(lights, l.ambient_intensity, normal, l.exaggeration);
+                        }
+                        if (normals) { normals->store(x + v.width * y, normal, u, w, lod); }
+
+                        dst[0] = shading::encode_srgb(l.albedo.x * intensity);
+                        dst[1] = shading::encode_srgb(l.albedo.y * intensity);
+                        dst[2] = shading::encode_srgb(l.albedo.z * intensity);
+                        dst[3] = 255;
+                    }
+                }
+            }
+        });
+
+        result.rays = v.width * v.height;
+        for (size_t count : hits) { result.hits += count; }
+        return result;
+    }
+
+}
@@ -0,0 +1,112 @@
+#include "hillshader/pyramid.hpp"
+
+#include <algorithm>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    pyramid::pyramid(terrain const& terrain)
+    {
+        if (terrain.width() < 2 || terrain.height() < 2) { return; }
+
+        m_terrain = &terrain;
+        m_cells_x = terrain.width() - 1;
+        m_cells_y = terrain.height() - 1;
+        while (width(m_top) > 1 || height(m_top) > 1) { ++m_top; }
+
+        if (m_top < c_base_level) { return; }
+
+        m_levels.resize(m_top - c_base_level + 1);
+
+        // the base level scans the posts directly
+        {
+            size_t const w = width(c_base_level);
+            std::vector<stff::interval>& base = m_levels.front();
+            base.resize(w * height(c_base_level));
+            parallel::for_each_chunk(0, height(c_base_level), [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t j = begin; j < end; ++j)
+                {
+                    for (size_t i = 0; i < w; ++i)
+                    {
+                        base[i + w * j] = scan(c_base_level, i, j);
+                    }
+                }
+            });
+        }
+
+        // every other level reduces the four children below it
+        for (size_t level = c_base_level + 1; level <= m_top; ++level)
+        {
+            std::vector<stff::interval> const& below = m_levels[level - c_base_level - 1];
+            std::vector<stff::interval>& current = m_levels[level - c_base_level];
+
+            size_t const w = width(level);
+            size_t const h = height(level);
+            size_t const below_w = width(level - 1);
+            size_t const below_h = height(level - 1);
+            current.resize(w * h);
+            parallel::for_each_chunk(0, h, [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t j = begin; j < end; ++j)
+                {
+                    for (size_t i = 0; i < w; ++i)
+                    {
+                        stff::interval range = below[2 * i + below_w * 2 * j];
+                        for (size_t cj = 2 * j; cj < std::min(2 * j + 2, below_h); ++cj)
+                        {
+                            for (size_t ci = 2 * i; ci < std::min(2 * i + 2, below_w); ++ci)
+                            {
+                                stff::interval const& child = below[ci + below_w * cj];
+                                range.a = std::min(range.a, child.a);
+                                range.b = std::max(range.b, child.b);
+                            }
+                        }
+                        current[i + w * j] = range;
+                    }
+                }
+            });
+        }
+    }
+
+    stff::interval pyramid::range(size_t level, size_t i, size_t j) const
+    {
+        return (level >= c_base_level) ? m_levels[level - c_base_level][i + width(level) * j] : scan(level, i, j);
+    }
+
+    stff::interval pyramid::scan(size_t level, size_t i, size_t j) const
+    {
+        // a node touches every post from its first cell up to one past its last cell
+        size_t const i0 = i << level;
+        size_t const j0 = j << level;
+        size_t const i1 = std::min((i + 1) << level, m_cells_x);
+        size_t const j1 = std::min((j + 1) << level, m_cells_y);
+
+        float first = m_terrain->read(i0, j0);
+        stff::interval range(first, first);
+        for (size_t y = j0; y <= j1; ++y)
+        {
+            for (size_t x = i0; x <= i1; ++x)
+            {
+                float elevation = m_terrain->read(x, y);
+                range.a = std::min(range.a, elevation);
+                range.b = std::max(range.b, elevation);
+            }
+        }
+        return range;
+    }
+
+    size_t pyramid::bytes() const
+    {
+        size_t bytes = 0;
+        for (std::vector<stff::interval> const& level : m_levels)
+        {
+            bytes += sizeof(stff::interval) * level.size();
+        }
+        return bytes;
+    }
+
+}
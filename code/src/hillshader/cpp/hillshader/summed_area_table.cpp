@@ -0,0 +1,138 @@
+#include "hillshader/summed_area_table.hpp"
+
+#include <algorithm>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        // first post at or after a texel coordinate
+        inline size_t first_post(float texel)
+        {
+            return static_cast<size_t>(std::max(0.f, std::ceil(texel)));
+        }
+
+        // one past the last post at or before a texel coordinate (n posts along the axis)
+        inline size_t past_post(float texel, size_t n)
+        {
+            float const past = std::floor(texel) + 1.f;
+            return (past > 0.f) ? static_cast<size_t>(std::min(past, static_cast<float>(n))) : 0;
+        }
+
+    }
+
+    summed_area_table::summed_area_table(terrain const& terrain) :
+        m_width(terrain.width()),
+        m_height(terrain.height()),
+        m_reference(0.5 * (static_cast<double>(terrain.range().a) + static_cast<double>(terrain.range().b))),
+        m_moments((terrain.width() + 1) * (terrain.height() + 1), moments{ 0.0, 0.0 })
+    {
+        size_t const stride = m_width + 1;
+
+        // running sums along each row
+        parallel::for_each_chunk(0, m_height, [&](size_t begin, size_t end, size_t)
+        {
+            std::vector<float> row(m_width);
+            for (size_t j = begin; j < end; ++j)
+            {
+                terrain.copy_rows(j, j + 1, row.data());
+                moments* dst = m_moments.data() + (j + 1) * stride + 1;
+                double sum = 0.0;
+                double squares = 0.0;
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    double const d = static_cast<double>(row[i]) - m_reference;
+                    sum += d;
+                    squares += d * d;
+                    dst[i] = { sum, squares };
+                }
+            }
+        });
+
+        // then down each column. threads take contiguous ranges of columns and walk the rows in order
+        parallel::for_each_chunk(1, stride, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t j = 2; j <= m_height; ++j)
+            {
+                moments const* above = m_moments.data() + (j - 1) * stride;
+                moments* row = m_moments.data() + j * stride;
+                for (size_t i = begin; i < end; ++i)
+                {
+                    row[i].sum += above[i].sum;
+                    row[i].squares += above[i].squares;
+                }
+            }
+        });
+    }
+
+    summed_area_table::statistics summed_area_table::query(size_t i0, size_t j0, size_t i1, size_t j1) const
+    {
+        i1 = std::min(i1, m_width);
+        j1 = std::min(j1, m_height);
+        i0 = std::min(i0, i1);
+        j0 = std::min(j0, j1);
+
+        statistics stats;
+        stats.count = (i1 - i0) * (j1 - j0);
+        if (stats.count == 0) { return stats; }
+
+        moments const& a = at(i0, j0);
+        moments const& b = at(i1, j0);
+        moments const& c = at(i0, j1);
+        moments const& d = at(i1, j1);
+        double const n = static_cast<double>(stats.count);
+        double const mean = (d.sum - b.sum - c.sum + a.sum) / n;
+        double const squares = (d.squares - b.squares - c.squares + a.squares) / n;
+        stats.mean = m_reference + mean;
+        stats.variance = std::max(0.0, squares - mean * mean);
+        return stats;
+    }
+
+    summed_area_table::statistics summed_area_table::query(terrain const& terrain, stff::aabb2 const& area) const
+    {
+        // texel space flips y, so the corners are sorted again
+        stff::vec2 const a = terrain.to_texel(area.min);
+        stff::vec2 const b = terrain.to_texel(area.max);
+        size_t const i0 = first_post(std::min(a.x, b.x));
+        size_t const j0 = first_post(std::min(a.y, b.y));
+        size_t const i1 = past_post(std::max(a.x, b.x), m_width);
+        size_t const j1 = past_post(std::max(a.y, b.y), m_height);
+        return query(i0, j0, std::max(i0, i1), std::max(j0, j1));
+    }
+
+    void summed_area_table::relief(terrain const& terrain, std::vector<size_t> const& radii, size_t begin, size_t end, float* deviations) const
+    {
+        end = std::min(end, m_height);
+        parallel::for_each_chunk(begin, end, [&](size_t lo, size_t hi, size_t)
+        {
+            std::vector<float> row(m_width);
+            for (size_t j = lo; j < hi; ++j)
+            {
+                terrain.copy_rows(j, j + 1, row.data());
+                float* dst = deviations + (j - begin) * m_width;
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    float best = 0.f;
+                    for (size_t const r : radii)
+                    {
+                        size_t const i0 = (i > r) ? i - r : 0;
+                        size_t const j0 = (j > r) ? j - r : 0;
+                        statistics const stats = query(i0, j0, i + r + 1, j + r + 1);
+                        double const stddev = stats.stddev();
+                        if (stddev <= 0.0) { continue; }
+
+                        float const deviation = static_cast<float>((static_cast<double>(row[i]) - stats.mean) / stddev);
+                        if (std::abs(deviation) > std::abs(best)) { best = deviation; }
+                    }
+                    dst[i] = best;
+                }
+            }
+        });
+    }
+
+}
@@ -1,84 +1,550 @@
 #include "hillshader/terrain.hpp"
 
 #include <algorithm>
-#include <fstream>
-
-#include <nlohmann/json.hpp>
+#include <atomic>
+#include <cmath>
+#include <limits>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "hillshader/dem_codec.hpp"
+#include "hillshader/dem_file.hpp"
+#include "hillshader/paged_terrain.hpp"
+#include "hillshader/parallel.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace
+{
+
+    // clips [t0, t1] to the portion of a ray (along a single axis) that lies in [lo, hi]
+    bool clip(double origin, double direction, double lo, double hi, double& t0, double& t1)
+    {
+        if (direction == 0.0)
+        {
+            return lo <= origin && origin <= hi;
+        }
+
+        double a = (lo - origin) / direction;
+        double b = (hi - origin) / direction;
+        t0 = std::max(t0, std::min(a, b));
+        t1 = std::min(t1, std::max(a, b));
+        return t0 <= t1;
+    }
+
+    // structure-of-arrays copy of a ray packet in texel space. zero direction components are nudged away from zero so
+    // the slab tests never multiply zero by infinity
+    struct alignas(32) ray_packet
+    {
+        float x[hillshader::terrain::c_packet_size];
+        float y[hillshader::terrain::c_packet_size];
+        float z[hillshader::terrain::c_packet_size];
+        float inv_dx[hillshader::terrain::c_packet_size];
+        float inv_dy[hillshader::terrain::c_packet_size];
+        float dz[hillshader::terrain::c_packet_size];
+        float hit[hillshader::terrain::c_packet_size];     // rays stop testing nodes beyond their first hit
+    };
+
+    // the node tests run in single precision, so they are widened to stay conservative (the cells are still
+    // intersected exactly). c_texel_slack is in texels and c_z_slack is relative to the magnitude of the elevations
+    constexpr float c_texel_slack = 1.f / 64.f;
+    constexpr float c_z_slack = 1e-6f;
+    constexpr float c_z_floor = 1e-3f;
+
+    // bit k is set if ray k (among those in active) might cross the surface inside [x0, x1] x [y0, y1] x range
+    uint32_t node_mask(ray_packet const& packet, float x0, float x1, float y0, float y1, stff::interval const& range, uint32_t active)
+    {
+        x0 -= c_texel_slack; x1 += c_texel_slack;
+        y0 -= c_texel_slack; y1 += c_texel_slack;
+#if defined(HILLSHADER_AVX2)
+        __m256 const ox = _mm256_load_ps(packet.x);
+        __m256 const oy = _mm256_load_ps(packet.y);
+        __m256 const inv_dx = _mm256_load_ps(packet.inv_dx);
+        __m256 const inv_dy = _mm256_load_ps(packet.inv_dy);
+        __m256 const tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(x0), ox), inv_dx);
+        __m256 const tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(x1), ox), inv_dx);
+        __m256 const ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(y0), oy), inv_dy);
+        __m256 const ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(y1), oy), inv_dy);
+        __m256 const t0 = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_setzero_ps());
+        __m256 const t1 = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_load_ps(packet.hit));
+
+        __m256 const oz = _mm256_load_ps(packet.z);
+        __m256 const dz = _mm256_load_ps(packet.dz);
+        __m256 const z0 = _mm256_fmadd_ps(t0, dz, oz);
+        __m256 const z1 = _mm256_fmadd_ps(t1, dz, oz);
+        __m256 const abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 const magnitude = _mm256_max_ps(_mm256_and_ps(z0, abs_mask), _mm256_and_ps(z1, abs_mask));
+        __m256 const slack = _mm256_fmadd_ps(magnitude, _mm256_set1_ps(c_z_slack), _mm256_set1_ps(c_z_floor));
+        __m256 const lo = _mm256_sub_ps(_mm256_min_ps(z0, z1), slack);
+        __m256 const hi = _mm256_add_ps(_mm256_max_ps(z0, z1), slack);
+
+        __m256 const inside = _mm256_and_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ),
+            _mm256_and_ps(_mm256_cmp_ps(hi, _mm256_set1_ps(range.a), _CMP_GE_OQ), _mm256_cmp_ps(lo, _mm256_set1_ps(range.b), _CMP_LE_OQ)));
+        return active & static_cast<uint32_t>(_mm256_movemask_ps(inside));
+#else
+        uint32_t mask = 0;
+        for (size_t k = 0; k < hillshader::terrain::c_packet_size; ++k)
+        {
+            if ((active & (1u << k)) == 0) { continue; }
+            float const tx0 = (x0 - packet.x[k]) * packet.inv_dx[k];
+            float const tx1 = (x1 - packet.x[k]) * packet.inv_dx[k];
+            float const ty0 = (y0 - packet.y[k]) * packet.inv_dy[k];
+            float const ty1 = (y1 - packet.y[k]) * packet.inv_dy[k];
+            float const t0 = std::max({ std::min(tx0, tx1), std::min(ty0, ty1), 0.f });
+            float const t1 = std::min({ std::max(tx0, tx1), std::max(ty0, ty1), packet.hit[k] });
+            float const z0 = packet.z[k] + t0 * packet.dz[k];
+            float const z1 = packet.z[k] + t1 * packet.dz[k];
+            float const slack = c_z_floor + c_z_slack * std::max(std::abs(z0), std::abs(z1));
+            if (t0 <= t1 && std::max(z0, z1) + slack >= range.a && std::min(z0, z1) - slack <= range.b)
+            {
+                mask |= 1u << k;
+            }
+        }
+        return mask;
+#endif
+    }
+
+}
+
 namespace hillshader
 {
 
-    terrain::terrain(std::filesystem::path const& path) :
+    static constexpr size_t c_rows_per_progress_step = 64;
+
+    terrain::terrain(std::filesystem::path const& path, progress* progress) : terrain(path, options(), progress) {}
+
+    terrain::terrain(std::filesystem::path const& path, options const& opts, progress* progress) :
+        m_width(0),
+        m_height(0),
+        m_data(nullptr),
+        m_quantized(nullptr)
+    {
+        std::filesystem::path native = dem_file::cache_path(path);
+        bool is_native = path.extension() == dem_file::c_extension;
+        if (path.extension() == dem_codec::c_extension)
+        {
+            load_compressed(path, opts.order, progress);
+        }
+        else if (load_native(native, (is_native) ? std::filesystem::path() : path))
+        {
+            reorder(opts.order);
+        }
+        else if (!is_native)
+        {
+            load_terrarium(path, opts.order, progress);
+            if (m_data)
+            {
+                write_native(native, path);
+            }
+        }
+
+        // the native cache always holds full precision values, so quantization happens after it is written
+        if (opts.quantize && !empty())
+        {
+            quantize();
+        }
+
+        if (!empty())
+        {
+            initialize();
+            if (opts.summed_area) { m_summed_area = summed_area_table(*this); }
+        }
+    }
+
+    terrain::terrain(paged_terrain const& pages, stff::aabb2 const& area, size_t width, size_t height, options const& opts, progress* progress) :
         m_width(0),
-        m_height(0)
+        m_height(0),
+        m_data(nullptr),
+        m_quantized(nullptr)
+    {
+        stff::vec2 const diagonal = area.diagonal();
+        if (pages.empty() || width < 2 || height < 2 || !(diagonal.x > 0.f) || !(diagonal.y > 0.f)) { return; }
+
+        // sample the post centers a row at a time, tracking the elevation range of each chunk as we go
+        std::vector<float> values(width * height);
+        std::vector<stff::interval> ranges(parallel::concurrency());
+        std::atomic<size_t> sampled{ 0 };
+        size_t chunks = parallel::for_each_chunk(0, height, [&](size_t begin, size_t end, size_t chunk)
+        {
+            std::vector<stff::vec2> queries(width);
+            stff::interval& range = ranges[chunk];
+            range = stff::interval(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+            for (size_t j = begin; j < end && !(progress && progress->cancelled()); ++j)
+            {
+                float const y = area.max.y - (static_cast<float>(j) + 0.5f) / static_cast<float>(height) * diagonal.y;
+                for (size_t i = 0; i < width; ++i)
+                {
+                    queries[i] = stff::vec2(area.min.x + (static_cast<float>(i) + 0.5f) / static_cast<float>(width) * diagonal.x, y);
+                }
+
+                float* row = values.data() + j * width;
+                pages.sample(queries.data(), row, width);
+                for (size_t i = 0; i < width; ++i)
+                {
+                    if (std::isnan(row[i])) { continue; }
+                    range.a = std::min(range.a, row[i]);
+                    range.b = std::max(range.b, row[i]);
+                }
+
+                if (progress)
+                {
+                    size_t rows = sampled.fetch_add(1) + 1;
+                    progress->set(static_cast<float>(rows) / static_cast<float>(height));
+                }
+            }
+        });
+
+        if (progress && progress->cancelled()) { return; }
+
+        // reduce the per-chunk elevation ranges. an inverted range means nothing was resident
+        stff::interval range = ranges[0];
+        for (size_t c = 1; c < chunks; ++c)
+        {
+            range.a = std::min(range.a, ranges[c].a);
+            range.b = std::max(range.b, ranges[c].b);
+        }
+        if (range.a > range.b) { return; }
+
+        for (float& value : values)
+        {
+            if (std::isnan(value)) { value = range.a; }
+        }
+
+        m_width = width;
+        m_height = height;
+        m_layout = layout(ordering::row_major, m_width, m_height);
+        m_values = std::move(values);
+        m_data = m_values.data();
+        m_range = range;
+        m_center = pages.center();
+        m_bounds = area;
+
+        reorder(opts.order);
+        if (opts.quantize) { quantize(); }
+
+        initialize();
+        if (opts.summed_area) { m_summed_area = summed_area_table(*this); }
+    }
+
+    void terrain::initialize()
+    {
+        // affine transform from world space to texel space (the y axis flips since rows run north to south)
+        stff::vec2 const diagonal = m_bounds.diagonal();
+        m_texel_scale = stff::vec2(static_cast<float>(m_width) / diagonal.x, -static_cast<float>(m_height) / diagonal.y);
+        m_texel_offset = stff::vec2(-m_bounds.min.x * m_texel_scale.x - 0.5f, -m_bounds.max.y * m_texel_scale.y - 0.5f);
+
+        m_pyramid = pyramid(*this);
+    }
+
+    bool terrain::load_native(std::filesystem::path const& path, std::filesystem::path const& source)
+    {
+        mapped_file file(path);
+        dem_file::header const* hdr = dem_file::validate(file);
+        if (!hdr || (!source.empty() && !dem_file::is_current(*hdr, source)))
+        {
+            return false;
+        }
+
+        if (hdr->tile_size != 0 && hdr->tile_size != layout::c_tile_size)
+        {
+            return false;
+        }
+
+        m_width = static_cast<size_t>(hdr->width);
+        m_height = static_cast<size_t>(hdr->height);
+        m_layout = layout((hdr->tile_size == 0) ? ordering::row_major : ordering::tiled, m_width, m_height);
+        m_range = stff::interval(hdr->range[0], hdr->range[1]);
+        set_bounds(stfd::vec2(hdr->min[0], hdr->min[1]), stfd::vec2(hdr->max[0], hdr->max[1]));
+
+        m_data = dem_file::payload(file, *hdr);
+        m_mapping = std::move(file);
+        return true;
+    }
+
+    void terrain::load_terrarium(std::filesystem::path const& path, ordering order, progress* progress)
     {
         int width = 0;
         int height = 0;
         int channels = 0;
-
         unsigned char* img = stbi_load(path.string().c_str(), &width, &height, &channels, 0);
-        if (img)
+        if (img && channels >= 3)
         {
             m_width = static_cast<size_t>(width);
             m_height = static_cast<size_t>(height);
 
-            m_values.reserve(m_width * m_height);
+            m_layout = layout(order, m_width, m_height);
+            m_values.resize(m_layout.size());
 
-            unsigned char* ptr = img;
-            for (int p = 0; p < width * height; ++p)
+            // decode the rows in parallel, tracking the elevation range of each chunk as we go. row-major storage is
+            // decoded in place while other orderings decode a band of rows at a time and then scatter it
+            std::vector<stff::interval> ranges(parallel::concurrency());
+            std::atomic<size_t> decoded{ 0 };
+            size_t chunks = parallel::for_each_chunk(0, m_height, [&](size_t begin, size_t end, size_t chunk)
             {
-                float r = static_cast<float>(*ptr++);
-                float g = static_cast<float>(*ptr++);
-                float b = static_cast<float>(*ptr++);
-                float elevation = (r * 256.f + g + b / 256.f) - 32768.f;
-                m_values.push_back(elevation);
+                bool const in_place = m_layout.order == ordering::row_major;
+                std::vector<float> band((in_place) ? 0 : m_width * c_rows_per_progress_step);
+
+                stff::interval& range = ranges[chunk];
+                range = stff::interval(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+                for (size_t j = begin; j < end && !(progress && progress->cancelled()); j += c_rows_per_progress_step)
+                {
+                    size_t const last = std::min(end, j + c_rows_per_progress_step);
+                    float* out = (in_place) ? m_values.data() + j * m_width : band.data();
+                    stff::interval step = terrarium::decode(img, static_cast<size_t>(channels), m_width, j, last, out);
+                    if (!in_place)
+                    {
+                        store_rows(j, last, out);
+                    }
+                    range.a = std::min(range.a, step.a);
+                    range.b = std::max(range.b, step.b);
+                    if (progress)
+                    {
+                        size_t rows = decoded.fetch_add(last - j) + (last - j);
+                        progress->set(static_cast<float>(rows) / static_cast<float>(m_height));
+                    }
+                }
+            });
+
+            // reduce the per-chunk elevation ranges
+            m_range = ranges[0];
+            for (size_t c = 1; c < chunks; ++c)
+            {
+                m_range.a = std::min(m_range.a, ranges[c].a);
+                m_range.b = std::max(m_range.b, ranges[c].b);
             }
+        }
 
+        if (img)
+        {
             stbi_image_free(img);
+        }
+
+        if (progress && progress->cancelled())
+        {
+            m_width = 0;
+            m_height = 0;
+            m_values = std::vector<float>();
+        }
+
+        // a terrarium image without (valid) bounds in its sidecar leaves the terrain empty
+        stfd::vec2 min, max;
+        if (m_width > 0 && m_height > 0 && !terrarium::read_sidecar(path, min, max))
+        {
+            m_width = 0;
+            m_height = 0;
+            m_values = std::vector<float>();
+        }
+
+        if (m_width > 0 && m_height > 0)
+        {
+            m_data = m_values.data();
+            set_bounds(min, max);
+        }
+    }
+
+    void terrain::load_compressed(std::filesystem::path const& path, ordering order, progress* progress)
+    {
+        mapped_file file(path);
+        dem_codec::header const* hdr = dem_codec::validate(file);
+        if (!hdr) { return; }
 
-            // compute elevation range
+        m_width = static_cast<size_t>(hdr->width);
+        m_height = static_cast<size_t>(hdr->height);
+        m_layout = layout(order, m_width, m_height);
+        m_values.resize(m_layout.size());
+
+        // row-major storage is decoded in place while other orderings decode each tile and then scatter it
+        size_t const tiles = static_cast<size_t>(dem_codec::tile_count(*hdr));
+        std::atomic<size_t> decoded{ 0 };
+        std::atomic<bool> corrupt{ false };
+        parallel::for_each_chunk(0, tiles, [&](size_t begin, size_t end, size_t)
+        {
+            bool const in_place = m_layout.order == ordering::row_major;
+            std::vector<float> scratch((in_place) ? 0 : hdr->tile_size * hdr->tile_size);
+            for (size_t t = begin; t < end && !(progress && progress->cancelled()) && !corrupt.load(std::memory_order_relaxed); ++t)
             {
-                m_range = stff::interval(m_values[0], m_values[0]);
-                for (float elevation : m_values)
+                dem_codec::tile_rect const rect = dem_codec::tile_extent(*hdr, t);
+                float* out = (in_place) ? m_values.data() + rect.x + m_width * rect.y : scratch.data();
+                if (!dem_codec::decode_tile(file, *hdr, t, out, (in_place) ? m_width : rect.width))
+                {
+                    corrupt.store(true, std::memory_order_relaxed);
+                    break;
+                }
+
+                if (!in_place)
                 {
-                    m_range.a = std::min(m_range.a, elevation);
-                    m_range.b = std::max(m_range.b, elevation);
+                    for (size_t j = 0; j < rect.height; ++j)
+                    {
+                        for (size_t i = 0; i < rect.width; ++i)
+                        {
+                            m_values[m_layout.index(rect.x + i, rect.y + j)] = scratch[i + rect.width * j];
+                        }
+                    }
+                }
+
+                if (progress)
+                {
+                    progress->set(static_cast<float>(decoded.fetch_add(1) + 1) / static_cast<float>(tiles));
                 }
             }
+        });
+
+        if (corrupt.load() || (progress && progress->cancelled()))
+        {
+            m_width = 0;
+            m_height = 0;
+            m_values = std::vector<float>();
+            return;
+        }
 
-            // read in metadata
+        m_data = m_values.data();
+        m_range = stff::interval(hdr->range[0], hdr->range[1]);
+        set_bounds(stfd::vec2(hdr->min[0], hdr->min[1]), stfd::vec2(hdr->max[0], hdr->max[1]));
+    }
+
+    void terrain::write_native(std::filesystem::path const& path, std::filesystem::path const& source) const
+    {
+        dem_file::header hdr = {};
+        hdr.tile_size = static_cast<uint32_t>(m_layout.tile_size());
+        hdr.width = static_cast<uint64_t>(m_width);
+        hdr.height = static_cast<uint64_t>(m_height);
+        hdr.min[0] = m_center.x + m_bounds.min.x; hdr.min[1] = m_center.y + m_bounds.min.y;
+        hdr.max[0] = m_center.x + m_bounds.max.x; hdr.max[1] = m_center.y + m_bounds.max.y;
+        hdr.range[0] = m_range.a;
+        hdr.range[1] = m_range.b;
+        dem_file::stamp(hdr, source);
+
+        // a failure here only means the next load decodes the png again
+        dem_file::write(path, hdr, m_data);
+    }
+
+    void terrain::reorder(ordering order)
+    {
+        if (order == m_layout.order) { return; }
+
+        layout const target(order, m_width, m_height);
+        std::vector<float> values(target.size());
+        parallel::for_each_chunk(0, m_height, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t j = begin; j < end; ++j)
             {
-                std::string json_path = path.parent_path().string() + "/" + path.stem().string() + ".json";
-                std::ifstream ifs(json_path);
-                nlohmann::json json = nlohmann::json::parse(ifs);
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    values[target.index(i, j)] = read(i, j);
+                }
+            }
+        });
 
-                stfd::vec2 min(json["min"][0], json["min"][1]);
-                stfd::vec2 max(json["max"][0], json["max"][1]);
+        m_values = std::move(values);
+        m_data = m_values.data();
+        m_layout = target;
+        m_mapping.close();
+    }
 
-                stfd::vec2 center = 0.5 * (min + max);
-                min -= center;
-                max -= center;
+    void terrain::store_rows(size_t begin, size_t end, float const* src)
+    {
+        for (size_t j = begin; j < end; ++j)
+        {
+            float const* row = src + (j - begin) * m_width;
+            for (size_t i = 0; i < m_width; ++i)
+            {
+                m_values[m_layout.index(i, j)] = row[i];
+            }
+        }
+    }
+
+    void terrain::quantize()
+    {
+        float const span = m_range.b - m_range.a;
+        m_quantization.offset = m_range.a;
+        m_quantization.scale = (span > 0.f) ? span / 65535.f : 1.f;
+
+        std::vector<uint16_t> quantized(m_layout.size() + 1, 0);
+        uint16_t* dst = quantized.data() + 1;
 
-                m_bounds = stff::aabb2(min.as<float>(), max.as<float>());
+        // quantize each row in parallel, measuring the actual error so the reported bound is exact
+        std::vector<float> errors(parallel::concurrency(), 0.f);
+        size_t chunks = parallel::for_each_chunk(0, m_height, [&](size_t begin, size_t end, size_t chunk)
+        {
+            float max_error = 0.f;
+            for (size_t j = begin; j < end; ++j)
+            {
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    size_t const index = m_layout.index(i, j);
+                    float const elevation = m_data[index];
+                    float const scaled = std::round((elevation - m_quantization.offset) / m_quantization.scale);
+                    uint16_t const value = static_cast<uint16_t>(std::clamp(scaled, 0.f, 65535.f));
+                    dst[index] = value;
+                    max_error = std::max(max_error, std::abs(dequantize(value) - elevation));
+                }
+            }
+            errors[chunk] = max_error;
+        });
+        m_quantization.max_error = *std::max_element(errors.begin(), errors.begin() + chunks);
+
+        m_quantized_values = std::move(quantized);
+        m_quantized = m_quantized_values.data() + 1;
+
+        m_values = std::vector<float>();
+        m_mapping.close();
+        m_data = nullptr;
+    }
+
+    void terrain::copy_quantized_rows(size_t begin, size_t end, uint16_t* dst) const
+    {
+        if (m_layout.order == ordering::row_major)
+        {
+            std::copy(m_quantized + begin * m_width, m_quantized + end * m_width, dst);
+        }
+        else
+        {
+            for (size_t j = begin; j < end; ++j)
+            {
+                uint16_t* row = dst + (j - begin) * m_width;
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    row[i] = m_quantized[m_layout.index(i, j)];
+                }
             }
         }
     }
 
-    float terrain::sample(stff::vec2 const& query) const
+    void terrain::copy_rows(size_t begin, size_t end, float* dst) const
     {
-        stff::aabb2 const bounds = m_bounds.as<float>();
-        if (bounds.contains(query))
+        if (m_data && m_layout.order == ordering::row_major)
+        {
+            std::copy(m_data + begin * m_width, m_data + end * m_width, dst);
+        }
+        else
         {
-            stff::vec2 top_left(bounds.min.x, bounds.max.y);
-            stff::vec2 bottom_right(bounds.max.x, bounds.min.y);
+            for (size_t j = begin; j < end; ++j)
+            {
+                float* row = dst + (j - begin) * m_width;
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    row[i] = read(i, j);
+                }
+            }
+        }
+    }
+
+    void terrain::set_bounds(stfd::vec2 const& min, stfd::vec2 const& max)
+    {
+        m_center = 0.5 * (min + max);
+        m_bounds = stff::aabb2((min - m_center).as<float>(), (max - m_center).as<float>());
+    }
 
-            stff::vec2 uv = (query - top_left) / (bottom_right - top_left);
+
+    float terrain::sample_one(stff::vec2 const& query) const
+    {
+        if (m_bounds.contains(query))
+        {
             // compute the index of the pixel that is left and up from the sample location
-            int i = static_cast<int>(uv.x * m_width  - 0.5f);
-            int j = static_cast<int>(uv.y * m_height - 0.5f);
+            stff::vec2 texel = to_texel(query);
+            int i = static_cast<int>(texel.x);
+            int j = static_cast<int>(texel.y);
 
             int clamped_i = std::clamp(i, 0, static_cast<int>(m_width)  - 2);
             int clamped_j = std::clamp(j, 0, static_cast<int>(m_height) - 2);
@@ -89,12 +555,11 @@ namespace hillshader
             else                                    // otherwise, use bilinear interpolation
             {
                 // read the four surrounding elevation values
-                float a = read(i, j);     float b = read(i + 1, j);
-                float c = read(i, j + 1); float d = read(i + 1, j + 1);
+                auto [a, b, c, d] = read_quad(i, j);
 
                 // compute the interpolation times
-                float s = stf::math::lerp_inv((i + 0.5f), (i + 1.5f), uv.x * m_width);
-                float t = stf::math::lerp_inv((j + 0.5f), (j + 1.5f), uv.y * m_height);
+                float s = texel.x - static_cast<float>(i);
+                float t = texel.y - static_cast<float>(j);
 
                 float top = stf::math::lerp(a, b, s);
                 float bottom = stf::math::lerp(c, d, s);
@@ -109,26 +574,366 @@ namespace hillshader
         }
     }
 
-    std::optional<stff::vec3> terrain::intersect(stff::ray3 const& ray) const
+    void terrain::sample(stff::vec2 const* queries, float* elevations, size_t count) const
     {
-        // this algorithm marches along a ray until the ray crosses the terrain or until the maximum distance is reached
-        float initial_step = 0.1f;
-        bool initially_above = ray.origin.z >= sample(ray.origin.xy);
-        float dist = initial_step;
-        for (size_t i = 1; dist <= 100'000.f; ++i)
+        size_t q = 0;
+
+#if defined(HILLSHADER_AVX2)
+        // the gathers use 32-bit indices
+        if (m_layout.size() <= static_cast<size_t>(std::numeric_limits<int32_t>::max()))
         {
-            size_t scaler = i * i;  // the scaler grows quadratically because detail decreases at that rate
-            dist = static_cast<float>(scaler) * initial_step;
-            stff::vec3 position = ray.origin + dist * ray.direction;
-            bool above = position.z >= sample(position.xy);
-            if (above != initially_above)
+            __m256 const scale_x = _mm256_set1_ps(m_texel_scale.x);
+            __m256 const scale_y = _mm256_set1_ps(m_texel_scale.y);
+            __m256 const offset_x = _mm256_set1_ps(m_texel_offset.x);
+            __m256 const offset_y = _mm256_set1_ps(m_texel_offset.y);
+            __m256 const min_x = _mm256_set1_ps(m_bounds.min.x);
+            __m256 const min_y = _mm256_set1_ps(m_bounds.min.y);
+            __m256 const max_x = _mm256_set1_ps(m_bounds.max.x);
+            __m256 const max_y = _mm256_set1_ps(m_bounds.max.y);
+            __m256 const outside = _mm256_set1_ps(m_range.a);
+            __m256 const quantized_scale = _mm256_set1_ps(m_quantization.scale);
+            __m256 const quantized_offset = _mm256_set1_ps(m_quantization.offset);
+            __m256i const zero = _mm256_setzero_si256();
+            __m256i const max_i = _mm256_set1_epi32(static_cast<int>(m_width) - 2);
+            __m256i const max_j = _mm256_set1_epi32(static_cast<int>(m_height) - 2);
+            __m256i const stride = _mm256_set1_epi32(static_cast<int>(m_width));
+            __m256i const one = _mm256_set1_epi32(1);
+            __m256i const tiles_x = _mm256_set1_epi32(static_cast<int>(m_layout.tiles_x));
+            __m256i const tile_mask = _mm256_set1_epi32(static_cast<int>(layout::c_tile_mask));
+            bool const tiled = m_layout.order == ordering::tiled;
+
+            // gathers eight elevations. quantized values are read as the high half of the 32-bit word that ends with
+            // them, which stays in bounds because of the leading slack element
+            auto fetch = [&](__m256i index)
+            {
+                if (m_data)
+                {
+                    return _mm256_i32gather_ps(m_data, index, 4);
+                }
+                else
+                {
+                    int const* base = reinterpret_cast<int const*>(m_quantized - 1);
+                    __m256i words = _mm256_i32gather_epi32(base, index, 2);
+                    __m256 values = _mm256_cvtepi32_ps(_mm256_srli_epi32(words, 16));
+                    return _mm256_fmadd_ps(values, quantized_scale, quantized_offset);
+                }
+            };
+
+            // vectorized layout::index for the tiled ordering
+            auto tiled_index = [&](__m256i i, __m256i j)
             {
-                return position;
+                int const shift = static_cast<int>(layout::c_tile_shift);
+                __m256i tile = _mm256_add_epi32(_mm256_srli_epi32(i, shift), _mm256_mullo_epi32(tiles_x, _mm256_srli_epi32(j, shift)));
+                __m256i local = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(j, tile_mask), shift), _mm256_and_si256(i, tile_mask));
+                return _mm256_or_si256(_mm256_slli_epi32(tile, 2 * shift), local);
+            };
+
+            for (; q + 8 <= count; q += 8)
+            {
+                // deinterleave eight (x, y) pairs
+                float const* ptr = reinterpret_cast<float const*>(queries + q);
+                __m256 lo = _mm256_loadu_ps(ptr);
+                __m256 hi = _mm256_loadu_ps(ptr + 8);
+                __m256 xs = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+                __m256 ys = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+                xs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs), _MM_SHUFFLE(3, 1, 2, 0)));
+                ys = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(ys), _MM_SHUFFLE(3, 1, 2, 0)));
+
+                __m256 inside = _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(min_x, xs, _CMP_LE_OQ), _mm256_cmp_ps(xs, max_x, _CMP_LE_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(min_y, ys, _CMP_LE_OQ), _mm256_cmp_ps(ys, max_y, _CMP_LE_OQ)));
+
+                __m256 tx = _mm256_fmadd_ps(scale_x, xs, offset_x);
+                __m256 ty = _mm256_fmadd_ps(scale_y, ys, offset_y);
+                __m256i i = _mm256_cvttps_epi32(tx);
+                __m256i j = _mm256_cvttps_epi32(ty);
+                __m256i ci = _mm256_min_epi32(_mm256_max_epi32(i, zero), max_i);
+                __m256i cj = _mm256_min_epi32(_mm256_max_epi32(j, zero), max_j);
+                __m256 boundary = _mm256_castsi256_ps(_mm256_or_si256(
+                    _mm256_xor_si256(_mm256_cmpeq_epi32(i, ci), _mm256_set1_epi32(-1)),
+                    _mm256_xor_si256(_mm256_cmpeq_epi32(j, cj), _mm256_set1_epi32(-1))));
+
+                // gather the 2x2 neighborhood (clamped indices keep every lane in bounds)
+                __m256i ia, ib, ic, id;
+                if (tiled)
+                {
+                    __m256i ci1 = _mm256_add_epi32(ci, one);
+                    __m256i cj1 = _mm256_add_epi32(cj, one);
+                    ia = tiled_index(ci, cj);  ib = tiled_index(ci1, cj);
+                    ic = tiled_index(ci, cj1); id = tiled_index(ci1, cj1);
+                }
+                else
+                {
+                    ia = _mm256_add_epi32(ci, _mm256_mullo_epi32(cj, stride));
+                    ib = _mm256_add_epi32(ia, one);
+                    ic = _mm256_add_epi32(ia, stride);
+                    id = _mm256_add_epi32(ic, one);
+                }
+                __m256 a = fetch(ia);
+                __m256 b = fetch(ib);
+                __m256 c = fetch(ic);
+                __m256 d = fetch(id);
+
+                __m256 s = _mm256_sub_ps(tx, _mm256_cvtepi32_ps(ci));
+                __m256 t = _mm256_sub_ps(ty, _mm256_cvtepi32_ps(cj));
+                __m256 top = _mm256_fmadd_ps(_mm256_sub_ps(b, a), s, a);
+                __m256 bottom = _mm256_fmadd_ps(_mm256_sub_ps(d, c), s, c);
+                __m256 elevation = _mm256_fmadd_ps(_mm256_sub_ps(bottom, top), t, top);
+
+                elevation = _mm256_blendv_ps(elevation, a, boundary);
+                elevation = _mm256_blendv_ps(outside, elevation, inside);
+                _mm256_storeu_ps(elevations + q, elevation);
             }
         }
+#endif
+
+        for (; q < count; ++q)
+        {
+            elevations[q] = sample_one(queries[q]);
+        }
+    }
+
+    terrain::texel_ray terrain::to_texel(stff::ray3 const& ray) const
+    {
+        texel_ray texel;
+        texel.x = static_cast<double>(m_texel_scale.x) * ray.origin.x + m_texel_offset.x;
+        texel.y = static_cast<double>(m_texel_scale.y) * ray.origin.y + m_texel_offset.y;
+        texel.z = ray.origin.z;
+        texel.dx = static_cast<double>(m_texel_scale.x) * ray.direction.x;
+        texel.dy = static_cast<double>(m_texel_scale.y) * ray.direction.y;
+        texel.dz = ray.direction.z;
+        return texel;
+    }
+
+    std::optional<stff::vec3> terrain::intersect(stff::ray3 const& ray) const
+    {
+        if (m_pyramid.empty()) { return {}; }
+
+        std::optional<double> t = intersect(to_texel(ray), m_pyramid.top(), 0, 0, 0.0, std::numeric_limits<double>::max());
+        if (t)
+        {
+            return ray.origin + static_cast<float>(*t) * ray.direction;
+        }
 
         // fall-through case
         return {};
     }
 
+    void terrain::intersect(std::array<stff::ray3, c_packet_size> const& rays, std::array<float, c_packet_size>& hits) const
+    {
+        hits.fill(std::numeric_limits<float>::infinity());
+        if (m_pyramid.empty()) { return; }
+
+        std::array<texel_ray, c_packet_size> texels;
+        bool coherent = true;
+        for (size_t k = 0; k < c_packet_size; ++k)
+        {
+            texels[k] = to_texel(rays[k]);
+            coherent = coherent && std::signbit(texels[k].dx) == std::signbit(texels[0].dx) && std::signbit(texels[k].dy) == std::signbit(texels[0].dy);
+        }
+
+        // the shared traversal order below is front-to-back only for rays that head into the same quadrant, so
+        // packets that straddle an axis fall back to tracing their rays one at a time
+        if (!coherent)
+        {
+            for (size_t k = 0; k < c_packet_size; ++k)
+            {
+                std::optional<double> t = intersect(texels[k], m_pyramid.top(), 0, 0, 0.0, std::numeric_limits<double>::max());
+                if (t) { hits[k] = static_cast<float>(*t); }
+            }
+            return;
+        }
+
+        ray_packet packet;
+        for (size_t k = 0; k < c_packet_size; ++k)
+        {
+            double const dx = (std::abs(texels[k].dx) < 1e-20) ? std::copysign(1e-20, texels[k].dx) : texels[k].dx;
+            double const dy = (std::abs(texels[k].dy) < 1e-20) ? std::copysign(1e-20, texels[k].dy) : texels[k].dy;
+            packet.x[k] = static_cast<float>(texels[k].x);
+            packet.y[k] = static_cast<float>(texels[k].y);
+            packet.z[k] = static_cast<float>(texels[k].z);
+            packet.inv_dx[k] = static_cast<float>(1.0 / dx);
+            packet.inv_dy[k] = static_cast<float>(1.0 / dy);
+            packet.dz[k] = static_cast<float>(texels[k].dz);
+            packet.hit[k] = std::numeric_limits<float>::infinity();
+        }
+        std::array<double, c_packet_size> first;
+        first.fill(std::numeric_limits<double>::max());
+
+        // children are visited nearest corner first. a ray that crosses a node passes through at most one of the two
+        // side children, so this order is front-to-back for every ray in the packet
+        size_t const flip_x = std::signbit(texels[0].dx) ? 1 : 0;
+        size_t const flip_y = std::signbit(texels[0].dy) ? 1 : 0;
+
+        struct node { size_t level, i, j; uint32_t active; };
+        std::array<node, 4 * 64> stack;
+        size_t size = 0;
+        stack[size++] = { m_pyramid.top(), 0, 0, (1u << c_packet_size) - 1 };
+        while (size > 0)
+        {
+            node const n = stack[--size];
+            float const x0 = static_cast<float>(n.i << n.level);
+            float const y0 = static_cast<float>(n.j << n.level);
+            float const x1 = static_cast<float>(std::min((n.i + 1) << n.level, m_pyramid.cells_x()));
+            float const y1 = static_cast<float>(std::min((n.j + 1) << n.level, m_pyramid.cells_y()));
+            uint32_t const active = node_mask(packet, x0, x1, y0, y1, m_pyramid.range(n.level, n.i, n.j), n.active);
+            if (active == 0) { continue; }
+
+            if (n.level == 0)
+            {
+                // solve the cell exactly for each ray that reached it
+                for (size_t k = 0; k < c_packet_size; ++k)
+                {
+                    if ((active & (1u << k)) == 0) { continue; }
+                    double t0 = 0.0;
+                    double t1 = first[k];
+                    if (clip(texels[k].x, texels[k].dx, static_cast<double>(n.i), static_cast<double>(n.i + 1), t0, t1) &&
+                        clip(texels[k].y, texels[k].dy, static_cast<double>(n.j), static_cast<double>(n.j + 1), t0, t1))
+                    {
+                        std::optional<double> t = intersect_cell(texels[k], n.i, n.j, t0, t1);
+                        if (t && *t < first[k])
+                        {
+                            first[k] = *t;
+                            packet.hit[k] = static_cast<float>(*t);
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // push in reverse so the nearest child is popped first
+            size_t const level = n.level - 1;
+            for (size_t c = 4; c-- > 0;)
+            {
+                size_t const ci = 2 * n.i + ((c & 1) ^ flip_x);
+                size_t const cj = 2 * n.j + ((c >> 1) ^ flip_y);
+                if (ci < m_pyramid.width(level) && cj < m_pyramid.height(level))
+                {
+                    stack[size++] = { level, ci, cj, active };
+                }
+            }
+        }
+
+        for (size_t k = 0; k < c_packet_size; ++k)
+        {
+            if (first[k] < std::numeric_limits<double>::max()) { hits[k] = static_cast<float>(first[k]); }
+        }
+    }
+
+    std::optional<double> terrain::intersect(texel_ray const& ray, size_t level, size_t i, size_t j, double t0, double t1) const
+    {
+        // clip the ray to the node
+        double const x0 = static_cast<double>(i << level);
+        double const y0 = static_cast<double>(j << level);
+        double const x1 = static_cast<double>(std::min((i + 1) << level, m_pyramid.cells_x()));
+        double const y1 = static_cast<double>(std::min((j + 1) << level, m_pyramid.cells_y()));
+        if (!clip(ray.x, ray.dx, x0, x1, t0, t1) || !clip(ray.y, ray.dy, y0, y1, t0, t1))
+        {
+            return {};
+        }
+
+        // skip the node if the ray passes entirely above or below it
+        stff::interval const range = m_pyramid.range(level, i, j);
+        double const z0 = ray.z + t0 * ray.dz;
+        double const z1 = ray.z + t1 * ray.dz;
+        if (std::max(z0, z1) < range.a || std::min(z0, z1) > range.b)
+        {
+            return {};
+        }
+
+        if (level == 0)
+        {
+            return intersect_cell(ray, i, j, t0, t1);
+        }
+
+        // otherwise visit the children in the order the ray enters them
+        struct child { size_t i, j; double t0, t1; };
+        std::array<child, 4> children;
+        size_t count = 0;
+        for (size_t cj = 2 * j; cj < std::min(2 * j + 2, m_pyramid.height(level - 1)); ++cj)
+        {
+            for (size_t ci = 2 * i; ci < std::min(2 * i + 2, m_pyramid.width(level - 1)); ++ci)
+            {
+                child c = { ci, cj, t0, t1 };
+                double const cx0 = static_cast<double>(ci << (level - 1));
+                double const cy0 = static_cast<double>(cj << (level - 1));
+                double const cx1 = static_cast<double>(std::min((ci + 1) << (level - 1), m_pyramid.cells_x()));
+                double const cy1 = static_cast<double>(std::min((cj + 1) << (level - 1), m_pyramid.cells_y()));
+                if (clip(ray.x, ray.dx, cx0, cx1, c.t0, c.t1) && clip(ray.y, ray.dy, cy0, cy1, c.t0, c.t1))
+                {
+                    children[count++] = c;
+                }
+            }
+        }
+        std::sort(children.begin(), children.begin() + count, [](child const& lhs, child const& rhs) { return lhs.t0 < rhs.t0; });
+
+        for (size_t c = 0; c < count; ++c)
+        {
+            std::optional<double> t = intersect(ray, level - 1, children[c].i, children[c].j, children[c].t0, children[c].t1);
+            if (t) { return t; }
+        }
+
+        return {};
+    }
+
+    std::optional<double> terrain::intersect_cell(texel_ray const& ray, size_t i, size_t j, double t0, double t1) const
+    {
+        // bilinear surface h(s, u) = a + e1 * s + e2 * u + e3 * s * u in cell-local coordinates
+        std::array<float, 4> const quad = read_quad(i, j);
+        double const a = quad[0]; double const b = quad[1];
+        double const c = quad[2]; double const d = quad[3];
+        double const e1 = b - a;
+        double const e2 = c - a;
+        double const e3 = a - b - c + d;
+
+        // substituting the ray gives the quadratic f(t) = z(t) - h(t) = qa * t^2 + qb * t + qc
+        double const s0 = ray.x - static_cast<double>(i);
+        double const u0 = ray.y - static_cast<double>(j);
+        double const qa = -e3 * ray.dx * ray.dy;
+        double const qb = ray.dz - e1 * ray.dx - e2 * ray.dy - e3 * (s0 * ray.dy + u0 * ray.dx);
+        double const qc = ray.z - a - e1 * s0 - e2 * u0 - e3 * s0 * u0;
+
+        auto f = [=](double t) { return (qa * t + qb) * t + qc; };
+        double const f0 = f(t0);
+        double const f1 = f(t1);
+        if (f0 == 0.0) { return t0; }
+
+        // collect the real roots (using the numerically stable form of the quadratic formula)
+        std::array<double, 2> roots;
+        size_t count = 0;
+        if (qa == 0.0)
+        {
+            if (qb != 0.0) { roots[count++] = -qc / qb; }
+        }
+        else
+        {
+            double const discriminant = qb * qb - 4.0 * qa * qc;
+            if (discriminant >= 0.0)
+            {
+                double const q = -0.5 * (qb + std::copysign(std::sqrt(discriminant), qb));
+                roots[count++] = q / qa;
+                if (q != 0.0) { roots[count++] = qc / q; }
+            }
+        }
+
+        double const tolerance = 1e-9 * std::max(1.0, std::abs(t1));
+        std::optional<double> first;
+        for (size_t r = 0; r < count; ++r)
+        {
+            double const t = roots[r];
+            if (t0 - tolerance <= t && t <= t1 + tolerance && (!first || t < *first))
+            {
+                first = std::clamp(t, t0, t1);
+            }
+        }
+
+        // guard against a sign change that rounding pushed out of the interval
+        if (!first && (f0 < 0.0) != (f1 < 0.0))
+        {
+            first = t1;
+        }
+
+        return first;
+    }
+
 }
\ No newline at end of file
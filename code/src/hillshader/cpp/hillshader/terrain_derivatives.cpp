@@ -0,0 +1,189 @@
+#include "hillshader/terrain_derivatives.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hillshader/dem_file.hpp"
+#include "hillshader/parallel.hpp"
+
+namespace hillshader::terrain_derivatives
+{
+
+    namespace
+    {
+
+        // scale of the curvature raster (the convention of common GIS tools)
+        constexpr float c_curvature_scale = 100.f;
+
+        // the posts on either side of index along an axis of n posts, clamped at the edges
+        struct neighbors
+        {
+            size_t lo;
+            size_t hi;
+        };
+
+        inline neighbors around(size_t index, size_t n)
+        {
+            return { (index > 0) ? index - 1 : 0, std::min(index + 1, n - 1) };
+        }
+
+        // 1 / (4 * distance between the neighbors), the scale of Horn's weighted differences (whose weights sum to 4).
+        // edge posts use a one sided difference over a single spacing. 0 if the axis has a single post
+        inline float horn_scale(neighbors const& nb, float spacing)
+        {
+            return (nb.hi > nb.lo) ? 1.f / (4.f * static_cast<float>(nb.hi - nb.lo) * spacing) : 0.f;
+        }
+
+    }
+
+    bool compute(terrain const& terrain, options const& opts, sink const& consume, progress* progress)
+    {
+        if (terrain.empty()) { return false; }
+
+        size_t const width = terrain.width();
+        size_t const height = terrain.height();
+        size_t const strip = std::max<size_t>(1, opts.strip_rows);
+        stff::vec2 const size = terrain.bounds().diagonal();
+        float const dx = size.x / static_cast<float>(width);
+        float const dy = size.y / static_cast<float>(height);
+        float const inv_dx2 = 1.f / (dx * dx);
+        float const inv_dy2 = 1.f / (dy * dy);
+        float const interior_x = horn_scale({ 0, 2 }, dx);
+        shading::light_set const lights = shading::resolve(opts.lighting);
+
+        // row-major float terrains are read in place. otherwise each strip and its halo are copied out first
+        bool const in_place = terrain.values() != nullptr && terrain.storage().order == ordering::row_major;
+        std::vector<float> input((in_place) ? 0 : (strip + 2) * width);
+
+        std::array<std::vector<float>, count> outputs;
+        std::array<float const*, count> rows = {};
+        for (size_t r = 0; r < count; ++r)
+        {
+            if (!opts.rasters[r]) { continue; }
+            outputs[r].resize(strip * width);
+            rows[r] = outputs[r].data();
+        }
+
+        for (size_t begin = 0; begin < height; begin += strip)
+        {
+            if (progress && progress->cancelled()) { return false; }
+
+            size_t const end = std::min(height, begin + strip);
+            size_t const first = (begin > 0) ? begin - 1 : 0;
+            size_t const last = std::min(height, end + 1);
+            float const* posts = input.data();
+            if (in_place)
+            {
+                posts = terrain.values() + first * width;
+            }
+            else
+            {
+                parallel::for_each_chunk(first, last, [&](size_t lo, size_t hi, size_t)
+                {
+                    terrain.copy_rows(lo, hi, input.data() + (lo - first) * width);
+                });
+            }
+
+            parallel::for_each_chunk(begin, end, [&](size_t lo, size_t hi, size_t)
+            {
+                for (size_t j = lo; j < hi; ++j)
+                {
+                    neighbors const ns = around(j, height);
+                    float const* north = posts + (ns.lo - first) * width;
+                    float const* center = posts + (j - first) * width;
+                    float const* south = posts + (ns.hi - first) * width;
+                    float const scale_y = horn_scale(ns, dy);
+                    bool const interior_y = ns.hi - ns.lo == 2;
+                    size_t const offset = (j - begin) * width;
+
+                    for (size_t i = 0; i < width; ++i)
+                    {
+                        neighbors const we = around(i, width);
+                        size_t const w = we.lo;
+                        size_t const e = we.hi;
+
+                        // world y is north, so rows increase toward -y
+                        float const scale_x = (e - w == 2) ? interior_x : horn_scale(we, dx);
+                        float const dz_dx = scale_x * ((north[e] + 2.f * center[e] + south[e]) - (north[w] + 2.f * center[w] + south[w]));
+                        float const dz_dy = scale_y * ((north[w] + 2.f * north[i] + north[e]) - (south[w] + 2.f * south[i] + south[e]));
+
+                        if (rows[slope])
+                        {
+                            outputs[slope][offset + i] = stf::math::to_degrees(std::atan(std::sqrt(dz_dx * dz_dx + dz_dy * dz_dy)));
+                        }
+                        if (rows[aspect])
+                        {
+                            // the downhill direction, measured clockwise from north
+                            float degrees = -1.f;
+                            if (dz_dx != 0.f || dz_dy != 0.f)
+                            {
+                                degrees = stf::math::to_degrees(std::atan2(-dz_dx, -dz_dy));
+                                degrees += (degrees < 0.f) ? 360.f : 0.f;      // also turns -0 into 0
+                            }
+                            outputs[aspect][offset + i] = degrees;
+                        }
+                        if (rows[curvature])
+                        {
+                            // second differences need a post on both sides, so edges only curve along the other axis
+                            float const d2x = (e - w == 2) ? (center[w] + center[e] - 2.f * center[i]) * inv_dx2 : 0.f;
+                            float const d2y = (interior_y) ? (north[i] + south[i] - 2.f * center[i]) * inv_dy2 : 0.f;
+                            outputs[curvature][offset + i] = -c_curvature_scale * (d2x + d2y);
+                        }
+                        if (rows[hillshade])
+                        {
+                            stff::vec3 const normal(-dz_dx, -dz_dy, 1.f);
+                            outputs[hillshade][offset + i] = shading::intensity(lights, opts.lighting.ambient_intensity, normal, opts.lighting.exaggeration);
+                        }
+                    }
+                }
+            });
+
+            if (!consume(begin, end, rows)) { return false; }
+            if (progress) { progress->set(static_cast<float>(end) / static_cast<float>(height)); }
+        }
+        return true;
+    }
+
+    bool write(terrain const& terrain, options const& opts, std::filesystem::path const& prefix, progress* progress)
+    {
+        if (terrain.empty()) { return false; }
+
+        dem_file::header hdr = {};
+        hdr.width = static_cast<uint64_t>(terrain.width());
+        hdr.height = static_cast<uint64_t>(terrain.height());
+        stfd::vec2 const& center = terrain.center();
+        stff::aabb2 const& bounds = terrain.bounds();
+        hdr.min[0] = center.x + bounds.min.x; hdr.min[1] = center.y + bounds.min.y;
+        hdr.max[0] = center.x + bounds.max.x; hdr.max[1] = center.y + bounds.max.y;
+
+        std::array<std::unique_ptr<dem_file::row_writer>, count> writers;
+        for (size_t r = 0; r < count; ++r)
+        {
+            if (!opts.rasters[r]) { continue; }
+            std::filesystem::path path = prefix;
+            path += std::string(".") + name(static_cast<raster>(r)) + dem_file::c_extension;
+            writers[r] = std::make_unique<dem_file::row_writer>(path, hdr);
+            if (!writers[r]->is_open()) { return false; }
+        }
+
+        bool const computed = compute(terrain, opts, [&](size_t begin, size_t end, std::array<float const*, count> const& rows)
+        {
+            for (size_t r = 0; r < count; ++r)
+            {
+                if (writers[r] && !writers[r]->write_rows(rows[r], end - begin)) { return false; }
+            }
+            return true;
+        }, progress);
+        if (!computed) { return false; }
+
+        for (std::unique_ptr<dem_file::row_writer> const& writer : writers)
+        {
+            if (writer && !writer->finish()) { return false; }
+        }
+        return true;
+    }
+
+}
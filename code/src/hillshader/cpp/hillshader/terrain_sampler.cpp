@@ -0,0 +1,204 @@
+#include "hillshader/terrain_sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace hillshader
+{
+
+    terrain_sampler::terrain_sampler(terrain const& terrain, mip_chain const& mips) :
+        m_quantization(terrain.quantization_params())
+    {
+        m_levels.reserve(mips.levels());
+
+        // level 0 is the terrain itself
+        level base;
+        base.width = terrain.width();
+        base.height = terrain.height();
+        base.storage = terrain.storage();
+        base.values = terrain.values();
+        base.codes = terrain.quantized_values();
+        m_levels.push_back(base);
+
+        for (size_t index = 1; index < mips.levels(); ++index)
+        {
+            mip_chain::level const& src = mips.at(index);
+            level lvl;
+            lvl.width = src.width;
+            lvl.height = src.height;
+            lvl.storage = layout(ordering::row_major, src.width, src.height);
+            if (!src.values.empty())
+            {
+                lvl.values = src.values.data();
+            }
+            else
+            {
+                lvl.codes = src.quantized_values.data() + 1;
+            }
+            m_levels.push_back(lvl);
+        }
+    }
+
+    float terrain_sampler::sample(size_t index, float u, float v) const
+    {
+        level const& lvl = m_levels[index];
+        float const w = static_cast<float>(lvl.width);
+        float const h = static_cast<float>(lvl.height);
+
+        // clamping first keeps the integer conversion in range without changing the clamp-to-edge result
+        float const x = std::clamp(u * w - 0.5f, -1.f, w);
+        float const y = std::clamp(v * h - 0.5f, -1.f, h);
+        float const fx = std::floor(x);
+        float const fy = std::floor(y);
+        float const s = x - fx;
+        float const t = y - fy;
+
+        int const last_i = static_cast<int>(lvl.width) - 1;
+        int const last_j = static_cast<int>(lvl.height) - 1;
+        int const i = static_cast<int>(fx);
+        int const j = static_cast<int>(fy);
+        size_t const i0 = static_cast<size_t>(std::clamp(i, 0, last_i));
+        size_t const i1 = static_cast<size_t>(std::clamp(i + 1, 0, last_i));
+        size_t const j0 = static_cast<size_t>(std::clamp(j, 0, last_j));
+        size_t const j1 = static_cast<size_t>(std::clamp(j + 1, 0, last_j));
+
+        size_t const k00 = lvl.storage.index(i0, j0);
+        size_t const k10 = lvl.storage.index(i1, j0);
+        size_t const k01 = lvl.storage.index(i0, j1);
+        size_t const k11 = lvl.storage.index(i1, j1);
+        if (lvl.values)
+        {
+            float const top = stf::math::lerp(lvl.values[k00], lvl.values[k10], s);
+            float const bottom = stf::math::lerp(lvl.values[k01], lvl.values[k11], s);
+            return stf::math::lerp(top, bottom, t);
+        }
+        else
+        {
+            // dequantization is affine, so filtering the codes and dequantizing the result matches filtering elevations
+            float const top = stf::math::lerp(static_cast<float>(lvl.codes[k00]), static_cast<float>(lvl.codes[k10]), s);
+            float const bottom = stf::math::lerp(static_cast<float>(lvl.codes[k01]), static_cast<float>(lvl.codes[k11]), s);
+            return m_quantization.offset + m_quantization.scale * stf::math::lerp(top, bottom, t);
+        }
+    }
+
+    float terrain_sampler::sample(float u, float v, float lod) const
+    {
+        float const clamped = std::clamp(lod, 0.f, static_cast<float>(m_levels.size() - 1));
+        size_t const index = static_cast<size_t>(clamped);
+        float const frac = clamped - static_cast<float>(index);
+        float const fine = sample(index, u, v);
+        return (frac > 0.f) ? stf::math::lerp(fine, sample(index + 1, u, v), frac) : fine;
+    }
+
+#if defined(HILLSHADER_AVX2)
+    __m256 terrain_sampler::sample(size_t index, __m256 u, __m256 v) const
+    {
+        level const& lvl = m_levels[index];
+
+        // the gathers use 32-bit indices, so larger levels are sampled a lane at a time
+        if (lvl.storage.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+        {
+            alignas(32) float us[8], vs[8], out[8];
+            _mm256_store_ps(us, u);
+            _mm256_store_ps(vs, v);
+            for (size_t lane = 0; lane < 8; ++lane) { out[lane] = sample(index, us[lane], vs[lane]); }
+            return _mm256_load_ps(out);
+        }
+
+        __m256 const w = _mm256_set1_ps(static_cast<float>(lvl.width));
+        __m256 const h = _mm256_set1_ps(static_cast<float>(lvl.height));
+        __m256 const half = _mm256_set1_ps(0.5f);
+        __m256 const minus_one = _mm256_set1_ps(-1.f);
+
+        __m256 const x = _mm256_min_ps(_mm256_max_ps(_mm256_fmsub_ps(u, w, half), minus_one), w);
+        __m256 const y = _mm256_min_ps(_mm256_max_ps(_mm256_fmsub_ps(v, h, half), minus_one), h);
+        __m256 const fx = _mm256_floor_ps(x);
+        __m256 const fy = _mm256_floor_ps(y);
+        __m256 const s = _mm256_sub_ps(x, fx);
+        __m256 const t = _mm256_sub_ps(y, fy);
+
+        __m256i const zero = _mm256_setzero_si256();
+        __m256i const one = _mm256_set1_epi32(1);
+        __m256i const last_i = _mm256_set1_epi32(static_cast<int>(lvl.width) - 1);
+        __m256i const last_j = _mm256_set1_epi32(static_cast<int>(lvl.height) - 1);
+        __m256i const i = _mm256_cvttps_epi32(fx);
+        __m256i const j = _mm256_cvttps_epi32(fy);
+        __m256i const i0 = _mm256_min_epi32(_mm256_max_epi32(i, zero), last_i);
+        __m256i const i1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(i, one), zero), last_i);
+        __m256i const j0 = _mm256_min_epi32(_mm256_max_epi32(j, zero), last_j);
+        __m256i const j1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(j, one), zero), last_j);
+
+        // layout::index splits into a column part and a row part that sum to the index of (i, j)
+        __m256i col0 = i0, col1 = i1, row0, row1;
+        if (lvl.storage.order == ordering::row_major)
+        {
+            __m256i const stride = _mm256_set1_epi32(static_cast<int>(lvl.width));
+            row0 = _mm256_mullo_epi32(j0, stride);
+            row1 = _mm256_mullo_epi32(j1, stride);
+        }
+        else
+        {
+            int const shift = static_cast<int>(layout::c_tile_shift);
+            __m256i const tile_mask = _mm256_set1_epi32(static_cast<int>(layout::c_tile_mask));
+            __m256i const tiles_x = _mm256_set1_epi32(static_cast<int>(lvl.storage.tiles_x));
+            auto col = [&](__m256i c)
+            {
+                return _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(c, shift), 2 * shift), _mm256_and_si256(c, tile_mask));
+            };
+            auto row = [&](__m256i r)
+            {
+                __m256i const tile = _mm256_mullo_epi32(_mm256_srli_epi32(r, shift), tiles_x);
+                return _mm256_or_si256(_mm256_slli_epi32(tile, 2 * shift), _mm256_slli_epi32(_mm256_and_si256(r, tile_mask), shift));
+            };
+            col0 = col(i0); col1 = col(i1);
+            row0 = row(j0); row1 = row(j1);
+        }
+        __m256i const k00 = _mm256_add_epi32(row0, col0);
+        __m256i const k10 = _mm256_add_epi32(row0, col1);
+        __m256i const k01 = _mm256_add_epi32(row1, col0);
+        __m256i const k11 = _mm256_add_epi32(row1, col1);
+
+        // quantized values are read as the high half of the 32-bit word that ends with them (the leading slack
+        // element keeps the first word in bounds) and filtered in code space
+        auto fetch = [&](__m256i k)
+        {
+            if (lvl.values)
+            {
+                return _mm256_i32gather_ps(lvl.values, k, 4);
+            }
+            else
+            {
+                int const* base = reinterpret_cast<int const*>(lvl.codes - 1);
+                return _mm256_cvtepi32_ps(_mm256_srli_epi32(_mm256_i32gather_epi32(base, k, 2), 16));
+            }
+        };
+        __m256 const v00 = fetch(k00);
+        __m256 const v10 = fetch(k10);
+        __m256 const v01 = fetch(k01);
+        __m256 const v11 = fetch(k11);
+
+        __m256 const top = _mm256_fmadd_ps(s, _mm256_sub_ps(v10, v00), v00);
+        __m256 const bottom = _mm256_fmadd_ps(s, _mm256_sub_ps(v11, v01), v01);
+        __m256 const filtered = _mm256_fmadd_ps(t, _mm256_sub_ps(bottom, top), top);
+        if (lvl.values) { return filtered; }
+        return _mm256_fmadd_ps(filtered, _mm256_set1_ps(m_quantization.scale), _mm256_set1_ps(m_quantization.offset));
+    }
+
+    __m256 terrain_sampler::sample(__m256 u, __m256 v, float lod) const
+    {
+        float const clamped = std::clamp(lod, 0.f, static_cast<float>(m_levels.size() - 1));
+        size_t const index = static_cast<size_t>(clamped);
+        float const frac = clamped - static_cast<float>(index);
+        __m256 const fine = sample(index, u, v);
+        if (frac > 0.f)
+        {
+            __m256 const coarse = sample(index + 1, u, v);
+            return _mm256_fmadd_ps(_mm256_set1_ps(frac), _mm256_sub_ps(coarse, fine), fine);
+        }
+        return fine;
+    }
+#endif
+
+}
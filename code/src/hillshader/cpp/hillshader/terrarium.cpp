@@ -0,0 +1,130 @@
+#include "hillshader/terrarium.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+
+#include <nlohmann/json.hpp>
+
+#include "hillshader/simd.hpp"
+
+namespace hillshader::terrarium
+{
+
+    float decode(unsigned char const* pixel)
+    {
+        float r = static_cast<float>(pixel[0]);
+        float g = static_cast<float>(pixel[1]);
+        float b = static_cast<float>(pixel[2]);
+        return (r * 256.f + g + b / 256.f) - 32768.f;
+    }
+
+    stff::interval decode(unsigned char const* img, size_t channels, size_t width, size_t begin, size_t end, float* out)
+    {
+        float lo = std::numeric_limits<float>::max();
+        float hi = std::numeric_limits<float>::lowest();
+
+#if defined(HILLSHADER_SSSE3)
+        // each 16-byte load holds at least four pixels. we shuffle every pixel into a 32-bit lane as (r << 16 | g << 8 | b)
+        // which is exactly 256 * (r * 256 + g + b / 256) and fits in the 24-bit float mantissa, so the conversion is exact
+        __m128i const shuffle = (channels == 3) ?
+            _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+            _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+        __m128 const scale = _mm_set1_ps(1.f / 256.f);
+        __m128 const offset = _mm_set1_ps(32768.f);
+        __m128 lo4 = _mm_set1_ps(lo);
+        __m128 hi4 = _mm_set1_ps(hi);
+#endif
+
+        size_t const row_bytes = width * channels;
+        for (size_t j = begin; j < end; ++j)
+        {
+            unsigned char const* row = img + j * row_bytes;
+            float* dst = out + (j - begin) * width;
+
+            size_t i = 0;
+#if defined(HILLSHADER_SSSE3)
+            // only use the vector path while a full 16-byte load stays inside the row
+            if (channels == 3 || channels == 4)
+            {
+                for (; (i + 4) * channels + (16 - 4 * channels) <= row_bytes; i += 4)
+                {
+                    __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i * channels));
+                    __m128i packed = _mm_shuffle_epi8(bytes, shuffle);
+                    __m128 elevations = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(packed), scale), offset);
+                    _mm_storeu_ps(dst + i, elevations);
+                    lo4 = _mm_min_ps(lo4, elevations);
+                    hi4 = _mm_max_ps(hi4, elevations);
+                }
+            }
+#endif
+            for (; i < width; ++i)
+            {
+                float elevation = decode(row + i * channels);
+                dst[i] = elevation;
+                lo = std::min(lo, elevation);
+                hi = std::max(hi, elevation);
+            }
+        }
+
+#if defined(HILLSHADER_SSSE3)
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, lo4);
+        for (float lane : lanes) { lo = std::min(lo, lane); }
+        _mm_store_ps(lanes, hi4);
+        for (float lane : lanes) { hi = std::max(hi, lane); }
+#endif
+
+        return stff::interval(lo, hi);
+    }
+
+    void encode(float elevation, unsigned char* pixel)
+    {
+        // the inverse of decode in 24-bit fixed point: (elevation + 32768) * 256 = r << 16 | g << 8 | b
+        double const fixed = std::round((static_cast<double>(elevation) + 32768.0) * 256.0);
+        uint32_t const packed = static_cast<uint32_t>(std::clamp(fixed, 0.0, 16777215.0));
+        pixel[0] = static_cast<unsigned char>(packed >> 16);
+        pixel[1] = static_cast<unsigned char>((packed >> 8) & 0xFF);
+        pixel[2] = static_cast<unsigned char>(packed & 0xFF);
+    }
+
+    void encode(float const* values, size_t count, unsigned char* out)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            encode(values[i], out + 3 * i);
+        }
+    }
+
+    bool read_sidecar(std::filesystem::path const& image, stfd::vec2& min, stfd::vec2& max)
+    {
+        std::filesystem::path sidecar = image;
+        sidecar.replace_extension(".json");
+        std::ifstream ifs(sidecar);
+        if (!ifs) { return false; }
+
+        nlohmann::json const json = nlohmann::json::parse(ifs, nullptr, false);
+        if (json.is_discarded() || !json.is_object()) { return false; }
+
+        // a point is an array that starts with two numbers
+        auto point = [&json](char const* key, stfd::vec2& out)
+        {
+            auto found = json.find(key);
+            if (found == json.end() || !found->is_array() || found->size() < 2) { return false; }
+            nlohmann::json const& x = (*found)[0];
+            nlohmann::json const& y = (*found)[1];
+            if (!x.is_number() || !y.is_number()) { return false; }
+            out = stfd::vec2(x.get<double>(), y.get<double>());
+            return true;
+        };
+
+        stfd::vec2 lo, hi;
+        if (!point("min", lo) || !point("max", hi)) { return false; }
+        min = lo;
+        max = hi;
+        return true;
+    }
+
+}
@@ -0,0 +1,35 @@
+#include "hillshader/texture_rows.hpp"
+
+#include <algorithm>
+
+namespace hillshader
+{
+
+    texture_rows::texture_rows(terrain const& terrain, size_t strip_bytes) :
+        m_terrain(terrain),
+        m_element_size((terrain.is_quantized()) ? sizeof(uint16_t) : sizeof(float)),
+        m_strip_rows(terrain.height()),
+        m_direct(!terrain.is_quantized() && terrain.storage().order == ordering::row_major)
+    {
+        if (strip_bytes > 0)
+        {
+            m_strip_rows = std::clamp<size_t>(strip_bytes / row_bytes(), 1, terrain.height());
+        }
+    }
+
+    void const* texture_rows::rows(size_t begin, size_t end)
+    {
+        size_t const width = m_terrain.width();
+        if (m_direct) { return m_terrain.values() + begin * width; }
+        if (m_terrain.is_quantized())
+        {
+            m_quantized_strip.resize((end - begin) * width);
+            m_terrain.copy_quantized_rows(begin, end, m_quantized_strip.data());
+            return m_quantized_strip.data();
+        }
+        m_strip.resize((end - begin) * width);
+        m_terrain.copy_rows(begin, end, m_strip.data());
+        return m_strip.data();
+    }
+
+}
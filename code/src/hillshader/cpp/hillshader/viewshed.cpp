@@ -0,0 +1,219 @@
+#include "hillshader/viewshed.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "hillshader/parallel.hpp"
+
+namespace hillshader
+{
+
+    namespace
+    {
+
+        // rays per task handed to a worker
+        constexpr int64_t c_rays_per_task = 32;
+
+        // posts per side of the blocks the swept square is copied in
+        constexpr size_t c_copy_block = 64;
+
+        // the posts whose direction from the observer is dominated by one axis. a post at major steps a and minor
+        // steps b from the observer belongs to the sector if |b| < a (or |b| <= a for the sectors that own the
+        // diagonals), so every post belongs to exactly one sector
+        struct sector
+        {
+            int64_t direction;      // +1 or -1 along the major axis
+            float major_spacing;
+            float minor_spacing;
+            int64_t extent;         // steps along the major axis before the edge of the raster
+            bool owns_diagonals;
+        };
+
+        // copies a window of posts into a row-major buffer, transposed (so that columns become rows) if asked. the
+        // copy goes a square block at a time so that the reads and the transposed writes both stay in cache, and rows
+        // of row-major float storage are read straight from the terrain
+        void copy_window(terrain const& terrain, size_t column, size_t row, size_t width, size_t height, bool transposed, std::vector<float>& posts)
+        {
+            posts.resize(width * height);
+            bool const direct = terrain.values() && terrain.storage().order == ordering::row_major;
+            size_t const blocks_x = (width + c_copy_block - 1) / c_copy_block;
+            size_t const blocks_y = (height + c_copy_block - 1) / c_copy_block;
+            parallel::for_each_dynamic(0, blocks_x * blocks_y, [&](size_t block, size_t)
+            {
+                size_t const i0 = (block % blocks_x) * c_copy_block;
+                size_t const j0 = (block / blocks_x) * c_copy_block;
+                size_t const i1 = std::min(width, i0 + c_copy_block);
+                size_t const j1 = std::min(height, j0 + c_copy_block);
+                for (size_t j = j0; j < j1; ++j)
+                {
+                    float const* src = (direct) ? terrain.values() + (row + j) * terrain.width() + column : nullptr;
+                    for (size_t i = i0; i < i1; ++i)
+                    {
+                        float const z = (direct) ? src[i] : terrain.read(column + i, row + j);
+                        posts[(transposed) ? i * height + j : j * width + i] = z;
+                    }
+                }
+            });
+        }
+
+    }
+
+    viewshed::viewshed(terrain const& terrain, observer const& obs)
+    {
+        if (terrain.empty()) { return; }
+
+        int64_t const columns = static_cast<int64_t>(terrain.width());
+        int64_t const rows = static_cast<int64_t>(terrain.height());
+        stff::vec2 const size = terrain.bounds().diagonal();
+        float const dx = size.x / static_cast<float>(columns);
+        float const dy = size.y / static_cast<float>(rows);
+
+        stff::vec2 const texel = terrain.to_texel(obs.position);
+        int64_t const oi = std::clamp(static_cast<int64_t>(std::llround(texel.x)), int64_t(0), columns - 1);
+        int64_t const oj = std::clamp(static_cast<int64_t>(std::llround(texel.y)), int64_t(0), rows - 1);
+
+        // the raster is the square of posts around the observer that the radius reaches
+        float const radius = (obs.radius > 0.f) ? obs.radius : std::numeric_limits<float>::infinity();
+        int64_t const reach_i = (obs.radius > 0.f) ? static_cast<int64_t>(std::min(static_cast<float>(columns), radius / dx)) : columns;
+        int64_t const reach_j = (obs.radius > 0.f) ? static_cast<int64_t>(std::min(static_cast<float>(rows), radius / dy)) : rows;
+        int64_t const first_i = std::max(int64_t(0), oi - reach_i);
+        int64_t const first_j = std::max(int64_t(0), oj - reach_j);
+        int64_t const last_i = std::min(columns - 1, oi + reach_i);
+        int64_t const last_j = std::min(rows - 1, oj + reach_j);
+        m_column = static_cast<size_t>(first_i);
+        m_row = static_cast<size_t>(first_j);
+        m_width = static_cast<size_t>(last_i - first_i + 1);
+        m_height = static_cast<size_t>(last_j - first_j + 1);
+        m_values.assign(m_width * m_height, 0);
+
+        float const eye = terrain.read(static_cast<size_t>(oi), static_cast<size_t>(oj)) + obs.height;
+        float const drop = (obs.earth_curvature) ? static_cast<float>((1.0 - obs.refraction) / (2.0 * c_earth_radius)) : 0.f;
+        m_values[(oj - first_j) * m_width + (oi - first_i)] = 255;
+
+        sector const sectors[4] =
+        {
+            { 1, dx, dy, last_i - oi, true },           // east
+            { -1, dx, dy, oi - first_i, true },         // west
+            { 1, dy, dx, last_j - oj, false },          // south
+            { -1, dy, dx, oj - first_j, false },        // north
+        };
+
+        // reciprocals of the step counts, shared by every ray
+        int64_t const longest = std::max({ sectors[0].extent, sectors[1].extent, sectors[2].extent, sectors[3].extent });
+        std::vector<float> inv_steps(static_cast<size_t>(longest) + 1, 0.f);
+        for (int64_t a = 1; a <= longest; ++a) { inv_steps[a] = 1.f / static_cast<float>(a); }
+
+        // rays read a float copy of the square laid out with their major axis along its rows, so successive steps are
+        // neighbors in memory. east and west read a row-major copy and north and south a transposed one, which reuses
+        // the buffer once east and west are done
+        std::vector<float> posts;
+        std::vector<size_t> visible(parallel::concurrency(), 0);
+        for (bool const transposed : { false, true })
+        {
+            copy_window(terrain, m_column, m_row, m_width, m_height, transposed, posts);
+
+            // the copy holds lines rows of pitch posts. p runs along the major axis and q along the minor one
+            int64_t const pitch = static_cast<int64_t>((transposed) ? m_height : m_width);
+            int64_t const lines = static_cast<int64_t>((transposed) ? m_width : m_height);
+            int64_t const op = (transposed) ? oj - first_j : oi - first_i;
+            int64_t const oq = (transposed) ? oi - first_i : oj - first_j;
+            sector const* pair = sectors + ((transposed) ? 2 : 0);
+            float const* const data = posts.data();
+            uint8_t* const values = m_values.data();
+            float const* const inv = inv_steps.data();
+
+            // the scalars a ray reads are copied in, since its stores to the (byte) raster could alias anything it
+            // reads through a reference
+            auto march = [&visible, data, values, inv, pitch, lines, op, oq, radius, eye, drop, target = obs.target_height, width = m_width, transposed](sector const& sec, int64_t k, size_t worker)
+            {
+                int64_t const extent = sec.extent;
+
+                // the ray advances a fixed distance per step along the major axis
+                float const minor_per_step = static_cast<float>(k) / static_cast<float>(extent);
+                float const step_length = std::sqrt(sec.major_spacing * sec.major_spacing + minor_per_step * minor_per_step * sec.minor_spacing * sec.minor_spacing);
+                float const inv_step_length = 1.f / step_length;
+
+                // the post the ray passes closest to at step a is b = round(k a / extent) (halves rounding up), kept
+                // as the quotient and remainder of (2 k a + extent) / (2 extent) so that no step divides
+                int64_t const den = 2 * extent;
+                int64_t b = 0;
+                int64_t remainder = extent;
+
+                size_t seen = 0;
+                float max_slope = -std::numeric_limits<float>::infinity();
+                for (int64_t a = 1; a <= extent; ++a)
+                {
+                    int64_t const p = op + a * sec.direction;
+                    float const* line = data + p;
+                    auto inside = [&](int64_t m) { return oq + m >= 0 && oq + m < lines; };
+                    auto elevation = [&](int64_t m) { return line[(oq + m) * pitch]; };
+
+                    // |2 k| <= 2 extent, so a single correction keeps the remainder in [0, 2 extent)
+                    remainder += 2 * k;
+                    if (remainder >= den) { remainder -= den; ++b; }
+                    else if (remainder < 0) { remainder += den; --b; }
+
+                    // the ray decides that post if it is also the ray nearest to it, i.e. if round(b extent / a) = k,
+                    // which multiplies out to 2 a k - a <= 2 b extent < 2 a k + a
+                    int64_t const scaled = 2 * b * extent;
+                    bool const in_sector = (sec.owns_diagonals) ? std::abs(b) <= a : std::abs(b) < a;
+                    bool const decides = in_sector & (2 * a * k - a <= scaled) & (scaled < 2 * a * k + a) & inside(b);
+                    if (decides)
+                    {
+                        float const along = static_cast<float>(a) * sec.major_spacing;
+                        float const across = static_cast<float>(b) * sec.minor_spacing;
+                        float const distance = std::sqrt(along * along + across * across);
+                        if (distance <= radius)
+                        {
+                            float const z = elevation(b) + target - drop * distance * distance;
+                            if ((z - eye) / distance >= max_slope)
+                            {
+                                int64_t const q = oq + b;
+                                size_t const index = (transposed) ? static_cast<size_t>(p) * width + static_cast<size_t>(q) : static_cast<size_t>(q) * width + static_cast<size_t>(p);
+                                values[index] = 255;
+                                ++seen;
+                            }
+                        }
+                    }
+
+                    // the line of sight over the terrain at the ray's exact position, interpolated across the minor
+                    // axis. the ray only moves away from the observer's line, so once it leaves the raster it is done
+                    float const minor = static_cast<float>(a) * minor_per_step;
+                    int64_t const b0 = static_cast<int64_t>(std::floor(minor));
+                    float const t = minor - static_cast<float>(b0);
+                    bool const in0 = inside(b0);
+                    bool const in1 = inside(b0 + 1);
+                    if (!in0 && !in1) { break; }
+
+                    float const z0 = (in0) ? elevation(b0) : elevation(b0 + 1);
+                    float const z1 = (in1 && t > 0.f) ? elevation(b0 + 1) : z0;
+                    float const distance = static_cast<float>(a) * step_length;
+                    float const z = z0 + t * (z1 - z0) - drop * distance * distance;
+                    max_slope = std::max(max_slope, (z - eye) * inv[a] * inv_step_length);
+                }
+                visible[worker] += seen;
+            };
+
+            // the rays of both sectors in one sequence, handed out in blocks
+            int64_t ray_offsets[3] = { 0, 0, 0 };
+            for (size_t s = 0; s < 2; ++s) { ray_offsets[s + 1] = ray_offsets[s] + ((pair[s].extent > 0) ? 2 * pair[s].extent + 1 : 0); }
+            int64_t const tasks = (ray_offsets[2] + c_rays_per_task - 1) / c_rays_per_task;
+
+            parallel::for_each_dynamic(0, static_cast<size_t>(tasks), [&](size_t task, size_t worker)
+            {
+                int64_t const begin = static_cast<int64_t>(task) * c_rays_per_task;
+                int64_t const end = std::min(ray_offsets[2], begin + c_rays_per_task);
+                for (int64_t ray = begin; ray < end; ++ray)
+                {
+                    size_t const s = (ray >= ray_offsets[1]) ? 1 : 0;
+                    march(pair[s], ray - ray_offsets[s] - pair[s].extent, worker);
+                }
+            });
+        }
+
+        m_visible = 1;
+        for (size_t const count : visible) { m_visible += count; }
+    }
+
+}
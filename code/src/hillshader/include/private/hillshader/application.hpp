@@ -3,6 +3,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #define NOMINMAX
 #include <Windows.h>
@@ -21,7 +22,12 @@
 #include <stf/gfx/color.hpp>
 
 #include "hillshader/camera/controllers/controller.hpp"
+#include "hillshader/dem_cache.hpp"
+#include "hillshader/dem_catalog.hpp"
+#include "hillshader/dem_loader.hpp"
 #include "hillshader/mesh.hpp"
+#include "hillshader/paged_terrain.hpp"
+#include "hillshader/shading.hpp"
 #include "hillshader/terrain.hpp"
 #include "hillshader/timer.hpp"
 
@@ -116,20 +122,59 @@ namespace hillshader
 
         stff::vec3 m_focus;
 
+        std::unique_ptr<dem_loader> m_loader;
+        std::vector<std::unique_ptr<dem_loader>> m_cancelled_loaders;
+
+        // resident memory sampled over the most recent load (each frame and while uploading)
+        struct load_memory
+        {
+            size_t baseline = 0;
+            size_t peak = 0;
+        };
+        load_memory m_load_memory;
+
+        // a terrarium pyramid on screen is paged in around the camera and drawn through terrain snapshots of its
+        // resident tiles, so the render loop never waits on tile I/O. a new snapshot is built once more tiles are
+        // resident or the view leaves the area of the last one
+        std::shared_ptr<paged_terrain> m_pages;
+        std::unique_ptr<dem_loader> m_page_loader;
+        size_t m_page_revision = 0;
+        stff::aabb2 m_page_area;
+        bool m_dem_snapshot = false;
+
+        std::unique_ptr<dem_catalog> m_catalog;
+        dem_cache m_dem_cache;
+
+        // the DEM on screen, the options it was loaded with and the state of its source at the time. m_terrain_options
+        // applies to the next load
         std::string m_dem_path;
+        terrain::options m_dem_options;
+        dem_file::source_stamp m_dem_stamp;
+        terrain::options m_terrain_options;
         std::unique_ptr<terrain const> m_terrain;
         std::vector<mesh::vertex_t> m_vertices;
         std::vector<uint32_t> m_indices;
         Diligent::RefCntAutoPtr<Diligent::ITexture> m_texture;
         Diligent::RefCntAutoPtr<Diligent::ITextureView> m_texture_srv;
+        Diligent::RefCntAutoPtr<Diligent::ITexture> m_normal_texture;
+        Diligent::RefCntAutoPtr<Diligent::ITextureView> m_normal_texture_srv;
+        Diligent::RefCntAutoPtr<Diligent::ITexture> m_horizon_texture;
+        Diligent::RefCntAutoPtr<Diligent::ITextureView> m_horizon_texture_srv;
+
+        // bound to g_horizons while the DEM on screen has no horizon field
+        Diligent::RefCntAutoPtr<Diligent::ITexture> m_empty_horizons;
 
         stf::gfx::rgba m_clear_color = { 0.0f, 0.0f, 0.0f, 1.0f };
         stf::gfx::rgba m_albedo = { 1.0f, 1.0f, 1.0f, 1.0f };
-        float m_azimuth = 315.f;
-        float m_altitude = 50.f;
+        std::vector<shading::light> m_lights = { shading::light() };
         float m_ambient_intensity = 0.0f;
         float m_exaggeration = 5.0f;
+        float m_shadows = 1.0f;
+        float m_sky_view = 1.0f;
         float m_step_scalar = 0.001f;
+
+        // half the side of the square around the cursor whose statistics are shown (needs summed-area tables)
+        float m_statistics_radius = 500.f;
         bool m_flag_3d = true;
 
         nlohmann::json m_start_up_state;
@@ -158,8 +203,32 @@ namespace hillshader
 
         void write_to_disk(std::string const& path);
 
+        // starts loading a DEM in the background (cancelling any load that is in flight). a directory is opened as
+        // a terrarium tile pyramid
         void load_dem(std::string const& path);
 
+        void cancel_dem_load();
+
+        // uploads the DEM on the render thread once the background load finishes
+        void poll_dem_load();
+
+        void upload_dem(dem_loader::result&& result);
+
+        // requests the pyramid tiles under the view and swaps in a new snapshot when the last one is out of date
+        void update_pages();
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> upload_terrain_texture(terrain const& dem, mip_chain const& mips);
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> upload_normal_texture(normal_field const& normals);
+
+        Diligent::RefCntAutoPtr<Diligent::ITexture> upload_horizon_texture(horizon_field const& horizons);
+
+        // makes a DEM the one on screen, moving the previous DEM into the cache. a snapshot replacing a snapshot of
+        // the same pyramid keeps the camera where it is
+        void activate_dem(dem_cache::entry&& dem, bool snapshot = false);
+
+        void stash_dem();
+
         void release_dem_resources();
 
     };
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/progress.hpp"
+#include "hillshader/terrain.hpp"
+
+// contour lines of a terrain by marching squares over the bilinear cells between posts. the cells are split into square
+// tiles that threads take from a shared queue. each tile descends the terrain's min/max pyramid, skipping every block
+// whose elevation range contains none of the contour elevations, and emits the segments of every elevation in a single
+// pass over the cells it keeps. segments are stitched into polylines inside the tile, and the pieces that end on a
+// tile boundary are joined afterwards
+namespace hillshader::contours
+{
+
+    struct options
+    {
+        // contours are drawn at base + k * interval for every integer k inside the elevation range
+        float interval = 10.f;
+        float base = 0.f;
+
+        // cells along each side of a tile (rounded up to a power of two)
+        size_t tile_cells = 128;
+    };
+
+    struct polyline
+    {
+        float elevation;
+        size_t first;       // index of the first point in collection::points
+        size_t count;
+        bool closed;        // closed polylines repeat their first point at the end
+    };
+
+    struct collection
+    {
+        std::vector<polyline> polylines;
+
+        // positions in world space (relative to the terrain's center, like terrain::bounds)
+        std::vector<stff::vec2> points;
+    };
+
+    // a vertex of a line list: every segment of every polyline contributes its two end points
+    struct line_vertex
+    {
+        stff::vec2 pos;
+        float elevation;
+    };
+
+    // contours ordered by elevation (polylines at the same elevation are in no particular order). if progress is
+    // provided, the extraction reports into it and stops early (returning an empty collection) when it is cancelled
+    collection extract(terrain const& terrain, options const& opts, progress* progress = nullptr);
+
+    // the vertices of a line list (e.g. for a vertex buffer drawn with a line list topology)
+    std::vector<line_vertex> line_list(collection const& lines);
+
+    // writes a GeoJSON FeatureCollection with one LineString per polyline (with its elevation as a property). GeoJSON
+    // coordinates are WGS84 longitude and latitude, so the terrain's coordinates are taken to be web mercator meters (as
+    // the tiler and the pyramids it writes use) and reprojected to degrees
+    bool write_geojson(terrain const& terrain, collection const& lines, std::filesystem::path const& path);
+
+}
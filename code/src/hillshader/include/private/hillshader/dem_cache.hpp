@@ -0,0 +1,88 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <Common/interface/RefCntAutoPtr.hpp>
+#include <Graphics/GraphicsEngine/interface/Buffer.h>
+#include <Graphics/GraphicsEngine/interface/Texture.h>
+#include <Graphics/GraphicsEngine/interface/TextureView.h>
+
+#include "hillshader/dem_file.hpp"
+#include "hillshader/mesh.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // least recently used cache of the DEMs that are not on screen. entries keep their decoded terrain, mesh, and GPU
+    // resources so that switching back to a DEM skips both the load and the upload. the least recently used entries
+    // are evicted whenever the cached bytes exceed the budget
+    class dem_cache
+    {
+    public:
+
+        static constexpr size_t c_default_budget = size_t(1) << 30;
+
+        struct entry
+        {
+            std::string path;
+            terrain::options options;
+            dem_file::source_stamp stamp;
+            std::unique_ptr<terrain const> dem;
+            std::vector<mesh::vertex_t> vertices;
+            std::vector<uint32_t> indices;
+            Diligent::RefCntAutoPtr<Diligent::ITexture> texture;
+            Diligent::RefCntAutoPtr<Diligent::ITextureView> texture_srv;
+            Diligent::RefCntAutoPtr<Diligent::ITexture> normal_texture;
+            Diligent::RefCntAutoPtr<Diligent::ITextureView> normal_texture_srv;
+            Diligent::RefCntAutoPtr<Diligent::ITexture> horizon_texture;
+            Diligent::RefCntAutoPtr<Diligent::ITextureView> horizon_texture_srv;
+            Diligent::RefCntAutoPtr<Diligent::IBuffer> vertex_buffer;
+            Diligent::RefCntAutoPtr<Diligent::IBuffer> index_buffer;
+        };
+
+    public:
+
+        dem_cache(size_t budget = c_default_budget) : m_budget(budget) {}
+
+        // removes and returns the entry for a path if it was loaded with the same options from the source as it is now
+        // on disk. an entry whose source (or sidecar) changed since it was loaded is dropped and counts as a miss
+        std::optional<entry> take(std::string const& path, terrain::options const& options);
+
+        // inserts an entry as the most recently used (dropping it immediately if it exceeds the budget by itself)
+        void insert(entry&& e);
+
+        void clear();
+
+        inline size_t budget() const { return m_budget; }
+        void set_budget(size_t budget);
+
+        inline size_t count() const { return m_entries.size(); }
+        inline size_t bytes() const { return m_bytes; }
+        inline size_t hits() const { return m_hits; }
+        inline size_t misses() const { return m_misses; }
+
+        // estimated bytes held by an entry across host and device memory
+        static size_t footprint(entry const& e);
+
+    private:
+
+        void evict();
+
+    private:
+
+        // ordered from most to least recently used, paired with the footprint of each entry
+        std::list<std::pair<size_t, entry>> m_entries;
+
+        size_t m_budget;
+        size_t m_bytes = 0;
+        size_t m_hits = 0;
+        size_t m_misses = 0;
+
+    };
+
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+namespace hillshader
+{
+
+    // catalog of the DEMs in a directory (images, compressed DEMs and terrarium tile pyramids). the directory is scanned on a background thread at construction and then
+    // rescanned whenever it changes (through a change notification where the platform offers one, otherwise by
+    // polling). a rescan only reads the metadata of files that were added or modified, and readers get an immutable
+    // snapshot so the render thread never touches the filesystem
+    class dem_catalog
+    {
+    public:
+
+        struct entry
+        {
+            std::string path;
+            std::string name;
+
+            // a directory of z/x/y terrarium tiles (see paged_terrain). pyramids have no dimensions or bounds
+            bool pyramid = false;
+
+            // dimensions in pixels (0 if the image header could not be read)
+            size_t width = 0;
+            size_t height = 0;
+
+            // bounds from the sidecar json (invalid if the sidecar is missing or malformed)
+            bool has_bounds = false;
+            stfd::vec2 min;
+            stfd::vec2 max;
+
+            uintmax_t file_size = 0;
+            std::filesystem::file_time_type modified;
+
+            // the sidecar's size and modification time (zero and the epoch if there is none). a sidecar that is
+            // edited or arrives after its image refreshes the entry
+            uintmax_t sidecar_size = 0;
+            std::filesystem::file_time_type sidecar_modified;
+        };
+
+        using snapshot = std::shared_ptr<std::vector<entry> const>;
+
+    public:
+
+        dem_catalog(std::filesystem::path const& directory);
+        ~dem_catalog();
+
+        dem_catalog(dem_catalog const& rhs) = delete;
+        dem_catalog& operator=(dem_catalog const& rhs) = delete;
+
+        // entries sorted by name. empty until the first scan finishes
+        snapshot entries() const;
+
+        // number of scans published so far
+        inline size_t revision() const { return m_revision.load(std::memory_order_acquire); }
+
+    private:
+
+        void watch();
+
+        void refresh();
+
+        bool watch_native();
+
+        void poll();
+
+    private:
+
+        std::filesystem::path m_directory;
+
+        mutable std::mutex m_mutex;
+        snapshot m_entries;
+        std::atomic<size_t> m_revision{0};
+
+        std::atomic<bool> m_stopping{false};
+        std::thread m_thread;
+
+    };
+
+}
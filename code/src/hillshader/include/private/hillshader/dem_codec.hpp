@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/mapped_file.hpp"
+
+// compressed DEM format. elevations are snapped to a grid (elevation = offset + q * step) and the integers q are
+// stored in independent square tiles, each predicted from its already-decoded neighbors (the LOCO-I median edge
+// detector) and Rice coded in blocks of 32 residuals. the default step reproduces terrarium elevations exactly, so
+// converting a terrarium png is lossless. tiles decode independently, so a reader can decode them in parallel
+namespace hillshader::dem_codec
+{
+
+    static constexpr char const* c_extension = ".hsz";
+    static constexpr uint32_t c_version = 1;
+    static constexpr uint32_t c_tile_size = 256;
+
+    // the resolution of the terrarium encoding
+    static constexpr float c_terrarium_step = 1.f / 256.f;
+
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t tile_size;
+
+        uint64_t width;
+        uint64_t height;
+
+        // bounds of the DEM in the source coordinate system
+        double min[2];
+        double max[2];
+
+        float range[2];
+
+        // elevation = offset + q * step
+        float offset;
+        float step;
+
+        // the header is followed by tile_count + 1 byte offsets (from the start of the file) that delimit the tiles
+        uint64_t tile_count;
+    };
+
+    struct tile_rect
+    {
+        size_t x = 0;
+        size_t y = 0;
+        size_t width = 0;
+        size_t height = 0;
+    };
+
+    // encodes row-major values and writes them to path (through a temporary file that is renamed into place). the
+    // width, height, bounds and step come from hdr. the error is at most step / 2 and is zero for values that are
+    // already on the grid. the format has no code for missing data, so values must be finite. returns false on
+    // failure (including any nan or infinite value)
+    bool write(std::filesystem::path const& path, header const& hdr, float const* values);
+
+    // reads just the header of a file. returns false if the file is not a DEM in this format
+    bool read_header(std::filesystem::path const& path, header& hdr);
+
+    // returns the header if the mapped file is a complete DEM in this format, otherwise nullptr
+    header const* validate(mapped_file const& file);
+
+    uint64_t tile_count(header const& hdr);
+
+    // posts covered by a tile
+    tile_rect tile_extent(header const& hdr, size_t tile);
+
+    // decodes a tile into out, where consecutive rows of the tile are stride floats apart. returns false if the tile
+    // is corrupt
+    bool decode_tile(mapped_file const& file, header const& hdr, size_t tile, float* out, size_t stride);
+
+}
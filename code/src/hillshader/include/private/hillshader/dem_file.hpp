@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/mapped_file.hpp"
+
+// native binary DEM format. the file is a fixed header followed by a float payload that starts on a page boundary so
+// the payload can be used directly from a memory mapping. the payload is either row-major or split into square tiles
+namespace hillshader::dem_file
+{
+
+    static constexpr char const* c_extension = ".hsdem";
+    static constexpr uint32_t c_version = 3;
+    static constexpr uint64_t c_payload_alignment = 4096;
+
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t tile_size;     // zero for a row-major payload
+
+        uint64_t width;
+        uint64_t height;
+        uint64_t payload_offset;
+
+        // size and modification time of the file this cache was built from (zero if there is no source)
+        uint64_t source_size;
+        int64_t source_time;
+
+        // size and modification time of the source's sidecar json, which supplies the bounds (zero if there is none)
+        uint64_t sidecar_size;
+        int64_t sidecar_time;
+
+        // bounds of the DEM in the source coordinate system
+        double min[2];
+        double max[2];
+
+        float range[2];
+    };
+
+    // path of the cache file that accompanies a source DEM (a cache file maps to itself)
+    std::filesystem::path cache_path(std::filesystem::path const& source);
+
+    // size and modification time of a source file and of its sidecar json, which supplies the bounds (zeros for a
+    // file that does not exist). anything derived from the source is stale once its stamp differs
+    struct source_stamp
+    {
+        uint64_t size = 0;
+        int64_t time = 0;
+        uint64_t sidecar_size = 0;
+        int64_t sidecar_time = 0;
+    };
+
+    source_stamp stamp(std::filesystem::path const& source);
+
+    inline bool operator==(source_stamp const& lhs, source_stamp const& rhs)
+    {
+        return lhs.size == rhs.size && lhs.time == rhs.time && lhs.sidecar_size == rhs.sidecar_size && lhs.sidecar_time == rhs.sidecar_time;
+    }
+
+    inline bool operator!=(source_stamp const& lhs, source_stamp const& rhs) { return !(lhs == rhs); }
+
+    // stamps the header with the size and modification time of the source file and its sidecar
+    void stamp(header& hdr, std::filesystem::path const& source);
+
+    // whether the stamp in the header matches the current state of the source file and its sidecar
+    bool is_current(header const& hdr, std::filesystem::path const& source);
+
+    // returns the header if the mapped file is a complete DEM file, otherwise nullptr
+    header const* validate(mapped_file const& file);
+
+    // writes a DEM file. the file is written to a temporary path unique to the writer and renamed into place, so
+    // concurrent readers never observe a partially written file and concurrent writers never share one. returns false
+    // on failure
+    bool write(std::filesystem::path const& path, header const& hdr, float const* values);
+
+    // writes a row-major DEM file a strip of rows at a time, so a raster never has to be held in memory. the range in
+    // the header is accumulated from the rows that are written. like write, the file only appears at its path once
+    // finish succeeds
+    class row_writer
+    {
+    public:
+
+        row_writer(std::filesystem::path const& path, header const& hdr);
+        ~row_writer();
+
+        row_writer(row_writer const& rhs) = delete;
+        row_writer& operator=(row_writer const& rhs) = delete;
+
+        inline bool is_open() const { return m_stream.is_open() && m_stream.good(); }
+
+        // appends count rows of width() floats
+        bool write_rows(float const* values, size_t count);
+
+        // writes the header and renames the file into place. fails unless every row was written
+        bool finish();
+
+    private:
+
+        std::filesystem::path m_path;
+        std::filesystem::path m_tmp;
+        header m_header;
+        std::ofstream m_stream;
+        uint64_t m_rows = 0;
+        float m_min;
+        float m_max;
+
+    };
+
+    // number of floats in the payload
+    uint64_t payload_count(header const& hdr);
+
+    inline float const* payload(mapped_file const& file, header const& hdr)
+    {
+        return reinterpret_cast<float const*>(file.data() + hdr.payload_offset);
+    }
+
+}
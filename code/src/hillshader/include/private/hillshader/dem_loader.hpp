@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hillshader/dem_file.hpp"
+#include "hillshader/horizon_field.hpp"
+#include "hillshader/mesh.hpp"
+#include "hillshader/mip_chain.hpp"
+#include "hillshader/normal_field.hpp"
+#include "hillshader/paged_terrain.hpp"
+#include "hillshader/progress.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // loads a DEM and builds its mesh and texture mip chain on a background thread. the GPU upload is left to the caller so that it can
+    // happen on the render thread once the loader is ready
+    class dem_loader
+    {
+    public:
+
+        enum class stage
+        {
+            decoding,
+            meshing,
+            mipmapping,
+            normals,
+            horizons,
+            ready,
+        };
+
+        struct result
+        {
+            std::string path;
+            terrain::options options;
+            dem_file::source_stamp stamp;   // state of the source when the load started
+            bool snapshot = false;          // the dem is a snapshot of a paged terrain (path is the pyramid root)
+            std::unique_ptr<terrain const> dem;
+            std::vector<mesh::vertex_t> vertices;
+            std::vector<uint32_t> indices;
+            mip_chain mips;
+            normal_field normals;       // empty unless options.normals is set
+            horizon_field horizons;     // empty unless options.horizons is set
+        };
+
+    public:
+
+        dem_loader(std::string const& path, terrain::options const& opts);
+
+        // builds a snapshot of the tiles a paged terrain has resident over an area (see terrain), with posts along
+        // the longer side of the area
+        dem_loader(std::shared_ptr<paged_terrain const> pages, stff::aabb2 const& area, size_t posts, terrain::options const& opts);
+        ~dem_loader();
+
+        dem_loader(dem_loader const& rhs) = delete;
+        dem_loader& operator=(dem_loader const& rhs) = delete;
+
+        inline std::string const& path() const { return m_path; }
+
+        inline stage current_stage() const { return m_stage.load(std::memory_order_acquire); }
+        inline bool is_ready() const { return current_stage() == stage::ready; }
+
+        // progress of the current stage in [0, 1]
+        inline float fraction() const { return (current_stage() == stage::decoding) ? m_progress.fraction() : 1.f; }
+
+        inline bool cancelled() const { return m_progress.cancelled(); }
+        void cancel() { m_progress.cancel(); }
+
+        // moves the result out of the loader. only valid once the loader is ready. the dem is null if the load
+        // failed or was cancelled
+        result take();
+
+    private:
+
+        void run();
+
+        // the stages of run, which may throw (e.g. on malformed sidecar metadata or when memory runs out)
+        void load();
+
+    private:
+
+        std::string m_path;
+        terrain::options m_options;
+        std::shared_ptr<paged_terrain const> m_pages;
+        stff::aabb2 m_area;
+        size_t m_posts = 0;
+        progress m_progress;
+        std::atomic<stage> m_stage;
+        result m_result;
+        std::thread m_thread;
+
+    };
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/horizon_field.hpp"
+#include "hillshader/normal_buffer.hpp"
+#include "hillshader/normal_field.hpp"
+#include "hillshader/shading.hpp"
+#include "hillshader/terrain.hpp"
+#include "hillshader/terrain_sampler.hpp"
+
+namespace hillshader
+{
+
+    // renders north-up orthographic hillshades of a terrain on the CPU with the lighting model of
+    // shaders/hillshade.psh, so images can be produced without a GPU. rows are shaded in parallel and, where AVX2 is
+    // available, eight pixels at a time
+    class hillshade_renderer
+    {
+    public:
+
+        using lighting = shading::lighting;
+
+        struct view
+        {
+            // area covered by the image, relative to the terrain's center
+            stff::aabb2 bounds;
+
+            size_t width = 0;
+            size_t height = 0;
+
+            // distance in meters between a pixel and the taps that estimate its normal. the shader uses step_scalar
+            // times the distance to the eye, and 0 uses the ground size of one pixel. as in the shader, the spacing
+            // never drops below half a texel
+            float tap_spacing = 0.f;
+        };
+
+    public:
+
+        // with a normal field, each pixel fetches its normal instead of estimating it from four elevation taps. with a
+        // horizon field, pixels are darkened by cast shadows and the sky-view factor (see shading::lighting)
+        hillshade_renderer(terrain const& terrain, mip_chain const& mips, normal_field const* normals = nullptr, horizon_field const* horizons = nullptr);
+
+        // renders into rgba (4 * width * height bytes, top row first). like the application's swap chain, colors are
+        // sRGB encoded. if normals is provided, it receives the frame's normals so that later lighting changes can be
+        // applied with normal_buffer::shade
+        void render(view const& v, lighting const& l, uint8_t* rgba, normal_buffer* normals = nullptr) const;
+
+        // a view of the whole terrain at one pixel per post
+        view full_view() const;
+
+    private:
+
+        terrain const& m_terrain;
+        terrain_sampler m_sampler;
+        normal_field const* m_normals;
+        horizon_field const* m_horizons;
+
+    };
+
+}
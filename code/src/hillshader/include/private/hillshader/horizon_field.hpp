@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/shading.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // horizon angles of every post toward a fixed set of evenly spaced azimuths, plus the sky-view factor they imply.
+    // each azimuth is one sweep over the grid: posts are walked along parallel lines from the far end while an upper
+    // convex hull of the posts already passed gives each post its horizon in amortized constant time, so the whole
+    // field costs O(directions * posts) instead of a ray march per post and direction.
+    //
+    // every level stores directions() + 1 layers of 16-bit unorm values (the memory layout of an R16_UNORM texture
+    // array): layer d holds the sine of the horizon angle toward azimuth d * 360 / directions() (horizons below the
+    // horizontal clamp to 0) and the last layer holds the sky-view factor. coarser levels are box filtered like
+    // mip_chain. the sky-view factor describes the terrain without exaggeration, while cast shadows apply it
+    class horizon_field
+    {
+    public:
+
+        struct level
+        {
+            size_t width = 0;
+            size_t height = 0;
+            std::vector<uint16_t> values;       // layer-major, each layer row-major
+        };
+
+        // the horizon layers on either side of a sun azimuth
+        struct sun
+        {
+            size_t layer0 = 0;
+            size_t layer1 = 0;
+            float blend = 0.f;
+            float sine = 0.f;           // of the altitude
+            float inv_penumbra = 0.f;
+        };
+
+        using suns = std::array<sun, shading::c_max_lights>;
+
+        // shadows fade over the sun's angular diameter, so filtered horizons give soft edges
+        static constexpr float c_penumbra = 0.0093f;
+
+    public:
+
+        horizon_field() = default;
+
+        // sweeps the azimuths one after another, each parallelized across its lines
+        horizon_field(terrain const& terrain, size_t directions);
+
+        inline bool empty() const { return m_levels.empty(); }
+
+        inline size_t directions() const { return m_directions; }
+        inline size_t layers() const { return m_directions + 1; }
+
+        inline size_t levels() const { return m_levels.size(); }
+        inline level const& at(size_t index) const { return m_levels[index]; }
+
+        size_t bytes() const;
+
+        // azimuth in degrees clockwise from north and altitude in degrees above the horizon
+        sun position(float azimuth, float altitude) const;
+
+        // the position of each light in a set
+        suns positions(shading::light_set const& lights) const;
+
+        // fraction of the sun above the horizon at a point, with elevations scaled by exaggeration. sampled like
+        // SampleLevel on the GPU (bilinear within a level and linear between levels)
+        float lit(sun const& s, float u, float v, float lod, float exaggeration) const;
+
+        float sky_view(float u, float v, float lod) const;
+
+        // the lit terms of shading::intensity at a point (one for each of the first count suns, written to lit) and
+        // its sky_view term (the return value), each blended toward 1 by the lighting's shadow and sky view strengths
+        // (sun_visibility and sky_visibility in the shader)
+        float occlusion(suns const& positioned, size_t count, float u, float v, float lod, shading::lighting const& l, float* lit) const;
+
+        // cast shadow mask of the posts (width * height bytes, 255 where the sun is fully visible)
+        void shadow_mask(float azimuth, float altitude, float exaggeration, uint8_t* mask) const;
+
+    private:
+
+        // the texels and weights of a bilinear sample in one level, shared by every layer
+        struct footprint
+        {
+            uint16_t const* values;     // the level's first layer
+            size_t layer_size;
+            size_t offsets[4];
+            float s;
+            float t;
+        };
+
+        // the footprints of a sample at a fractional level of detail (the second is only used when blend > 0)
+        struct lookup
+        {
+            footprint fine;
+            footprint coarse;
+            float blend;
+        };
+
+        footprint locate(size_t index, float u, float v) const;
+        lookup locate(float u, float v, float lod) const;
+
+        // filtered unorm value of a layer in [0, 1]
+        float sample(lookup const& l, size_t layer) const;
+
+        // fraction of the sun above a horizon (given by its sine) scaled by exaggeration
+        static float visibility(sun const& s, float sine, float exaggeration);
+
+    private:
+
+        size_t m_directions = 0;
+        std::vector<level> m_levels;
+
+    };
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+namespace hillshader
+{
+
+    enum class ordering
+    {
+        row_major,
+        tiled,      // square tiles of posts stored one after another, each tile row-major
+    };
+
+    // describes where the post in column i and row j of a width x height grid lives in memory
+    struct layout
+    {
+        static constexpr size_t c_tile_shift = 5;
+        static constexpr size_t c_tile_size = size_t(1) << c_tile_shift;    // a 32x32 tile of floats is one 4 KB page
+        static constexpr size_t c_tile_mask = c_tile_size - 1;
+
+        ordering order = ordering::row_major;
+        size_t width = 0;
+        size_t height = 0;
+        size_t tiles_x = 0;
+        size_t tiles_y = 0;
+
+        layout() = default;
+        layout(ordering order, size_t width, size_t height) :
+            order(order),
+            width(width),
+            height(height),
+            tiles_x((width + c_tile_mask) >> c_tile_shift),
+            tiles_y((height + c_tile_mask) >> c_tile_shift)
+        {}
+
+        inline size_t index(size_t i, size_t j) const
+        {
+            if (order == ordering::row_major)
+            {
+                return i + width * j;
+            }
+            else
+            {
+                size_t tile = (i >> c_tile_shift) + tiles_x * (j >> c_tile_shift);
+                return (tile << (2 * c_tile_shift)) | ((j & c_tile_mask) << c_tile_shift) | (i & c_tile_mask);
+            }
+        }
+
+        // offsets from the index of post (i, j) to posts (i + 1, j) and (i, j + 1), valid when neither step leaves the
+        // tile containing (i, j)
+        inline size_t step_x() const { return 1; }
+        inline size_t step_y() const { return (order == ordering::row_major) ? width : c_tile_size; }
+
+        inline bool quad_in_tile(size_t i, size_t j) const
+        {
+            return order == ordering::row_major || ((i & c_tile_mask) != c_tile_mask && (j & c_tile_mask) != c_tile_mask);
+        }
+
+        // number of elements required to store the grid (tiles along the edges are padded)
+        inline size_t size() const
+        {
+            return (order == ordering::row_major) ? width * height : (tiles_x * tiles_y) << (2 * c_tile_shift);
+        }
+
+        // tile size recorded in DEM files (zero means row-major)
+        inline size_t tile_size() const { return (order == ordering::row_major) ? 0 : c_tile_size; }
+    };
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace hillshader
+{
+
+    // read-only memory mapping of an entire file. pages are shared with every other process that maps the same file
+    class mapped_file
+    {
+    public:
+
+        mapped_file() = default;
+        mapped_file(std::filesystem::path const& path);
+        ~mapped_file();
+
+        mapped_file(mapped_file const& rhs) = delete;
+        mapped_file& operator=(mapped_file const& rhs) = delete;
+
+        mapped_file(mapped_file&& rhs) noexcept;
+        mapped_file& operator=(mapped_file&& rhs) noexcept;
+
+        inline bool is_open() const { return m_data != nullptr; }
+
+        inline std::byte const* data() const { return m_data; }
+        inline size_t size() const { return m_size; }
+
+        void close();
+
+    private:
+
+        std::byte const* m_data = nullptr;
+        size_t m_size = 0;
+
+#if defined(_WIN32)
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+
+    };
+
+}
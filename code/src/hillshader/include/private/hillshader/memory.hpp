@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+namespace hillshader::memory
+{
+
+    // bytes of the process currently resident in physical memory (0 if unavailable)
+    size_t resident_bytes();
+
+    // highest resident_bytes() over the lifetime of the process (0 if unavailable)
+    size_t peak_resident_bytes();
+
+}
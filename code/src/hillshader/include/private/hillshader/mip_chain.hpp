@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hillshader
+{
+
+    class terrain;
+
+    // box filtered mip levels of a terrain's texture. level L is max(1, width >> L) x max(1, height >> L) (matching
+    // the GPU convention) and each texel is the area-weighted average of the texels it covers in the level above, so
+    // odd dimensions are filtered without dropping a row or column. level 0 is the terrain itself and is not stored
+    class mip_chain
+    {
+    public:
+
+        struct level
+        {
+            size_t width = 0;
+            size_t height = 0;
+
+            // row-major values. quantized terrains produce 16-bit values with the terrain's quantization parameters.
+            // like the terrain's quantized storage, quantized_values has one leading element of slack (the texels
+            // start at quantized_values.data() + 1)
+            std::vector<float> values;
+            std::vector<uint16_t> quantized_values;
+        };
+
+    public:
+
+        mip_chain() = default;
+        mip_chain(terrain const& terrain);
+
+        // number of levels including level 0
+        inline size_t levels() const { return m_levels.size() + 1; }
+
+        // stored level L (for L >= 1)
+        inline level const& at(size_t index) const { return m_levels[index - 1]; }
+
+    private:
+
+        std::vector<level> m_levels;
+
+    };
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // a directory of adjacent DEM tiles (each with a sidecar json) treated as a single surface. the tile bounds are
+    // read up front into a uniform grid, but a tile is only decoded when a query touches it. at most capacity tiles stay
+    // decoded: loading another releases the least recently used one. positions are relative to the center
+    // of the mosaic, matching the convention of terrain
+    class mosaic
+    {
+    public:
+
+        struct tile
+        {
+            std::filesystem::path path;
+
+            // bounds in the mosaic's frame
+            stff::aabb2 bounds;
+
+            // mosaic position + offset = position in the tile's frame
+            stff::vec2 offset;
+        };
+
+    public:
+
+        static constexpr size_t c_default_capacity = 64;
+
+        // a capacity of zero keeps every tile that has been decoded
+        mosaic(std::filesystem::path const& directory);
+        mosaic(std::filesystem::path const& directory, terrain::options const& opts, size_t capacity = c_default_capacity);
+
+        mosaic(mosaic const& rhs) = delete;
+        mosaic& operator=(mosaic const& rhs) = delete;
+
+        inline bool empty() const { return m_tiles.empty(); }
+
+        inline size_t tile_count() const { return m_tiles.size(); }
+        inline tile const& tile_info(size_t index) const { return m_tiles[index]; }
+
+        inline size_t capacity() const { return m_capacity; }
+
+        // number of tiles currently decoded
+        size_t loaded() const;
+
+        // number of times a tile has been decoded (a tile that was released and touched again counts twice)
+        size_t loads() const;
+
+        inline stff::aabb2 const& bounds() const { return m_bounds; }
+
+        // center of the mosaic in the source coordinate system
+        inline stfd::vec2 const& center() const { return m_center; }
+
+        // elevation at a position, interpolating across tile seams. positions outside every tile (beyond the mosaic or
+        // in a gap in its coverage) have no elevation
+        std::optional<float> sample(stff::vec2 const& query) const;
+
+        // samples many positions in parallel. positions without an elevation are written as NaN
+        void sample(stff::vec2 const* queries, float* elevations, size_t count) const;
+
+        // first intersection of a ray with the surface. tiles are visited in the order the ray enters them and the
+        // half-texel band along each tile's edge (which the tile itself cannot interpolate) is marched with sample. a
+        // gap in the coverage is a hole: a ray that drops into one hits the side of the next tile it reaches, just as
+        // a ray that enters a terrain below its surface does
+        std::optional<stff::vec3> intersect(stff::ray3 const& ray) const;
+
+        // the decoded tile, loading it if it is not decoded (safe to call from multiple threads). the pointer keeps the
+        // tile alive after the mosaic releases it
+        std::shared_ptr<terrain const> load(size_t index) const;
+
+    private:
+
+        struct slot
+        {
+            // held while the tile is decoded, so that concurrent queries decode it once
+            std::mutex loading;
+
+            // guarded by m_mutex. recent is the tile's position in m_recent while it is decoded
+            std::shared_ptr<terrain const> dem;
+            std::list<size_t>::iterator recent;
+        };
+
+        // the last tile a sequence of queries loaded, which spares queries that stay within a tile the cache lookup
+        struct pin
+        {
+            size_t index = std::numeric_limits<size_t>::max();
+            std::shared_ptr<terrain const> dem;
+        };
+
+    private:
+
+        terrain const& load(size_t index, pin& pinned) const;
+
+        // marks a decoded tile as the most recently used (m_mutex must be held)
+        void touch(size_t index) const;
+
+        std::optional<float> sample(stff::vec2 const& query, pin& pinned) const;
+
+        // index of a tile containing a position
+        std::optional<size_t> find(stff::vec2 const& pos) const;
+
+        // nearest post to a position in whichever tile contains it
+        std::optional<float> nearest_post(stff::vec2 const& pos) const;
+
+        // bilinear interpolation of posts that straddle a seam (texel is in the frame of the given tile)
+        float sample_seam(size_t index, stff::vec2 const& texel, pin& pinned) const;
+
+        // first crossing of the surface on [t0, t1] found by marching with sample
+        std::optional<float> march(stff::ray3 const& ray, float t0, float t1, float step) const;
+
+        inline size_t cell_x(float x) const { return static_cast<size_t>(std::clamp((x - m_bounds.min.x) / m_cell_size.x, 0.f, static_cast<float>(m_cells_x - 1))); }
+        inline size_t cell_y(float y) const { return static_cast<size_t>(std::clamp((y - m_bounds.min.y) / m_cell_size.y, 0.f, static_cast<float>(m_cells_y - 1))); }
+
+    private:
+
+        terrain::options m_options;
+        size_t m_capacity;
+
+        std::vector<tile> m_tiles;
+        mutable std::vector<std::unique_ptr<slot>> m_slots;
+
+        // decoded tiles, most recently used first
+        mutable std::mutex m_mutex;
+        mutable std::list<size_t> m_recent;
+        mutable size_t m_loads = 0;
+
+        stff::aabb2 m_bounds;
+        stfd::vec2 m_center;
+
+        // uniform grid over the bounds. each cell lists the tiles that overlap it
+        stff::vec2 m_cell_size;
+        size_t m_cells_x = 0;
+        size_t m_cells_y = 0;
+        std::vector<std::vector<uint32_t>> m_cells;
+
+    };
+
+}
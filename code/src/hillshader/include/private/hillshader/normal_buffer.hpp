@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/horizon_field.hpp"
+#include "hillshader/shading.hpp"
+
+namespace hillshader
+{
+
+    // per-pixel normals of a frame from hillshade_renderer or perspective_renderer. the lighting controls (azimuth,
+    // altitude, ambient, albedo, and exaggeration) only enter the final dot product, so while the view is unchanged a
+    // frame can be re-lit from the buffer without sampling the terrain or tracing rays again
+    class normal_buffer
+    {
+    public:
+
+        void resize(size_t width, size_t height);
+
+        inline size_t width() const { return m_width; }
+        inline size_t height() const { return m_height; }
+        inline bool empty() const { return m_width == 0 || m_height == 0; }
+
+        // normals are stored before exaggeration and need not be unit length. pixels without terrain store a negative z
+        inline float* x() { return m_x.data(); }
+        inline float* y() { return m_y.data(); }
+        inline float* z() { return m_z.data(); }
+
+        // where each pixel sampled the terrain, which is where shadows and sky view are looked up when re-lighting
+        inline float* u() { return m_u.data(); }
+        inline float* v() { return m_v.data(); }
+        inline float* lod() { return m_lod.data(); }
+
+        inline void store(size_t index, stff::vec3 const& normal, float u, float v, float lod)
+        {
+            m_x[index] = normal.x; m_y[index] = normal.y; m_z[index] = normal.z;
+            m_u[index] = u; m_v[index] = v; m_lod[index] = lod;
+        }
+
+        inline void store_miss(size_t index) { m_x[index] = 0.f; m_y[index] = 0.f; m_z[index] = -1.f; }
+
+        // shades the buffer into rgba (4 * width * height bytes) exactly as the renderer that filled it would have
+        void shade(shading::lighting const& l, uint8_t* rgba) const;
+
+    public:
+
+        // heading of the camera that rendered the frame (the application's light follows the camera, see
+        // shading::view_azimuth). north-up frames use half_pi
+        float theta = stff::constants::half_pi;
+
+        // linear color of the pixels without terrain
+        stff::vec3 background = stff::vec3(0.f, 0.f, 0.f);
+
+        // the horizon field the frame was rendered with (if any). shadows move with the sun, so they are recomputed
+        // from the field for each new lighting
+        horizon_field const* horizons = nullptr;
+
+    private:
+
+        size_t m_width = 0;
+        size_t m_height = 0;
+        std::vector<float> m_x;
+        std::vector<float> m_y;
+        std::vector<float> m_z;
+        std::vector<float> m_u;
+        std::vector<float> m_v;
+        std::vector<float> m_lod;
+
+    };
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/mip_chain.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // unit terrain normals for every level of a mip chain, octahedral encoded into two 16-bit unorm channels (the
+    // memory layout of an RG16_UNORM texel, x in the low half). the normal of a texel at level L is the one normal_at
+    // in the shader computes there at lod L, so shading with the field takes one filtered fetch instead of four.
+    // exaggeration is applied at shading time (see shading::intensity)
+    class normal_field
+    {
+    public:
+
+        struct level
+        {
+            size_t width = 0;
+            size_t height = 0;
+            std::vector<uint32_t> values;       // row-major
+        };
+
+    public:
+
+        normal_field() = default;
+
+        // builds every level in parallel
+        normal_field(terrain const& terrain, mip_chain const& mips);
+
+        inline bool empty() const { return m_levels.empty(); }
+
+        inline size_t levels() const { return m_levels.size(); }
+        inline level const& at(size_t index) const { return m_levels[index]; }
+
+        size_t bytes() const;
+
+        static uint32_t encode(stff::vec3 const& normal);
+        static stff::vec3 decode(uint32_t encoded);
+
+        // filters the encoded values like SampleLevel does on the GPU (bilinear with clamp-to-edge within a level and
+        // linear between levels) and decodes the result. the result is not quite unit length
+        stff::vec3 sample(float u, float v, float lod) const;
+
+#if defined(HILLSHADER_AVX2)
+        // eight samples at the same fractional level of detail
+        void sample(__m256 u, __m256 v, float lod, __m256& x, __m256& y, __m256& z) const;
+#endif
+
+    private:
+
+        // filtered octahedral coordinates in [-1, 1] of a single level
+        stff::vec2 sample_encoded(size_t index, float u, float v) const;
+
+#if defined(HILLSHADER_AVX2)
+        void sample_encoded(size_t index, __m256 u, __m256 v, __m256& x, __m256& y) const;
+#endif
+
+    private:
+
+        std::vector<level> m_levels;
+
+    };
+
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+namespace hillshader
+{
+
+    // elevation backed by a z/x/y pyramid of web mercator terrarium tiles on disk (root/z/x/y.png). tiles are decoded
+    // on background threads into a bounded LRU as footprints request them. queries never wait on a decode: they use
+    // the finest resident tile that covers them, so coarser levels stand in while finer tiles are in flight. the
+    // tiles of the coarsest level are pinned so that there is always something to fall back to. positions are
+    // relative to center(), matching the convention of terrain. the viewer renders a pyramid through terrain
+    // snapshots of the resident tiles (see the paged terrain constructor of terrain)
+    class paged_terrain
+    {
+    public:
+
+        static constexpr size_t c_default_capacity = 512;
+
+        // ring of tiles requested around a footprint
+        static constexpr uint32_t c_prefetch_ring = 1;
+
+        // assumed tile resolution when picking a zoom level
+        static constexpr size_t c_tile_pixels = 256;
+
+        struct key
+        {
+            uint32_t z = 0;
+            uint32_t x = 0;
+            uint32_t y = 0;
+        };
+
+    public:
+
+        paged_terrain(std::filesystem::path const& root, size_t capacity = c_default_capacity);
+        ~paged_terrain();
+
+        paged_terrain(paged_terrain const& rhs) = delete;
+        paged_terrain& operator=(paged_terrain const& rhs) = delete;
+
+        inline bool empty() const { return m_empty; }
+
+        inline std::filesystem::path const& root() const { return m_root; }
+
+        // the capacity never drops below the pinned level plus one tile, so a new tile is never evicted by its own
+        // insertion
+        inline size_t capacity() const { return m_capacity; }
+
+        inline uint32_t min_zoom() const { return m_min_zoom; }
+        inline uint32_t max_zoom() const { return m_max_zoom; }
+
+        // coverage of the coarsest level, relative to the center
+        inline stff::aabb2 const& bounds() const { return m_bounds; }
+
+        // center of the coverage in web mercator meters
+        inline stfd::vec2 const& center() const { return m_center; }
+
+        // requests the tiles covering a footprint at the coarsest level whose texels are no larger than
+        // meters_per_texel, plus a prefetch ring. tiles nearest the middle of the footprint come first and the request
+        // is trimmed to the capacity left beside the pinned level. queued tiles that are no longer wanted are dropped
+        void request(stff::aabb2 const& footprint, float meters_per_texel);
+
+        // elevation from the finest resident tile covering a position (nullopt if no resident tile covers it). posts
+        // across a tile's edge are read from the neighboring tile of the same level when it is resident, so the
+        // surface is continuous across seams
+        std::optional<float> sample(stff::vec2 const& pos) const;
+
+        // samples many positions under a single lock. positions without a resident tile are written as NaN
+        void sample(stff::vec2 const* positions, float* elevations, size_t count) const;
+
+        // marches a ray through the resident tiles, refining the first crossing by bisection
+        std::optional<stff::vec3> intersect(stff::ray3 const& ray, float max_distance) const;
+
+        size_t resident() const;
+        size_t pending() const;
+
+        // number of tiles decoded so far. a caller that built something from the resident tiles rebuilds it once
+        // this changes
+        inline size_t revision() const { return m_revision.load(std::memory_order_acquire); }
+
+        // bounds of the ground visible from a camera, treating the ground as the plane at the given elevation and
+        // cutting rays that never reach it off at max_distance
+        static stff::aabb2 footprint(stff::scamera const& camera, float ground, float max_distance);
+
+    private:
+
+        // an empty tile marks a key without a file so that it is not requested again
+        struct tile
+        {
+            size_t width = 0;
+            size_t height = 0;
+            std::vector<float> values;
+        };
+
+        struct entry
+        {
+            std::shared_ptr<tile const> data;
+            std::list<uint64_t>::iterator lru;
+        };
+
+    private:
+
+        static inline uint64_t pack(key const& k) { return (static_cast<uint64_t>(k.z) << 58) | (static_cast<uint64_t>(k.x) << 29) | k.y; }
+
+        // edge length of a tile in meters
+        static double tile_meters(uint32_t z);
+
+        // tile bounds relative to the center
+        stff::aabb2 tile_bounds(key const& k) const;
+
+        // tile containing a position at a zoom level (nullopt off the edge of the world)
+        std::optional<key> tile_at(uint32_t z, stff::vec2 const& pos) const;
+
+        // sample that also reports the texel size of the level that answered (m_resident_mutex must be held)
+        std::optional<float> sample_locked(stff::vec2 const& pos, float* texel) const;
+
+        // post (i, j) of a tile, where i and j may be one past either edge. those posts come from the neighbor
+        // across the edge if it is resident and are clamped to the tile otherwise (m_resident_mutex must be held)
+        float post(key const& k, tile const& t, long i, long j) const;
+
+        void work();
+
+        std::shared_ptr<tile const> decode(key const& k) const;
+
+        void insert(key const& k, std::shared_ptr<tile const> data);
+
+    private:
+
+        std::filesystem::path m_root;
+        size_t m_capacity;
+
+        bool m_empty = true;
+        uint32_t m_min_zoom = 0;
+        uint32_t m_max_zoom = 0;
+        stfd::vec2 m_center;
+        stff::aabb2 m_bounds;
+
+        // resident tiles with their position in the LRU (most recently requested first)
+        mutable std::shared_mutex m_resident_mutex;
+        std::unordered_map<uint64_t, entry> m_resident;
+        std::list<uint64_t> m_lru;
+        size_t m_pinned = 0;
+        std::atomic<size_t> m_revision{0};
+
+        // the pinned queue (coarsest level) drains before the requested queue
+        mutable std::mutex m_queue_mutex;
+        std::condition_variable m_wake;
+        std::deque<key> m_pinned_queue;
+        std::deque<key> m_queue;
+        std::unordered_set<uint64_t> m_in_flight;
+        bool m_stopping = false;
+
+        std::vector<std::thread> m_workers;
+
+    };
+
+}
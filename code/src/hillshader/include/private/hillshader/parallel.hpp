@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace hillshader::parallel
+{
+
+    // number of threads to use for data-parallel work
+    size_t concurrency();
+
+    // splits [begin, end) into contiguous chunks and calls fn(chunk_begin, chunk_end, chunk_index) for each chunk on a
+    // separate thread. returns the number of chunks used (which is at most concurrency())
+    template<typename Fn>
+    size_t for_each_chunk(size_t begin, size_t end, Fn&& fn)
+    {
+        size_t const count = (end > begin) ? end - begin : 0;
+        size_t const chunks = std::max<size_t>(1, std::min(concurrency(), count));
+        size_t const per_chunk = (count + chunks - 1) / chunks;
+
+        std::vector<std::thread> threads;
+        threads.reserve(chunks - 1);
+        for (size_t c = 1; c < chunks; ++c)
+        {
+            size_t const lo = std::min(end, begin + c * per_chunk);
+            size_t const hi = std::min(end, lo + per_chunk);
+            threads.emplace_back([&fn, lo, hi, c]() { fn(lo, hi, c); });
+        }
+
+        // the calling thread processes the first chunk
+        fn(begin, std::min(end, begin + per_chunk), size_t(0));
+
+        for (std::thread& thread : threads) { thread.join(); }
+        return chunks;
+    }
+
+    // calls fn(index, worker_index) for each index in [begin, end). workers take the next index from a shared counter,
+    // so items with uneven costs (e.g. image tiles) balance across threads. returns the number of workers used
+    template<typename Fn>
+    size_t for_each_dynamic(size_t begin, size_t end, Fn&& fn)
+    {
+        size_t const count = (end > begin) ? end - begin : 0;
+        size_t const workers = std::max<size_t>(1, std::min(concurrency(), count));
+
+        std::atomic<size_t> next(begin);
+        auto work = [&fn, &next, end](size_t worker)
+        {
+            for (size_t index = next++; index < end; index = next++) { fn(index, worker); }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(workers - 1);
+        for (size_t w = 1; w < workers; ++w)
+        {
+            threads.emplace_back(work, w);
+        }
+
+        // the calling thread is the first worker
+        work(size_t(0));
+
+        for (std::thread& thread : threads) { thread.join(); }
+        return workers;
+    }
+
+}
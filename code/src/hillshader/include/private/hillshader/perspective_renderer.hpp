@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/horizon_field.hpp"
+#include "hillshader/normal_buffer.hpp"
+#include "hillshader/normal_field.hpp"
+#include "hillshader/shading.hpp"
+#include "hillshader/terrain.hpp"
+#include "hillshader/terrain_sampler.hpp"
+
+namespace hillshader
+{
+
+    // renders the application's 3d view of a terrain on the CPU by casting a ray through each pixel. threads take
+    // c_tile_size square tiles from a shared counter, trace each tile in packets of 4 x 2 pixels (see
+    // terrain::intersect) and shade the hits with the lighting model of shaders/hillshade.psh
+    class perspective_renderer
+    {
+    public:
+
+        static constexpr size_t c_tile_size = 16;
+
+        using lighting = shading::lighting;
+
+        struct view
+        {
+            // positioned relative to the terrain's center. the aspect ratio is taken from the image size
+            stff::scamera camera;
+
+            size_t width = 0;
+            size_t height = 0;
+
+            // distance between a hit and the taps that estimate its normal, per meter of distance to the eye
+            float step_scalar = 0.001f;
+
+            // linear color of the pixels whose rays miss the terrain
+            stff::vec3 background = stff::vec3(0.f, 0.f, 0.f);
+        };
+
+        struct stats
+        {
+            size_t rays = 0;
+            size_t hits = 0;
+        };
+
+    public:
+
+        // with a normal field, each hit fetches its normal instead of estimating it from four elevation taps. with a
+        // horizon field, hits are darkened by cast shadows and the sky-view factor (see shading::lighting)
+        perspective_renderer(terrain const& terrain, mip_chain const& mips, normal_field const* normals = nullptr, horizon_field const* horizons = nullptr);
+
+        // renders into rgba (4 * width * height bytes, top row first). like the application's swap chain, colors are
+        // sRGB encoded. if normals is provided, it receives the frame's normals so that later lighting changes can be
+        // applied with normal_buffer::shade
+        stats render(view const& v, lighting const& l, uint8_t* rgba, normal_buffer* normals = nullptr) const;
+
+    private:
+
+        terrain const& m_terrain;
+        terrain_sampler m_sampler;
+        normal_field const* m_normals;
+        horizon_field const* m_horizons;
+
+    };
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+
+namespace hillshader
+{
+
+    // progress and cancellation state shared between a worker thread and the thread that observes it
+    class progress
+    {
+    public:
+
+        inline float fraction() const { return m_fraction.load(std::memory_order_relaxed); }
+        inline void set(float const fraction) { m_fraction.store(fraction, std::memory_order_relaxed); }
+
+        inline bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+        inline void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+
+    private:
+
+        std::atomic<float> m_fraction{ 0.f };
+        std::atomic<bool> m_cancelled{ false };
+
+    };
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include <stf/stf.hpp>
+
+namespace hillshader
+{
+
+    class terrain;
+
+    // min/max pyramid over the bilinear cells of a terrain. a cell spans four neighboring posts and the node (i, j) at
+    // level L covers cells [i * 2^L, (i + 1) * 2^L) x [j * 2^L, (j + 1) * 2^L). levels below c_base_level are not
+    // stored (they are computed from the posts on demand) which keeps the pyramid at 1/8th the size of the terrain
+    class pyramid
+    {
+    public:
+
+        static constexpr size_t c_base_level = 2;
+
+        pyramid() = default;
+        pyramid(terrain const& terrain);
+
+        inline bool empty() const { return m_terrain == nullptr; }
+
+        // number of levels, the top level is a single node covering every cell
+        inline size_t levels() const { return m_top + 1; }
+        inline size_t top() const { return m_top; }
+
+        inline size_t cells_x() const { return m_cells_x; }
+        inline size_t cells_y() const { return m_cells_y; }
+
+        // number of nodes along each dimension at a level
+        inline size_t width(size_t level) const { return (m_cells_x + (size_t(1) << level) - 1) >> level; }
+        inline size_t height(size_t level) const { return (m_cells_y + (size_t(1) << level) - 1) >> level; }
+
+        // elevation range of the posts touched by the node (i, j) at a level
+        stff::interval range(size_t level, size_t i, size_t j) const;
+
+        // bytes held by the stored levels
+        size_t bytes() const;
+
+    private:
+
+        stff::interval scan(size_t level, size_t i, size_t j) const;
+
+    private:
+
+        terrain const* m_terrain = nullptr;
+        size_t m_cells_x = 0;
+        size_t m_cells_y = 0;
+        size_t m_top = 0;
+
+        // stored levels, starting at c_base_level
+        std::vector<std::vector<stff::interval>> m_levels;
+
+    };
+
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/simd.hpp"
+
+// the lighting model of shaders/hillshade.psh, for code that shades on the CPU. keep the two in sync
+namespace hillshader::shading
+{
+
+    // the shader's constant buffer has room for this many lights
+    static constexpr size_t c_max_lights = 4;
+
+    // a sun at an azimuth (degrees clockwise from north) and altitude (degrees above the horizon). the weight is its
+    // share of the direct light relative to the other lights
+    struct light
+    {
+        float azimuth = 315.f;
+        float altitude = 50.f;
+        float weight = 1.f;
+    };
+
+    // mirrors the lighting controls of the application
+    struct lighting
+    {
+        stff::vec3 albedo = stff::vec3(1.f, 1.f, 1.f);
+
+        // weights are normalized to sum to 1 and lights past c_max_lights are ignored. combining several azimuths
+        // (see multidirectional) keeps slopes that face away from a single sun legible
+        std::vector<light> lights = { light() };
+
+        float ambient_intensity = 0.f;
+        float exaggeration = 5.f;
+
+        // how much a horizon field's cast shadows and sky-view factor darken the direct and ambient light (0 ignores
+        // them and 1 applies them fully). they have no effect without a horizon field
+        float shadows = 1.f;
+        float sky_view = 1.f;
+    };
+
+    // the application holds the light fixed relative to the view, so the azimuth the shader sees is offset by the
+    // camera's heading (theta = half_pi looks north and leaves the azimuth unchanged)
+    inline float view_azimuth(float const azimuth, float const theta)
+    {
+        return azimuth - stf::math::to_degrees(theta - stff::constants::half_pi);
+    }
+
+    // direction the light travels for a sun at the given azimuth (degrees clockwise from north) and altitude (degrees
+    // above the horizon)
+    inline stff::vec3 light_direction(float const azimuth, float const altitude)
+    {
+        // transform azimuth and altitude into spherical coordinates
+        float const theta = stff::constants::half_pi - stf::math::to_radians(azimuth);
+        float const phi = stff::constants::half_pi - stf::math::to_radians(altitude);
+        return -stf::math::unit_vector(theta, phi);
+    }
+
+    // the four azimuths of the USGS multidirectional oblique-weighted (MDOW) hillshade, placed so that the default
+    // azimuth of 315 gives MDOW's 225, 270, 315 and 360. MDOW weights each azimuth by the local aspect, which averages
+    // out to equal weights, and equal weights are what this returns
+    inline std::vector<light> multidirectional(light const& primary)
+    {
+        std::vector<light> lights;
+        for (float const offset : { -90.f, -45.f, 0.f, 45.f })
+        {
+            lights.push_back(light{ primary.azimuth + offset, primary.altitude, primary.weight });
+        }
+        return lights;
+    }
+
+    // the lights of a lighting as a frame uses them: azimuths offset by the view (see view_azimuth), weights
+    // normalized and lights without weight dropped
+    struct light_set
+    {
+        size_t count = 0;
+        std::array<light, c_max_lights> lights;
+        std::array<stff::vec3, c_max_lights> directions;        // of travel
+
+        // the diffuse term is linear in the light direction, so lights that are not shadowed shade exactly like one
+        // light along the weighted sum of their directions. weight is the sum of the weights (0 without lights)
+        stff::vec3 combined = stff::vec3(0.f, 0.f, 0.f);
+        float weight = 0.f;
+    };
+
+    inline light_set resolve(lighting const& l, float const theta = stff::constants::half_pi)
+    {
+        size_t const count = std::min(l.lights.size(), c_max_lights);
+        float total = 0.f;
+        for (size_t i = 0; i < count; ++i) { total += std::max(l.lights[i].weight, 0.f); }
+
+        light_set set;
+        for (size_t i = 0; i < count && total > 0.f; ++i)
+        {
+            light const& source = l.lights[i];
+            if (source.weight <= 0.f) { continue; }
+            light& resolved = set.lights[set.count];
+            resolved.azimuth = view_azimuth(source.azimuth, theta);
+            resolved.altitude = source.altitude;
+            resolved.weight = source.weight / total;
+            set.directions[set.count] = light_direction(resolved.azimuth, resolved.altitude);
+            set.combined += resolved.weight * set.directions[set.count];
+            set.weight += resolved.weight;
+            ++set.count;
+        }
+        return set;
+    }
+
+    // unnormalized normal from the central differences of the four taps around a point, where the taps are
+    // delta_world meters from the point (normal_at in the shader)
+    inline stff::vec3 normal(float east, float west, float north, float south, float delta_world)
+    {
+        return stff::vec3(west - east, south - north, 2.f * delta_world);
+    }
+
+    // shading intensity in [0, 1] of a normal (which need not be unit length). albedo scales the intensity (hillshade
+    // in the shader)
+    inline float intensity(light_set const& lights, float ambient_intensity, stff::vec3 const& normal, float exaggeration)
+    {
+        float const x = exaggeration * normal.x;
+        float const y = exaggeration * normal.y;
+        float const inv_length = 1.f / std::sqrt(x * x + y * y + normal.z * normal.z);
+        stff::vec3 const& light_dir = lights.combined;
+        float const cosine = inv_length * (x * light_dir.x + y * light_dir.y + normal.z * light_dir.z);
+        float const strength = 0.5f * (lights.weight - cosine);
+        return ambient_intensity + (1.f - ambient_intensity) * strength;
+    }
+
+    // intensity with each sun partly hidden (lit holds one value per light) and the sky partly occluded (sky_view),
+    // all in [0, 1]. see horizon_field::occlusion. the normal is normalized once for all the lights
+    inline float intensity(light_set const& lights, float ambient_intensity, stff::vec3 const& normal, float exaggeration, float const* lit, float sky_view)
+    {
+        float const x = exaggeration * normal.x;
+        float const y = exaggeration * normal.y;
+        float const inv_length = 1.f / std::sqrt(x * x + y * y + normal.z * normal.z);
+        float diffuse = 0.f;
+        for (size_t i = 0; i < lights.count; ++i)
+        {
+            stff::vec3 const& light_dir = lights.directions[i];
+            float const cosine = inv_length * (x * light_dir.x + y * light_dir.y + normal.z * light_dir.z);
+            float const strength = 0.5f * (1.f - cosine);
+            diffuse += lights.lights[i].weight * strength * lit[i];
+        }
+        return ambient_intensity * sky_view + (1.f - ambient_intensity) * diffuse;
+    }
+
+    // 8-bit sRGB encodings of linear values i / 65535. the three bytes of slack let vector code read each entry as
+    // the low byte of a 32-bit load
+    inline std::array<uint8_t, 65536 + 3> const& srgb_table()
+    {
+        static std::array<uint8_t, 65536 + 3> const table = []()
+        {
+            std::array<uint8_t, 65536 + 3> values = {};
+            for (size_t i = 0; i < 65536; ++i)
+            {
+                double const c = static_cast<double>(i) / 65535.0;
+                double const encoded = (c <= 0.0031308) ? 12.92 * c : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+                values[i] = static_cast<uint8_t>(std::round(255.0 * encoded));
+            }
+            return values;
+        }();
+        return table;
+    }
+
+    // encodes a linear value in [0, 1] as 8-bit sRGB, which is what the swap chain's sRGB format does on write
+    inline uint8_t encode_srgb(float linear)
+    {
+        float const clamped = (linear > 0.f) ? std::min(linear, 1.f) : 0.f;
+        return srgb_table()[static_cast<size_t>(clamped * 65535.f + 0.5f)];
+    }
+
+    // writes count opaque sRGB pixels with color albedo * intensities[i] (the last step of every CPU renderer)
+    inline void encode_row(float const* intensities, size_t count, stff::vec3 const& albedo, uint8_t* rgba)
+    {
+        size_t i = 0;
+#if defined(HILLSHADER_AVX2)
+        uint8_t const* table = srgb_table().data();
+        __m256 const zero = _mm256_setzero_ps();
+        __m256 const one = _mm256_set1_ps(1.f);
+        __m256 const scale = _mm256_set1_ps(65535.f);
+        __m256 const half = _mm256_set1_ps(0.5f);
+        __m256i const low_byte = _mm256_set1_epi32(0xff);
+        auto channel = [&](__m256 intensity, float a)
+        {
+            // max(x, 0) returns 0 for NaN, matching encode_srgb
+            __m256 const clamped = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_set1_ps(a), intensity), zero), one);
+            __m256i const index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(clamped, scale), half));
+            return _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<int const*>(table), index, 1), low_byte);
+        };
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 const intensity = _mm256_loadu_ps(intensities + i);
+            __m256i pixels = _mm256_set1_epi32(static_cast<int>(0xff000000));
+            pixels = _mm256_or_si256(pixels, channel(intensity, albedo.x));
+            pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(channel(intensity, albedo.y), 8));
+            pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(channel(intensity, albedo.z), 16));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4 * i), pixels);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            rgba[4 * i + 0] = encode_srgb(albedo.x * intensities[i]);
+            rgba[4 * i + 1] = encode_srgb(albedo.y * intensities[i]);
+            rgba[4 * i + 2] = encode_srgb(albedo.z * intensities[i]);
+            rgba[4 * i + 3] = 255;
+        }
+    }
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// detect which vector instruction sets the translation unit may use. msvc does not define __SSSE3__ but every x64
+// target we ship to supports it, so we enable the ssse3 paths there as well. the avx2 paths also use fma, which msvc
+// enables alongside /arch:AVX2
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+    #define HILLSHADER_AVX2 1
+#endif
+
+#if defined(__SSSE3__) || defined(_M_X64) || defined(_M_AMD64)
+    #define HILLSHADER_SSSE3 1
+#endif
+
+#if defined(HILLSHADER_AVX2)
+    #include <immintrin.h>
+#elif defined(HILLSHADER_SSSE3)
+    #include <tmmintrin.h>
+#endif
+
+#if defined(HILLSHADER_AVX2) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace hillshader::simd
+{
+
+    // whether the cpu can run the instruction sets the build targets (see HILLSHADER_ENABLE_AVX2 in the cmake files).
+    // executables check this first so an avx2 build stops with a message on an older cpu instead of faulting on an
+    // illegal instruction somewhere in the first vector loop
+    inline bool supported()
+    {
+#if defined(HILLSHADER_AVX2)
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool const fma = (info[2] & (1 << 12)) != 0;
+        bool const os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        bool const avx2 = (info[1] & (1 << 5)) != 0;
+        return fma && os_saves_ymm && avx2;
+    #else
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    #endif
+#else
+        return true;
+#endif
+    }
+
+    // the widest vector path compiled into this target (the flags are per target, so every translation unit of an
+    // executable agrees). executables report it with their timings so a benchmark shows which path it measured
+    constexpr char const* name()
+    {
+#if defined(HILLSHADER_AVX2)
+        return "avx2";
+#elif defined(HILLSHADER_SSSE3)
+        return "ssse3";
+#else
+        return "scalar";
+#endif
+    }
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+namespace hillshader
+{
+
+    class terrain;
+
+    // summed-area tables of the elevations and squared elevations of a terrain's posts, so the mean and variance of any
+    // rectangle of posts cost four lookups regardless of its size. sums are kept in double precision relative to the
+    // middle of the elevation range, which keeps the variance (a difference of two large sums) accurate on big DEMs
+    class summed_area_table
+    {
+    public:
+
+        struct statistics
+        {
+            size_t count = 0;
+            double mean = 0.0;
+            double variance = 0.0;
+
+            inline double stddev() const { return std::sqrt(variance); }
+        };
+
+    public:
+
+        summed_area_table() = default;
+
+        // rows are summed in parallel and then columns are summed in parallel
+        summed_area_table(terrain const& terrain);
+
+        inline bool empty() const { return m_moments.empty(); }
+
+        // dimensions in posts
+        inline size_t width() const { return m_width; }
+        inline size_t height() const { return m_height; }
+
+        inline size_t bytes() const { return sizeof(moments) * m_moments.size(); }
+
+        // statistics of the posts in columns [i0, i1) and rows [j0, j1), which are clamped to the terrain
+        statistics query(size_t i0, size_t j0, size_t i1, size_t j1) const;
+
+        // statistics of the posts inside an area in world space (relative to the terrain's center, like
+        // terrain::bounds). this is what the application shows for the area around the cursor
+        statistics query(terrain const& terrain, stff::aabb2 const& area) const;
+
+        // maximum elevation deviation over several scales for rows [begin, end) of posts. at each radius r a post's
+        // deviation is (z - mean) / stddev over the (2r + 1) x (2r + 1) window of posts around it (clipped to the
+        // terrain). the value with the largest magnitude across radii is written, so ridges and valleys stand out at
+        // whichever scale they are most prominent. writes (end - begin) * width() values
+        void relief(terrain const& terrain, std::vector<size_t> const& radii, size_t begin, size_t end, float* deviations) const;
+
+    private:
+
+        // sums of (z - m_reference) and (z - m_reference)^2 over the posts above and to the left of an entry
+        struct moments
+        {
+            double sum;
+            double squares;
+        };
+
+        // (m_width + 1) x (m_height + 1) entries with a leading row and column of zeros
+        inline moments const& at(size_t i, size_t j) const { return m_moments[j * (m_width + 1) + i]; }
+
+    private:
+
+        size_t m_width = 0;
+        size_t m_height = 0;
+        double m_reference = 0.0;
+        std::vector<moments> m_moments;
+
+    };
+
+}
@@ -6,39 +6,225 @@
 
 #include <stf/stf.hpp>
 
+#include "hillshader/layout.hpp"
+#include "hillshader/mapped_file.hpp"
+#include "hillshader/progress.hpp"
+#include "hillshader/pyramid.hpp"
+#include "hillshader/summed_area_table.hpp"
+
 namespace hillshader
 {
 
+    class paged_terrain;
+
     class terrain
     {
     public:
 
-        terrain(std::filesystem::path const& path);
+        struct options
+        {
+            // tiled storage keeps 2D neighborhoods (and north-south ray marches) within a page
+            ordering order = ordering::row_major;
+
+            // store elevations as 16-bit integers scaled over the elevation range
+            bool quantize = false;
+
+            // precompute a normal field for every mip level when the DEM is loaded for rendering (see normal_field)
+            bool normals = false;
+
+            // azimuths of the horizon field (cast shadows and sky-view factor) built when the DEM is loaded for
+            // rendering. 0 skips it (see horizon_field)
+            size_t horizons = 0;
+
+            // build summed-area tables of the elevations for constant time regional statistics (see
+            // summed_area_table). they take four times the memory of float elevations
+            bool summed_area = false;
+        };
+
+        // elevation = offset + scale * value for quantized values. max_error bounds the difference between a
+        // quantized elevation and the elevation it was computed from
+        struct quantization
+        {
+            float offset = 0.f;
+            float scale = 1.f;
+            float max_error = 0.f;
+        };
+
+    public:
+
+        // loads a DEM from a terrarium png (with a sidecar json), a native DEM file or a compressed DEM file (.hsz).
+        // terrarium DEMs are cached in the native format next to the png and the cache is memory mapped on subsequent
+        // loads. compressed DEMs decode quickly enough that they are not cached. if progress is
+        // provided, the load reports into it and stops early (leaving the terrain empty) when it is cancelled
+        terrain(std::filesystem::path const& path, progress* progress = nullptr);
+        terrain(std::filesystem::path const& path, options const& opts, progress* progress = nullptr);
+
+        // snapshot of the tiles a paged terrain has resident over an area (relative to pages.center()), sampled with
+        // width x height posts at the finest resident level. snapshots share the center of the pages, so a new one
+        // can replace the last without moving the camera. posts no resident tile covers take the lowest elevation
+        // and the terrain is empty if none is covered
+        terrain(paged_terrain const& pages, stff::aabb2 const& area, size_t width, size_t height, options const& opts, progress* progress = nullptr);
+
+        terrain(terrain const& rhs) = delete;
+        terrain& operator=(terrain const& rhs) = delete;
 
-        float sample(stff::vec2 const& query) const;
+        inline float sample(stff::vec2 const& query) const { return sample_one(query); }
 
+        // samples a batch of queries, writing count elevations. queries outside the bounds sample as range().a
+        void sample(stff::vec2 const* queries, float* elevations, size_t count) const;
+
+        // computes the first point where the ray crosses the bilinear surface through the posts. the min/max pyramid
+        // lets the traversal skip every block the ray clears and the crossing inside the final cell is solved exactly.
+        // rays that leave the DEM without crossing it miss (callers that want a floor beyond the edge add one)
         std::optional<stff::vec3> intersect(stff::ray3 const& ray) const;
 
+        static constexpr size_t c_packet_size = 8;
+
+        // first hits of a packet of rays as ray parameters (infinity for a miss). the packet descends the pyramid
+        // together, so coherent rays (e.g. neighboring pixels) share the node tests that dominate the traversal. the
+        // results match intersecting each ray on its own
+        void intersect(std::array<stff::ray3, c_packet_size> const& rays, std::array<float, c_packet_size>& hits) const;
+
+        inline bool empty() const { return m_data == nullptr && m_quantized == nullptr; }
+
         inline size_t width() const { return m_width; }
         inline size_t height() const { return m_height; }
 
         inline stff::interval const& range() const { return m_range; }
 
+        // bounds are relative to center()
         inline stff::aabb2 const& bounds() const { return m_bounds; }
 
-        inline std::vector<float> const& values() const { return m_values; }
+        // center of the DEM in the source coordinate system
+        inline stfd::vec2 const& center() const { return m_center; }
+
+        // elevation values in the order described by storage() (either owned or pointing into a memory mapped DEM file).
+        // null if the terrain is quantized
+        inline float const* values() const { return m_data; }
+
+        // quantized elevation values in the order described by storage(). null if the terrain is not quantized
+        inline uint16_t const* quantized_values() const { return m_quantized; }
+
+        inline bool is_quantized() const { return m_quantized != nullptr; }
+
+        inline quantization const& quantization_params() const { return m_quantization; }
+
+        inline layout const& storage() const { return m_layout; }
+
+        inline bool is_mapped() const { return m_mapping.is_open(); }
+
+        inline pyramid const& min_max() const { return m_pyramid; }
+
+        // empty unless the terrain was loaded with options::summed_area
+        inline summed_area_table const& summed_area() const { return m_summed_area; }
+
+        // elevation of the post in column i and row j
+        inline float read(size_t i, size_t j) const
+        {
+            size_t const index = m_layout.index(i, j);
+            return (m_data) ? m_data[index] : dequantize(m_quantized[index]);
+        }
+
+        // reads posts (i, j), (i + 1, j), (i, j + 1), and (i + 1, j + 1)
+        inline std::array<float, 4> read_quad(size_t i, size_t j) const
+        {
+            if (m_layout.quad_in_tile(i, j))
+            {
+                size_t const index = m_layout.index(i, j);
+                size_t const step = m_layout.step_y();
+                if (m_data)
+                {
+                    float const* ptr = m_data + index;
+                    return { ptr[0], ptr[1], ptr[step], ptr[step + 1] };
+                }
+                else
+                {
+                    uint16_t const* ptr = m_quantized + index;
+                    return { dequantize(ptr[0]), dequantize(ptr[1]), dequantize(ptr[step]), dequantize(ptr[step + 1]) };
+                }
+            }
+            else
+            {
+                return { read(i, j), read(i + 1, j), read(i, j + 1), read(i + 1, j + 1) };
+            }
+        }
+
+        inline float dequantize(uint16_t value) const { return m_quantization.offset + m_quantization.scale * static_cast<float>(value); }
+
+        // copies rows [begin, end) into dst in row-major order
+        void copy_rows(size_t begin, size_t end, float* dst) const;
+
+        // copies quantized rows [begin, end) into dst in row-major order (only valid for a quantized terrain)
+        void copy_quantized_rows(size_t begin, size_t end, uint16_t* dst) const;
+
+        // transforms a position in world space to texel space, where post (i, j) sits at (i, j)
+        inline stff::vec2 to_texel(stff::vec2 const& pos) const
+        {
+            return stff::vec2(m_texel_scale.x * pos.x + m_texel_offset.x, m_texel_scale.y * pos.y + m_texel_offset.y);
+        }
 
     private:
 
-        float read(size_t i, size_t j) const { return m_values[i + m_width * j]; }
+        // a ray in texel space (parameterized by the same t as the world space ray)
+        struct texel_ray
+        {
+            double x, y, z;
+            double dx, dy, dz;
+        };
+
+        float sample_one(stff::vec2 const& query) const;
+
+        texel_ray to_texel(stff::ray3 const& ray) const;
+
+        std::optional<double> intersect(texel_ray const& ray, size_t level, size_t i, size_t j, double t0, double t1) const;
+
+        std::optional<double> intersect_cell(texel_ray const& ray, size_t i, size_t j, double t0, double t1) const;
+
+        void initialize();
+
+        bool load_native(std::filesystem::path const& path, std::filesystem::path const& source);
+
+        void load_terrarium(std::filesystem::path const& path, ordering order, progress* progress);
+
+        // decodes the tiles of a compressed DEM in parallel
+        void load_compressed(std::filesystem::path const& path, ordering order, progress* progress);
+
+        // moves the values into owned storage with the given ordering (a no-op if they are already stored that way)
+        void reorder(ordering order);
+
+        // writes row-major rows [begin, end) from src into the owned storage
+        void store_rows(size_t begin, size_t end, float const* src);
+
+        // replaces the float values with 16-bit values spanning the elevation range
+        void quantize();
+
+        void write_native(std::filesystem::path const& path, std::filesystem::path const& source) const;
+
+        void set_bounds(stfd::vec2 const& min, stfd::vec2 const& max);
 
         size_t m_width;
         size_t m_height;
+        layout m_layout;
         std::vector<float> m_values;
+        mapped_file m_mapping;
+        float const* m_data;
+
+        // the quantized storage has one leading element of slack so that vector code can read each value as the
+        // high half of a 32-bit word
+        std::vector<uint16_t> m_quantized_values;
+        uint16_t const* m_quantized;
+        quantization m_quantization;
 
         stff::interval m_range;
 
         stff::aabb2 m_bounds;
+        stfd::vec2 m_center;
+
+        stff::vec2 m_texel_scale;
+        stff::vec2 m_texel_offset;
+
+        pyramid m_pyramid;
+        summed_area_table m_summed_area;
 
     };
 
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+
+#include "hillshader/progress.hpp"
+#include "hillshader/shading.hpp"
+#include "hillshader/terrain.hpp"
+
+// slope, aspect, curvature and hillshade of every post, computed together from a single read of each post's 3x3
+// neighborhood. the terrain is processed in strips of rows (each read with a one row halo above and below) and the
+// rows of a strip are spread across threads, so memory is bounded by the strip size rather than the DEM size
+namespace hillshader::terrain_derivatives
+{
+
+    enum raster : size_t
+    {
+        slope,          // degrees from horizontal (Horn's method)
+        aspect,         // degrees clockwise from north that the slope faces, -1 where the terrain is flat
+        curvature,      // negated laplacian in hundredths of a meter per square meter, positive on convex terrain
+        hillshade,      // shading::intensity of the post's normal
+        count
+    };
+
+    // file name suffix of each raster
+    inline char const* name(raster r)
+    {
+        static constexpr char const* c_names[count] = { "slope", "aspect", "curvature", "hillshade" };
+        return c_names[r];
+    }
+
+    struct options
+    {
+        // which rasters to compute
+        std::array<bool, count> rasters = { true, true, true, true };
+
+        // lighting of the hillshade raster (its exaggeration does not affect the other rasters)
+        shading::lighting lighting;
+
+        // rows per strip. each raster holds one strip at a time
+        size_t strip_rows = 256;
+    };
+
+    // receives each strip once all of its rows are computed, in order from the north edge. rows[r] points at
+    // (end - begin) * width row-major values of raster r (null if the raster was not requested). returning false stops
+    // the pass
+    using sink = std::function<bool(size_t begin, size_t end, std::array<float const*, count> const& rows)>;
+
+    // returns false if the sink stopped the pass or progress was cancelled
+    bool compute(terrain const& terrain, options const& opts, sink const& consume, progress* progress = nullptr);
+
+    // writes each requested raster to prefix.<name>.hsdem (with the terrain's bounds) as the strips are computed.
+    // returns false if a file could not be written or progress was cancelled
+    bool write(terrain const& terrain, options const& opts, std::filesystem::path const& prefix, progress* progress = nullptr);
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hillshader/layout.hpp"
+#include "hillshader/mip_chain.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // CPU counterpart of SampleLevel on the terrain texture in the shaders: bilinear filtering with clamp-to-edge
+    // addressing within a level and linear filtering between adjacent levels of the mip chain. uv (0, 0) is the north
+    // west corner of the terrain and texel centers sit at (i + 0.5) / width. samples are elevations in meters
+    class terrain_sampler
+    {
+    public:
+
+        struct level
+        {
+            size_t width = 0;
+            size_t height = 0;
+            layout storage;                     // where texel (i, j) lives in values or codes
+            float const* values = nullptr;      // null for quantized levels
+            uint16_t const* codes = nullptr;    // quantized values, preceded by one element of slack
+        };
+
+    public:
+
+        // the levels are read in place: tiled terrains are addressed through their layout and quantized terrains are
+        // filtered in code space and dequantized once per sample
+        terrain_sampler(terrain const& terrain, mip_chain const& mips);
+
+        terrain_sampler(terrain_sampler const& rhs) = delete;
+        terrain_sampler& operator=(terrain_sampler const& rhs) = delete;
+
+        inline size_t levels() const { return m_levels.size(); }
+        inline level const& at(size_t index) const { return m_levels[index]; }
+
+        // bilinear sample of a single level
+        float sample(size_t index, float u, float v) const;
+
+        // sample at a fractional level of detail (clamped to the chain)
+        float sample(float u, float v, float lod) const;
+
+#if defined(HILLSHADER_AVX2)
+        // eight bilinear samples of a single level (a lane at a time if the level is too large for 32-bit gathers)
+        __m256 sample(size_t index, __m256 u, __m256 v) const;
+
+        // eight samples at the same fractional level of detail
+        __m256 sample(__m256 u, __m256 v, float lod) const;
+#endif
+
+    private:
+
+        std::vector<level> m_levels;
+        terrain::quantization m_quantization;
+
+    };
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+#include <stf/stf.hpp>
+
+namespace hillshader::terrarium
+{
+
+    // decodes a single terrarium pixel (r * 256 + g + b / 256 - 32768)
+    float decode(unsigned char const* pixel);
+
+    // decodes rows [begin, end) of a terrarium image with the given channel count into out (which holds the decoded
+    // rows contiguously, starting with row begin) and returns the elevation range of the decoded rows
+    stff::interval decode(unsigned char const* img, size_t channels, size_t width, size_t begin, size_t end, float* out);
+
+    // encodes an elevation as a terrarium pixel (rgb), rounding to the nearest 1/256 m and clamping to the range the
+    // format can represent
+    void encode(float elevation, unsigned char* pixel);
+
+    // encodes count elevations into count rgb pixels
+    void encode(float const* values, size_t count, unsigned char* out);
+
+    // reads the bounds of a terrarium image from its sidecar (the image path with a .json extension), which holds
+    // "min": [x, y] and "max": [x, y]. returns false and leaves min and max unchanged if the sidecar is missing or
+    // malformed
+    bool read_sidecar(std::filesystem::path const& image, stfd::vec2& min, stfd::vec2& max);
+
+}
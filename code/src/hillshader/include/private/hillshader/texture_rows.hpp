@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // rows of a terrain in the row-major layout of its texture, handed out one strip at a time for an upload.
+    // row-major float terrains are read straight from their (possibly memory mapped) buffer and every other storage is
+    // flattened into a staging strip of at most strip_bytes. quantized terrains hand out their 16-bit values as-is
+    class texture_rows
+    {
+    public:
+
+        // a strip_bytes of zero flattens the whole terrain at once
+        texture_rows(terrain const& terrain, size_t strip_bytes);
+
+        texture_rows(texture_rows const& rhs) = delete;
+        texture_rows& operator=(texture_rows const& rhs) = delete;
+
+        inline size_t element_size() const { return m_element_size; }
+        inline size_t row_bytes() const { return m_element_size * m_terrain.width(); }
+
+        // rows per strip (the height of the terrain when it fits in a single strip)
+        inline size_t strip_rows() const { return m_strip_rows; }
+
+        // true if the rows come straight from the terrain's buffer
+        inline bool direct() const { return m_direct; }
+
+        // rows [begin, end), at most strip_rows() of them. the pointer is valid until the next call
+        void const* rows(size_t begin, size_t end);
+
+    private:
+
+        terrain const& m_terrain;
+        size_t m_element_size;
+        size_t m_strip_rows;
+        bool m_direct;
+
+        std::vector<float> m_strip;
+        std::vector<uint16_t> m_quantized_strip;
+
+    };
+
+}
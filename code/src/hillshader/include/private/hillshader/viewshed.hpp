@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "hillshader/terrain.hpp"
+
+namespace hillshader
+{
+
+    // the posts of a terrain that can be seen from an observer. the area around the observer is split into four
+    // sectors by the axis that dominates the direction to a post, and each sector is swept by rays from the observer to
+    // every post on its far edge (the R2 algorithm). a ray carries the steepest line of sight it has passed, so each
+    // post costs a single comparison, and every post is decided by exactly the ray that passes closest to it, so rays
+    // are independent and are spread across threads. rays read a float copy of the posts laid out so that they step
+    // along its rows (a transposed copy for the north and south sectors), which costs one copy of the square's posts
+    class viewshed
+    {
+    public:
+
+        static constexpr double c_earth_radius = 6371000.0;
+
+        struct observer
+        {
+            // relative to the terrain's center (like terrain::bounds). the observer stands on the nearest post
+            stff::vec2 position = stff::vec2(0.f, 0.f);
+
+            // heights above the terrain of the observer's eye and of the targets it looks for
+            float height = 2.f;
+            float target_height = 0.f;
+
+            // meters around the observer to consider (0 considers the whole terrain)
+            float radius = 0.f;
+
+            // lowers distant terrain by the curvature of the earth, less the fraction that atmospheric refraction
+            // bends the line of sight back
+            bool earth_curvature = true;
+            float refraction = 0.13f;
+        };
+
+    public:
+
+        viewshed() = default;
+        viewshed(terrain const& terrain, observer const& obs);
+
+        inline bool empty() const { return m_values.empty(); }
+
+        // the raster covers columns [column(), column() + width()) and rows [row(), row() + height()) of the terrain
+        inline size_t column() const { return m_column; }
+        inline size_t row() const { return m_row; }
+        inline size_t width() const { return m_width; }
+        inline size_t height() const { return m_height; }
+
+        // 255 where a post is visible and 0 where it is hidden or beyond the radius (row-major)
+        inline uint8_t const* values() const { return m_values.data(); }
+
+        inline bool visible(size_t i, size_t j) const
+        {
+            return i >= m_column && j >= m_row && i - m_column < m_width && j - m_row < m_height
+                && m_values[(j - m_row) * m_width + (i - m_column)] != 0;
+        }
+
+        inline size_t visible_count() const { return m_visible; }
+
+    private:
+
+        size_t m_column = 0;
+        size_t m_row = 0;
+        size_t m_width = 0;
+        size_t m_height = 0;
+        std::vector<uint8_t> m_values;
+        size_t m_visible = 0;
+
+    };
+
+}
@@ -0,0 +1,395 @@
+#include "tiler/builder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+#include <nlohmann/json.hpp>
+
+#include <stb_image_write.h>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace tiler
+{
+
+    // half the width of the web mercator plane in meters
+    static constexpr double c_half_world = 20037508.342789244;
+
+    // texels outside the source are marked with nan so that the box filter can skip them
+    static constexpr float c_outside = std::numeric_limits<float>::quiet_NaN();
+
+    // gives the texels of a tile that are outside the source the elevation of the nearest texel inside it along their
+    // row, and rows without one the elevation of the nearest row that has one. encoding them as 0 m would leave a cliff
+    // at the edge of the coverage that readers interpolating across it would pick up
+    static void fill_outside(float* texels, size_t size)
+    {
+        // fills [lo, hi) from whichever of lo - 1 and hi is nearer (either may be missing)
+        auto fill = [](float* values, size_t stride, long lo, long hi, long count)
+        {
+            for (long k = lo; k < hi; ++k)
+            {
+                bool const from_lo = lo > 0 && (hi >= count || k - (lo - 1) <= hi - k);
+                values[k * stride] = values[((from_lo) ? lo - 1 : hi) * stride];
+            }
+        };
+
+        long const count = static_cast<long>(size);
+        std::vector<bool> inside(size, false);
+        for (long r = 0; r < count; ++r)
+        {
+            float* row = texels + r * size;
+            long last = -1;
+            for (long c = 0; c < count; ++c)
+            {
+                if (std::isnan(row[c])) { continue; }
+                fill(row, 1, last + 1, c, count);
+                last = c;
+            }
+            if (last < 0) { continue; }
+            fill(row, 1, last + 1, count, count);
+            inside[r] = true;
+        }
+
+        // whole rows are copied from the nearest row that had a texel inside the source
+        long last = -1;
+        for (long r = 0; r <= count; ++r)
+        {
+            if (r < count && !inside[r]) { continue; }
+            for (long c = 0; c < count && last + 1 < r; ++c)
+            {
+                fill(texels + c, size, last + 1, r, count);
+            }
+            last = r;
+        }
+    }
+
+    builder::builder(source& src, std::filesystem::path const& root) : builder(src, root, options()) {}
+
+    builder::builder(source& src, std::filesystem::path const& root, options const& opts) :
+        m_source(src),
+        m_root(root),
+        m_options(opts)
+    {}
+
+    double builder::tile_meters(uint32_t z)
+    {
+        return 2.0 * c_half_world / static_cast<double>(uint64_t(1) << z);
+    }
+
+    builder::level builder::range(uint32_t z) const
+    {
+        double const size = tile_meters(z);
+        double const last = static_cast<double>((uint64_t(1) << z) - 1);
+        auto index = [last](double value) { return static_cast<uint32_t>(std::clamp(value, 0.0, last)); };
+
+        stfd::aabb2 const& b = m_source.bounds();
+        level lvl;
+        lvl.z = z;
+        lvl.x0 = index(std::floor((b.min.x + c_half_world) / size));
+        lvl.x1 = std::max(lvl.x0, index(std::ceil((b.max.x + c_half_world) / size) - 1.0));
+        lvl.y0 = index(std::floor((c_half_world - b.max.y) / size));
+        lvl.y1 = std::max(lvl.y0, index(std::ceil((c_half_world - b.min.y) / size) - 1.0));
+        return lvl;
+    }
+
+    bool builder::run(progress_fn const& progress, std::string& error)
+    {
+        m_stats = stats();
+        if (m_source.width() == 0 || m_source.height() == 0)
+        {
+            error = "the source is empty";
+            return false;
+        }
+
+        // pick the zoom range
+        stfd::aabb2 const& b = m_source.bounds();
+        double const texel = std::min((b.max.x - b.min.x) / m_source.width(), (b.max.y - b.min.y) / m_source.height());
+        uint32_t max_zoom = 0;
+        while (max_zoom < c_max_auto_zoom && tile_meters(max_zoom) / c_tile_pixels > texel) { ++max_zoom; }
+        max_zoom = m_options.max_zoom.value_or(max_zoom);
+
+        uint32_t min_zoom = max_zoom;
+        while (min_zoom > 0)
+        {
+            level const lvl = range(min_zoom);
+            if (lvl.x0 == lvl.x1 && lvl.y0 == lvl.y1) { break; }
+            --min_zoom;
+        }
+        min_zoom = std::min(max_zoom, m_options.min_zoom.value_or(min_zoom));
+
+        m_stats.min_zoom = min_zoom;
+        m_stats.max_zoom = max_zoom;
+
+        // set up a band per level and the directories it writes to
+        m_levels.clear();
+        for (uint32_t z = max_zoom + 1; z-- > min_zoom;)
+        {
+            level lvl = range(z);
+            lvl.band.assign(lvl.width() * c_tile_pixels, c_outside);
+            for (uint32_t x = lvl.x0; x <= lvl.x1; ++x)
+            {
+                std::error_code ec;
+                std::filesystem::create_directories(m_root / std::to_string(z) / std::to_string(x), ec);
+                if (ec)
+                {
+                    error = "failed to create " + (m_root / std::to_string(z) / std::to_string(x)).string() + ": " + ec.message();
+                    return false;
+                }
+            }
+            m_levels.push_back(std::move(lvl));
+        }
+
+        m_window.clear();
+        m_window_begin = 0;
+        m_window_end = 0;
+
+        stbi_write_png_compression_level = m_options.compression_level;
+
+        level const& finest = m_levels.front();
+        for (uint32_t y = finest.y0; y <= finest.y1; ++y)
+        {
+            if (!resample(y, error)) { return false; }
+            if (!emit(0, y, error)) { return false; }
+            if (progress) { progress(static_cast<float>(y - finest.y0 + 1) / static_cast<float>(finest.y1 - finest.y0 + 1)); }
+        }
+
+        // release the bands and the window
+        m_levels.clear();
+        m_window = std::vector<float>();
+
+        nlohmann::json metadata;
+        metadata["min"] = { b.min.x, b.min.y };
+        metadata["max"] = { b.max.x, b.max.y };
+        metadata["min_zoom"] = min_zoom;
+        metadata["max_zoom"] = max_zoom;
+        std::ofstream ofs(m_root / "metadata.json");
+        ofs << metadata.dump(4);
+        return true;
+    }
+
+    bool builder::resample(uint32_t y, std::string& error)
+    {
+        level& lvl = m_levels.front();
+        size_t const width = lvl.width();
+
+        stfd::aabb2 const& b = m_source.bounds();
+        size_t const src_width = m_source.width();
+        size_t const src_height = m_source.height();
+        double const dx = (b.max.x - b.min.x) / static_cast<double>(src_width);
+        double const dy = (b.max.y - b.min.y) / static_cast<double>(src_height);
+        double const texel = tile_meters(lvl.z) / c_tile_pixels;
+
+        // source pixel and weight for each texel center (the source's posts sit at its pixel centers). a texel
+        // outside the source has no pixel
+        struct tap
+        {
+            bool inside = false;
+            size_t index = 0;
+            float weight = 0.f;
+        };
+        auto locate = [](double coord, size_t count) -> tap
+        {
+            tap t;
+            t.inside = coord >= -0.5 && coord <= static_cast<double>(count) - 0.5;
+            double const clamped = std::clamp(coord, 0.0, static_cast<double>(count - 1));
+            t.index = std::min(static_cast<size_t>(clamped), count - std::min<size_t>(count, 2));
+            t.weight = static_cast<float>(clamped - static_cast<double>(t.index));
+            return t;
+        };
+
+        std::vector<tap> cols(width);
+        for (size_t c = 0; c < width; ++c)
+        {
+            double const x = -c_half_world + (static_cast<double>(lvl.x0) * c_tile_pixels + c + 0.5) * texel;
+            cols[c] = locate((x - b.min.x) / dx - 0.5, src_width);
+        }
+
+        std::vector<tap> rows(c_tile_pixels);
+        size_t lo = std::numeric_limits<size_t>::max();
+        size_t hi = 0;
+        for (size_t r = 0; r < c_tile_pixels; ++r)
+        {
+            double const row_y = c_half_world - (static_cast<double>(y) * c_tile_pixels + r + 0.5) * texel;
+            rows[r] = locate((b.max.y - row_y) / dy - 0.5, src_height);
+            if (rows[r].inside)
+            {
+                lo = std::min(lo, rows[r].index);
+                hi = std::max(hi, std::min(rows[r].index + 2, src_height));
+            }
+        }
+
+        if (lo >= hi)
+        {
+            std::fill(lvl.band.begin(), lvl.band.end(), c_outside);
+            return true;
+        }
+
+        // slide the window down to [lo, hi), keeping the rows it already holds
+        size_t const keep_begin = std::clamp(lo, m_window_begin, m_window_end);
+        size_t const keep_end = std::clamp(hi, m_window_begin, m_window_end);
+        std::vector<float> window((hi - lo) * src_width);
+        if (keep_begin < keep_end)
+        {
+            std::copy(m_window.begin() + (keep_begin - m_window_begin) * src_width, m_window.begin() + (keep_end - m_window_begin) * src_width, window.begin() + (keep_begin - lo) * src_width);
+        }
+        if (lo < keep_begin || keep_begin == keep_end)
+        {
+            size_t const end = (keep_begin < keep_end) ? keep_begin : hi;
+            if (!m_source.read(lo, end, window.data())) { error = "failed to read source rows"; return false; }
+            m_stats.source_rows += end - lo;
+        }
+        if (keep_begin < keep_end && keep_end < hi)
+        {
+            if (!m_source.read(keep_end, hi, window.data() + (keep_end - lo) * src_width)) { error = "failed to read source rows"; return false; }
+            m_stats.source_rows += hi - keep_end;
+        }
+        m_window = std::move(window);
+        m_window_begin = lo;
+        m_window_end = hi;
+
+        hillshader::parallel::for_each_chunk(0, c_tile_pixels, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t r = begin; r < end; ++r)
+            {
+                float* dst = lvl.band.data() + r * width;
+                tap const& row = rows[r];
+                if (!row.inside)
+                {
+                    std::fill(dst, dst + width, c_outside);
+                    continue;
+                }
+
+                float const* top = m_window.data() + (row.index - m_window_begin) * src_width;
+                float const* bottom = m_window.data() + (std::min(row.index + 1, src_height - 1) - m_window_begin) * src_width;
+                for (size_t c = 0; c < width; ++c)
+                {
+                    tap const& col = cols[c];
+                    if (!col.inside)
+                    {
+                        dst[c] = c_outside;
+                        continue;
+                    }
+
+                    size_t const i1 = std::min(col.index + 1, src_width - 1);
+                    float const upper = stf::math::lerp(top[col.index], top[i1], col.weight);
+                    float const lower = stf::math::lerp(bottom[col.index], bottom[i1], col.weight);
+                    dst[c] = stf::math::lerp(upper, lower, row.weight);
+                }
+            }
+        });
+        return true;
+    }
+
+    bool builder::emit(size_t index, uint32_t y, std::string& error)
+    {
+        level& lvl = m_levels[index];
+        if (!write_tiles(lvl, y, error)) { return false; }
+
+        if (index + 1 == m_levels.size()) { return true; }
+
+        // fold this band into the top or bottom half of the parent's band with a 2x2 box filter over the texels that
+        // are inside the source
+        level& parent = m_levels[index + 1];
+        size_t const half = c_tile_pixels / 2;
+        size_t const row_offset = (y & 1) * half;
+        size_t const col_offset = static_cast<size_t>(lvl.x0) * half - static_cast<size_t>(parent.x0) * c_tile_pixels;
+        size_t const width = lvl.width();
+        size_t const parent_width = parent.width();
+        hillshader::parallel::for_each_chunk(0, half, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t r = begin; r < end; ++r)
+            {
+                float const* upper = lvl.band.data() + 2 * r * width;
+                float const* lower = upper + width;
+                float* dst = parent.band.data() + (row_offset + r) * parent_width + col_offset;
+                for (size_t c = 0; c < width / 2; ++c)
+                {
+                    float sum = 0.f;
+                    int count = 0;
+                    for (float value : { upper[2 * c], upper[2 * c + 1], lower[2 * c], lower[2 * c + 1] })
+                    {
+                        if (!std::isnan(value)) { sum += value; ++count; }
+                    }
+                    dst[c] = (count > 0) ? sum / static_cast<float>(count) : c_outside;
+                }
+            }
+        });
+
+        // the parent is complete once its bottom half is in or this was the last row
+        if ((y & 1) || y == lvl.y1)
+        {
+            if (!emit(index + 1, y >> 1, error)) { return false; }
+            std::fill(parent.band.begin(), parent.band.end(), c_outside);
+        }
+        return true;
+    }
+
+    bool builder::write_tiles(level const& lvl, uint32_t y, std::string& error)
+    {
+        size_t const width = lvl.width();
+        size_t const count = static_cast<size_t>(lvl.x1 - lvl.x0 + 1);
+        std::atomic<size_t> written{ 0 };
+        std::atomic<bool> failed{ false };
+        hillshader::parallel::for_each_chunk(0, count, [&](size_t begin, size_t end, size_t)
+        {
+            std::vector<unsigned char> rgb(c_tile_pixels * c_tile_pixels * 3);
+            std::vector<float> texels(c_tile_pixels * c_tile_pixels);
+            for (size_t t = begin; t < end; ++t)
+            {
+                float const* origin = lvl.band.data() + t * c_tile_pixels;
+
+                // tiles entirely outside the source are left out (readers treat a missing tile as empty)
+                bool any = false;
+                for (size_t r = 0; r < c_tile_pixels && !any; ++r)
+                {
+                    float const* row = origin + r * width;
+                    any = std::any_of(row, row + c_tile_pixels, [](float value) { return !std::isnan(value); });
+                }
+                if (!any) { continue; }
+
+                // the band keeps its nans for the box filter of the parent level, so the fill works on a copy
+                for (size_t r = 0; r < c_tile_pixels; ++r)
+                {
+                    float const* row = origin + r * width;
+                    std::copy(row, row + c_tile_pixels, texels.data() + r * c_tile_pixels);
+                }
+                fill_outside(texels.data(), c_tile_pixels);
+
+                for (size_t r = 0; r < c_tile_pixels; ++r)
+                {
+                    float const* row = texels.data() + r * c_tile_pixels;
+                    unsigned char* dst = rgb.data() + r * c_tile_pixels * 3;
+                    for (size_t c = 0; c < c_tile_pixels; ++c)
+                    {
+                        hillshader::terrarium::encode(row[c], dst + 3 * c);
+                    }
+                }
+
+                uint32_t const x = lvl.x0 + static_cast<uint32_t>(t);
+                std::filesystem::path const path = m_root / std::to_string(lvl.z) / std::to_string(x) / (std::to_string(y) + ".png");
+                int const row_bytes = static_cast<int>(c_tile_pixels * 3);
+                if (stbi_write_png(path.string().c_str(), c_tile_pixels, c_tile_pixels, 3, rgb.data(), row_bytes))
+                {
+                    written.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+
+        m_stats.tiles += written.load();
+        if (failed.load())
+        {
+            error = "failed to write tiles at z" + std::to_string(lvl.z) + " row " + std::to_string(y);
+            return false;
+        }
+        return true;
+    }
+
+}
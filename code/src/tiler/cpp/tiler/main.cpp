@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "hillshader/memory.hpp"
+#include "hillshader/parallel.hpp"
+#include "hillshader/simd.hpp"
+#include "hillshader/timer.hpp"
+
+#include "tiler/builder.hpp"
+#include "tiler/source.hpp"
+
+static void usage()
+{
+    std::printf("Usage: tiler SOURCE OUTPUT [--min-zoom Z] [--max-zoom Z] [--compression LEVEL]\n");
+    std::printf("\n");
+    std::printf("  SOURCE   a terrarium .png with a sidecar .json, or a raw float32/int16 raster (e.g. .bil) with an ESRI .hdr\n");
+    std::printf("           header. coordinates are web mercator meters\n");
+    std::printf("  OUTPUT   directory that receives the z/x/y.png terrarium pyramid and metadata.json\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (!hillshader::simd::supported())
+    {
+        std::fprintf(stderr, "error: this build requires a cpu with AVX2 and FMA (configure with -DHILLSHADER_ENABLE_AVX2=OFF for older cpus)\n");
+        return 1;
+    }
+
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    tiler::builder::options opts;
+    for (int i = 3; i < argc; ++i)
+    {
+        bool const has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--min-zoom") == 0 && has_value) { opts.min_zoom = static_cast<uint32_t>(std::atoi(argv[++i])); }
+        else if (std::strcmp(argv[i], "--max-zoom") == 0 && has_value) { opts.max_zoom = static_cast<uint32_t>(std::atoi(argv[++i])); }
+        else if (std::strcmp(argv[i], "--compression") == 0 && has_value) { opts.compression_level = std::atoi(argv[++i]); }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    std::string error;
+    std::unique_ptr<tiler::source> src = tiler::source::open(argv[1], error);
+    if (!src)
+    {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+    std::printf("%s: %zu x %zu\n", argv[1], src->width(), src->height());
+
+    hillshader::timer::time_t const start = hillshader::timer::now_ms();
+    tiler::builder builder(*src, argv[2], opts);
+    bool const success = builder.run([](float fraction)
+    {
+        std::printf("\r%5.1f%%", 100.f * fraction);
+        std::fflush(stdout);
+    }, error);
+    std::printf("\n");
+
+    if (!success)
+    {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    tiler::builder::stats const& stats = builder.last_stats();
+    double const seconds = static_cast<double>(hillshader::timer::now_ms() - start) / 1000.0;
+    std::printf("wrote %zu tiles (z%u-%u) in %.1f s on %zu threads, peak memory %.1f MB\n", stats.tiles, stats.min_zoom, stats.max_zoom, seconds,
+        hillshader::parallel::concurrency(), static_cast<double>(hillshader::memory::peak_resident_bytes()) / (1024.0 * 1024.0));
+    return 0;
+}
@@ -0,0 +1,349 @@
+#include "tiler/source.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <stb_image.h>
+
+#include "hillshader/parallel.hpp"
+#include "hillshader/terrarium.hpp"
+
+namespace
+{
+
+    // fields of an ESRI .hdr header that we support
+    struct header
+    {
+        size_t rows = 0;
+        size_t cols = 0;
+        size_t bands = 1;
+        size_t bits = 0;
+        size_t skip = 0;
+        size_t band_row_bytes = 0;
+        size_t total_row_bytes = 0;
+        bool is_float = false;
+        bool is_signed = true;
+        bool big_endian = false;
+        std::string layout = "BIL";
+
+        // center of the upper-left pixel and the pixel size
+        bool has_origin = false;
+        double ulx = 0.0;
+        double uly = 0.0;
+        double xdim = 0.0;
+        double ydim = 0.0;
+
+        bool has_nodata = false;
+        double nodata = 0.0;
+    };
+
+    bool parse_header(std::filesystem::path const& path, header& hdr, std::string& error)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+        {
+            error = "missing header " + path.string();
+            return false;
+        }
+
+        bool has_pixel_type = false;
+        bool has_ulx = false, has_uly = false;
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            std::istringstream tokens(line);
+            std::string key, value;
+            if (!(tokens >> key >> value)) { continue; }
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+            std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+            char* end = nullptr;
+            double const number = std::strtod(value.c_str(), &end);
+            bool const numeric = end != value.c_str();
+
+            if (key == "NROWS" && numeric) { hdr.rows = static_cast<size_t>(number); }
+            else if (key == "NCOLS" && numeric) { hdr.cols = static_cast<size_t>(number); }
+            else if (key == "NBANDS" && numeric) { hdr.bands = static_cast<size_t>(number); }
+            else if (key == "NBITS" && numeric) { hdr.bits = static_cast<size_t>(number); }
+            else if (key == "SKIPBYTES" && numeric) { hdr.skip = static_cast<size_t>(number); }
+            else if (key == "BANDROWBYTES" && numeric) { hdr.band_row_bytes = static_cast<size_t>(number); }
+            else if (key == "TOTALROWBYTES" && numeric) { hdr.total_row_bytes = static_cast<size_t>(number); }
+            else if (key == "BYTEORDER") { hdr.big_endian = value == "M" || value == "MSBFIRST"; }
+            else if (key == "LAYOUT" || key == "INTERLEAVING") { hdr.layout = value; }
+            else if (key == "PIXELTYPE")
+            {
+                has_pixel_type = true;
+                hdr.is_float = value == "FLOAT";
+                hdr.is_signed = value != "UNSIGNEDINT";
+            }
+            else if (key == "ULXMAP" && numeric) { hdr.ulx = number; has_ulx = true; }
+            else if (key == "ULYMAP" && numeric) { hdr.uly = number; has_uly = true; }
+            else if (key == "XDIM" && numeric) { hdr.xdim = number; }
+            else if (key == "YDIM" && numeric) { hdr.ydim = number; }
+            else if (key == "NODATA" && numeric) { hdr.nodata = number; hdr.has_nodata = true; }
+        }
+
+        // 32-bit samples without an explicit pixel type are floats (the usual raw float32 dump)
+        if (!has_pixel_type) { hdr.is_float = hdr.bits == 32; }
+        hdr.has_origin = has_ulx && has_uly && hdr.xdim > 0.0 && hdr.ydim > 0.0;
+
+        if (hdr.rows == 0 || hdr.cols == 0)
+        {
+            error = "header " + path.string() + " does not give the raster dimensions";
+            return false;
+        }
+        if (!((hdr.bits == 32 && hdr.is_float) || (hdr.bits == 16 && !hdr.is_float)))
+        {
+            error = "header " + path.string() + " describes an unsupported sample type (expected float32 or 16-bit integers)";
+            return false;
+        }
+        if (hdr.bands > 1 && hdr.layout != "BIL")
+        {
+            error = "header " + path.string() + " describes an unsupported layout " + hdr.layout;
+            return false;
+        }
+        return true;
+    }
+
+    // half the width of the web mercator plane in meters
+    static constexpr double c_half_world = 20037508.342789244;
+
+    // bounds from a sidecar json with min/max, matching the output of convert.py. returns false with an empty error
+    // if there is no sidecar and false with an error if the sidecar exists but is malformed
+    bool read_sidecar(std::filesystem::path const& path, stfd::aabb2& bounds, std::string& error)
+    {
+        std::filesystem::path sidecar = path;
+        sidecar.replace_extension(".json");
+        std::error_code ec;
+        if (!std::filesystem::exists(sidecar, ec)) { return false; }
+
+        stfd::vec2 min, max;
+        if (!hillshader::terrarium::read_sidecar(path, min, max))
+        {
+            error = "malformed sidecar " + sidecar.string() + " (expected \"min\": [x, y] and \"max\": [x, y])";
+            return false;
+        }
+        bounds = stfd::aabb2(min, max);
+        return true;
+    }
+
+    // the tiler only understands web mercator meters, so bounds that are empty, fall off the mercator plane, or look
+    // like degrees are rejected rather than silently producing tiles in the wrong place
+    bool check_bounds(std::filesystem::path const& path, stfd::aabb2 const& bounds, std::string& error)
+    {
+        stfd::vec2 const& min = bounds.min;
+        stfd::vec2 const& max = bounds.max;
+        if (!(min.x < max.x && min.y < max.y))
+        {
+            error = "bounds of " + path.string() + " are empty or inverted";
+            return false;
+        }
+
+        // allow a little slack for rounding in the tools that wrote the bounds
+        double const limit = c_half_world * 1.001;
+        if (min.x < -limit || max.x > limit || min.y < -limit || max.y > limit)
+        {
+            error = "bounds of " + path.string() + " fall outside the web mercator plane (+/-20037508 m)";
+            return false;
+        }
+
+        bool const degrees = std::abs(min.x) <= 180.0 && std::abs(max.x) <= 180.0 && std::abs(min.y) <= 90.0 && std::abs(max.y) <= 90.0;
+        if (degrees)
+        {
+            error = "bounds of " + path.string() + " look like degrees (expected web mercator meters)";
+            return false;
+        }
+        return true;
+    }
+
+    bool host_is_big_endian()
+    {
+        uint16_t const probe = 1;
+        unsigned char first = 0;
+        std::memcpy(&first, &probe, 1);
+        return first == 0;
+    }
+
+    // raw samples read straight from the file, one strip at a time
+    class raw_source final : public tiler::source
+    {
+    public:
+
+        raw_source(std::filesystem::path const& path, header const& hdr, stfd::aabb2 const& bounds) :
+            m_stream(path, std::ios::binary),
+            m_header(hdr),
+            m_sample_bytes(hdr.bits / 8),
+            m_swap(hdr.big_endian != host_is_big_endian())
+        {
+            m_width = hdr.cols;
+            m_height = hdr.rows;
+            m_bounds = bounds;
+
+            size_t const band_row_bytes = (hdr.band_row_bytes > 0) ? hdr.band_row_bytes : hdr.cols * m_sample_bytes;
+            m_row_stride = (hdr.total_row_bytes > 0) ? hdr.total_row_bytes : band_row_bytes * hdr.bands;
+        }
+
+        inline bool is_open() const { return static_cast<bool>(m_stream); }
+
+        bool read(size_t begin, size_t end, float* out) override
+        {
+            size_t const row_bytes = m_width * m_sample_bytes;
+            m_row.resize(row_bytes);
+            for (size_t j = begin; j < end; ++j)
+            {
+                // only the first band is read
+                m_stream.seekg(static_cast<std::streamoff>(m_header.skip + j * m_row_stride));
+                m_stream.read(reinterpret_cast<char*>(m_row.data()), static_cast<std::streamsize>(row_bytes));
+                if (!m_stream) { return false; }
+
+                float* dst = out + (j - begin) * m_width;
+                for (size_t i = 0; i < m_width; ++i)
+                {
+                    unsigned char bytes[4];
+                    std::memcpy(bytes, m_row.data() + i * m_sample_bytes, m_sample_bytes);
+                    if (m_swap) { std::reverse(bytes, bytes + m_sample_bytes); }
+
+                    double value = 0.0;
+                    if (m_header.is_float)
+                    {
+                        float sample = 0.f;
+                        std::memcpy(&sample, bytes, sizeof(float));
+                        value = static_cast<double>(sample);
+                    }
+                    else if (m_header.is_signed)
+                    {
+                        int16_t sample = 0;
+                        std::memcpy(&sample, bytes, sizeof(int16_t));
+                        value = static_cast<double>(sample);
+                    }
+                    else
+                    {
+                        uint16_t sample = 0;
+                        std::memcpy(&sample, bytes, sizeof(uint16_t));
+                        value = static_cast<double>(sample);
+                    }
+
+                    bool const missing = std::isnan(value) || (m_header.has_nodata && value == m_header.nodata);
+                    dst[i] = (missing) ? 0.f : static_cast<float>(value);
+                }
+            }
+            return true;
+        }
+
+    private:
+
+        std::ifstream m_stream;
+        header m_header;
+        size_t m_sample_bytes;
+        size_t m_row_stride = 0;
+        bool m_swap;
+        std::vector<unsigned char> m_row;
+
+    };
+
+    // stb_image has no streaming interface, so a terrarium source is decoded up front and its rows are converted to
+    // elevations strip by strip
+    class terrarium_source final : public tiler::source
+    {
+    public:
+
+        terrarium_source(unsigned char* img, size_t width, size_t height, size_t channels, stfd::aabb2 const& bounds) :
+            m_img(img),
+            m_channels(channels)
+        {
+            m_width = width;
+            m_height = height;
+            m_bounds = bounds;
+        }
+
+        ~terrarium_source() { stbi_image_free(m_img); }
+
+        bool read(size_t begin, size_t end, float* out) override
+        {
+            hillshader::parallel::for_each_chunk(begin, end, [&](size_t lo, size_t hi, size_t)
+            {
+                hillshader::terrarium::decode(m_img, m_channels, m_width, lo, hi, out + (lo - begin) * m_width);
+            });
+            return true;
+        }
+
+    private:
+
+        unsigned char* m_img;
+        size_t m_channels;
+
+    };
+
+}
+
+namespace tiler
+{
+
+    std::unique_ptr<source> source::open(std::filesystem::path const& path, std::string& error)
+    {
+        if (path.extension() == ".png")
+        {
+            stfd::aabb2 bounds;
+            if (!read_sidecar(path, bounds, error))
+            {
+                if (error.empty()) { error = "missing sidecar json for " + path.string(); }
+                return nullptr;
+            }
+            if (!check_bounds(path, bounds, error)) { return nullptr; }
+
+            int width = 0, height = 0, channels = 0;
+            unsigned char* img = stbi_load(path.string().c_str(), &width, &height, &channels, 0);
+            if (!img)
+            {
+                error = "failed to decode " + path.string();
+                return nullptr;
+            }
+            if (channels < 3)
+            {
+                stbi_image_free(img);
+                error = path.string() + " is not a terrarium image";
+                return nullptr;
+            }
+            return std::make_unique<terrarium_source>(img, static_cast<size_t>(width), static_cast<size_t>(height), static_cast<size_t>(channels), bounds);
+        }
+
+        std::filesystem::path hdr_path = path;
+        hdr_path.replace_extension(".hdr");
+        header hdr;
+        if (!parse_header(hdr_path, hdr, error)) { return nullptr; }
+
+        stfd::aabb2 bounds;
+        if (!read_sidecar(path, bounds, error))
+        {
+            if (!error.empty()) { return nullptr; }
+            if (!hdr.has_origin)
+            {
+                error = "no bounds for " + path.string() + " (the header has no ULXMAP/ULYMAP/XDIM/YDIM and there is no sidecar json)";
+                return nullptr;
+            }
+
+            // the header locates pixel centers
+            double const left = hdr.ulx - 0.5 * hdr.xdim;
+            double const top = hdr.uly + 0.5 * hdr.ydim;
+            bounds = stfd::aabb2(stfd::vec2(left, top - hdr.rows * hdr.ydim), stfd::vec2(left + hdr.cols * hdr.xdim, top));
+        }
+        if (!check_bounds(path, bounds, error)) { return nullptr; }
+
+        auto raw = std::make_unique<raw_source>(path, hdr, bounds);
+        if (!raw->is_open())
+        {
+            error = "failed to open " + path.string();
+            return nullptr;
+        }
+        return raw;
+    }
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <stf/stf.hpp>
+
+#include "tiler/source.hpp"
+
+namespace tiler
+{
+
+    // writes a source as a pyramid of web mercator terrarium tiles (root/z/x/y.png, the layout paged_terrain reads).
+    // the source is streamed one band of finest-level tiles at a time through a window of source rows, and every
+    // band is box-filtered into the band above it, so memory is proportional to the raster's width rather than its
+    // size. resampling, encoding and png compression are spread across threads within each band. the threads are
+    // started per band like the rest of parallel's callers: a band is a full row of tiles, so starting them costs
+    // far less than the work they share. texels outside the source are filled from the nearest texel inside it
+    // before they are encoded
+    class builder
+    {
+    public:
+
+        static constexpr uint32_t c_tile_pixels = 256;
+
+        // deepest zoom we will pick automatically (~2 cm texels)
+        static constexpr uint32_t c_max_auto_zoom = 22;
+
+        struct options
+        {
+            // the finest level defaults to the first level whose texels are no larger than the source's
+            std::optional<uint32_t> max_zoom;
+
+            // the coarsest level defaults to the first level at which the source fits in a single tile
+            std::optional<uint32_t> min_zoom;
+
+            // zlib level passed to stb_image_write
+            int compression_level = 6;
+        };
+
+        struct stats
+        {
+            uint32_t min_zoom = 0;
+            uint32_t max_zoom = 0;
+            size_t tiles = 0;
+            size_t source_rows = 0;
+        };
+
+        // called after each band of finest-level tiles with the fraction of bands completed
+        using progress_fn = std::function<void(float)>;
+
+    public:
+
+        builder(source& src, std::filesystem::path const& root);
+        builder(source& src, std::filesystem::path const& root, options const& opts);
+
+        // builds the pyramid. returns false (and sets error) if the source could not be read or a tile could not be
+        // written
+        bool run(progress_fn const& progress, std::string& error);
+
+        inline stats const& last_stats() const { return m_stats; }
+
+        // edge length of a tile in meters
+        static double tile_meters(uint32_t z);
+
+    private:
+
+        // a row of tiles at one zoom level, c_tile_pixels texels tall and covering the tile columns [x0, x1]
+        struct level
+        {
+            uint32_t z = 0;
+            uint32_t x0 = 0, x1 = 0;
+            uint32_t y0 = 0, y1 = 0;
+            std::vector<float> band;
+
+            inline size_t width() const { return static_cast<size_t>(x1 - x0 + 1) * c_tile_pixels; }
+        };
+
+        // tile range at a zoom level covering the source bounds
+        level range(uint32_t z) const;
+
+        // resamples the source into the finest level's band for tile row y
+        bool resample(uint32_t y, std::string& error);
+
+        // writes the tiles of a level's band and folds it into the next coarser level, flushing that level once
+        // both of its halves are in
+        bool emit(size_t index, uint32_t y, std::string& error);
+
+        bool write_tiles(level const& lvl, uint32_t y, std::string& error);
+
+    private:
+
+        source& m_source;
+        std::filesystem::path m_root;
+        options m_options;
+
+        // finest level first
+        std::vector<level> m_levels;
+
+        // window of source rows [m_window_begin, m_window_end)
+        std::vector<float> m_window;
+        size_t m_window_begin = 0;
+        size_t m_window_end = 0;
+
+        stats m_stats;
+
+    };
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include <stf/stf.hpp>
+
+namespace tiler
+{
+
+    // a raster of elevations in web mercator meters that is read in strips of rows, top row first
+    class source
+    {
+    public:
+
+        virtual ~source() = default;
+
+        inline size_t width() const { return m_width; }
+        inline size_t height() const { return m_height; }
+
+        // bounds of the raster (edges of the outer pixels, not their centers)
+        inline stfd::aabb2 const& bounds() const { return m_bounds; }
+
+        // reads rows [begin, end) into out, which holds width() values per row. missing data reads as 0. returns
+        // false if the rows could not be read
+        virtual bool read(size_t begin, size_t end, float* out) = 0;
+
+        // opens a source by extension. a .png is a terrarium image with a json sidecar. anything else is a raw
+        // raster (float32 or 16-bit integer samples, such as a BIL) described by an ESRI .hdr header, optionally
+        // with a json sidecar that overrides the header's bounds. bounds must be web mercator meters; a malformed
+        // sidecar or bounds that are empty, off the mercator plane, or in degrees are errors. returns null (and sets
+        // error) on failure
+        static std::unique_ptr<source> open(std::filesystem::path const& path, std::string& error);
+
+    protected:
+
+        size_t m_width = 0;
+        size_t m_height = 0;
+        stfd::aabb2 m_bounds;
+
+    };
+
+}